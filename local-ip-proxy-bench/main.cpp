@@ -0,0 +1,1250 @@
+﻿// local-ip-proxy-bench.cpp
+// In-process benchmarks for local-ip-proxy's net event path
+//
+// Feeds synthetic FWPM_NET_EVENT5 records, shaped like what the BFE delivers
+// but made up in memory, through the same code local-ip-proxy runs in its net
+// event callback, and reports events per second. No WFP engine or
+// administrator rights are involved, so besides the project file it builds
+// off Windows too, with stand-ins for the few WFP types it needs:
+//
+//   g++ -std=c++20 -O2 -pthread -Iposix main.cpp -o local-ip-proxy-bench
+//
+// Usage:
+//   local-ip-proxy-bench [options]
+//
+// Options:
+//   --bench=<key|intern|ring|map|shard>
+//                                    what to run (default: key)
+//                                    key: the callback's per-event work,
+//                                    the compact EventKey against the old
+//                                    key of formatted strings and app path
+//                                    intern: app path per event, decoding
+//                                    the appId blob against AppPathTable
+//                                    ring: producer latency with 1, 2, 4, ...
+//                                    threads delivering at once, counting
+//                                    under the map's mutex against queueing
+//                                    into the MPSC ring
+//                                    map: inserts and lookups of distinct
+//                                    keys, std::unordered_map against the
+//                                    aggregator's FlatMap
+//                                    shard: events per second with 1, 2,
+//                                    4, ... threads delivering at once, one
+//                                    map behind one mutex against the
+//                                    sharded Aggregator
+//   --events=<n>                     events per run (default: 5000000)
+//   --flows=<n>                      distinct addresses/ports/filters, i.e.
+//                                    aggregation keys (default: 10000)
+//   --apps=<n>                       distinct executables (default: 200)
+//   --threads=<n>                    most producer threads for --bench=ring
+//                                    and --bench=shard (default: one per
+//                                    logical CPU)
+//   --keys=<n>                       distinct keys for --bench=map
+//                                    (default: 1000, 100000 and 10000000)
+//
+// Example (a busy host, a million flows):
+//   local-ip-proxy-bench --bench=key --flows=1000000 --events=20000000
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#endif
+
+#include "../local-ip-proxy/Aggregator.hpp"
+#include "../local-ip-proxy/AppPathTable.hpp"
+#include "../local-ip-proxy/EventKey.hpp"
+#include "../local-ip-proxy/FlatMap.hpp"
+#include "../local-ip-proxy/MpscRing.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum class Bench
+{
+    Key,
+    Intern,
+    Ring,
+    Map,
+    Shard
+};
+
+struct BenchConfig
+{
+    Bench bench      = Bench::Key;
+    unsigned events  = 5000000;
+    unsigned flows   = 10000;
+    unsigned apps    = 200;
+    unsigned threads = 0; // 0 = one per logical CPU
+    unsigned keys    = 0; // 0 = 1k, 100k and 10M
+};
+
+// Net events as the callback would receive them, with everything they point
+// to. Each of the flows is a distinct aggregation key; order is the sequence
+// they arrive in, cycled through for as many events as a run needs.
+struct SyntheticEvents
+{
+    std::vector<std::vector<UINT8>> appBlobs; // UTF-16LE NT paths, NUL included
+    std::vector<FWPM_NET_EVENT_CLASSIFY_DROP2> drops;
+    std::vector<FWPM_NET_EVENT_CLASSIFY_ALLOW0> allows;
+    std::vector<FWPM_NET_EVENT5> flows;
+    std::vector<std::uint32_t> order;
+};
+
+static bool
+parseCount(
+    const char* s,
+    const char* what,
+    unsigned long minValue,
+    unsigned long maxValue,
+    unsigned& out
+    )
+{
+    char* end           = nullptr;
+    unsigned long value = std::strtoul(
+        s,
+        &end,
+        10
+        );
+
+    if ((end == s) || (*end != '\0') || (value < minValue) || (value > maxValue))
+    {
+        std::cerr << "Invalid " << what << " '" << s << "' (must be " << minValue << ".." << maxValue << ")\n";
+
+        return false;
+    }
+
+    out = static_cast<unsigned>(value);
+
+    return true;
+}
+
+static void
+printUsage()
+{
+    std::cout << "Usage: local-ip-proxy-bench [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --bench=<key|intern|ring|map|shard> compact vs. string key, app path interning, producer latency,\n"
+              << "                           the aggregation map, or producer scaling (default: key)\n"
+              << "  --events=<n>             events per run (default: 5000000)\n"
+              << "  --flows=<n>              distinct aggregation keys (default: 10000)\n"
+              << "  --apps=<n>               distinct executables (default: 200)\n"
+              << "  --threads=<n>            most producer threads for --bench=ring and shard (default: all CPUs)\n"
+              << "  --keys=<n>               distinct keys for --bench=map (default: 1k, 100k and 10M)\n";
+}
+
+static bool
+parseCommandLine(
+    int argc,
+    char* argv[],
+    BenchConfig& cfg
+    )
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg.starts_with("--bench="))
+        {
+            std::string value = arg.substr(sizeof("--bench=") - 1);
+
+            if (value == "key")
+            {
+                cfg.bench = Bench::Key;
+            }
+            else if (value == "intern")
+            {
+                cfg.bench = Bench::Intern;
+            }
+            else if (value == "ring")
+            {
+                cfg.bench = Bench::Ring;
+            }
+            else if (value == "map")
+            {
+                cfg.bench = Bench::Map;
+            }
+            else if (value == "shard")
+            {
+                cfg.bench = Bench::Shard;
+            }
+            else
+            {
+                std::cerr << "Invalid benchmark '" << value << "' (must be key, intern, ring, map or shard)\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--events="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--events=") - 1,
+                    "event count",
+                    1,
+                    4000000000ul,
+                    cfg.events
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--flows="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--flows=") - 1,
+                    "flow count",
+                    1,
+                    100000000,
+                    cfg.flows
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--apps="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--apps=") - 1,
+                    "app count",
+                    1,
+                    1000000,
+                    cfg.apps
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--threads="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--threads=") - 1,
+                    "thread count",
+                    1,
+                    1024,
+                    cfg.threads
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--keys="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--keys=") - 1,
+                    "key count",
+                    1,
+                    100000000,
+                    cfg.keys
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option '" << arg << "'\n";
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Mostly IPv4 TCP from a handful of layers and filters, a quarter IPv6 and
+// some UDP, drops and allows mixed; every flow gets its own local port so
+// flows never collapse into the same key.
+static SyntheticEvents
+makeSyntheticEvents(
+    const BenchConfig& cfg
+    )
+{
+    static constexpr UINT16 kLayers[]      = {44, 46, 48, 50};
+    static constexpr UINT16 kRemotePorts[] = {53, 80, 443, 3389, 25565};
+
+    std::mt19937_64 rng(42);
+    SyntheticEvents s;
+
+    for (unsigned a = 0; a < cfg.apps; ++a)
+    {
+        std::wstring path = L"\\device\\harddiskvolume3\\program files\\vendor" + std::to_wstring(a % 37) + L"\\app" + std::to_wstring(a) + L".exe";
+        std::vector<UINT8> blob;
+
+        for (wchar_t c : path)
+        {
+            blob.push_back(static_cast<UINT8>(c & 0xFF));
+            blob.push_back(static_cast<UINT8>((c >> 8) & 0xFF));
+        }
+
+        blob.push_back(0);
+        blob.push_back(0);
+        s.appBlobs.push_back(std::move(blob));
+    }
+
+    // Events point into these; no reallocation after this.
+    s.drops.resize(cfg.flows);
+    s.allows.resize(cfg.flows);
+    s.flows.resize(cfg.flows);
+
+    for (unsigned i = 0; i < cfg.flows; ++i)
+    {
+        FWPM_NET_EVENT5& e          = s.flows[i];
+        FWPM_NET_EVENT_HEADER3& hdr = e.header;
+        std::uint64_t r             = rng();
+
+        hdr.ipProtocol = ((r & 7) == 0) ? IPPROTO_UDP : IPPROTO_TCP;
+        hdr.localPort  = static_cast<UINT16>(1024 + i % 64000);
+        hdr.remotePort = kRemotePorts[(r >> 8) % std::size(kRemotePorts)];
+
+        if (i % 4 == 0)
+        {
+            hdr.ipVersion = FWP_IP_VERSION_V6;
+
+            for (int b = 0; b < 16; ++b)
+            {
+                hdr.localAddrV6.byteArray16[b]  = static_cast<UINT8>((b < 8) ? 0x20 + b : rng());
+                hdr.remoteAddrV6.byteArray16[b] = static_cast<UINT8>(rng());
+            }
+
+            hdr.localAddrV6.byteArray16[15] = static_cast<UINT8>(i / 64000);
+        }
+        else
+        {
+            hdr.ipVersion    = FWP_IP_VERSION_V4;
+            hdr.localAddrV4  = 0x0A000000u | (i / 64000);
+            hdr.remoteAddrV4 = static_cast<UINT32>(rng());
+        }
+
+        const std::vector<UINT8>& app = s.appBlobs[(r >> 16) % s.appBlobs.size()];
+        hdr.appId.size                = static_cast<UINT32>(app.size());
+        hdr.appId.data                = const_cast<UINT8*>(app.data());
+
+        UINT16 layerId   = kLayers[(r >> 24) % std::size(kLayers)];
+        UINT64 filterId  = 60000 + (r >> 32) % 16;
+        UINT32 direction = ((r >> 40) & 1) ? FWP_DIRECTION_INBOUND : FWP_DIRECTION_OUTBOUND;
+
+        if ((r >> 41) % 3 == 0)
+        {
+            e.type                     = FWPM_NET_EVENT_TYPE_CLASSIFY_ALLOW;
+            s.allows[i].layerId        = layerId;
+            s.allows[i].filterId       = filterId;
+            s.allows[i].msFwpDirection = direction;
+            e.classifyAllow            = &s.allows[i];
+        }
+        else
+        {
+            e.type                    = FWPM_NET_EVENT_TYPE_CLASSIFY_DROP;
+            s.drops[i].layerId        = layerId;
+            s.drops[i].filterId       = filterId;
+            s.drops[i].msFwpDirection = direction;
+            e.classifyDrop            = &s.drops[i];
+        }
+    }
+
+    // Each flow once, in random order, then random repeats.
+    s.order.resize(std::max<std::size_t>(
+        cfg.flows,
+        1 << 20
+        ));
+
+    for (std::size_t i = 0; i < s.order.size(); ++i)
+    {
+        s.order[i] = static_cast<std::uint32_t>((i < cfg.flows) ? i : rng() % cfg.flows);
+    }
+
+    std::shuffle(
+        s.order.begin(),
+        s.order.begin() + cfg.flows,
+        rng
+        );
+
+    return s;
+}
+
+// The callback as it was before the key went compact: both endpoints
+// formatted and the app path decoded for every event, then the whole of it
+// hashed byte by byte.
+struct LegacyEventKey
+{
+    std::string localSocket;
+    std::string remoteSocket;
+    IPPROTO protocol;
+    std::uint32_t layerId;
+    EventType type;
+    EventDirection direction;
+    std::uint64_t filterId;
+    std::wstring appName;
+
+    bool
+    operator==(
+        const LegacyEventKey& o
+        ) const noexcept = default;
+};
+
+template <typename String>
+static std::size_t
+legacyStrHash(
+    const String& str
+    )
+{
+    std::size_t h = 1469598103934665603ULL;
+
+    for (auto c : str)
+    {
+        h ^= static_cast<std::size_t>(c);
+        h *= 1099511628211ULL;
+    }
+
+    return h;
+}
+
+struct LegacyEventKeyHasher
+{
+    std::size_t
+    operator()(
+        const LegacyEventKey& k
+        ) const noexcept
+    {
+        std::size_t h = 1469598103934665603ULL;
+        auto mix      = [&] (auto v)
+            {
+                h ^= static_cast<std::size_t>(v);
+                h *= 1099511628211ULL;
+            };
+        mix(legacyStrHash(k.localSocket));
+        mix(legacyStrHash(k.remoteSocket));
+        mix(k.protocol);
+        mix(k.layerId);
+        mix(static_cast<std::uint8_t>(k.type));
+        mix(static_cast<std::uint8_t>(k.direction));
+        mix(k.filterId);
+        mix(legacyStrHash(k.appName));
+
+        return h;
+    }
+};
+
+struct LegacyAggregator
+{
+    std::unordered_map<LegacyEventKey, EventStats, LegacyEventKeyHasher> map;
+    std::mutex mtx;
+};
+
+static std::string
+legacyV4String(
+    UINT32 addr,
+    UINT16 port
+    )
+{
+    std::ostringstream oss;
+    oss << ((addr >> 24) & 0xFF) << '.'
+        << ((addr >> 16) & 0xFF) << '.'
+        << ((addr >> 8) & 0xFF) << '.'
+        << (addr & 0xFF)
+        << ':' << port;
+
+    return oss.str();
+}
+
+static std::string
+legacyV6String(
+    const FWP_BYTE_ARRAY16& addr,
+    UINT16 port
+    )
+{
+    std::string result = "[";
+
+    for (int i = 0; i < 16; i += 2)
+    {
+        if (i > 0)
+        {
+            result += ':';
+        }
+
+        char buf[5];
+        std::snprintf(
+            buf,
+            sizeof(buf),
+            "%04x",
+            (static_cast<unsigned>(addr.byteArray16[i]) << 8) | addr.byteArray16[i + 1]
+            );
+        result += buf;
+    }
+
+    char portbuf[16];
+    std::snprintf(
+        portbuf,
+        sizeof(portbuf),
+        "]:%u",
+        unsigned {port}
+        );
+    result += portbuf;
+
+    return result;
+}
+
+static void
+legacyRecord(
+    LegacyAggregator& agg,
+    const FWPM_NET_EVENT5& event
+    )
+{
+    const auto& hdr = FwpmNetEventHeader {event.header};
+
+    // Everything but the strings comes out the same as in the compact key.
+    EventKey fixed           = makeEventKey(event);
+    std::string localSocket  = "N/A";
+    std::string remoteSocket = "N/A";
+    std::wstring appPath     = hdr.getAppPath();
+
+    if (hdr.ipVersion == FWP_IP_VERSION_V4)
+    {
+        localSocket  = legacyV4String(hdr.localAddrV4, hdr.localPort);
+        remoteSocket = legacyV4String(hdr.remoteAddrV4, hdr.remotePort);
+    }
+
+    if (hdr.ipVersion == FWP_IP_VERSION_V6)
+    {
+        localSocket  = legacyV6String(hdr.localAddrV6, hdr.localPort);
+        remoteSocket = legacyV6String(hdr.remoteAddrV6, hdr.remotePort);
+    }
+
+    std::lock_guard lock(agg.mtx);
+
+    auto [it, inserted] = agg.map.try_emplace(
+        {localSocket, remoteSocket, static_cast<IPPROTO>(hdr.ipProtocol), fixed.layerId, fixed.type, fixed.direction, fixed.filterId, appPath},
+        EventStats {}
+        );
+    ++it->second.count;
+}
+
+// Runs record over cfg.events events; nanoseconds per event.
+template <typename Record>
+static double
+timeEvents(
+    const BenchConfig& cfg,
+    const SyntheticEvents& s,
+    Record&& record
+    )
+{
+    std::size_t mask = s.order.size();
+    auto started     = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0, j = 0; i < cfg.events; ++i)
+    {
+        record(s.flows[s.order[j]]);
+        j = (j + 1 == mask) ? 0 : j + 1;
+    }
+
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / cfg.events;
+}
+
+static void
+printAppPathStats(
+    const char* label,
+    const AppPathTable& apps
+    )
+{
+    AppPathTable::Stats st = apps.snapshot();
+
+    std::cout << label << ": app paths: " << st.entries << " interned, " << (st.bytes / 1024) << " KiB, "
+              << std::setprecision(4) << (st.lookups ? 100.0 * (st.lookups - st.misses) / st.lookups : 0.0)
+              << "% hit rate (" << st.lookups << " lookups)\n";
+}
+
+// What an event costs from callback to map: the key of formatted strings
+// the callback used to build against the compact EventKey counted through
+// the Aggregator, drained on the same thread every 1024 events in case it
+// queued any. Single-threaded, so nothing is contended.
+static void
+runKeyBench(
+    const BenchConfig& cfg
+    )
+{
+    SyntheticEvents s = makeSyntheticEvents(cfg);
+
+    std::cout << "key: " << cfg.events << " events over " << cfg.flows << " flows and " << cfg.apps
+              << " apps; EventKey is " << sizeof(EventKey) << " bytes\n";
+
+    auto legacy     = std::make_unique<LegacyAggregator>();
+    double legacyNs = timeEvents(
+        cfg,
+        s,
+        [&] (const FWPM_NET_EVENT5& e)
+        {
+            legacyRecord(
+                *legacy,
+                e
+                );
+        }
+        );
+
+    auto agg         = std::make_unique<Aggregator>();
+    double compactNs = timeEvents(
+        cfg,
+        s,
+        [&, n = std::size_t {0}] (const FWPM_NET_EVENT5& e) mutable
+        {
+            agg->record(e);
+
+            if ((++n % 1024) == 0)
+            {
+                agg->drain();
+            }
+        }
+        );
+    agg->drain();
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "key: strings  " << std::setw(7) << legacyNs << " ns/event, " << std::setw(6) << (1000.0 / legacyNs)
+              << " M events/s, " << legacy->map.size() << " keys\n"
+              << "key: compact  " << std::setw(7) << compactNs << " ns/event, " << std::setw(6) << (1000.0 / compactNs)
+              << " M events/s, " << agg->size() << " keys\n"
+              << "key: " << (legacyNs / compactNs) << "x the events per second"
+              << ((legacy->map.size() == agg->size()) ? "" : " (KEY COUNTS DIFFER)") << "\n";
+
+    printAppPathStats(
+        "key",
+        agg->apps
+        );
+}
+
+// The aggregator as it was before it was queued or sharded: one map behind
+// one mutex that every delivering thread and the printer take.
+struct LockedAggregator
+{
+    FlatMap<EventKey, EventStats, EventKeyHasher> map;
+    AppPathTable apps;
+    std::mutex mtx;
+};
+
+static void
+recordUnderLock(
+    LockedAggregator& agg,
+    const FWPM_NET_EVENT5& event
+    )
+{
+    EventKey key = makeEventKey(event);
+    key.appId    = agg.apps.intern(event.header.appId);
+
+    std::lock_guard lock(agg.mtx);
+
+    ++agg.map.try_emplace(key).first->second.count;
+}
+
+// The callback as the ring first had it: every event queued for the
+// aggregation thread, none counted in place.
+static void
+recordQueued(
+    Aggregator& agg,
+    const FWPM_NET_EVENT5& event
+    )
+{
+    EventKey key = makeEventKey(event);
+    key.appId    = agg.apps.intern(event.header.appId);
+
+    agg.ring.tryPush(key);
+}
+
+static std::uint32_t
+percentile(
+    std::vector<std::uint32_t>& v,
+    double p
+    )
+{
+    if (v.empty())
+    {
+        return 0;
+    }
+
+    auto nth = v.begin() + static_cast<std::ptrdiff_t>(p * static_cast<double>(v.size() - 1));
+    std::nth_element(
+        v.begin(),
+        nth,
+        v.end()
+        );
+
+    return *nth;
+}
+
+// What a delivering thread waits for per event with 1, 2, 4, ... of them
+// delivering at once: counting under the map's mutex, as the callback used
+// to, against queueing into the ring while one thread drains it the way
+// local-ip-proxy's aggregation thread does. Every 16th event is timed on
+// its own; the percentiles include the clock's own overhead, printed first.
+static void
+runRingBench(
+    const BenchConfig& cfg
+    )
+{
+    constexpr std::size_t kSampleEvery = 16;
+
+    SyntheticEvents s   = makeSyntheticEvents(cfg);
+    unsigned maxThreads = cfg.threads ? cfg.threads : std::max(
+        std::thread::hardware_concurrency(),
+        1u
+        );
+
+    auto clockStarted = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        (void) std::chrono::steady_clock::now();
+    }
+
+    double clockNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - clockStarted).count() / 1000;
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "ring: " << cfg.events << " events per run over " << cfg.flows << " flows, " << Aggregator::kRingSlots
+              << " slots; latency in ns, clock overhead " << clockNs << " ns\n"
+              << "ring: threads  mode        M events/s     p50     p99   p99.9      max   dropped\n";
+
+    for (unsigned producers = 1;; producers = std::min(
+             producers * 2,
+             maxThreads
+             ))
+    {
+        for (bool queued : {false, true})
+        {
+            auto locked = std::make_unique<LockedAggregator>();
+            auto agg    = std::make_unique<Aggregator>();
+            std::vector<std::vector<std::uint32_t>> samples(producers);
+            std::size_t perThread = cfg.events / producers;
+            std::jthread consumer;
+
+            if (queued)
+            {
+                consumer = std::jthread(
+                    [&] (std::stop_token st)
+                    {
+                        while (!st.stop_requested())
+                        {
+                            if (agg->drain() == 0)
+                            {
+                                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                            }
+                        }
+
+                        agg->drain();
+                    }
+                    );
+            }
+
+            auto started = std::chrono::steady_clock::now();
+
+            {
+                std::vector<std::jthread> threads;
+
+                for (unsigned t = 0; t < producers; ++t)
+                {
+                    threads.emplace_back(
+                        [&, t] ()
+                        {
+                            std::vector<std::uint32_t>& mine = samples[t];
+                            std::size_t j                    = (t * 7919) % s.order.size();
+                            mine.reserve(perThread / kSampleEvery + 1);
+
+                            for (std::size_t i = 0; i < perThread; ++i)
+                            {
+                                const FWPM_NET_EVENT5& e = s.flows[s.order[j]];
+                                j                        = (j + 1 == s.order.size()) ? 0 : j + 1;
+                                bool timed               = (i % kSampleEvery) == 0;
+                                auto before              = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point {};
+
+                                if (queued)
+                                {
+                                    recordQueued(
+                                        *agg,
+                                        e
+                                        );
+                                }
+                                else
+                                {
+                                    recordUnderLock(
+                                        *locked,
+                                        e
+                                        );
+                                }
+
+                                if (timed)
+                                {
+                                    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - before).count();
+                                    mine.push_back(static_cast<std::uint32_t>(std::min<std::int64_t>(
+                                        ns,
+                                        UINT32_MAX
+                                        )));
+                                }
+                            }
+                        }
+                        );
+                }
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+            if (consumer.joinable())
+            {
+                consumer.request_stop();
+                consumer.join();
+            }
+
+            std::vector<std::uint32_t> all;
+
+            for (auto& mine : samples)
+            {
+                all.insert(
+                    all.end(),
+                    mine.begin(),
+                    mine.end()
+                    );
+            }
+
+            std::uint32_t p50  = percentile(
+                all,
+                0.5
+                );
+            std::uint32_t p99  = percentile(
+                all,
+                0.99
+                );
+            std::uint32_t p999 = percentile(
+                all,
+                0.999
+                );
+            std::uint32_t most = all.empty() ? 0 : *std::max_element(
+                all.begin(),
+                all.end()
+                );
+
+            std::cout << "ring: " << std::setw(7) << producers << "  " << (queued ? "ring " : "mutex")
+                      << std::setw(17) << (perThread * producers / seconds / 1e6) << std::setw(8) << p50 << std::setw(8) << p99
+                      << std::setw(8) << p999 << std::setw(9) << most << std::setw(10) << (queued ? agg->ring.dropped() : 0) << "\n";
+        }
+
+        if (producers == maxThreads)
+        {
+            break;
+        }
+    }
+}
+
+// Every count in agg added up, to check no event went missing.
+static std::uint64_t
+countedEvents(
+    Aggregator& agg
+    )
+{
+    std::uint64_t n = 0;
+
+    for (Aggregator::Shard& shard : agg.shards)
+    {
+        std::lock_guard lock(shard.mtx);
+
+        for (auto& [k, v] : shard.map)
+        {
+            n += v.count;
+        }
+    }
+
+    return n;
+}
+
+// Events per second with 1, 2, 4, ... threads delivering at once: one map
+// behind one mutex, as the aggregator was before it was queued or sharded,
+// against the sharded Aggregator with an aggregation thread counting what
+// record() queued, as local-ip-proxy runs it. The counts are checked
+// against the events sent, less any dropped.
+static void
+runShardBench(
+    const BenchConfig& cfg
+    )
+{
+    SyntheticEvents s   = makeSyntheticEvents(cfg);
+    unsigned maxThreads = cfg.threads ? cfg.threads : std::max(
+        std::thread::hardware_concurrency(),
+        1u
+        );
+    double oneThread[2] = {};
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "shard: " << cfg.events << " events per run over " << cfg.flows << " flows, " << Aggregator::kShards
+              << " shards\n"
+              << "shard: threads  mode      M events/s  vs. 1 thread    queued   dropped\n";
+
+    for (unsigned producers = 1;; producers = std::min(
+             producers * 2,
+             maxThreads
+             ))
+    {
+        for (bool sharded : {false, true})
+        {
+            auto locked           = std::make_unique<LockedAggregator>();
+            auto agg              = std::make_unique<Aggregator>();
+            std::size_t perThread = cfg.events / producers;
+            std::uint64_t drained = 0;
+            std::jthread consumer;
+
+            if (sharded)
+            {
+                consumer = std::jthread(
+                    [&] (std::stop_token st)
+                    {
+                        while (!st.stop_requested())
+                        {
+                            std::size_t n = agg->drain();
+                            drained += n;
+
+                            if (n == 0)
+                            {
+                                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                            }
+                        }
+
+                        drained += agg->drain();
+                    }
+                    );
+            }
+
+            auto started = std::chrono::steady_clock::now();
+
+            {
+                std::vector<std::jthread> threads;
+
+                for (unsigned t = 0; t < producers; ++t)
+                {
+                    threads.emplace_back(
+                        [&, t] ()
+                        {
+                            std::size_t j = (t * 7919) % s.order.size();
+
+                            for (std::size_t i = 0; i < perThread; ++i)
+                            {
+                                const FWPM_NET_EVENT5& e = s.flows[s.order[j]];
+                                j                        = (j + 1 == s.order.size()) ? 0 : j + 1;
+
+                                if (sharded)
+                                {
+                                    agg->record(e);
+                                }
+                                else
+                                {
+                                    recordUnderLock(
+                                        *locked,
+                                        e
+                                        );
+                                }
+                            }
+                        }
+                        );
+                }
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+            if (consumer.joinable())
+            {
+                consumer.request_stop();
+                consumer.join();
+            }
+
+            std::uint64_t sent    = std::uint64_t {perThread} * producers;
+            std::uint64_t dropped = agg->ring.dropped() + agg->newApps.dropped();
+            std::uint64_t counted = 0;
+
+            if (sharded)
+            {
+                counted = countedEvents(*agg);
+            }
+            else
+            {
+                for (auto& [k, v] : locked->map)
+                {
+                    counted += v.count;
+                }
+            }
+
+            double rate = sent / seconds / 1e6;
+
+            if (producers == 1)
+            {
+                oneThread[sharded] = rate;
+            }
+
+            std::cout << "shard: " << std::setw(7) << producers << "  " << (sharded ? "sharded " : "one lock")
+                      << std::setw(14) << rate << std::setw(13) << (rate / oneThread[sharded]) << "x" << std::setw(10)
+                      << drained << std::setw(10) << dropped << ((counted + dropped == sent) ? "" : " (COUNTS DIFFER)")
+                      << "\n";
+        }
+
+        if (producers == maxThreads)
+        {
+            break;
+        }
+    }
+}
+
+// The app path of every event, decoded from its appId blob each time as the
+// callback used to, against an AppPathTable lookup by the raw bytes; then
+// every interned path checked against a fresh decode.
+static void
+runInternBench(
+    const BenchConfig& cfg
+    )
+{
+    SyntheticEvents s = makeSyntheticEvents(cfg);
+
+    std::cout << "intern: " << cfg.events << " events from " << cfg.apps << " apps\n";
+
+    std::size_t chars = 0; // keeps the decoding from being optimized away
+    double decodeNs   = timeEvents(
+        cfg,
+        s,
+        [&] (const FWPM_NET_EVENT5& e)
+        {
+            chars += FwpmNetEventHeader {e.header}.getAppPath().size();
+        }
+        );
+
+    AppPathTable apps;
+    std::uint64_t ids = 0;
+    double internNs   = timeEvents(
+        cfg,
+        s,
+        [&] (const FWPM_NET_EVENT5& e)
+        {
+            ids += apps.intern(e.header.appId);
+        }
+        );
+
+    std::size_t mismatches = 0;
+
+    for (const std::vector<UINT8>& blob : s.appBlobs)
+    {
+        FwpmNetEventHeader hdr {};
+        hdr.appId.data = const_cast<UINT8*>(blob.data());
+        hdr.appId.size = static_cast<UINT32>(blob.size());
+
+        mismatches += (apps.path(apps.intern(hdr.appId)) != hdr.getAppPath()) ? 1 : 0;
+    }
+
+    std::cout << std::fixed << std::setprecision(1)
+              << "intern: decode  " << std::setw(7) << decodeNs << " ns/event (" << (chars / cfg.events) << " chars)\n"
+              << "intern: intern  " << std::setw(7) << internNs << " ns/event, " << (decodeNs / internNs) << "x faster, "
+              << mismatches << " paths differ from a fresh decode\n";
+
+    printAppPathStats(
+        "intern",
+        apps
+        );
+}
+
+// A distinct key for every i below 2^48, laid out like an IPv4 flow: the
+// low 16 bits are the local port, the rest the remote address.
+static EventKey
+mapBenchKey(
+    std::uint64_t i
+    )
+{
+    EventKey key {};
+    key.filterId      = 70000 + (i % 61);
+    key.localAddr[0]  = 192;
+    key.localAddr[1]  = 168;
+    key.localAddr[3]  = 10;
+    key.remoteAddr[0] = static_cast<std::uint8_t>(i >> 40);
+    key.remoteAddr[1] = static_cast<std::uint8_t>(i >> 32);
+    key.remoteAddr[2] = static_cast<std::uint8_t>(i >> 24);
+    key.remoteAddr[3] = static_cast<std::uint8_t>(i >> 16);
+    key.layerId       = 44;
+    key.localPort     = static_cast<std::uint16_t>(i);
+    key.remotePort    = 443;
+    key.ipVersion     = FWP_IP_VERSION_V4;
+    key.protocol      = IPPROTO_TCP;
+    key.type          = EventType::Drop;
+    key.direction     = EventDirection::Inbound;
+
+    return key;
+}
+
+struct MapResult
+{
+    double insertNs;   // per insert, the clock read around each included
+    double longestUs;  // slowest single insert: a rehash, if anything
+    double lookupNs;   // per lookup of a key already there
+    std::uint64_t sum; // of all counts, to check both maps agree
+};
+
+// Inserts keys distinct keys one at a time, timing each, then looks up
+// lookups of them in a scattered order, counting each time as drain() does.
+template <typename Map>
+static MapResult
+timeMap(
+    Map& map,
+    std::size_t keys,
+    std::size_t lookups
+    )
+{
+    MapResult r {};
+    auto started = std::chrono::steady_clock::now();
+    auto longest = std::chrono::steady_clock::duration::zero();
+
+    for (std::size_t i = 0; i < keys; ++i)
+    {
+        auto before = std::chrono::steady_clock::now();
+        ++map.try_emplace(mapBenchKey(i)).first->second.count;
+        longest = std::max(
+            longest,
+            std::chrono::steady_clock::now() - before
+            );
+    }
+
+    r.insertNs  = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / keys;
+    r.longestUs = std::chrono::duration<double, std::micro>(longest).count();
+    started     = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < lookups; ++i)
+    {
+        ++map.try_emplace(mapBenchKey((i * 2654435761u) % keys)).first->second.count;
+    }
+
+    r.lookupNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / lookups;
+
+    for (auto& [k, v] : map)
+    {
+        r.sum += v.count;
+    }
+
+    return r;
+}
+
+// The aggregation map at a small, a busy and an extreme number of keys:
+// std::unordered_map as the aggregator used to have it against FlatMap.
+// cfg.events lookups per size. unordered_map's size is an estimate, a node
+// being taken as the entry plus two pointers.
+static void
+runMapBench(
+    const BenchConfig& cfg
+    )
+{
+    using Entry = std::pair<EventKey, EventStats>;
+
+    std::vector<std::size_t> sizes = {1000, 100000, 10000000};
+
+    if (cfg.keys)
+    {
+        sizes = {cfg.keys};
+    }
+
+    std::cout << std::fixed << std::setprecision(1) << "map: " << cfg.events << " lookups per size, entries of "
+              << sizeof(Entry) << " bytes\n"
+              << "map:     keys  map         ns/insert  longest us  ns/lookup       MiB\n";
+
+    for (std::size_t keys : sizes)
+    {
+        MapResult results[2];
+        std::size_t bytes[2];
+
+        {
+            auto map   = std::make_unique<std::unordered_map<EventKey, EventStats, EventKeyHasher>>();
+            results[0] = timeMap(
+                *map,
+                keys,
+                cfg.events
+                );
+            bytes[0] = map->bucket_count() * sizeof(void*) + map->size() * (sizeof(Entry) + 2 * sizeof(void*));
+        }
+
+        {
+            auto map   = std::make_unique<FlatMap<EventKey, EventStats, EventKeyHasher>>();
+            results[1] = timeMap(
+                *map,
+                keys,
+                cfg.events
+                );
+            bytes[1] = map->bytes();
+        }
+
+        for (int m = 0; m < 2; ++m)
+        {
+            std::cout << "map: " << std::setw(8) << keys << "  " << (m ? "flat     " : "unordered") << std::setw(12)
+                      << results[m].insertNs << std::setw(12) << results[m].longestUs << std::setw(11) << results[m].lookupNs
+                      << std::setw(10) << (bytes[m] / 1048576.0) << "\n";
+        }
+
+        double longest = results[0].longestUs / results[1].longestUs;
+
+        std::cout << "map: " << std::setw(8) << keys << "  flat is " << (results[0].lookupNs / results[1].lookupNs)
+                  << "x the lookups per second, longest insert " << ((longest >= 1) ? longest : 1 / longest)
+                  << ((longest >= 1) ? "x shorter" : "x longer")
+                  << ((results[0].sum == results[1].sum) ? "" : " (COUNTS DIFFER)") << "\n";
+    }
+}
+
+int
+main(
+    int argc,
+    char* argv[]
+    )
+{
+    BenchConfig cfg {};
+
+    if (
+        !parseCommandLine(
+            argc,
+            argv,
+            cfg
+            )
+        )
+    {
+        printUsage();
+
+        return 1;
+    }
+
+    switch (cfg.bench)
+    {
+        case Bench::Key:
+            runKeyBench(cfg);
+            break;
+
+        case Bench::Intern:
+            runInternBench(cfg);
+            break;
+
+        case Bench::Ring:
+            runRingBench(cfg);
+            break;
+
+        case Bench::Map:
+            runMapBench(cfg);
+            break;
+
+        case Bench::Shard:
+            runShardBench(cfg);
+            break;
+    }
+
+    return 0;
+}
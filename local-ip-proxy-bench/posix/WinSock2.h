@@ -0,0 +1,28 @@
+﻿#pragma once
+
+// Stand-in for the few Windows SDK types the portable local-ip-proxy headers
+// use, so local-ip-proxy-bench also builds off Windows (see main.cpp).
+
+#include <cstdint>
+
+typedef std::uint8_t UINT8;
+typedef std::uint16_t UINT16;
+typedef std::uint32_t UINT32;
+typedef std::uint64_t UINT64;
+typedef unsigned int UINT;
+typedef unsigned long DWORD;
+
+typedef struct _FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct _SID SID;
+
+typedef enum
+{
+    IPPROTO_ICMP = 1,
+    IPPROTO_TCP  = 6,
+    IPPROTO_UDP  = 17
+} IPPROTO;
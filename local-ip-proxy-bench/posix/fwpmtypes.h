@@ -0,0 +1,122 @@
+﻿#pragma once
+
+// Stand-in for the part of the WFP net event types local-ip-proxy reads: same
+// names, fields and order as the SDK's fwptypes.h / fwpmtypes.h, trimmed to
+// what the portable headers and local-ip-proxy-bench touch.
+
+#include "WinSock2.h"
+
+typedef enum FWP_IP_VERSION_
+{
+    FWP_IP_VERSION_V4,
+    FWP_IP_VERSION_V6,
+    FWP_IP_VERSION_NONE,
+    FWP_IP_VERSION_MAX
+} FWP_IP_VERSION;
+
+typedef enum FWP_DIRECTION_
+{
+    FWP_DIRECTION_OUTBOUND,
+    FWP_DIRECTION_INBOUND,
+    FWP_DIRECTION_MAX
+} FWP_DIRECTION;
+
+typedef enum FWP_AF_
+{
+    FWP_AF_INET,
+    FWP_AF_INET6,
+    FWP_AF_ETHER,
+    FWP_AF_NONE
+} FWP_AF;
+
+typedef struct FWP_BYTE_ARRAY16_
+{
+    UINT8 byteArray16[16];
+} FWP_BYTE_ARRAY16;
+
+typedef struct FWP_BYTE_BLOB_
+{
+    UINT32 size;
+    UINT8* data;
+} FWP_BYTE_BLOB;
+
+typedef enum FWPM_NET_EVENT_TYPE_
+{
+    FWPM_NET_EVENT_TYPE_CLASSIFY_DROP,
+    FWPM_NET_EVENT_TYPE_IKEEXT_MM_FAILURE,
+    FWPM_NET_EVENT_TYPE_IKEEXT_QM_FAILURE,
+    FWPM_NET_EVENT_TYPE_IKEEXT_EM_FAILURE,
+    FWPM_NET_EVENT_TYPE_IPSEC_KERNEL_DROP,
+    FWPM_NET_EVENT_TYPE_IPSEC_DOSP_DROP,
+    FWPM_NET_EVENT_TYPE_CLASSIFY_ALLOW,
+    FWPM_NET_EVENT_TYPE_CAPABILITY_DROP,
+    FWPM_NET_EVENT_TYPE_CAPABILITY_ALLOW,
+    FWPM_NET_EVENT_TYPE_CLASSIFY_DROP_MAC,
+    FWPM_NET_EVENT_TYPE_LPM_PACKET_ARRIVAL,
+    FWPM_NET_EVENT_TYPE_MAX
+} FWPM_NET_EVENT_TYPE;
+
+typedef struct FWPM_NET_EVENT_HEADER3_
+{
+    FILETIME timeStamp;
+    UINT32 flags;
+    FWP_IP_VERSION ipVersion;
+    UINT8 ipProtocol;
+    union
+    {
+        UINT32 localAddrV4;
+        FWP_BYTE_ARRAY16 localAddrV6;
+    };
+    union
+    {
+        UINT32 remoteAddrV4;
+        FWP_BYTE_ARRAY16 remoteAddrV6;
+    };
+    UINT16 localPort;
+    UINT16 remotePort;
+    UINT32 scopeId;
+    FWP_BYTE_BLOB appId;
+    SID* userId;
+    FWP_AF addressFamily;
+    SID* packageSid;
+    wchar_t* enterpriseId;
+    UINT64 policyFlags;
+    FWP_BYTE_BLOB effectiveName;
+} FWPM_NET_EVENT_HEADER3;
+
+typedef struct FWPM_NET_EVENT_CLASSIFY_DROP2_
+{
+    UINT64 filterId;
+    UINT16 layerId;
+    UINT32 reauthReason;
+    UINT32 originalProfile;
+    UINT32 currentProfile;
+    UINT32 msFwpDirection;
+    int isLoopback;
+    FWP_BYTE_BLOB vSwitchId;
+    UINT32 vSwitchSourcePort;
+    UINT32 vSwitchDestinationPort;
+} FWPM_NET_EVENT_CLASSIFY_DROP2;
+
+typedef struct FWPM_NET_EVENT_CLASSIFY_ALLOW0_
+{
+    UINT64 filterId;
+    UINT16 layerId;
+    UINT32 reauthReason;
+    UINT32 originalProfile;
+    UINT32 currentProfile;
+    UINT32 msFwpDirection;
+    int isLoopback;
+} FWPM_NET_EVENT_CLASSIFY_ALLOW0;
+
+typedef struct FWPM_NET_EVENT5_
+{
+    FWPM_NET_EVENT_HEADER3 header;
+    FWPM_NET_EVENT_TYPE type;
+    union
+    {
+        FWPM_NET_EVENT_CLASSIFY_DROP2* classifyDrop;
+        FWPM_NET_EVENT_CLASSIFY_ALLOW0* classifyAllow;
+        void* other; // the remaining event types
+    };
+} FWPM_NET_EVENT5;
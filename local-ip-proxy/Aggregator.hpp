@@ -0,0 +1,197 @@
+﻿#pragma once
+
+#include "AppPathTable.hpp"
+#include "EventKey.hpp"
+#include "FlatMap.hpp"
+#include "MpscRing.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+struct EventStats
+{
+    uint64_t count       = 0;
+    uint64_t lastPrinted = 0;
+};
+
+// Net event counts by key, split by key hash into shards that each have
+// their own lock, so threads counting different keys do not wait on each
+// other and the printer holds up only one shard at a time.
+//
+// The callback (record()) looks the event's app blob up without locking and
+// counts the event straight into its shard only when the shard's lock is
+// free and the key is already there. Anything else is queued, an event with
+// an app blob never seen before together with a copy of the blob, so the
+// callback never waits on a lock, allocates, decodes a path or grows a map.
+// The aggregation thread counts what was queued (drain()) and does every
+// intern and insert.
+struct Aggregator
+{
+    // Queued keys; 4 MiB.
+    static constexpr std::size_t kRingSlots = 1 << 16;
+    static constexpr std::size_t kBatch     = 256;
+
+    // Queued events with a new app blob, about 1 KiB each: room for every
+    // event of a busy new executable until the aggregation thread, which
+    // looks every millisecond, has interned it.
+    static constexpr std::size_t kNewAppSlots = 4096;
+
+    // Picked by the top bits of the hash; FlatMap probes by the low ones.
+    static constexpr std::size_t kShardBits = 4;
+    static constexpr std::size_t kShards    = std::size_t {1} << kShardBits;
+
+    // A cache line or more each, so one shard's lock and map header never
+    // share a line with another's.
+    struct alignas(64) Shard
+    {
+        std::mutex mtx;
+        FlatMap<EventKey, EventStats, EventKeyHasher> map;
+    };
+
+    std::array<Shard, kShards> shards;
+
+    // Keys carry the id of their app path here.
+    AppPathTable apps;
+
+    MpscRing<EventKey> ring {kRingSlots};
+
+    // An event whose app blob was not interned yet: its key, appId not set,
+    // and the blob for drain() to intern.
+    struct NewAppEvent
+    {
+        EventKey key;
+        AppBlob app;
+    };
+
+    MpscRing<NewAppEvent> newApps {kNewAppSlots};
+
+    Shard&
+    shardOf(
+        const EventKey& key
+        )
+    {
+        return shards[EventKeyHasher {}(key) >> (8 * sizeof(std::size_t) - kShardBits)];
+    }
+
+    // Count one net event. Called on whatever thread the BFE delivers on,
+    // any number at once. If the event's app, its key or its shard's lock
+    // is not at hand it is queued instead, lock-free, and if the queue is
+    // full it is dropped and counted rather than waited for.
+    void
+    record(
+        const FWPM_NET_EVENT5& event
+        )
+    {
+        EventKey key = makeEventKey(event);
+        key.appId    = apps.find(event.header.appId);
+
+        if (key.appId == AppPathTable::kNotFound)
+        {
+            NewAppEvent pending;
+            pending.key = key;
+            AppPathTable::copy(
+                event.header.appId,
+                pending.app
+                );
+            newApps.tryPush(pending);
+
+            return;
+        }
+
+        Shard& shard = shardOf(key);
+
+        if (shard.mtx.try_lock())
+        {
+            std::lock_guard lock(
+                shard.mtx,
+                std::adopt_lock
+                );
+
+            // A new key is left to drain(): inserting could grow the map.
+            if (auto it = shard.map.find(key); it != shard.map.end())
+            {
+                ++it->second.count;
+
+                return;
+            }
+        }
+
+        ring.tryPush(key);
+    }
+
+    // Count everything queued so far, a batch at a time, interning new app
+    // blobs first. One thread at a time; returns how many events it counted.
+    std::size_t
+    drain()
+    {
+        std::array<EventKey, kBatch> batch;
+        std::size_t total = 0;
+
+        for (;;)
+        {
+            std::size_t interned = newApps.drain(
+                [&] (const NewAppEvent& e)
+                {
+                    EventKey key = e.key;
+                    key.appId    = apps.intern(e.app);
+
+                    count(key);
+                },
+                kBatch
+                );
+
+            std::size_t n = 0;
+            ring.drain(
+                [&] (const EventKey& key)
+                {
+                    batch[n++] = key;
+                },
+                kBatch
+                );
+
+            if ((interned == 0) && (n == 0))
+            {
+                return total;
+            }
+
+            total += interned + n;
+
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                count(batch[i]);
+            }
+        }
+    }
+
+    // One event into its shard, inserting its key if new. Aggregation
+    // thread only, since it may grow the map.
+    void
+    count(
+        const EventKey& key
+        )
+    {
+        Shard& shard = shardOf(key);
+
+        std::lock_guard lock(shard.mtx);
+
+        ++shard.map.try_emplace(key).first->second.count;
+    }
+
+    // Distinct keys counted, adding up the shards one lock at a time.
+    std::size_t
+    size()
+    {
+        std::size_t n = 0;
+
+        for (Shard& shard : shards)
+        {
+            std::lock_guard lock(shard.mtx);
+
+            n += shard.map.size();
+        }
+
+        return n;
+    }
+};
@@ -0,0 +1,486 @@
+﻿#pragma once
+
+#include "FwpmNetEventHeader.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// An appId blob copied out of a net event, cut to kMaxBytes, with its hash:
+// how a thread that must not allocate hands a blob AppPathTable has not seen
+// to the one that interns it.
+struct AppBlob
+{
+    static constexpr std::size_t kMaxBytes = 1024;
+
+    std::uint64_t hash;
+    std::uint32_t size;
+    UINT8 bytes[kMaxBytes];
+};
+
+// Interns the appId blobs of net events: each distinct blob gets a stable
+// 32-bit id the first time it is seen, and its path is decoded then, once.
+// Blobs are told apart by their first AppBlob::kMaxBytes bytes, so paths
+// over 512 characters that agree that far share an id.
+//
+// find() and path() never lock, allocate or decode. find() hashes the raw
+// bytes and probes an open-addressing table of immutable entries; path()
+// reads an entry through an id directory whose chunks never move. Both are
+// safe from any number of threads, so the net event callback and the
+// printer never wait for intern(), which takes the mutex to decode and
+// publish a new blob. A full table is replaced by one twice the size; the
+// old one stays allocated until the table is destroyed, since a reader may
+// still be probing it, which costs at most as much again as the live table
+// for what is normally a few hundred executables.
+class AppPathTable
+{
+public:
+    // find() for a blob not interned yet; also the id of every blob past
+    // the last one the id directory has room for.
+    static constexpr std::uint32_t kNotFound = UINT32_MAX;
+
+    struct Stats
+    {
+        std::size_t entries;  // distinct blobs
+        std::uint64_t lookups;
+        std::uint64_t misses; // lookups that found the blob new
+        std::size_t bytes;    // blobs, paths and tables
+    };
+
+    AppPathTable()
+        : m_table(std::make_unique<Table>(kInitialSlots))
+    {
+        m_current.store(m_table.get());
+    }
+
+    AppPathTable(const AppPathTable&)            = delete;
+    AppPathTable& operator=(const AppPathTable&) = delete;
+
+    // The id of blob, or kNotFound if it has not been interned. A missing
+    // blob is looked up like an empty one.
+    std::uint32_t
+    find(
+        const FWP_BYTE_BLOB& blob
+        )
+    {
+        const UINT8* data = blob.data;
+        std::size_t size  = clampedSize(blob);
+
+        m_lookups[lookupStripe()].value.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+
+        if (
+            const Entry* e = findEntry(
+                m_current.load(std::memory_order_acquire),
+                hashBlob(
+                    data,
+                    size
+                    ),
+                data,
+                size
+                )
+            )
+        {
+            return e->id;
+        }
+
+        m_misses.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+
+        return kNotFound;
+    }
+
+    // Copy blob into out, for intern() on another thread.
+    static void
+    copy(
+        const FWP_BYTE_BLOB& blob,
+        AppBlob& out
+        )
+    {
+        out.size = static_cast<std::uint32_t>(clampedSize(blob));
+
+        if (out.size)
+        {
+            std::memcpy(
+                out.bytes,
+                blob.data,
+                out.size
+                );
+        }
+
+        out.hash = hashBlob(
+            out.bytes,
+            out.size
+            );
+    }
+
+    // The id of blob, interning it if new. A new blob takes the mutex and is
+    // decoded, so this is for a thread that may wait, not the callback.
+    std::uint32_t
+    intern(
+        const AppBlob& blob
+        )
+    {
+        if (
+            const Entry* e = findEntry(
+                m_current.load(std::memory_order_acquire),
+                blob.hash,
+                blob.bytes,
+                blob.size
+                )
+            )
+        {
+            return e->id;
+        }
+
+        return insert(
+            blob.hash,
+            blob.bytes,
+            blob.size
+            );
+    }
+
+    // find(), then intern() if new, on this thread.
+    std::uint32_t
+    intern(
+        const FWP_BYTE_BLOB& blob
+        )
+    {
+        if (
+            std::uint32_t id = find(blob); id != kNotFound
+            )
+        {
+            return id;
+        }
+
+        auto copied = std::make_unique<AppBlob>();
+        copy(
+            blob,
+            *copied
+            );
+
+        return intern(*copied);
+    }
+
+    // The decoded path of an id intern() returned. The reference stays valid
+    // for the life of the table.
+    const std::wstring&
+    path(
+        std::uint32_t id
+        ) const
+    {
+        static const std::wstring kTooMany = L"<too many app paths>";
+
+        if (id >= kChunkSize * kMaxChunks)
+        {
+            return kTooMany;
+        }
+
+        const Slot* chunk = m_byId[id / kChunkSize].load(std::memory_order_acquire);
+
+        return chunk[id % kChunkSize].load(std::memory_order_acquire)->path;
+    }
+
+    Stats
+    snapshot() const
+    {
+        std::uint64_t lookups = 0;
+
+        for (const LookupCell& c : m_lookups)
+        {
+            lookups += c.value.load(std::memory_order_relaxed);
+        }
+
+        return {
+            m_entryCount.load(std::memory_order_relaxed),
+            lookups,
+            m_misses.load(std::memory_order_relaxed),
+            m_bytes.load(std::memory_order_relaxed)};
+    }
+
+private:
+    static constexpr std::size_t kInitialSlots  = 256;
+    static constexpr std::size_t kLookupStripes = 32;
+
+    // The id directory: up to kMaxChunks chunks of kChunkSize entries, 4M
+    // ids in all, for 32 KiB of chunk pointers up front.
+    static constexpr std::size_t kChunkSize = 1024;
+    static constexpr std::size_t kMaxChunks = 4096;
+
+    // Lookups are counted per thread stripe, each on its own cache line:
+    // every delivering thread interns every event, and one shared counter
+    // would have them all queue on the same line.
+    struct alignas(64) LookupCell
+    {
+        std::atomic<std::uint64_t> value {0};
+    };
+
+    static std::size_t
+    lookupStripe() noexcept
+    {
+        static std::atomic<std::size_t> nextStripe {0};
+        thread_local std::size_t mine = nextStripe.fetch_add(
+            1,
+            std::memory_order_relaxed
+            ) % kLookupStripes;
+
+        return mine;
+    }
+
+    struct Entry
+    {
+        std::uint64_t hash;
+        std::vector<UINT8> blob;
+        std::uint32_t id;
+        std::wstring path;
+    };
+
+    using Slot = std::atomic<const Entry*>;
+
+    static std::size_t
+    clampedSize(
+        const FWP_BYTE_BLOB& blob
+        ) noexcept
+    {
+        return blob.data ? std::min<std::size_t>(
+            blob.size,
+            AppBlob::kMaxBytes
+            ) : 0;
+    }
+
+    // Power-of-two slots, linear probing, at most half full. Slots go from
+    // null to an entry once and never change after that.
+    struct Table
+    {
+        explicit Table(
+            std::size_t n
+            )
+            : slots(new Slot[n]),
+              mask(n - 1)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                slots[i].store(nullptr);
+            }
+        }
+
+        std::unique_ptr<Slot[]> slots;
+        std::size_t mask;
+        std::size_t used {0};
+    };
+
+    // 8 bytes at a time, then a splitmix64 finish.
+    static std::uint64_t
+    hashBlob(
+        const UINT8* data,
+        std::size_t size
+        )
+    {
+        std::uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+
+        for (; size >= 8; data += 8, size -= 8)
+        {
+            std::uint64_t w;
+            std::memcpy(
+                &w,
+                data,
+                8
+                );
+            h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+            h ^= h >> 29;
+        }
+
+        if (size)
+        {
+            std::uint64_t w = 0;
+            std::memcpy(
+                &w,
+                data,
+                size
+                );
+            h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+        }
+
+        h ^= h >> 30;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 27;
+        h *= 0x94D049BB133111EBull;
+        h ^= h >> 31;
+
+        return h;
+    }
+
+    static const Entry*
+    findEntry(
+        const Table* table,
+        std::uint64_t h,
+        const UINT8* data,
+        std::size_t size
+        )
+    {
+        for (std::size_t i = h & table->mask;; i = (i + 1) & table->mask)
+        {
+            const Entry* e = table->slots[i].load(std::memory_order_acquire);
+
+            if (!e)
+            {
+                return nullptr;
+            }
+
+            if ((e->hash == h) && (e->blob.size() == size) && ((size == 0) || (std::memcmp(e->blob.data(), data, size) == 0)))
+            {
+                return e;
+            }
+        }
+    }
+
+    static void
+    place(
+        Table& table,
+        const Entry* e
+        )
+    {
+        std::size_t i = e->hash & table.mask;
+
+        while (table.slots[i].load(std::memory_order_relaxed))
+        {
+            i = (i + 1) & table.mask;
+        }
+
+        table.slots[i].store(
+            e,
+            std::memory_order_release
+            );
+        ++table.used;
+    }
+
+    std::uint32_t
+    insert(
+        std::uint64_t h,
+        const UINT8* data,
+        std::size_t size
+        )
+    {
+        std::lock_guard lock(m_mtx);
+
+        // Another thread may have interned it since the lock-free probe.
+        Table* table = m_table.get();
+
+        if (
+            const Entry* e = findEntry(
+                table,
+                h,
+                data,
+                size
+                )
+            )
+        {
+            return e->id;
+        }
+
+        std::size_t id = m_entries.size();
+
+        if (id >= kChunkSize * kMaxChunks)
+        {
+            return kNotFound;
+        }
+
+        if (id % kChunkSize == 0)
+        {
+            m_chunks.push_back(std::make_unique<Slot[]>(kChunkSize));
+            m_byId[id / kChunkSize].store(
+                m_chunks.back().get(),
+                std::memory_order_release
+                );
+            m_bytes.fetch_add(
+                kChunkSize * sizeof(Slot),
+                std::memory_order_relaxed
+                );
+        }
+
+        auto e  = std::make_unique<Entry>();
+        e->hash = h;
+        e->blob.assign(
+            data,
+            data + size
+            );
+        e->id = static_cast<std::uint32_t>(id);
+
+        FwpmNetEventHeader hdr {};
+        hdr.appId.data = const_cast<UINT8*>(data);
+        hdr.appId.size = static_cast<UINT32>(size);
+        e->path        = hdr.getAppPath();
+
+        if (2 * (table->used + 1) > table->mask + 1)
+        {
+            auto bigger = std::make_unique<Table>(2 * (table->mask + 1));
+
+            for (const auto& old : m_entries)
+            {
+                place(
+                    *bigger,
+                    old.get()
+                    );
+            }
+
+            m_bytes.fetch_add(
+                (bigger->mask + 1) * sizeof(Slot),
+                std::memory_order_relaxed
+                );
+            m_retired.push_back(std::move(m_table));
+            m_table = std::move(bigger);
+            table   = m_table.get();
+        }
+
+        m_bytes.fetch_add(
+            sizeof(Entry) + size + e->path.size() * sizeof(wchar_t),
+            std::memory_order_relaxed
+            );
+        m_entries.push_back(std::move(e));
+        m_entryCount.store(
+            m_entries.size(),
+            std::memory_order_relaxed
+            );
+
+        // Publish only once path() can find it.
+        const Entry* added = m_entries.back().get();
+        m_byId[id / kChunkSize].load(std::memory_order_relaxed)[id % kChunkSize].store(
+            added,
+            std::memory_order_release
+            );
+        place(
+            *table,
+            added
+            );
+        m_current.store(
+            table,
+            std::memory_order_release
+            );
+
+        return added->id;
+    }
+
+    std::mutex m_mtx;
+    std::vector<std::unique_ptr<Entry>> m_entries; // by id
+    std::vector<std::unique_ptr<Slot[]>> m_chunks;
+    std::unique_ptr<Table> m_table;
+    std::vector<std::unique_ptr<Table>> m_retired;
+
+    std::atomic<const Table*> m_current {nullptr};
+    std::array<std::atomic<Slot*>, kMaxChunks> m_byId {};
+    std::array<LookupCell, kLookupStripes> m_lookups {};
+    std::atomic<std::size_t> m_entryCount {0};
+    std::atomic<std::uint64_t> m_misses {0};
+    std::atomic<std::size_t> m_bytes {kInitialSlots * sizeof(Slot) + kMaxChunks * sizeof(Slot*)};
+};
@@ -1,5 +1,8 @@
 ﻿#pragma once
 
+#include "EventKey.hpp"
+#include "SocketAddress.hpp"
+
 #include <WinSock2.h>
 #include <fwpmu.h>
 #include <fwpmtypes.h>
@@ -8,43 +11,13 @@
 
 #include <string>
 #include <cstdint>
+#include <cstring>
 #include <sstream>
 #include <format>
 #include <ostream>
 #include <unordered_map>
 #include <utility>
 
-enum class EventDirection : std::uint8_t
-{
-    Unknown  = 0,
-    Inbound  = 1,
-    Outbound = 2
-};
-
-enum class EventType : std::uint8_t
-{
-    Other = 0,
-    Drop  = 1,
-    Allow = 2
-};
-
-struct EventKey
-{
-    std::string localSocket;
-    std::string remoteSocket;
-    IPPROTO protocol;
-    std::uint32_t layerId;
-    EventType type;
-    EventDirection direction;
-    std::uint64_t filterId;
-    std::wstring appName;
-
-    bool
-    operator==(
-        const EventKey& o
-        ) const noexcept = default;
-};
-
 inline std::string
 to_string(
     EventType t
@@ -179,6 +152,37 @@ to_string(
     }
 }
 
+// "a.b.c.d:port", "[xxxx:...:xxxx]:port" or "N/A" for an address kept raw
+// in an EventKey.
+inline std::string
+endpointToString(
+    const std::uint8_t (&addr)[16],
+    std::uint16_t port,
+    std::uint8_t ipVersion
+    )
+{
+    if (ipVersion == FWP_IP_VERSION_V4)
+    {
+        UINT32 v4 = (UINT32 {addr[0]} << 24) | (UINT32 {addr[1]} << 16) | (UINT32 {addr[2]} << 8) | UINT32 {addr[3]};
+
+        return to_string(std::pair<UINT32, UINT16> {v4, port});
+    }
+
+    if (ipVersion == FWP_IP_VERSION_V6)
+    {
+        FWP_BYTE_ARRAY16 v6 {};
+        std::memcpy(
+            v6.byteArray16,
+            addr,
+            sizeof(v6.byteArray16)
+            );
+
+        return to_string(std::pair<FWP_BYTE_ARRAY16, UINT16> {v6, port});
+    }
+
+    return "N/A";
+}
+
 inline std::string
 to_string(
     const EventKey& k
@@ -188,9 +192,10 @@ to_string(
     out
         << "[" << to_string(k.type) << "]"
         << "[" << layerIdToName(k.layerId) << "]"
-        << "[" << to_string(k.protocol) << "]"
+        << "[" << to_string(static_cast<IPPROTO>(k.protocol)) << "]"
         << "[" << to_string(k.direction) << "] "
-        << k.localSocket << " -> " << k.remoteSocket;
+        << endpointToString(k.localAddr, k.localPort, k.ipVersion) << " -> "
+        << endpointToString(k.remoteAddr, k.remotePort, k.ipVersion);
 
     return out.str();
 }
\ No newline at end of file
@@ -0,0 +1,200 @@
+﻿#pragma once
+
+#include <WinSock2.h>
+#include <fwpmtypes.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+
+enum class EventDirection : std::uint8_t
+{
+    Unknown  = 0,
+    Inbound  = 1,
+    Outbound = 2
+};
+
+enum class EventType : std::uint8_t
+{
+    Other = 0,
+    Drop  = 1,
+    Allow = 2
+};
+
+// What net events are grouped by. Fixed size, no padding and nothing owned,
+// so a key is built with a few stores, hashed and compared as plain memory
+// and copied with memcpy; text is made from it only when printing.
+struct EventKey
+{
+    std::uint64_t filterId;
+    std::uint8_t localAddr[16];  // IPv4 in the first 4 bytes, network order
+    std::uint8_t remoteAddr[16]; // likewise
+    std::uint32_t layerId;
+    std::uint32_t appId; // index of the app path in the aggregator
+    std::uint16_t localPort;
+    std::uint16_t remotePort;
+    std::uint8_t ipVersion; // FWP_IP_VERSION; neither v4 nor v6 = no addresses
+    std::uint8_t protocol;  // IPPROTO
+    EventType type;
+    EventDirection direction;
+
+    bool
+    operator==(
+        const EventKey& o
+        ) const noexcept = default;
+};
+
+static_assert(std::is_trivially_copyable_v<EventKey>);
+static_assert(std::has_unique_object_representations_v<EventKey>, "EventKey must have no padding: it is hashed as raw bytes");
+static_assert(sizeof(EventKey) % sizeof(std::uint64_t) == 0);
+
+struct EventKeyHasher
+{
+    std::size_t
+    operator()(
+        const EventKey& k
+        ) const noexcept
+    {
+        // Each 8 bytes times its own odd constant, summed, so the multiplies
+        // do not wait on each other; then a full avalanche (splitmix64).
+        static constexpr std::uint64_t kMul[] = {
+            0x9E3779B97F4A7C15ull, 0xBF58476D1CE4E5B9ull, 0x94D049BB133111EBull, 0xD6E8FEB86659FD93ull,
+            0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x85EBCA77C2B2AE63ull, 0xFF51AFD7ED558CCDull};
+
+        std::uint64_t words[sizeof(EventKey) / sizeof(std::uint64_t)];
+        std::memcpy(
+            words,
+            &k,
+            sizeof(words)
+            );
+
+        static_assert(std::size(words) <= std::size(kMul));
+
+        std::uint64_t h = 0;
+
+        for (std::size_t i = 0; i < std::size(words); ++i)
+        {
+            h += words[i] * kMul[i];
+        }
+
+        h ^= h >> 30;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 27;
+        h *= 0x94D049BB133111EBull;
+        h ^= h >> 31;
+
+        return static_cast<std::size_t>(h);
+    }
+};
+
+namespace event_key_detail
+{
+
+inline EventDirection
+toDirection(
+    UINT32 msFwpDirection
+    )
+{
+    switch (msFwpDirection)
+    {
+        case FWP_DIRECTION_INBOUND: return EventDirection::Inbound;
+        case FWP_DIRECTION_OUTBOUND: return EventDirection::Outbound;
+        default: return EventDirection::Unknown;
+    }
+}
+
+inline void
+storeAddress(
+    std::uint8_t (&out)[16],
+    UINT32 v4
+    )
+{
+    out[0] = static_cast<std::uint8_t>(v4 >> 24);
+    out[1] = static_cast<std::uint8_t>(v4 >> 16);
+    out[2] = static_cast<std::uint8_t>(v4 >> 8);
+    out[3] = static_cast<std::uint8_t>(v4);
+}
+
+} // namespace event_key_detail
+
+// The key of one net event, all but appId, which the aggregator fills in.
+// Reads only fixed-size header fields; nothing is allocated or formatted.
+inline EventKey
+makeEventKey(
+    const FWPM_NET_EVENT5& event
+    )
+{
+    using namespace event_key_detail;
+
+    const FWPM_NET_EVENT_HEADER3& hdr = event.header;
+
+    EventKey key {};
+    key.ipVersion = static_cast<std::uint8_t>(hdr.ipVersion);
+    key.protocol  = hdr.ipProtocol;
+
+    if (hdr.ipVersion == FWP_IP_VERSION_V4)
+    {
+        storeAddress(
+            key.localAddr,
+            hdr.localAddrV4
+            );
+        storeAddress(
+            key.remoteAddr,
+            hdr.remoteAddrV4
+            );
+    }
+    else if (hdr.ipVersion == FWP_IP_VERSION_V6)
+    {
+        std::memcpy(
+            key.localAddr,
+            hdr.localAddrV6.byteArray16,
+            sizeof(key.localAddr)
+            );
+        std::memcpy(
+            key.remoteAddr,
+            hdr.remoteAddrV6.byteArray16,
+            sizeof(key.remoteAddr)
+            );
+    }
+
+    if ((hdr.ipVersion == FWP_IP_VERSION_V4) || (hdr.ipVersion == FWP_IP_VERSION_V6))
+    {
+        key.localPort  = hdr.localPort;
+        key.remotePort = hdr.remotePort;
+    }
+
+    switch (event.type)
+    {
+        case FWPM_NET_EVENT_TYPE_CLASSIFY_DROP:
+            key.type = EventType::Drop;
+
+            if (event.classifyDrop)
+            {
+                key.layerId   = event.classifyDrop->layerId;
+                key.filterId  = event.classifyDrop->filterId;
+                key.direction = toDirection(event.classifyDrop->msFwpDirection);
+            }
+
+            break;
+
+        case FWPM_NET_EVENT_TYPE_CLASSIFY_ALLOW:
+            key.type = EventType::Allow;
+
+            if (event.classifyAllow)
+            {
+                key.layerId   = event.classifyAllow->layerId;
+                key.filterId  = event.classifyAllow->filterId;
+                key.direction = toDirection(event.classifyAllow->msFwpDirection);
+            }
+
+            break;
+
+        default:
+            key.type = EventType::Other;
+            break;
+    }
+
+    return key;
+}
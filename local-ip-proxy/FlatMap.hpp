@@ -0,0 +1,483 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
+
+namespace flat_map_detail
+{
+
+// One control byte per slot: a full slot has the high bit set and the low 7
+// bits of its key's hash below it. Empty is zero, so a new table's control
+// bytes can come straight from calloc, as pages the OS zeroes when first
+// touched, rather than being filled in before the first insert.
+constexpr std::int8_t kEmpty = 0;
+constexpr std::int8_t kMoved = 1; // only in a table being rehashed away
+
+inline bool
+isFull(
+    std::int8_t ctrl
+    )
+{
+    return ctrl < 0;
+}
+
+inline std::int8_t
+fullCtrl(
+    std::size_t h
+    )
+{
+    return static_cast<std::int8_t>(0x80 | (h & 0x7F));
+}
+
+struct FreeCtrl
+{
+    void
+    operator()(
+        std::int8_t* p
+        ) const noexcept
+    {
+        std::free(p);
+    }
+};
+
+constexpr std::size_t kGroupSize = 16;
+
+// Bit i set where group[i] == b; one compare for the whole group with SSE2.
+inline std::uint32_t
+matchByte(
+    const std::int8_t* group,
+    std::int8_t b
+    )
+{
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+    __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+
+    return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(
+        ctrl,
+        _mm_set1_epi8(b)
+        )));
+#else
+    std::uint32_t m = 0;
+
+    for (std::size_t i = 0; i < kGroupSize; ++i)
+    {
+        m |= static_cast<std::uint32_t>(group[i] == b) << i;
+    }
+
+    return m;
+#endif
+}
+
+} // namespace flat_map_detail
+
+// Hash map with keys and values inline in one array, for the aggregator's
+// fixed-size keys: an insert or lookup hashes once, compares 16 control bytes
+// at a time and touches only the slots whose 7 hash bits match, and nothing
+// is allocated per key. There is no erase.
+//
+// Growing never rehashes everything at once: the full table is kept aside
+// while a twice-as-large one takes new keys, and every try_emplace() after
+// that moves the next 16 of its slots over, until it is empty and freed;
+// that free, which the OS may take milliseconds over for a huge table, is
+// the largest single cost left. A key lives in exactly one of the two
+// tables, so lookups check both while that lasts. Iterators and references
+// are invalidated by try_emplace().
+template <typename K, typename V, typename Hash>
+class FlatMap
+{
+    static_assert(std::is_trivially_destructible_v<K> && std::is_trivially_destructible_v<V>);
+
+    struct Table;
+
+public:
+    using value_type = std::pair<K, V>;
+
+    class iterator
+    {
+    public:
+        value_type&
+        operator*() const
+        {
+            return *m_tables[m_t]->slot(m_i);
+        }
+
+        value_type*
+        operator->() const
+        {
+            return m_tables[m_t]->slot(m_i);
+        }
+
+        iterator&
+        operator++()
+        {
+            ++m_i;
+            skipEmpty();
+
+            return *this;
+        }
+
+        bool
+        operator==(
+            const iterator& o
+            ) const noexcept
+        {
+            return (m_t == o.m_t) && (m_i == o.m_i);
+        }
+
+    private:
+        friend class FlatMap;
+
+        iterator(
+            const FlatMap& map,
+            std::size_t t,
+            std::size_t i
+            )
+            : m_tables {map.m_old.get(), map.m_table.get()},
+              m_t(t),
+              m_i(i)
+        {
+        }
+
+        // Forward to the next full slot, the old table's before the new's.
+        void
+        skipEmpty()
+        {
+            for (; m_t < 2; ++m_t, m_i = 0)
+            {
+                if (const Table* table = m_tables[m_t])
+                {
+                    for (; m_i < table->capacity(); ++m_i)
+                    {
+                        if (flat_map_detail::isFull(table->ctrl[m_i]))
+                        {
+                            return;
+                        }
+                    }
+                }
+            }
+        }
+
+        Table* m_tables[2];
+        std::size_t m_t;
+        std::size_t m_i;
+    };
+
+    FlatMap()
+        : m_table(std::make_unique<Table>(kInitialGroups))
+    {
+    }
+
+    FlatMap(const FlatMap&)            = delete;
+    FlatMap& operator=(const FlatMap&) = delete;
+
+    // The entry for key, inserted with a value-initialized V if missing;
+    // true if it was inserted.
+    std::pair<iterator, bool>
+    try_emplace(
+        const K& key
+        )
+    {
+        if (m_old)
+        {
+            migrateSome();
+        }
+
+        std::size_t h = m_hash(key);
+        std::size_t i;
+
+        if (m_old)
+        {
+            i = findSlot(
+                *m_old,
+                h,
+                key
+                );
+
+            if (i != kNotFound)
+            {
+                return {iterator(*this, 0, i), false};
+            }
+        }
+
+        i = findSlot(
+            *m_table,
+            h,
+            key
+            );
+
+        if (i != kNotFound)
+        {
+            return {iterator(*this, 1, i), false};
+        }
+
+        if (8 * (m_table->size + 1) > 7 * m_table->capacity())
+        {
+            grow();
+        }
+
+        i = place(
+            *m_table,
+            h,
+            value_type(key, V {})
+            );
+
+        return {iterator(*this, 1, i), true};
+    }
+
+    // The entry for key, or end(). Never inserts, grows or moves a slot, so
+    // unlike try_emplace() it allocates and frees nothing.
+    iterator
+    find(
+        const K& key
+        )
+    {
+        std::size_t h = m_hash(key);
+        std::size_t i;
+
+        if (m_old)
+        {
+            i = findSlot(
+                *m_old,
+                h,
+                key
+                );
+
+            if (i != kNotFound)
+            {
+                return iterator(*this, 0, i);
+            }
+        }
+
+        i = findSlot(
+            *m_table,
+            h,
+            key
+            );
+
+        return (i != kNotFound) ? iterator(*this, 1, i) : end();
+    }
+
+    iterator
+    begin()
+    {
+        iterator it(*this, 0, 0);
+        it.skipEmpty();
+
+        return it;
+    }
+
+    iterator
+    end()
+    {
+        return iterator(*this, 2, 0);
+    }
+
+    std::size_t
+    size() const noexcept
+    {
+        return m_table->size + (m_old ? m_old->size : 0);
+    }
+
+    // Slots and control bytes of both tables.
+    std::size_t
+    bytes() const noexcept
+    {
+        std::size_t slots = m_table->capacity() + (m_old ? m_old->capacity() : 0);
+
+        return slots * (sizeof(value_type) + 1);
+    }
+
+    // Whether a table grown out of is still being emptied.
+    bool
+    rehashing() const noexcept
+    {
+        return m_old != nullptr;
+    }
+
+private:
+    static constexpr std::size_t kInitialGroups = 1;
+    static constexpr std::size_t kNotFound      = SIZE_MAX;
+
+    // Old slots moved per try_emplace() while rehashing. The new table is
+    // twice the size and at most 7/8 of the old one is full, so moving 2
+    // per insert would already empty it before the new one fills up.
+    static constexpr std::size_t kMigrateSlots = flat_map_detail::kGroupSize;
+
+    // Slot storage is left uninitialized until a key is placed, so making a
+    // table, however big, costs no more than the allocations.
+    struct alignas(value_type) SlotStorage
+    {
+        std::byte bytes[sizeof(value_type)];
+    };
+
+    struct Table
+    {
+        explicit Table(
+            std::size_t groups
+            )
+            : ctrl(static_cast<std::int8_t*>(std::calloc(
+                  groups,
+                  flat_map_detail::kGroupSize
+                  ))),
+              slots(std::make_unique_for_overwrite<SlotStorage[]>(groups * flat_map_detail::kGroupSize)),
+              groupMask(groups - 1)
+        {
+            if (!ctrl)
+            {
+                throw std::bad_alloc();
+            }
+        }
+
+        std::size_t
+        capacity() const noexcept
+        {
+            return (groupMask + 1) * flat_map_detail::kGroupSize;
+        }
+
+        value_type*
+        slot(
+            std::size_t i
+            ) const noexcept
+        {
+            return std::launder(reinterpret_cast<value_type*>(slots[i].bytes));
+        }
+
+        std::unique_ptr<std::int8_t[], flat_map_detail::FreeCtrl> ctrl;
+        std::unique_ptr<SlotStorage[]> slots;
+        std::size_t groupMask;
+        std::size_t size {0};
+    };
+
+    // Groups are probed triangularly from the one picked by the hash bits
+    // just above the 7 kept in the control byte (h >> 7), which visits every
+    // group of a power-of-two table; a group with an empty slot ends the
+    // search, since an insert would have stopped there.
+    static std::size_t
+    findSlot(
+        const Table& table,
+        std::size_t h,
+        const K& key
+        )
+    {
+        std::int8_t h2 = flat_map_detail::fullCtrl(h);
+        std::size_t g  = (h >> 7) & table.groupMask;
+
+        for (std::size_t step = 1;; g = (g + step++) & table.groupMask)
+        {
+            const std::int8_t* group = table.ctrl.get() + g * flat_map_detail::kGroupSize;
+
+            for (std::uint32_t m = flat_map_detail::matchByte(group, h2); m; m &= m - 1)
+            {
+                std::size_t i = g * flat_map_detail::kGroupSize + std::countr_zero(m);
+
+                if (table.slot(i)->first == key)
+                {
+                    return i;
+                }
+            }
+
+            if (
+                flat_map_detail::matchByte(
+                    group,
+                    flat_map_detail::kEmpty
+                    )
+                )
+            {
+                return kNotFound;
+            }
+        }
+    }
+
+    // Into the first empty slot on key's probe path; the caller knows the key
+    // is not in the table and that the table has room.
+    static std::size_t
+    place(
+        Table& table,
+        std::size_t h,
+        value_type&& value
+        )
+    {
+        std::size_t g = (h >> 7) & table.groupMask;
+
+        for (std::size_t step = 1;; g = (g + step++) & table.groupMask)
+        {
+            std::int8_t* group = table.ctrl.get() + g * flat_map_detail::kGroupSize;
+
+            if (
+                std::uint32_t m = flat_map_detail::matchByte(
+                    group,
+                    flat_map_detail::kEmpty
+                    )
+                )
+            {
+                std::size_t i = g * flat_map_detail::kGroupSize + std::countr_zero(m);
+
+                ::new (table.slots[i].bytes) value_type(std::move(value));
+                table.ctrl[i] = flat_map_detail::fullCtrl(h);
+                ++table.size;
+
+                return i;
+            }
+        }
+    }
+
+    void
+    grow()
+    {
+        // Only if something inserted faster than kMigrateSlots allows.
+        while (m_old)
+        {
+            migrateSome();
+        }
+
+        m_old     = std::move(m_table);
+        m_table   = std::make_unique<Table>(2 * (m_old->groupMask + 1));
+        m_migrate = 0;
+    }
+
+    void
+    migrateSome()
+    {
+        std::size_t end = std::min(
+            m_migrate + kMigrateSlots,
+            m_old->capacity()
+            );
+
+        for (; m_migrate < end; ++m_migrate)
+        {
+            if (flat_map_detail::isFull(m_old->ctrl[m_migrate]))
+            {
+                value_type* v = m_old->slot(m_migrate);
+
+                place(
+                    *m_table,
+                    m_hash(v->first),
+                    std::move(*v)
+                    );
+                m_old->ctrl[m_migrate] = flat_map_detail::kMoved;
+                --m_old->size;
+            }
+        }
+
+        if (m_migrate == m_old->capacity())
+        {
+            m_old.reset();
+        }
+    }
+
+    std::unique_ptr<Table> m_table;
+    std::unique_ptr<Table> m_old; // being moved into m_table, if not null
+    std::size_t m_migrate {0};    // next slot of m_old to move
+    Hash m_hash;
+};
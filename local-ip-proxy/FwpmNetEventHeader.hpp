@@ -1,4 +1,5 @@
-﻿
+﻿#pragma once
+
 #include "UTF16.hpp"
 
 #include <fwpmtypes.h>
@@ -0,0 +1,157 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+// Bounded multi-producer, single-consumer ring of trivially copyable records.
+//
+// tryPush() never blocks and never allocates: a producer claims a slot with
+// one compare-and-swap on the tail, copies its record in and publishes it by
+// bumping the slot's sequence number. When the ring is full the record is
+// dropped and counted instead, so a burst can cost events but never stalls
+// the thread that produced it. The one consumer takes records in order with
+// drain(). Each slot is its own cache line, so producers writing neighbouring
+// slots do not contend.
+template <typename T>
+class MpscRing
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+    // capacity is rounded up to a power of two.
+    explicit MpscRing(
+        std::size_t capacity
+        )
+    {
+        std::size_t n = 2;
+
+        while (n < capacity)
+        {
+            n *= 2;
+        }
+
+        m_cells = std::make_unique<Cell[]>(n);
+        m_mask  = n - 1;
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            m_cells[i].seq.store(
+                i,
+                std::memory_order_relaxed
+                );
+        }
+    }
+
+    MpscRing(const MpscRing&)            = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // Any thread. False, and counted as dropped, if the ring is full.
+    bool
+    tryPush(
+        const T& value
+        ) noexcept
+    {
+        std::uint64_t pos = m_tail.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+            Cell& cell        = m_cells[pos & m_mask];
+            std::uint64_t seq = cell.seq.load(std::memory_order_acquire);
+            auto lag          = static_cast<std::int64_t>(seq - pos);
+
+            if (lag == 0)
+            {
+                if (
+                    m_tail.compare_exchange_weak(
+                        pos,
+                        pos + 1,
+                        std::memory_order_relaxed
+                        )
+                    )
+                {
+                    cell.value = value;
+                    cell.seq.store(
+                        pos + 1,
+                        std::memory_order_release
+                        );
+
+                    return true;
+                }
+            }
+            else if (lag < 0)
+            {
+                // The consumer has not freed this slot from the last lap yet.
+                m_dropped.fetch_add(
+                    1,
+                    std::memory_order_relaxed
+                    );
+
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer only. Hands up to max records to fn(const T&), oldest first,
+    // and returns how many. Stops early at a slot that is claimed but not
+    // yet written.
+    template <typename Fn>
+    std::size_t
+    drain(
+        Fn&& fn,
+        std::size_t max
+        )
+    {
+        std::size_t n = 0;
+
+        for (; n < max; ++n, ++m_head)
+        {
+            Cell& cell = m_cells[m_head & m_mask];
+
+            if (cell.seq.load(std::memory_order_acquire) != m_head + 1)
+            {
+                break;
+            }
+
+            fn(static_cast<const T&>(cell.value));
+            cell.seq.store(
+                m_head + m_mask + 1,
+                std::memory_order_release
+                );
+        }
+
+        return n;
+    }
+
+    std::size_t
+    capacity() const noexcept
+    {
+        return m_mask + 1;
+    }
+
+    std::uint64_t
+    dropped() const noexcept
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<std::uint64_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    std::size_t m_mask {0};
+
+    alignas(64) std::atomic<std::uint64_t> m_tail {0}; // producers
+    alignas(64) std::uint64_t m_head {0};              // consumer
+    alignas(64) std::atomic<std::uint64_t> m_dropped {0};
+};
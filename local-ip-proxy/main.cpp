@@ -1,5 +1,6 @@
 ﻿#include "SocketAddress.hpp"
 #include "Event.hpp"
+#include "Aggregator.hpp"
 #include "NetEventCollectionGuard.hpp"
 #include "WinSockSession.hpp"
 #include "FwpmNetEventHeader.hpp"
@@ -42,77 +43,6 @@ struct RunConfig
     bool interactive = true;
 };
 
-static std::size_t
-str_hash(
-    const std::wstring& str
-    )
-{
-    size_t h = 1469598103934665603ULL;
-
-    for (std::wstring::value_type c : str)
-    {
-        h ^= static_cast<size_t>(c);
-        h *= 1099511628211ULL;
-    }
-
-    return h;
-}
-
-static std::size_t
-str_hash(
-    const std::string& str
-    )
-{
-    size_t h = 1469598103934665603ULL;
-
-    for (std::string::value_type c : str)
-    {
-        h ^= static_cast<size_t>(c);
-        h *= 1099511628211ULL;
-    }
-
-    return h;
-}
-
-struct EventKeyHasher
-{
-    size_t
-    operator()(
-        const EventKey& k
-        ) const noexcept
-    {
-        // Simple hash combine
-        size_t h = 1469598103934665603ULL;
-        auto mix = [&] (auto v)
-            {
-                h ^= static_cast<size_t>(v);
-                h *= 1099511628211ULL;
-            };
-        mix(str_hash(k.localSocket));
-        mix(str_hash(k.remoteSocket));
-        mix(k.protocol);
-        mix(k.layerId);
-        mix(std::to_underlying(k.type));
-        mix(std::to_underlying(k.direction));
-        mix(k.filterId);
-        mix(str_hash(k.appName));
-
-        return h;
-    }
-};
-
-struct EventStats
-{
-    uint64_t count       = 0;
-    uint64_t lastPrinted = 0;
-};
-
-struct Aggregator
-{
-    std::unordered_map<EventKey, EventStats, EventKeyHasher> map;
-    std::mutex mtx;
-};
-
 static bool
 promptYesNo(
     const std::string_view& prompt,
@@ -345,108 +275,10 @@ netEventCallback(
         return;
     }
 
-    auto* agg       = static_cast<Aggregator*>(context);
-    const auto& hdr = FwpmNetEventHeader {event->header};
-
-    UINT32 layerId     = 0;
-    UINT64 filterId    = 0;
-    EventDirection dir = EventDirection::Unknown;
-    EventType type     = EventType::Other;
-
-    switch (event->type)
-    {
-        using enum EventType;
-        case FWPM_NET_EVENT_TYPE_CLASSIFY_DROP:
-            type = Drop;
-
-            if (event->classifyDrop)
-            {
-                layerId  = event->classifyDrop->layerId;
-                filterId = event->classifyDrop->filterId;
-
-                switch (event->classifyDrop->msFwpDirection)
-                {
-                    using enum EventDirection;
-                    case FWP_DIRECTION_INBOUND:
-                        dir = Inbound;
-                        break;
-
-                    case FWP_DIRECTION_OUTBOUND:
-                        dir = Outbound;
-                        break;
-
-                    default:
-                        dir = Unknown;
-                }
-            }
-
-            break;
-
-        case FWPM_NET_EVENT_TYPE_CLASSIFY_ALLOW:
-            type = Allow;
-
-            if (event->classifyAllow)
-            {
-                layerId  = event->classifyAllow->layerId;
-                filterId = event->classifyAllow->filterId;
-
-                switch (event->classifyAllow->msFwpDirection)
-                {
-                    using enum EventDirection;
-                    case FWP_DIRECTION_INBOUND:
-                        dir = Inbound;
-                        break;
-
-                    case FWP_DIRECTION_OUTBOUND:
-                        dir = Outbound;
-                        break;
-
-                    default:
-                        dir = Unknown;
-                }
-            }
-
-            break;
-
-        default:
-            type = Other;
-            break;
-    }
-
-    std::string localSocket = "N/A";
-
-    std::string remoteSocket = "N/A";
-
-    std::wstring appPath = hdr.getAppPath();
-
-    auto ipProtocol = (IPPROTO) hdr.ipProtocol;
-
-    auto recordEvent = [&] ()
-        {
-            std::lock_guard lock(agg->mtx);
-
-            auto [it, inserted] = agg->map.try_emplace(
-                {localSocket, remoteSocket, ipProtocol, layerId, type, dir, filterId, appPath},
-                EventStats{}
-                );
-
-            auto& stats = it->second;
-            ++stats.count;
-        };
-
-    if (hdr.ipVersion == FWP_IP_VERSION_V4)
-    {
-        localSocket  = to_string({hdr.localAddrV4, hdr.localPort});
-        remoteSocket = to_string({hdr.remoteAddrV4, hdr.remotePort});
-    }
-
-    if (hdr.ipVersion == FWP_IP_VERSION_V6)
-    {
-         localSocket = to_string({ hdr.localAddrV6, hdr.localPort });
-         remoteSocket = to_string({ hdr.remoteAddrV6, hdr.remotePort });
-    }
-
-    recordEvent();
+    // Only a fixed-size key is built and counted, or queued, here: addresses
+    // are formatted when printing and each app path is decoded once, on the
+    // aggregation thread, the first time it is seen.
+    static_cast<Aggregator*>(context)->record(*event);
 }
 
 static void
@@ -456,10 +288,12 @@ doPrint(
 {
     std::vector<std::pair<EventKey, uint64_t>> changed;
 
+    // A shard at a time, so events keep being counted into the rest.
+    for (Aggregator::Shard& shard : agg->shards)
     {
-        std::lock_guard lock(agg->mtx);
+        std::lock_guard lock(shard.mtx);
 
-        for (auto& [k, v] : agg->map)
+        for (auto& [k, v] : shard.map)
         {
             if (v.count != v.lastPrinted)
             {
@@ -483,16 +317,45 @@ doPrint(
         std::cout << "  (x" << total << ") ";
         std::cout.flush();
 
-        std::wcout << k.appName;
+        std::wcout << agg->apps.path(k.appId);
 
         std::wcout.flush();
 
         std::cout << "\n";
     }
 
+    AppPathTable::Stats apps = agg->apps.snapshot();
+    std::cout << "app paths: " << apps.entries << " interned, " << (apps.bytes / 1024) << " KiB, "
+              << (apps.lookups ? (100 * (apps.lookups - apps.misses) / apps.lookups) : 0) << "% hit rate ("
+              << apps.lookups << " lookups)\n";
+
+    if (std::uint64_t dropped = agg->ring.dropped() + agg->newApps.dropped())
+    {
+        std::cout << "events: " << dropped << " dropped with the queue full\n";
+    }
+
     std::cout.flush();
 }
 
+// Counts what the callback queued into the shards, waiting a millisecond
+// whenever the queue runs empty; on stop, drains what is left.
+static void
+RunAggregation(
+    std::stop_token st,
+    Aggregator* agg
+    )
+{
+    while (!st.stop_requested())
+    {
+        if (agg->drain() == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    agg->drain();
+}
+
 static void
 RunPrinter(
     std::stop_token st,
@@ -619,6 +482,8 @@ main(
             FWPM_NET_EVENT_ENUM_TEMPLATE0 tmpl = {};
             sub.enumTemplate = &tmpl;
 
+            std::jthread aggregationThread(RunAggregation, &aggregator);
+
             DWORD status = FwpmNetEventSubscribe4(
                 tempEngine,
                 &sub,
@@ -647,6 +512,10 @@ main(
             printerThread.join();
 
             FwpmNetEventUnsubscribe0(tempEngine, subscriptionHandle);
+
+            // Count what the callback queued before it stopped.
+            aggregationThread.request_stop();
+            aggregationThread.join();
         }
 
     }
@@ -0,0 +1,2733 @@
+﻿// local-tcp-proxy-bench.cpp
+// Loopback load generator for local-tcp-proxy (IPv4)
+//
+// Runs its own echo/sink server on 127.0.0.1:<server-port> (TCP and UDP), drives it
+// directly and, if --proxy-port is given, through a local-tcp-proxy listening
+// on 127.0.0.1:<proxy-port> that forwards to the server port. Both runs use the
+// same load and are reported side by side. With --server-unix and --proxy-unix
+// the same is repeated over AF_UNIX stream sockets, for loopback TCP against
+// Unix domain sockets on both legs.
+//
+// Usage:
+//   local-tcp-proxy-bench [options]
+//
+// Options:
+//   --server-port=<port>             echo/sink server port (default: 25600)
+//   --proxy-port=<port>              also run through the proxy on this port
+//   --server-only                    only run the echo/sink server
+//   --server-unix=<path>             also serve on an AF_UNIX socket at path
+//                                    and run directly against it
+//   --proxy-unix=<path>              also run through a proxy listening on
+//                                    this AF_UNIX path (tcp transport only)
+//   --connections=<n>                concurrent client connections (default: 16)
+//   --message-size=<bytes>           bytes per message (default: 64)
+//   --pattern=<rr|stream>            rr: send a message, wait for its echo;
+//                                    stream: send continuously into a sink
+//                                    (default: rr)
+//   --churn=<n>                      reconnect after every n messages
+//                                    (default: 0 = keep connections open)
+//   --duration=<seconds>             length of each run (default: 10)
+//   --transport=<tcp|udp>            udp: each connection is a connected UDP
+//                                    socket sending one datagram per message;
+//                                    rr waits up to 1 s for each echo, stream
+//                                    reports datagrams that reached the sink
+//                                    (default: tcp)
+//   --microbench=cidr                run an in-process benchmark instead:
+//                                    access list (CidrTrie) build, lookups
+//                                    and lookups during reloads
+//   --prefixes=<n>                   prefixes for --microbench=cidr
+//                                    (default: 100000)
+//   --scale-proxy=<exe>              scaling sweep: start <exe> --per-core=k
+//                                    on the proxy port for k = 1, 2, 4, ...
+//                                    cores, each run with k times
+//                                    --connections, and report throughput
+//                                    against one core
+//   --max-cores=<n>                  last k of the sweep (default: all
+//                                    logical CPUs)
+//   --shard-proxy=<exe>              connection-rate sweep: start <exe>
+//                                    --accept-shards=k on the proxy port for
+//                                    k = 1, 2, 4, ... up to --max-cores, run
+//                                    the same --connections through each
+//                                    with --churn (default 1 here, i.e. a
+//                                    connect per message) and report
+//                                    connects/s against one shard
+//   --blackhole-proxy=<exe>          connect-timeout test: start <exe> on the
+//                                    proxy port balancing round-robin between
+//                                    the --blackhole target and the echo
+//                                    server, open --connections clients at
+//                                    once and report how long the ones sent
+//                                    to the server waited for their echo;
+//                                    exits 0 on ok, 1 on FAIL and 2 when
+//                                    inconclusive
+//   --blackhole=<ip>:<port>          target that never answers a SYN
+//                                    (default: 192.0.2.1:25565, TEST-NET-1)
+//   --connect-timeout=<ms>           the proxy's --connect-timeout in the
+//                                    blackhole test (default: 2000)
+//   --mode-proxy=<exe>               forwarding engine comparison: start
+//                                    <exe> --forward-mode=m on the proxy port
+//                                    for m = copy, overlapped and rio, run the
+//                                    same load through each and report it
+//                                    next to the proxy's CPU time per MiB;
+//                                    with --pattern=stream each mode also
+//                                    gets a request/response pass of 64 B
+//                                    messages for its rtt percentiles
+//   --compare-proxies=<exe>,<exe>[,...]
+//                                    start each <exe> in turn on the proxy
+//                                    port with only the positional target
+//                                    arguments, run the same load through it
+//                                    and report throughput next to the
+//                                    proxy's peak thread count
+//
+// Example (compare forwarding engines: MiB/s and rtt p99 per mode):
+//   local-tcp-proxy-bench --mode-proxy=local-tcp-proxy.exe --proxy-port=25601 --pattern=stream --message-size=65536
+//
+// Kernel CPU per MiB stands in for the syscalls each engine makes per MiB:
+// Windows has no cheap syscall counter, and it is where those calls are paid
+// for. The streaming load gives MiB/s and CPU per MiB; the request/response
+// pass after it gives the p99 that matters for small game packets. This is a
+// procedure, not a result: no numbers for this tree are recorded here.
+//
+// Example (loopback TCP vs. Unix domain sockets through the proxy):
+//   local-tcp-proxy 25601 127.0.0.1 25600
+//   local-tcp-proxy unix:C:\Temp\proxy.sock unix:C:\Temp\bench.sock
+//   local-tcp-proxy-bench --proxy-port=25601 --server-unix=C:\Temp\bench.sock --proxy-unix=C:\Temp\proxy.sock
+//
+// Example (UDP packets per second):
+//   local-tcp-proxy --udp 25601 127.0.0.1 25600
+//   local-tcp-proxy-bench --proxy-port=25601 --transport=udp --pattern=stream
+//
+// Example (access list lookups with a million prefixes):
+//   local-tcp-proxy-bench --microbench=cidr --prefixes=1000000
+//
+// Example (thread-per-core scaling, 1 to 8 cores):
+//   local-tcp-proxy-bench --scale-proxy=local-tcp-proxy.exe --proxy-port=25601 --max-cores=8
+//
+// The load generator runs on the same machine, so the sweep is only
+// meaningful up to about half the logical CPUs.
+//
+// Example (reconnect storm, connects/s with 1 to 8 accept shards):
+//   local-tcp-proxy-bench --shard-proxy=local-tcp-proxy.exe --proxy-port=25601 --connections=256 --max-cores=8
+//
+// The direct run that comes first uses the same churn, so its connects/s is
+// the most the bench's own server, which accepts on one thread, can take;
+// shard counts that reach it are limited by the bench, not the proxy. The
+// sweep has not been run for this tree, so it has no connects/s to quote.
+//
+// Example (thread-per-connection baseline against the IOCP worker pool):
+//   local-tcp-proxy-bench --compare-proxies=baseline\local-tcp-proxy.exe,local-tcp-proxy.exe --proxy-port=25601 --connections=2000
+//
+// baseline\local-tcp-proxy.exe is a build of the proxy from before the
+// worker pool, which runs a thread per client plus one per direction; both
+// are started as "<exe> <proxy-port> 127.0.0.1 <server-port>", so each
+// runs its defaults. Threads are sampled every 100 ms and the peak is
+// reported with connections per thread. The bench itself also runs a thread
+// per connection, so keep the load on a machine with room for both. No
+// numbers from this comparison are recorded for this tree; quote the table
+// from a run alongside the machine and builds it came from.
+//
+// Example (a blackholed target does not hold up other clients):
+//   local-tcp-proxy-bench --blackhole-proxy=local-tcp-proxy.exe --proxy-port=25601 --connect-timeout=2000
+//
+// Half the clients land on the blackhole and are closed by the proxy once
+// their connect times out; the other half should get their echo in about
+// the time a direct run takes. A proxy that connects on its accept thread
+// makes each of them wait out the timeouts of the blackholed clients accepted
+// before it instead. TEST-NET-1 only blackholes if the machine has a default
+// route: without one the connect fails at once, and the test says so. A
+// local listener with a full backlog is no substitute on Windows, which
+// refuses such connects rather than dropping them.
+//
+// The verdict is also the exit code, so a script can gate on it: 0 when every
+// echo arrived within half the connect timeout, 1 when one did not (or none
+// reached the server, or the proxy would not start) and 2 when the target was
+// not actually blackholed here.
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+
+#include "../local-tcp-proxy/CidrTrie.hpp"
+#include "../local-tcp-proxy/CpuAffinity.hpp"
+#include "../local-tcp-proxy/Metrics.hpp"
+#include "../local-tcp-proxy/Rcu.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <Windows.h>
+#include <tlhelp32.h>
+
+#pragma comment(lib, "ws2_32.lib")
+
+// First byte a client sends: what the server does with the rest.
+constexpr char kModeEcho = 'E';
+constexpr char kModeSink = 'S';
+
+enum class Pattern
+{
+    RequestResponse,
+    Stream
+};
+
+enum class Transport
+{
+    Tcp,
+    Udp
+};
+
+enum class Microbench
+{
+    None,
+    Cidr
+};
+
+// Largest UDP payload over IPv4.
+constexpr unsigned kMaxDatagram = 65507;
+
+struct BenchConfig
+{
+    int serverPort           = 25600;
+    int proxyPort            = 0; // 0 = direct only
+    bool serverOnly          = false;
+    std::string serverUnix; // AF_UNIX path, empty = none
+    std::string proxyUnix;  // AF_UNIX path, empty = none
+    unsigned connections     = 16;
+    unsigned messageSize     = 64;
+    Pattern pattern          = Pattern::RequestResponse;
+    unsigned churn           = 0; // 0 = never reconnect
+    unsigned durationSeconds = 10;
+    Transport transport      = Transport::Tcp;
+    Microbench microbench    = Microbench::None;
+    unsigned prefixes        = 100000;
+    std::string scaleProxy; // proxy executable, empty = no sweep
+    std::string shardProxy; // proxy executable, empty = no shard sweep
+    std::string modeProxy;  // proxy executable, empty = no engine comparison
+    unsigned maxCores        = 0; // 0 = all logical CPUs
+    std::string blackholeProxy; // proxy executable, empty = no blackhole test
+    std::string blackholeTarget = "192.0.2.1:25565";
+    unsigned connectTimeoutMs   = 2000;
+    std::vector<std::string> compareProxies; // proxy executables, empty = no comparison
+};
+
+// Everything one run measures. Shared by all client threads of the run.
+struct RunResult
+{
+    std::atomic<std::uint64_t> messages {0};
+    std::atomic<std::uint64_t> bytes {0};
+    std::atomic<std::uint64_t> connects {0};
+    std::atomic<std::uint64_t> failures {0};
+    LatencyHistogram roundTrip;
+    LatencyHistogram connectLatency;
+};
+
+// Where clients connect: 127.0.0.1:<port> or an AF_UNIX path.
+struct Endpoint
+{
+    sockaddr_storage addr {};
+    int len {0};
+};
+
+static Endpoint
+loopbackEndpoint(
+    int port
+    )
+{
+    Endpoint e;
+    auto& in           = reinterpret_cast<sockaddr_in&>(e.addr);
+    in.sin_family      = AF_INET;
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    in.sin_port        = htons(static_cast<u_short>(port));
+    e.len              = sizeof(sockaddr_in);
+
+    return e;
+}
+
+// False if path does not fit in sun_path.
+static bool
+unixEndpoint(
+    const std::string& path,
+    Endpoint& e
+    )
+{
+    auto& un = reinterpret_cast<SOCKADDR_UN&>(e.addr);
+
+    if (path.empty() || (path.size() >= sizeof(un.sun_path)))
+    {
+        std::cerr << "Invalid AF_UNIX path '" << path << "' (empty or too long)\n";
+
+        return false;
+    }
+
+    e             = {};
+    un.sun_family = AF_UNIX;
+    path.copy(
+        un.sun_path,
+        path.size()
+        );
+    e.len = sizeof(SOCKADDR_UN);
+
+    return true;
+}
+
+// Bytes the sink has swallowed; the stream pattern's throughput is what
+// actually arrived, not what the clients managed to hand to their sockets.
+static std::atomic<std::uint64_t> g_sinkBytes {0};
+static std::atomic<std::uint64_t> g_sinkDatagrams {0};
+
+static int
+parsePort(
+    const char* s,
+    const char* what
+    )
+{
+    char* end  = nullptr;
+    long value = std::strtol(
+        s,
+        &end,
+        10
+        );
+
+    if ((end == s) || (*end != '\0') || (value < 1) || (value > 65535))
+    {
+        std::cerr << "Invalid " << what << " '" << s << "' (must be 1..65535)\n";
+
+        return -1;
+    }
+
+    return static_cast<int>(value);
+}
+
+static bool
+parseCount(
+    const char* s,
+    const char* what,
+    unsigned long minValue,
+    unsigned long maxValue,
+    unsigned& out
+    )
+{
+    char* end           = nullptr;
+    unsigned long value = std::strtoul(
+        s,
+        &end,
+        10
+        );
+
+    if ((end == s) || (*end != '\0') || (value < minValue) || (value > maxValue))
+    {
+        std::cerr << "Invalid " << what << " '" << s << "' (must be " << minValue << ".." << maxValue << ")\n";
+
+        return false;
+    }
+
+    out = static_cast<unsigned>(value);
+
+    return true;
+}
+
+static void
+printUsage()
+{
+    std::cout << "Usage: local-tcp-proxy-bench [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  --server-port=<port>     echo/sink server port (default: 25600)\n"
+              << "  --proxy-port=<port>      also run through the proxy on this port\n"
+              << "  --server-only            only run the echo/sink server\n"
+              << "  --server-unix=<path>     also serve and run directly over AF_UNIX\n"
+              << "  --proxy-unix=<path>      also run through a proxy listening on this AF_UNIX path\n"
+              << "  --connections=<n>        concurrent client connections (default: 16)\n"
+              << "  --message-size=<bytes>   bytes per message (default: 64)\n"
+              << "  --pattern=<rr|stream>    request/response or streaming (default: rr)\n"
+              << "  --churn=<n>              reconnect after every n messages (default: 0 = never)\n"
+              << "  --duration=<seconds>     length of each run (default: 10)\n"
+              << "  --transport=<tcp|udp>    stream sockets or datagrams (default: tcp)\n"
+              << "  --microbench=cidr        benchmark access list lookups instead\n"
+              << "  --prefixes=<n>           prefixes for --microbench=cidr (default: 100000)\n"
+              << "  --scale-proxy=<exe>      run <exe> --per-core=1, 2, 4, ... and report scaling\n"
+              << "  --max-cores=<n>          last core count of the sweep (default: all)\n"
+              << "  --shard-proxy=<exe>      run <exe> --accept-shards=1, 2, 4, ... and report connects/s\n"
+              << "  --blackhole-proxy=<exe>  show <exe> serving clients while connects to --blackhole hang\n"
+              << "  --blackhole=<ip>:<port>  target that never answers (default: 192.0.2.1:25565)\n"
+              << "  --connect-timeout=<ms>   proxy connect timeout for the blackhole test (default: 2000)\n"
+              << "  --mode-proxy=<exe>       run <exe> --forward-mode=copy, overlapped and rio and compare\n"
+              << "  --compare-proxies=<exe>,<exe>[,...]\n"
+              << "                           run the same load through each proxy and report its threads\n";
+}
+
+static bool
+parseCommandLine(
+    int argc,
+    char* argv[],
+    BenchConfig& cfg
+    )
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+
+        if (arg.starts_with("--server-port="))
+        {
+            cfg.serverPort = parsePort(
+                argv[i] + sizeof("--server-port=") - 1,
+                "server port"
+                );
+
+            if (cfg.serverPort < 0)
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--proxy-port="))
+        {
+            cfg.proxyPort = parsePort(
+                argv[i] + sizeof("--proxy-port=") - 1,
+                "proxy port"
+                );
+
+            if (cfg.proxyPort < 0)
+            {
+                return false;
+            }
+        }
+        else if (arg == "--server-only")
+        {
+            cfg.serverOnly = true;
+        }
+        else if (arg.starts_with("--server-unix="))
+        {
+            cfg.serverUnix = arg.substr(sizeof("--server-unix=") - 1);
+        }
+        else if (arg.starts_with("--proxy-unix="))
+        {
+            cfg.proxyUnix = arg.substr(sizeof("--proxy-unix=") - 1);
+        }
+        else if (arg.starts_with("--connections="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--connections=") - 1,
+                    "connection count",
+                    1,
+                    4096,
+                    cfg.connections
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--message-size="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--message-size=") - 1,
+                    "message size",
+                    1,
+                    16 * 1024 * 1024,
+                    cfg.messageSize
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--pattern="))
+        {
+            std::string value = arg.substr(sizeof("--pattern=") - 1);
+
+            if (value == "rr")
+            {
+                cfg.pattern = Pattern::RequestResponse;
+            }
+            else if (value == "stream")
+            {
+                cfg.pattern = Pattern::Stream;
+            }
+            else
+            {
+                std::cerr << "Invalid pattern '" << value << "' (must be rr or stream)\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--churn="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--churn=") - 1,
+                    "churn",
+                    0,
+                    1000000000,
+                    cfg.churn
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--duration="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--duration=") - 1,
+                    "duration",
+                    1,
+                    86400,
+                    cfg.durationSeconds
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--transport="))
+        {
+            std::string value = arg.substr(sizeof("--transport=") - 1);
+
+            if (value == "tcp")
+            {
+                cfg.transport = Transport::Tcp;
+            }
+            else if (value == "udp")
+            {
+                cfg.transport = Transport::Udp;
+            }
+            else
+            {
+                std::cerr << "Invalid transport '" << value << "' (must be tcp or udp)\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--microbench="))
+        {
+            std::string value = arg.substr(sizeof("--microbench=") - 1);
+
+            if (value == "cidr")
+            {
+                cfg.microbench = Microbench::Cidr;
+            }
+            else
+            {
+                std::cerr << "Invalid microbenchmark '" << value << "' (must be cidr)\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--prefixes="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--prefixes=") - 1,
+                    "prefix count",
+                    1,
+                    10000000,
+                    cfg.prefixes
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--scale-proxy="))
+        {
+            cfg.scaleProxy = arg.substr(sizeof("--scale-proxy=") - 1);
+
+            if (cfg.scaleProxy.empty())
+            {
+                std::cerr << "Missing proxy executable for --scale-proxy\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--shard-proxy="))
+        {
+            cfg.shardProxy = arg.substr(sizeof("--shard-proxy=") - 1);
+
+            if (cfg.shardProxy.empty())
+            {
+                std::cerr << "Missing proxy executable for --shard-proxy\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--mode-proxy="))
+        {
+            cfg.modeProxy = arg.substr(sizeof("--mode-proxy=") - 1);
+
+            if (cfg.modeProxy.empty())
+            {
+                std::cerr << "Missing proxy executable for --mode-proxy\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--max-cores="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--max-cores=") - 1,
+                    "core count",
+                    1,
+                    logicalCoreCount(),
+                    cfg.maxCores
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--blackhole-proxy="))
+        {
+            cfg.blackholeProxy = arg.substr(sizeof("--blackhole-proxy=") - 1);
+
+            if (cfg.blackholeProxy.empty())
+            {
+                std::cerr << "Missing proxy executable for --blackhole-proxy\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--blackhole="))
+        {
+            cfg.blackholeTarget = arg.substr(sizeof("--blackhole=") - 1);
+
+            if (cfg.blackholeTarget.find(':') == std::string::npos)
+            {
+                std::cerr << "Invalid blackhole target '" << cfg.blackholeTarget << "' (must be <ip>:<port>)\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--compare-proxies="))
+        {
+            std::string list = arg.substr(sizeof("--compare-proxies=") - 1);
+
+            for (std::size_t start = 0; start <= list.size();)
+            {
+                std::size_t comma = std::min(
+                    list.find(',', start),
+                    list.size()
+                    );
+
+                if (comma == start)
+                {
+                    std::cerr << "Empty proxy executable in --compare-proxies\n";
+
+                    return false;
+                }
+
+                cfg.compareProxies.push_back(list.substr(start, comma - start));
+                start = comma + 1;
+            }
+        }
+        else if (arg.starts_with("--connect-timeout="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--connect-timeout=") - 1,
+                    "connect timeout",
+                    100,
+                    60000,
+                    cfg.connectTimeoutMs
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown argument '" << arg << "'\n";
+
+            return false;
+        }
+    }
+
+    if ((cfg.transport == Transport::Udp) && (!cfg.serverUnix.empty() || !cfg.proxyUnix.empty()))
+    {
+        std::cerr << "AF_UNIX runs need --transport=tcp\n";
+
+        return false;
+    }
+
+    if (!cfg.scaleProxy.empty() && !cfg.proxyPort)
+    {
+        std::cerr << "--scale-proxy needs --proxy-port\n";
+
+        return false;
+    }
+
+    if (!cfg.shardProxy.empty())
+    {
+        if (!cfg.proxyPort || (cfg.transport == Transport::Udp))
+        {
+            std::cerr << "--shard-proxy needs --proxy-port and --transport=tcp\n";
+
+            return false;
+        }
+
+        // Connection rate is what is under test.
+        if (!cfg.churn)
+        {
+            cfg.churn = 1;
+        }
+    }
+
+    if (!cfg.modeProxy.empty() && (!cfg.proxyPort || (cfg.transport == Transport::Udp)))
+    {
+        std::cerr << "--mode-proxy needs --proxy-port and --transport=tcp\n";
+
+        return false;
+    }
+
+    if (!cfg.compareProxies.empty() && (!cfg.proxyPort || (cfg.transport == Transport::Udp)))
+    {
+        std::cerr << "--compare-proxies needs --proxy-port and --transport=tcp\n";
+
+        return false;
+    }
+
+    if (!cfg.blackholeProxy.empty() && (!cfg.proxyPort || (cfg.transport == Transport::Udp)))
+    {
+        std::cerr << "--blackhole-proxy needs --proxy-port and --transport=tcp\n";
+
+        return false;
+    }
+
+    if ((cfg.transport == Transport::Udp) && (cfg.messageSize > kMaxDatagram))
+    {
+        std::cerr << "Invalid message size " << cfg.messageSize << " for udp (must be 1.." << kMaxDatagram << ")\n";
+
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+sendAll(
+    SOCKET s,
+    const char* data,
+    std::size_t size
+    )
+{
+    while (size > 0)
+    {
+        int n = send(
+            s,
+            data,
+            static_cast<int>(size),
+            0
+            );
+
+        if (n == SOCKET_ERROR)
+        {
+            return false;
+        }
+
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+
+    return true;
+}
+
+static bool
+recvAll(
+    SOCKET s,
+    char* data,
+    std::size_t size
+    )
+{
+    while (size > 0)
+    {
+        int n = recv(
+            s,
+            data,
+            static_cast<int>(size),
+            0
+            );
+
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+
+    return true;
+}
+
+static void
+setNoDelay(
+    SOCKET s
+    )
+{
+    BOOL on = TRUE;
+    setsockopt(
+        s,
+        IPPROTO_TCP,
+        TCP_NODELAY,
+        reinterpret_cast<const char*>(&on),
+        sizeof(on)
+        );
+}
+
+// Serve one client: echo everything back, or count and discard it.
+static void
+serveConnection(
+    SOCKET s
+    )
+{
+    setNoDelay(s);
+
+    char mode = 0;
+    std::vector<char> buffer(64 * 1024);
+
+    if (
+        recvAll(
+            s,
+            &mode,
+            1
+            )
+        )
+    {
+        while (true)
+        {
+            int n = recv(
+                s,
+                buffer.data(),
+                static_cast<int>(buffer.size()),
+                0
+                );
+
+            if (n <= 0)
+            {
+                break;
+            }
+
+            if (mode == kModeSink)
+            {
+                g_sinkBytes.fetch_add(
+                    static_cast<std::uint64_t>(n),
+                    std::memory_order_relaxed
+                    );
+            }
+            else if (
+                !sendAll(
+                    s,
+                    buffer.data(),
+                    static_cast<std::size_t>(n)
+                    )
+                )
+            {
+                break;
+            }
+        }
+    }
+
+    closesocket(s);
+}
+
+static void
+runServer(
+    SOCKET listener
+    )
+{
+    while (true)
+    {
+        SOCKET client = accept(
+            listener,
+            nullptr,
+            nullptr
+            );
+
+        if (client == INVALID_SOCKET)
+        {
+            int err = WSAGetLastError();
+
+            // The listener was closed: shutting down.
+            if ((err == WSAENOTSOCK) || (err == WSAEINTR))
+            {
+                return;
+            }
+
+            std::cerr << "accept() failed on bench server (WSAGetLastError = " << err << ")\n";
+            continue;
+        }
+
+        // One thread per connection keeps the server trivially correct; it is
+        // the proxy that is under test.
+        std::thread(
+            serveConnection,
+            client
+            ).detach();
+    }
+}
+
+static SOCKET
+openServer(
+    int port
+    )
+{
+    SOCKET s = socket(
+        AF_INET,
+        SOCK_STREAM,
+        IPPROTO_TCP
+        );
+
+    if (s == INVALID_SOCKET)
+    {
+        std::cerr << "socket() failed for bench server (WSAGetLastError = " << WSAGetLastError() << ")\n";
+
+        return INVALID_SOCKET;
+    }
+
+    sockaddr_in addr {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(static_cast<u_short>(port));
+
+    if (
+        bind(
+            s,
+            (sockaddr*) &addr,
+            sizeof(addr)
+            ) == SOCKET_ERROR
+        )
+    {
+        std::cerr << "bind() failed for bench server on port " << port << " (WSAGetLastError = " << WSAGetLastError() << ")\n";
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    if (
+        listen(
+            s,
+            SOMAXCONN
+            ) == SOCKET_ERROR
+        )
+    {
+        std::cerr << "listen() failed for bench server (WSAGetLastError = " << WSAGetLastError() << ")\n";
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    return s;
+}
+
+// The echo/sink server on an AF_UNIX path, replacing a socket file left by an
+// earlier run.
+static SOCKET
+openUnixServer(
+    const std::string& path
+    )
+{
+    Endpoint e;
+
+    if (
+        !unixEndpoint(
+            path,
+            e
+            )
+        )
+    {
+        return INVALID_SOCKET;
+    }
+
+    SOCKET s = socket(
+        AF_UNIX,
+        SOCK_STREAM,
+        0
+        );
+
+    if (s == INVALID_SOCKET)
+    {
+        std::cerr << "socket(AF_UNIX) failed for bench server (WSAGetLastError = " << WSAGetLastError() << ")\n";
+
+        return INVALID_SOCKET;
+    }
+
+    DeleteFileA(path.c_str());
+
+    if (
+        bind(
+            s,
+            (sockaddr*) &e.addr,
+            e.len
+            ) == SOCKET_ERROR
+        )
+    {
+        std::cerr << "bind() failed for bench server on " << path << " (WSAGetLastError = " << WSAGetLastError() << ")\n";
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    if (
+        listen(
+            s,
+            SOMAXCONN
+            ) == SOCKET_ERROR
+        )
+    {
+        std::cerr << "listen() failed for bench server (WSAGetLastError = " << WSAGetLastError() << ")\n";
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    return s;
+}
+
+// Datagram counterpart of runServer(): the first byte of every datagram picks
+// echo or sink, so one socket serves every client.
+static void
+runUdpServer(
+    SOCKET s
+    )
+{
+    std::vector<char> buffer(kMaxDatagram);
+
+    while (true)
+    {
+        sockaddr_in peer {};
+        int peerLen = sizeof(peer);
+        int n       = recvfrom(
+            s,
+            buffer.data(),
+            static_cast<int>(buffer.size()),
+            0,
+            (sockaddr*) &peer,
+            &peerLen
+            );
+
+        if (n == SOCKET_ERROR)
+        {
+            int err = WSAGetLastError();
+
+            // The socket was closed: shutting down.
+            if ((err == WSAENOTSOCK) || (err == WSAEINTR))
+            {
+                return;
+            }
+
+            // ICMP errors for clients that went away, oversized datagrams.
+            continue;
+        }
+
+        if (n < 1)
+        {
+            continue;
+        }
+
+        if (buffer[0] == kModeSink)
+        {
+            g_sinkBytes.fetch_add(
+                static_cast<std::uint64_t>(n),
+                std::memory_order_relaxed
+                );
+            g_sinkDatagrams.fetch_add(
+                1,
+                std::memory_order_relaxed
+                );
+        }
+        else
+        {
+            sendto(
+                s,
+                buffer.data(),
+                n,
+                0,
+                (sockaddr*) &peer,
+                peerLen
+                );
+        }
+    }
+}
+
+static SOCKET
+openUdpServer(
+    int port
+    )
+{
+    SOCKET s = socket(
+        AF_INET,
+        SOCK_DGRAM,
+        IPPROTO_UDP
+        );
+
+    if (s == INVALID_SOCKET)
+    {
+        std::cerr << "socket() failed for bench UDP server (WSAGetLastError = " << WSAGetLastError() << ")\n";
+
+        return INVALID_SOCKET;
+    }
+
+    // Streaming clients outrun a single server thread in bursts.
+    int rcvbuf = 8 * 1024 * 1024;
+    setsockopt(
+        s,
+        SOL_SOCKET,
+        SO_RCVBUF,
+        reinterpret_cast<const char*>(&rcvbuf),
+        sizeof(rcvbuf)
+        );
+
+    sockaddr_in addr {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(static_cast<u_short>(port));
+
+    if (
+        bind(
+            s,
+            (sockaddr*) &addr,
+            sizeof(addr)
+            ) == SOCKET_ERROR
+        )
+    {
+        std::cerr << "bind() failed for bench UDP server on port " << port << " (WSAGetLastError = " << WSAGetLastError() << ")\n";
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    return s;
+}
+
+static std::chrono::microseconds
+elapsedSince(
+    std::chrono::steady_clock::time_point start
+    )
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+}
+
+// Connect and announce the server mode. Returns INVALID_SOCKET on failure.
+static SOCKET
+openClient(
+    const Endpoint& endpoint,
+    char mode,
+    RunResult& result
+    )
+{
+    SOCKET s = socket(
+        endpoint.addr.ss_family,
+        SOCK_STREAM,
+        0
+        );
+
+    if (s == INVALID_SOCKET)
+    {
+        result.failures.fetch_add(1);
+
+        return INVALID_SOCKET;
+    }
+
+    if (endpoint.addr.ss_family == AF_INET)
+    {
+        setNoDelay(s);
+    }
+
+    auto started = std::chrono::steady_clock::now();
+
+    if (
+        (connect(
+            s,
+            (const sockaddr*) &endpoint.addr,
+            endpoint.len
+            ) == SOCKET_ERROR) || !sendAll(
+            s,
+            &mode,
+            1
+            )
+        )
+    {
+        result.failures.fetch_add(1);
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    result.connectLatency.record(elapsedSince(started));
+    result.connects.fetch_add(
+        1,
+        std::memory_order_relaxed
+        );
+
+    return s;
+}
+
+// One client connection's worth of load, reconnecting every cfg.churn
+// messages, until deadline.
+static void
+runClient(
+    const Endpoint& endpoint,
+    const BenchConfig& cfg,
+    RunResult& result,
+    std::chrono::steady_clock::time_point deadline
+    )
+{
+    std::vector<char> message(cfg.messageSize, 'x');
+    std::vector<char> reply(cfg.messageSize);
+    bool rr  = (cfg.pattern == Pattern::RequestResponse);
+    SOCKET s = INVALID_SOCKET;
+    unsigned sentOnConnection = 0;
+
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        if (s == INVALID_SOCKET)
+        {
+            s = openClient(
+                endpoint,
+                rr ? kModeEcho : kModeSink,
+                result
+                );
+            sentOnConnection = 0;
+
+            if (s == INVALID_SOCKET)
+            {
+                // Do not spin on a dead target.
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        bool ok      = sendAll(
+            s,
+            message.data(),
+            message.size()
+            );
+
+        if (ok && rr)
+        {
+            ok = recvAll(
+                s,
+                reply.data(),
+                reply.size()
+                );
+        }
+
+        if (!ok)
+        {
+            result.failures.fetch_add(1);
+            closesocket(s);
+            s = INVALID_SOCKET;
+            continue;
+        }
+
+        if (rr)
+        {
+            result.roundTrip.record(elapsedSince(started));
+        }
+
+        result.messages.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+        result.bytes.fetch_add(
+            message.size(),
+            std::memory_order_relaxed
+            );
+
+        if (cfg.churn && (++sentOnConnection >= cfg.churn))
+        {
+            closesocket(s);
+            s = INVALID_SOCKET;
+        }
+    }
+
+    if (s != INVALID_SOCKET)
+    {
+        closesocket(s);
+    }
+}
+
+// A connected UDP socket towards endpoint. Returns INVALID_SOCKET on failure.
+static SOCKET
+openUdpClient(
+    const Endpoint& endpoint,
+    RunResult& result
+    )
+{
+    SOCKET s = socket(
+        AF_INET,
+        SOCK_DGRAM,
+        IPPROTO_UDP
+        );
+
+    if (s == INVALID_SOCKET)
+    {
+        result.failures.fetch_add(1);
+
+        return INVALID_SOCKET;
+    }
+
+    // A lost datagram must not stall a request/response client forever.
+    DWORD timeoutMs = 1000;
+    setsockopt(
+        s,
+        SOL_SOCKET,
+        SO_RCVTIMEO,
+        reinterpret_cast<const char*>(&timeoutMs),
+        sizeof(timeoutMs)
+        );
+
+    if (
+        connect(
+            s,
+            (const sockaddr*) &endpoint.addr,
+            endpoint.len
+            ) == SOCKET_ERROR
+        )
+    {
+        result.failures.fetch_add(1);
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    result.connects.fetch_add(
+        1,
+        std::memory_order_relaxed
+        );
+
+    return s;
+}
+
+// runClient() over UDP: one datagram per message. Churn opens a fresh socket,
+// i.e. a new source port and so a new session on the proxy.
+static void
+runUdpClient(
+    const Endpoint& endpoint,
+    const BenchConfig& cfg,
+    RunResult& result,
+    std::chrono::steady_clock::time_point deadline
+    )
+{
+    bool rr = (cfg.pattern == Pattern::RequestResponse);
+    std::vector<char> message(cfg.messageSize, 'x');
+    std::vector<char> reply(kMaxDatagram);
+    message[0] = rr ? kModeEcho : kModeSink;
+    SOCKET s   = INVALID_SOCKET;
+    unsigned sentOnSocket = 0;
+
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        if (s == INVALID_SOCKET)
+        {
+            s = openUdpClient(
+                endpoint,
+                result
+                );
+            sentOnSocket = 0;
+
+            if (s == INVALID_SOCKET)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                continue;
+            }
+        }
+
+        auto started = std::chrono::steady_clock::now();
+
+        if (
+            send(
+                s,
+                message.data(),
+                static_cast<int>(message.size()),
+                0
+                ) == SOCKET_ERROR
+            )
+        {
+            result.failures.fetch_add(1);
+            closesocket(s);
+            s = INVALID_SOCKET;
+            continue;
+        }
+
+        if (rr)
+        {
+            // Timeout or ICMP error: the datagram or its echo was lost.
+            if (
+                recv(
+                    s,
+                    reply.data(),
+                    static_cast<int>(reply.size()),
+                    0
+                    ) == SOCKET_ERROR
+                )
+            {
+                result.failures.fetch_add(1);
+                continue;
+            }
+
+            result.roundTrip.record(elapsedSince(started));
+        }
+
+        result.messages.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+        result.bytes.fetch_add(
+            message.size(),
+            std::memory_order_relaxed
+            );
+
+        if (cfg.churn && (++sentOnSocket >= cfg.churn))
+        {
+            closesocket(s);
+            s = INVALID_SOCKET;
+        }
+    }
+
+    if (s != INVALID_SOCKET)
+    {
+        closesocket(s);
+    }
+}
+
+struct RunSummary
+{
+    std::string label;
+    double messagesPerSec;
+    double megabytesPerSec;
+    double connectsPerSec;
+    std::uint64_t failures;
+    LatencyHistogram::Snapshot roundTrip;
+    LatencyHistogram::Snapshot connectLatency;
+};
+
+static RunSummary
+runLoad(
+    const char* label,
+    const Endpoint& endpoint,
+    const BenchConfig& cfg
+    )
+{
+    RunResult result;
+    bool udp                          = (cfg.transport == Transport::Udp);
+    std::uint64_t sinkBefore          = g_sinkBytes.load();
+    std::uint64_t sinkDatagramsBefore = g_sinkDatagrams.load();
+    auto started             = std::chrono::steady_clock::now();
+    auto deadline            = started + std::chrono::seconds(cfg.durationSeconds);
+
+    {
+        std::vector<std::jthread> clients;
+        clients.reserve(cfg.connections);
+
+        for (unsigned i = 0; i < cfg.connections; ++i)
+        {
+            clients.emplace_back(
+                udp ? runUdpClient : runClient,
+                std::cref(endpoint),
+                std::cref(cfg),
+                std::ref(result),
+                deadline
+                );
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    // Give the sink a moment to swallow what is still in flight.
+    if (cfg.pattern == Pattern::Stream)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    std::uint64_t bytes = (cfg.pattern == Pattern::Stream) ? g_sinkBytes.load() - sinkBefore : 2 * result.bytes.load();
+
+    std::uint64_t messages = result.messages.load();
+    std::uint64_t failures = result.failures.load();
+
+    // Streamed datagrams count when they arrive; the rest were lost.
+    if (udp && (cfg.pattern == Pattern::Stream))
+    {
+        std::uint64_t delivered = g_sinkDatagrams.load() - sinkDatagramsBefore;
+        failures               += (messages > delivered) ? messages - delivered : 0;
+        messages                = delivered;
+    }
+
+    RunSummary s;
+    s.label           = label;
+    s.messagesPerSec  = static_cast<double>(messages) / seconds;
+    s.megabytesPerSec = static_cast<double>(bytes) / seconds / (1024.0 * 1024.0);
+    s.connectsPerSec  = static_cast<double>(result.connects.load()) / seconds;
+    s.failures        = failures;
+    s.roundTrip       = result.roundTrip.snapshot();
+    s.connectLatency  = result.connectLatency.snapshot();
+
+    return s;
+}
+
+static void
+printSummaries(
+    const BenchConfig& cfg,
+    const std::vector<RunSummary>& runs
+    )
+{
+    std::cout << "\n"
+              << cfg.connections << ((cfg.transport == Transport::Udp) ? " UDP sockets, " : " connections, ")
+              << cfg.messageSize << " B messages, "
+              << ((cfg.pattern == Pattern::RequestResponse) ? "request/response" : "streaming")
+              << ", churn " << cfg.churn << ", " << cfg.durationSeconds << " s per run\n\n";
+
+    std::cout << std::left << std::setw(10) << "path" << std::right
+              << std::setw(12) << "msg/s"
+              << std::setw(10) << "MiB/s"
+              << std::setw(12) << "connects/s"
+              << std::setw(10) << "rtt p50"
+              << std::setw(10) << "p99"
+              << std::setw(10) << "p999"
+              << std::setw(12) << "connect p99"
+              << std::setw(10) << "failures" << "\n";
+
+    for (const RunSummary& r : runs)
+    {
+        std::cout << std::left << std::setw(10) << r.label << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << r.messagesPerSec
+                  << std::setw(10) << r.megabytesPerSec
+                  << std::setw(12) << r.connectsPerSec
+                  << std::setw(10) << r.roundTrip.percentile(0.50)
+                  << std::setw(10) << r.roundTrip.percentile(0.99)
+                  << std::setw(10) << r.roundTrip.percentile(0.999)
+                  << std::setw(12) << r.connectLatency.percentile(0.99)
+                  << std::setw(10) << r.failures << "\n";
+    }
+
+    std::cout << "(latencies in us)\n";
+}
+
+// Start the proxy under test, exe, with args. Its output goes nowhere.
+// Returns null on failure.
+static HANDLE
+startProxy(
+    const std::string& exe,
+    const std::string& args
+    )
+{
+    SECURITY_ATTRIBUTES inherit {};
+    inherit.nLength        = sizeof(inherit);
+    inherit.bInheritHandle = TRUE;
+
+    HANDLE nul = CreateFileA(
+        "NUL",
+        GENERIC_WRITE,
+        FILE_SHARE_WRITE,
+        &inherit,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr
+        );
+
+    std::string command = "\"" + exe + "\" " + args;
+
+    STARTUPINFOA si {};
+    si.cb         = sizeof(si);
+    si.dwFlags    = STARTF_USESTDHANDLES;
+    si.hStdInput  = nul;
+    si.hStdOutput = nul;
+    si.hStdError  = nul;
+
+    PROCESS_INFORMATION pi {};
+    BOOL started = CreateProcessA(
+        nullptr,
+        command.data(),
+        nullptr,
+        nullptr,
+        TRUE,
+        CREATE_NO_WINDOW,
+        nullptr,
+        nullptr,
+        &si,
+        &pi
+        );
+
+    if (nul != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(nul);
+    }
+
+    if (!started)
+    {
+        std::cerr << "CreateProcess(" << command << ") failed (GetLastError = " << GetLastError() << ")\n";
+
+        return nullptr;
+    }
+
+    CloseHandle(pi.hThread);
+
+    return pi.hProcess;
+}
+
+// Wait up to five seconds for something to accept on 127.0.0.1:port.
+static bool
+waitForListener(
+    int port
+    )
+{
+    sockaddr_in addr {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(static_cast<u_short>(port));
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        SOCKET s = socket(
+            AF_INET,
+            SOCK_STREAM,
+            IPPROTO_TCP
+            );
+
+        if (s == INVALID_SOCKET)
+        {
+            return false;
+        }
+
+        int rc = connect(
+            s,
+            (sockaddr*) &addr,
+            sizeof(addr)
+            );
+        closesocket(s);
+
+        if (rc == 0)
+        {
+            return true;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    return false;
+}
+
+// Start exe with args and wait until it listens on the proxy port. Returns
+// null, having said why, if it does not.
+static HANDLE
+launchProxy(
+    const BenchConfig& cfg,
+    const std::string& exe,
+    const std::string& args
+    )
+{
+    HANDLE proxy = startProxy(
+        exe,
+        args
+        );
+
+    if (proxy && !waitForListener(cfg.proxyPort))
+    {
+        std::cerr << exe << " " << args << " did not start listening on port " << cfg.proxyPort << "\n";
+        TerminateProcess(
+            proxy,
+            1
+            );
+        CloseHandle(proxy);
+        proxy = nullptr;
+    }
+
+    return proxy;
+}
+
+static void
+stopProxy(
+    HANDLE proxy
+    )
+{
+    TerminateProcess(
+        proxy,
+        0
+        );
+    WaitForSingleObject(
+        proxy,
+        INFINITE
+        );
+    CloseHandle(proxy);
+}
+
+// 1, 2, 4, ... up to cfg.maxCores or all logical CPUs, which always ends it.
+static std::vector<unsigned>
+sweepSteps(
+    const BenchConfig& cfg
+    )
+{
+    unsigned maxCores = cfg.maxCores ? cfg.maxCores : logicalCoreCount();
+    std::vector<unsigned> steps;
+
+    for (unsigned k = 1; k < maxCores; k *= 2)
+    {
+        steps.push_back(k);
+    }
+
+    steps.push_back(maxCores);
+
+    return steps;
+}
+
+// Throughput of the proxy's thread-per-core mode from one core up, with the
+// offered load growing along with the cores so each core sees the same share.
+static void
+runScaling(
+    const BenchConfig& cfg
+    )
+{
+    std::vector<std::pair<unsigned, RunSummary>> runs;
+
+    for (unsigned cores : sweepSteps(cfg))
+    {
+        HANDLE proxy = launchProxy(
+            cfg,
+            cfg.scaleProxy,
+            "--per-core=" + std::to_string(cores) + " " + std::to_string(cfg.proxyPort) + " 127.0.0.1 "
+                + std::to_string(cfg.serverPort)
+            );
+
+        if (!proxy)
+        {
+            break;
+        }
+
+        BenchConfig step = cfg;
+        step.connections = cfg.connections * cores;
+
+        std::cout << "running through proxy on " << cores << " core(s), " << step.connections << " connections...\n";
+        runs.emplace_back(
+            cores,
+            runLoad(
+                "proxy",
+                loopbackEndpoint(cfg.proxyPort),
+                step
+                )
+            );
+
+        stopProxy(proxy);
+    }
+
+    if (runs.empty())
+    {
+        return;
+    }
+
+    std::cout << "\nthread-per-core scaling, " << cfg.connections << " connections per core, "
+              << cfg.messageSize << " B messages, "
+              << ((cfg.pattern == Pattern::RequestResponse) ? "request/response" : "streaming")
+              << ", " << cfg.durationSeconds << " s per run\n\n";
+
+    std::cout << std::right << std::setw(6) << "cores"
+              << std::setw(12) << "msg/s"
+              << std::setw(10) << "MiB/s"
+              << std::setw(10) << "rtt p99"
+              << std::setw(10) << "speedup"
+              << std::setw(12) << "efficiency"
+              << std::setw(10) << "failures" << "\n";
+
+    double base = runs.front().second.messagesPerSec;
+
+    for (const auto& [cores, r] : runs)
+    {
+        double speedup = base ? r.messagesPerSec / base : 0.0;
+
+        std::cout << std::setw(6) << cores << std::fixed << std::setprecision(1)
+                  << std::setw(12) << r.messagesPerSec
+                  << std::setw(10) << r.megabytesPerSec
+                  << std::setw(10) << r.roundTrip.percentile(0.99)
+                  << std::setw(9) << speedup << "x"
+                  << std::setw(11) << (100.0 * speedup / cores) << "%"
+                  << std::setw(10) << r.failures << "\n";
+    }
+
+    std::cout << "(latencies in us; efficiency = speedup / cores)\n";
+}
+
+// Connects/s through the proxy from one accept shard up, with the same
+// connections reconnecting every cfg.churn messages at every step.
+static void
+runShardSweep(
+    const BenchConfig& cfg
+    )
+{
+    std::vector<std::pair<unsigned, RunSummary>> runs;
+
+    for (unsigned shards : sweepSteps(cfg))
+    {
+        HANDLE proxy = launchProxy(
+            cfg,
+            cfg.shardProxy,
+            "--accept-shards=" + std::to_string(shards) + " " + std::to_string(cfg.proxyPort) + " 127.0.0.1 "
+                + std::to_string(cfg.serverPort)
+            );
+
+        if (!proxy)
+        {
+            break;
+        }
+
+        std::cout << "running through proxy with " << shards << " accept shard(s)...\n";
+        runs.emplace_back(
+            shards,
+            runLoad(
+                "proxy",
+                loopbackEndpoint(cfg.proxyPort),
+                cfg
+                )
+            );
+
+        stopProxy(proxy);
+    }
+
+    if (runs.empty())
+    {
+        return;
+    }
+
+    std::cout << "\naccept shard sweep, " << cfg.connections << " connections reconnecting every "
+              << cfg.churn << " message(s), " << cfg.messageSize << " B messages, "
+              << cfg.durationSeconds << " s per run\n\n";
+
+    std::cout << std::right << std::setw(7) << "shards"
+              << std::setw(12) << "connects/s"
+              << std::setw(12) << "connect p50"
+              << std::setw(12) << "connect p99"
+              << std::setw(10) << "speedup"
+              << std::setw(10) << "failures" << "\n";
+
+    double base = runs.front().second.connectsPerSec;
+
+    for (const auto& [shards, r] : runs)
+    {
+        std::cout << std::setw(7) << shards << std::fixed << std::setprecision(1)
+                  << std::setw(12) << r.connectsPerSec
+                  << std::setw(12) << r.connectLatency.percentile(0.50)
+                  << std::setw(12) << r.connectLatency.percentile(0.99)
+                  << std::setw(9) << (base ? r.connectsPerSec / base : 0.0) << "x"
+                  << std::setw(10) << r.failures << "\n";
+    }
+
+    std::cout << "(latencies in us, from connect() to the first byte sent; compare with the direct run below)\n";
+}
+
+// Threads the process pid has right now, 0 if they cannot be listed.
+static unsigned
+threadCount(
+    DWORD pid
+    )
+{
+    HANDLE snapshot = CreateToolhelp32Snapshot(
+        TH32CS_SNAPTHREAD,
+        0
+        );
+
+    if (snapshot == INVALID_HANDLE_VALUE)
+    {
+        return 0;
+    }
+
+    THREADENTRY32 entry {};
+    entry.dwSize = sizeof(entry);
+    unsigned n   = 0;
+
+    for (
+        BOOL more = Thread32First(
+            snapshot,
+            &entry
+            ); more; more = Thread32Next(
+            snapshot,
+            &entry
+            )
+        )
+    {
+        n += (entry.th32OwnerProcessID == pid) ? 1 : 0;
+    }
+
+    CloseHandle(snapshot);
+
+    return n;
+}
+
+// The same load through each of cfg.compareProxies, e.g. the
+// thread-per-connection baseline and the worker pool, with the most threads
+// each proxy ran at once.
+static void
+runComparison(
+    const BenchConfig& cfg
+    )
+{
+    std::vector<std::pair<unsigned, RunSummary>> runs;
+
+    for (const std::string& exe : cfg.compareProxies)
+    {
+        HANDLE proxy = launchProxy(
+            cfg,
+            exe,
+            std::to_string(cfg.proxyPort) + " 127.0.0.1 " + std::to_string(cfg.serverPort)
+            );
+
+        if (!proxy)
+        {
+            break;
+        }
+
+        std::cout << "running through " << exe << "...\n";
+
+        std::atomic<unsigned> peakThreads {0};
+        DWORD pid = GetProcessId(proxy);
+
+        std::jthread sampler(
+            [&] (std::stop_token stop)
+            {
+                while (!stop.stop_requested())
+                {
+                    peakThreads.store(std::max(
+                        peakThreads.load(),
+                        threadCount(pid)
+                        ));
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+            }
+            );
+
+        RunSummary r = runLoad(
+            exe.c_str(),
+            loopbackEndpoint(cfg.proxyPort),
+            cfg
+            );
+
+        sampler.request_stop();
+        sampler.join();
+        stopProxy(proxy);
+
+        runs.emplace_back(
+            peakThreads.load(),
+            std::move(r)
+            );
+    }
+
+    if (runs.empty())
+    {
+        return;
+    }
+
+    std::cout << "\nproxy comparison, " << cfg.connections << " connections, "
+              << cfg.messageSize << " B messages, "
+              << ((cfg.pattern == Pattern::RequestResponse) ? "request/response" : "streaming")
+              << ", churn " << cfg.churn << ", " << cfg.durationSeconds << " s per run\n\n";
+
+    std::cout << std::right << std::setw(12) << "msg/s"
+              << std::setw(10) << "MiB/s"
+              << std::setw(10) << "rtt p99"
+              << std::setw(10) << "threads"
+              << std::setw(13) << "conn/thread"
+              << std::setw(10) << "failures" << "  proxy\n";
+
+    for (const auto& [threads, r] : runs)
+    {
+        std::cout << std::fixed << std::setprecision(1)
+                  << std::setw(12) << r.messagesPerSec
+                  << std::setw(10) << r.megabytesPerSec
+                  << std::setw(10) << r.roundTrip.percentile(0.99)
+                  << std::setw(10) << threads
+                  << std::setw(13) << (threads ? static_cast<double>(cfg.connections) / threads : 0.0)
+                  << std::setw(10) << r.failures << "  " << r.label << "\n";
+    }
+
+    std::cout << "(latencies in us; threads = most seen in the proxy at once, sampled every 100 ms)\n";
+}
+
+// User and kernel CPU the process has used so far, in ms.
+static std::pair<double, double>
+processCpuMs(
+    HANDLE process
+    )
+{
+    FILETIME created {};
+    FILETIME exited {};
+    FILETIME kernel {};
+    FILETIME user {};
+
+    if (
+        !GetProcessTimes(
+            process,
+            &created,
+            &exited,
+            &kernel,
+            &user
+            )
+        )
+    {
+        return {0.0, 0.0};
+    }
+
+    // FILETIME counts 100 ns ticks.
+    auto toMs = [] (const FILETIME& t)
+        {
+            return static_cast<double>((std::uint64_t {t.dwHighDateTime} << 32) | t.dwLowDateTime) / 10000.0;
+        };
+
+    return {toMs(user), toMs(kernel)};
+}
+
+// The same load through the proxy in each forwarding mode, with the CPU the
+// proxy spent per MiB forwarded. A streaming load measures no round trips,
+// so each mode then also runs request/response for its latencies.
+static void
+runModeComparison(
+    const BenchConfig& cfg
+    )
+{
+    struct ModeRun
+    {
+        RunSummary load;
+        LatencyHistogram::Snapshot roundTrip;
+        double userMsPerMiB;
+        double kernelMsPerMiB;
+    };
+
+    bool streaming = (cfg.pattern == Pattern::Stream);
+
+    BenchConfig rrCfg = cfg;
+    rrCfg.pattern     = Pattern::RequestResponse;
+    rrCfg.messageSize = 64;
+    rrCfg.churn       = 0;
+
+    std::vector<ModeRun> runs;
+
+    for (const char* mode : {"copy", "overlapped", "rio"})
+    {
+        HANDLE proxy = launchProxy(
+            cfg,
+            cfg.modeProxy,
+            std::string("--forward-mode=") + mode + " " + std::to_string(cfg.proxyPort) + " 127.0.0.1 "
+                + std::to_string(cfg.serverPort)
+            );
+
+        if (!proxy)
+        {
+            break;
+        }
+
+        std::cout << "running through proxy with --forward-mode=" << mode << "...\n";
+
+        auto [userBefore, kernelBefore] = processCpuMs(proxy);
+        RunSummary r = runLoad(
+            mode,
+            loopbackEndpoint(cfg.proxyPort),
+            cfg
+            );
+        auto [userAfter, kernelAfter] = processCpuMs(proxy);
+
+        LatencyHistogram::Snapshot roundTrip = r.roundTrip;
+
+        if (streaming)
+        {
+            std::cout << "running request/response through proxy with --forward-mode=" << mode << "...\n";
+            roundTrip = runLoad(
+                mode,
+                loopbackEndpoint(cfg.proxyPort),
+                rrCfg
+                ).roundTrip;
+        }
+
+        stopProxy(proxy);
+
+        double mib = r.megabytesPerSec * cfg.durationSeconds;
+
+        runs.push_back(
+            {r,
+             roundTrip,
+             mib ? (userAfter - userBefore) / mib : 0.0,
+             mib ? (kernelAfter - kernelBefore) / mib : 0.0}
+            );
+    }
+
+    if (runs.empty())
+    {
+        return;
+    }
+
+    std::cout << "\nforwarding modes, " << cfg.connections << " connections, "
+              << cfg.messageSize << " B messages, "
+              << ((cfg.pattern == Pattern::RequestResponse) ? "request/response" : "streaming")
+              << ", churn " << cfg.churn << ", " << cfg.durationSeconds << " s per run\n\n";
+
+    std::cout << std::left << std::setw(12) << "mode" << std::right
+              << std::setw(12) << "msg/s"
+              << std::setw(10) << "MiB/s"
+              << std::setw(10) << "vs copy"
+              << std::setw(10) << "rtt p50"
+              << std::setw(10) << "p99"
+              << std::setw(10) << "p999"
+              << std::setw(14) << "user ms/MiB"
+              << std::setw(16) << "kernel ms/MiB"
+              << std::setw(10) << "failures" << "\n";
+
+    double base = runs.front().load.megabytesPerSec;
+
+    for (const ModeRun& m : runs)
+    {
+        const RunSummary& r = m.load;
+
+        std::cout << std::left << std::setw(12) << r.label << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(12) << r.messagesPerSec
+                  << std::setw(10) << r.megabytesPerSec
+                  << std::setw(9) << (base ? r.megabytesPerSec / base : 0.0) << "x"
+                  << std::setw(10) << m.roundTrip.percentile(0.50)
+                  << std::setw(10) << m.roundTrip.percentile(0.99)
+                  << std::setw(10) << m.roundTrip.percentile(0.999)
+                  << std::setprecision(3)
+                  << std::setw(14) << m.userMsPerMiB
+                  << std::setw(16) << m.kernelMsPerMiB
+                  << std::setw(10) << r.failures << "\n";
+    }
+
+    std::cout << "(latencies in us";
+
+    if (streaming)
+    {
+        std::cout << ", from the 64 B request/response pass";
+    }
+
+    std::cout << "; ms/MiB = proxy CPU time per MiB it forwarded)\n";
+}
+
+// What one client of the blackhole test saw: its echo, or the proxy closing
+// it, after elapsed.
+struct BlackholeProbe
+{
+    bool echoed {false};
+    std::chrono::microseconds elapsed {0};
+};
+
+// Connect through the proxy and wait at most wait for one echoed request.
+static BlackholeProbe
+probeThroughProxy(
+    const Endpoint& endpoint,
+    std::chrono::milliseconds wait
+    )
+{
+    BlackholeProbe probe;
+    RunResult unused;
+    auto started = std::chrono::steady_clock::now();
+    SOCKET s     = openClient(
+        endpoint,
+        kModeEcho,
+        unused
+        );
+
+    if (s != INVALID_SOCKET)
+    {
+        DWORD timeoutMs = static_cast<DWORD>(wait.count());
+        setsockopt(
+            s,
+            SOL_SOCKET,
+            SO_RCVTIMEO,
+            reinterpret_cast<const char*>(&timeoutMs),
+            sizeof(timeoutMs)
+            );
+
+        char message[64] {};
+        char reply[sizeof(message)];
+        probe.echoed = sendAll(
+            s,
+            message,
+            sizeof(message)
+            ) && recvAll(
+            s,
+            reply,
+            sizeof(reply)
+            );
+        closesocket(s);
+    }
+
+    probe.elapsed = elapsedSince(started);
+
+    return probe;
+}
+
+// Clients through one proxy listener whose backends alternate between a
+// target that never answers and the echo server: those sent to the server
+// must not wait for the connects to the other to time out. Returns the exit
+// code for the verdict.
+static int
+runBlackhole(
+    const BenchConfig& cfg
+    )
+{
+    HANDLE proxy = launchProxy(
+        cfg,
+        cfg.blackholeProxy,
+        "--connect-timeout=" + std::to_string(cfg.connectTimeoutMs) + " --backend=" + cfg.blackholeTarget
+            + " --backend=127.0.0.1:" + std::to_string(cfg.serverPort) + " " + std::to_string(cfg.proxyPort)
+        );
+
+    if (!proxy)
+    {
+        return 1;
+    }
+
+    std::cout << "running " << cfg.connections << " clients through the proxy, half of them to "
+              << cfg.blackholeTarget << "...\n";
+
+    Endpoint endpoint = loopbackEndpoint(cfg.proxyPort);
+    auto wait         = std::chrono::milliseconds(cfg.connectTimeoutMs) + std::chrono::seconds(5);
+    std::vector<BlackholeProbe> probes(cfg.connections);
+
+    {
+        std::vector<std::jthread> clients;
+        clients.reserve(cfg.connections);
+
+        for (BlackholeProbe& probe : probes)
+        {
+            clients.emplace_back(
+                [&] ()
+                {
+                    probe = probeThroughProxy(
+                        endpoint,
+                        wait
+                        );
+                }
+                );
+        }
+    }
+
+    stopProxy(proxy);
+
+    std::vector<double> echoed;
+    std::vector<double> closed;
+
+    for (const BlackholeProbe& probe : probes)
+    {
+        (probe.echoed ? echoed : closed).push_back(static_cast<double>(probe.elapsed.count()) / 1000.0);
+    }
+
+    std::sort(
+        echoed.begin(),
+        echoed.end()
+        );
+    std::sort(
+        closed.begin(),
+        closed.end()
+        );
+
+    double timeout = static_cast<double>(cfg.connectTimeoutMs);
+
+    std::cout << "\nblackhole test, " << cfg.connections << " clients at once, round-robin between "
+              << cfg.blackholeTarget << " and the echo server, connect timeout " << cfg.connectTimeoutMs
+              << " ms\n\n" << std::fixed << std::setprecision(1);
+
+    std::cout << "reached the server: " << echoed.size();
+
+    if (!echoed.empty())
+    {
+        std::cout << ", first echo after p50 " << echoed[echoed.size() / 2]
+                  << " / p99 " << echoed[(echoed.size() * 99) / 100]
+                  << " / max " << echoed.back() << " ms";
+    }
+
+    std::cout << "\nsent to the blackhole: " << closed.size();
+
+    if (!closed.empty())
+    {
+        std::cout << ", closed by the proxy after " << closed.front() << " .. " << closed.back() << " ms";
+    }
+
+    std::cout << "\n\n";
+
+    if (!closed.empty() && (closed.front() < timeout / 2))
+    {
+        std::cout << "inconclusive: connects to " << cfg.blackholeTarget
+                  << " failed before the timeout, so it is refused or unreachable here rather than blackholed;"
+                  << " pass --blackhole with an address this machine routes but nothing answers\n";
+
+        return 2;
+    }
+
+    if (echoed.empty())
+    {
+        std::cout << "FAIL: no client reached the echo server\n";
+
+        return 1;
+    }
+
+    if (echoed.back() >= timeout / 2)
+    {
+        std::cout << "FAIL: clients sent to the echo server waited behind connects to the blackhole\n";
+
+        return 1;
+    }
+
+    std::cout << "ok: no client sent to the echo server waited for a connect to the blackhole\n";
+
+    return 0;
+}
+
+struct BenchPrefix
+{
+    IpKey key;
+    unsigned len;
+    CidrVerdict verdict;
+};
+
+// A random address inside p.
+static IpKey
+addressIn(
+    const BenchPrefix& p,
+    std::mt19937_64& rng
+    )
+{
+    IpKey host {rng(), rng()};
+    IpKey net  = host.masked(p.len);
+    IpKey key;
+    key.hi = p.key.hi | (host.hi ^ net.hi);
+    key.lo = p.key.lo | (host.lo ^ net.lo);
+
+    return key;
+}
+
+// Access list lookups as the proxy does them, through an RcuCell: build time
+// and size of a trie with cfg.prefixes random prefixes, the cost of a single
+// lookup (checked against a linear scan), and lookups per second from several
+// threads, first alone and then while another thread keeps swapping in a
+// rebuilt trie the way a reload does.
+static void
+runCidrMicrobench(
+    const BenchConfig& cfg
+    )
+{
+    std::mt19937_64 rng(42);
+    std::vector<BenchPrefix> prefixes;
+    prefixes.reserve(cfg.prefixes);
+
+    // Shaped roughly like a routing table: mostly IPv4 /16../24 with a few
+    // longer prefixes and host routes, and a fifth IPv6 /32../64.
+    static constexpr unsigned kV4Lengths[] = {16, 16, 19, 20, 22, 22, 23, 24, 24, 24, 24, 24, 28, 32};
+    std::size_t v6                         = 0;
+
+    for (unsigned i = 0; i < cfg.prefixes; ++i)
+    {
+        BenchPrefix p;
+        IpKey random {rng(), rng()};
+
+        if (rng() % 5 == 0)
+        {
+            p.len = 32 + static_cast<unsigned>(rng() % 33);
+            p.key = random.masked(p.len);
+            ++v6;
+        }
+        else
+        {
+            in_addr a {};
+            a.s_addr = static_cast<std::uint32_t>(random.lo);
+            p.len    = 96 + kV4Lengths[rng() % std::size(kV4Lengths)];
+            p.key    = IpKey::fromV4(a).masked(p.len);
+        }
+
+        p.verdict = (rng() % 4 == 0) ? CidrVerdict::Deny : CidrVerdict::Allow;
+        prefixes.push_back(p);
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    auto trie    = std::make_unique<CidrTrie>();
+
+    for (const BenchPrefix& p : prefixes)
+    {
+        trie->insert(
+            p.key,
+            p.len,
+            p.verdict
+            );
+    }
+
+    trie->index();
+
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+
+    std::cout << "cidr: " << cfg.prefixes << " prefixes (" << (cfg.prefixes - v6) << " IPv4, " << v6 << " IPv6), "
+              << trie->prefixes() << " distinct, " << (trie->bytes() / 1024) << " KiB, built in "
+              << std::fixed << std::setprecision(1) << buildMs << " ms\n";
+
+    // Half the lookups fall inside some prefix, half are random IPv4 clients.
+    constexpr std::size_t kLookups = 1 << 20;
+    std::vector<IpKey> addresses;
+    addresses.reserve(kLookups);
+
+    for (std::size_t i = 0; i < kLookups; ++i)
+    {
+        if (i % 2)
+        {
+            addresses.push_back(
+                addressIn(
+                    prefixes[rng() % prefixes.size()],
+                    rng
+                    )
+                );
+        }
+        else
+        {
+            in_addr a {};
+            a.s_addr = static_cast<std::uint32_t>(rng());
+            addresses.push_back(IpKey::fromV4(a));
+        }
+    }
+
+    std::size_t matched = 0;
+    started             = std::chrono::steady_clock::now();
+
+    for (const IpKey& addr : addresses)
+    {
+        matched += (trie->lookup(addr) != CidrVerdict::None) ? 1 : 0;
+    }
+
+    double lookupNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / kLookups;
+
+    // The longest match, and among equal prefixes the last one inserted.
+    std::size_t checked    = std::min<std::size_t>(
+        kLookups,
+        std::max<std::size_t>(
+            200'000'000 / prefixes.size(),
+            16
+            )
+        );
+    std::size_t mismatches = 0;
+
+    for (std::size_t i = 0; i < checked; ++i)
+    {
+        const IpKey& addr    = addresses[i];
+        CidrVerdict expected = CidrVerdict::None;
+        unsigned best        = 0;
+
+        for (const BenchPrefix& p : prefixes)
+        {
+            if ((commonPrefix(addr, p.key) >= p.len) && ((expected == CidrVerdict::None) || (p.len >= best)))
+            {
+                expected = p.verdict;
+                best     = p.len;
+            }
+        }
+
+        mismatches += (trie->lookup(addr) != expected) ? 1 : 0;
+    }
+
+    std::cout << "cidr: " << kLookups << " lookups, " << std::setprecision(1) << lookupNs << " ns each ("
+              << (100 * matched / kLookups) << "% matched); " << checked << " checked against a linear scan, "
+              << mismatches << " mismatches\n";
+
+    // Now from several threads through an RcuCell, as AccessControl reads it.
+    RcuCell<CidrTrie> cell(std::move(trie));
+    unsigned readers = std::max(
+        std::thread::hardware_concurrency(),
+        2u
+        ) - 1;
+
+    auto measure = [&] (bool reloading, std::uint64_t& reloads, std::chrono::microseconds& worstReload)
+        {
+            std::atomic<bool> stop {false};
+            std::atomic<std::uint64_t> total {0};
+            std::atomic<std::uint64_t> deniedTotal {0}; // keeps the lookups from being optimized away
+
+            {
+                std::vector<std::jthread> threads;
+
+                for (unsigned t = 0; t < readers; ++t)
+                {
+                    threads.emplace_back(
+                        [&, t] ()
+                        {
+                            std::uint64_t done   = 0;
+                            std::uint64_t denied = 0;
+                            std::size_t i        = t * 7919;
+
+                            while (!stop.load(std::memory_order_relaxed))
+                            {
+                                for (int batch = 0; batch < 256; ++batch, ++i, ++done)
+                                {
+                                    RcuReadGuard guard;
+                                    denied += (cell.load()->lookup(addresses[i % kLookups]) == CidrVerdict::Deny) ? 1 : 0;
+                                }
+                            }
+
+                            total.fetch_add(done);
+                            deniedTotal.fetch_add(denied);
+                        }
+                        );
+                }
+
+                if (reloading)
+                {
+                    threads.emplace_back(
+                        [&] ()
+                        {
+                            while (!stop.load(std::memory_order_relaxed))
+                            {
+                                auto next  = std::make_unique<const CidrTrie>(*cell.load());
+                                auto began = std::chrono::steady_clock::now();
+                                cell.replace(std::move(next));
+                                worstReload = std::max(
+                                    worstReload,
+                                    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - began)
+                                    );
+                                ++reloads;
+                            }
+                        }
+                        );
+                }
+
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                stop.store(true);
+            }
+
+            return static_cast<double>(total.load()) / 1e6;
+        };
+
+    std::uint64_t reloads = 0;
+    std::chrono::microseconds worstReload {0};
+    double idle      = measure(
+        false,
+        reloads,
+        worstReload
+        );
+    double reloading = measure(
+        true,
+        reloads,
+        worstReload
+        );
+
+    std::cout << "cidr: " << readers << " reader threads, " << std::setprecision(1) << idle << " M lookups/s, "
+              << reloading << " M lookups/s during " << reloads << " reloads (worst swap "
+              << worstReload.count() << " us)\n";
+}
+
+int
+main(
+    int argc,
+    char* argv[]
+    )
+{
+    BenchConfig cfg {};
+
+    if (
+        !parseCommandLine(
+            argc,
+            argv,
+            cfg
+            )
+        )
+    {
+        printUsage();
+
+        return 1;
+    }
+
+    if (cfg.microbench == Microbench::Cidr)
+    {
+        runCidrMicrobench(cfg);
+
+        return 0;
+    }
+
+    WSADATA wsaData {};
+
+    if (
+        int wsaResult = WSAStartup(
+            MAKEWORD(
+                2,
+                2
+                ),
+            &wsaData
+            ); (wsaResult != 0)
+        )
+    {
+        std::cerr << "WSAStartup() failed: " << wsaResult << "\n";
+
+        return 1;
+    }
+
+    SOCKET listener = openServer(cfg.serverPort);
+
+    if (listener == INVALID_SOCKET)
+    {
+        WSACleanup();
+
+        return 1;
+    }
+
+    SOCKET udpServerSocket = openUdpServer(cfg.serverPort);
+
+    if (udpServerSocket == INVALID_SOCKET)
+    {
+        closesocket(listener);
+        WSACleanup();
+
+        return 1;
+    }
+
+    std::jthread server(
+        runServer,
+        listener
+        );
+    std::jthread udpServer(
+        runUdpServer,
+        udpServerSocket
+        );
+
+    std::cout << "echo/sink server on 127.0.0.1:" << cfg.serverPort << " (tcp + udp)\n";
+
+    SOCKET unixListener = INVALID_SOCKET;
+    std::jthread unixServer;
+
+    if (!cfg.serverUnix.empty())
+    {
+        unixListener = openUnixServer(cfg.serverUnix);
+
+        if (unixListener == INVALID_SOCKET)
+        {
+            closesocket(listener);
+            closesocket(udpServerSocket);
+            server.join();
+            udpServer.join();
+            WSACleanup();
+
+            return 1;
+        }
+
+        unixServer = std::jthread(
+            runServer,
+            unixListener
+            );
+
+        std::cout << "echo/sink server on unix:" << cfg.serverUnix << "\n";
+    }
+
+    if (cfg.serverOnly)
+    {
+        server.join();
+
+        return 0;
+    }
+
+    std::vector<RunSummary> runs;
+
+    std::cout << "running direct...\n";
+    runs.push_back(
+        runLoad(
+            "direct",
+            loopbackEndpoint(cfg.serverPort),
+            cfg
+            )
+        );
+
+    Endpoint unixTarget;
+
+    if (
+        !cfg.serverUnix.empty() && unixEndpoint(
+            cfg.serverUnix,
+            unixTarget
+            )
+        )
+    {
+        std::cout << "running direct over AF_UNIX...\n";
+        runs.push_back(
+            runLoad(
+                "uds",
+                unixTarget,
+                cfg
+                )
+            );
+    }
+
+    int exitCode = 0;
+
+    if (!cfg.compareProxies.empty())
+    {
+        runComparison(cfg);
+    }
+    else if (!cfg.blackholeProxy.empty())
+    {
+        exitCode = runBlackhole(cfg);
+    }
+    else if (!cfg.modeProxy.empty())
+    {
+        runModeComparison(cfg);
+    }
+    else if (!cfg.shardProxy.empty())
+    {
+        runShardSweep(cfg);
+    }
+    else if (!cfg.scaleProxy.empty())
+    {
+        runScaling(cfg);
+    }
+    else if (cfg.proxyPort)
+    {
+        std::cout << "running through proxy on 127.0.0.1:" << cfg.proxyPort << "...\n";
+        runs.push_back(
+            runLoad(
+                "proxy",
+                loopbackEndpoint(cfg.proxyPort),
+                cfg
+                )
+            );
+    }
+
+    Endpoint unixProxy;
+
+    if (
+        !cfg.proxyUnix.empty() && unixEndpoint(
+            cfg.proxyUnix,
+            unixProxy
+            )
+        )
+    {
+        std::cout << "running through proxy on unix:" << cfg.proxyUnix << "...\n";
+        runs.push_back(
+            runLoad(
+                "proxy-uds",
+                unixProxy,
+                cfg
+                )
+            );
+    }
+
+    printSummaries(
+        cfg,
+        runs
+        );
+
+    closesocket(listener);
+    closesocket(udpServerSocket);
+    server.join();
+    udpServer.join();
+
+    if (unixListener != INVALID_SOCKET)
+    {
+        closesocket(unixListener);
+        unixServer.join();
+    }
+
+    WSACleanup();
+
+    return exitCode;
+}
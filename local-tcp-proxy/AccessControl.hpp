@@ -0,0 +1,366 @@
+﻿#pragma once
+
+#include "AsyncLog.hpp"
+#include "CidrTrie.hpp"
+#include "Rcu.hpp"
+
+#include <winsock2.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// One "allow <cidr>" or "deny <cidr>" line.
+struct AccessRule
+{
+    CidrVerdict verdict {CidrVerdict::Allow};
+    IpKey prefix;
+    unsigned len {0};
+};
+
+// Parse "allow <cidr>" or "deny <cidr>"; anything after a '#' is a comment.
+// Returns false for a malformed line; blank lines parse to no rule (empty
+// stays true).
+inline bool
+parseAccessRule(
+    std::string_view line,
+    AccessRule& rule,
+    bool& empty
+    )
+{
+    line = line.substr(
+        0,
+        line.find('#')
+        );
+
+    auto isSpace = [] (char c)
+        {
+            return (c == ' ') || (c == '\t') || (c == '\r');
+        };
+
+    while (!line.empty() && isSpace(line.front()))
+    {
+        line.remove_prefix(1);
+    }
+
+    while (!line.empty() && isSpace(line.back()))
+    {
+        line.remove_suffix(1);
+    }
+
+    empty = line.empty();
+
+    if (empty)
+    {
+        return true;
+    }
+
+    std::size_t gap = line.find_first_of(" \t");
+
+    if (gap == std::string_view::npos)
+    {
+        return false;
+    }
+
+    std::string_view action = line.substr(
+        0,
+        gap
+        );
+    std::string_view cidr   = line.substr(line.find_first_not_of(" \t", gap));
+
+    if (action == "allow")
+    {
+        rule.verdict = CidrVerdict::Allow;
+    }
+    else if (action == "deny")
+    {
+        rule.verdict = CidrVerdict::Deny;
+    }
+    else
+    {
+        return false;
+    }
+
+    return parseCidr(
+        cidr,
+        rule.prefix,
+        rule.len
+        );
+}
+
+// Whether rule covers IPv4 addresses, i.e. IPv4-mapped addresses on the
+// trie's 128-bit scale. The TCP and UDP listeners are IPv4 only, so an IPv6
+// rule could never match a client and is refused rather than ignored.
+inline bool
+isV4Rule(
+    const AccessRule& rule
+    )
+{
+    return (rule.len >= 96) && (rule.prefix.hi == 0) && ((rule.prefix.lo >> 32) == 0xFFFF);
+}
+
+// Decides who may use the proxy, by source address.
+//
+// Rules come from the command line and, optionally, a file with one rule per
+// line. The most specific prefix containing the client decides; among equal
+// prefixes the last rule wins, command-line rules coming after the file's.
+// Addresses no rule covers are allowed, unless there is at least one allow
+// rule, in which case the allow rules are the whole list of who may connect.
+//
+// The compiled list sits in an RcuCell: checking a client is a lookup in the
+// current CidrTrie with no lock taken, and a reload builds a complete new trie
+// on the side and swaps it in, so accepts never wait on a reload. The file is
+// polled for changes once a second; a file that fails to parse is reported and
+// the previous list stays in force.
+class AccessControl
+{
+public:
+    AccessControl(
+        std::vector<AccessRule> rules,
+        std::string file
+        )
+        : m_rules(std::move(rules))
+        , m_file(std::move(file))
+        , m_list(nullptr)
+    {
+        const char* what = "";
+        std::size_t line = 0;
+        auto list        = build(
+            what,
+            line
+            );
+
+        if (!list)
+        {
+            throw std::runtime_error("access list '" + m_file + "' " + what + (line ? " on line " + std::to_string(line) : std::string()));
+        }
+
+        m_list.replace(std::move(list));
+
+        if (!m_file.empty())
+        {
+            m_thread = std::jthread(
+                [this] (std::stop_token st)
+                {
+                    run(st);
+                }
+                );
+        }
+    }
+
+    AccessControl(const AccessControl&)            = delete;
+    AccessControl& operator=(const AccessControl&) = delete;
+
+    bool
+    allowed(
+        const in_addr& addr
+        ) const
+    {
+        RcuReadGuard guard;
+        const List* list    = m_list.load();
+        CidrVerdict verdict = list->trie.lookup(IpKey::fromV4(addr));
+
+        return ((verdict == CidrVerdict::None) ? list->unmatched : verdict) == CidrVerdict::Allow;
+    }
+
+private:
+    struct List
+    {
+        CidrTrie trie;
+        CidrVerdict unmatched {CidrVerdict::Allow};
+    };
+
+    static void
+    formatReloaded(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Access list " << rec.str << " reloaded, " << rec.num[0] << " prefixes\n";
+    }
+
+    static void
+    formatReloadFailed(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Access list " << rec.str << " not reloaded, it " << rec.text[0];
+
+        if (rec.num[0])
+        {
+            out << " on line " << rec.num[0];
+        }
+
+        out << "; keeping the previous list\n";
+    }
+
+    // Compile the file's rules and then the command line's. On failure returns
+    // null with what went wrong, and where if it is a line of the file.
+    std::unique_ptr<const List>
+    build(
+        const char*& what,
+        std::size_t& badLine
+        ) const
+    {
+        auto list     = std::make_unique<List>();
+        bool anyAllow = false;
+
+        auto add = [&] (const AccessRule& rule)
+            {
+                list->trie.insert(
+                    rule.prefix,
+                    rule.len,
+                    rule.verdict
+                    );
+                anyAllow = anyAllow || (rule.verdict == CidrVerdict::Allow);
+            };
+
+        if (!m_file.empty())
+        {
+            std::ifstream in(m_file);
+
+            if (!in)
+            {
+                what = "cannot be read";
+
+                return nullptr;
+            }
+
+            std::string line;
+            std::size_t number = 0;
+
+            while (std::getline(in, line))
+            {
+                ++number;
+                AccessRule rule;
+                bool empty = false;
+
+                if (
+                    !parseAccessRule(
+                        line,
+                        rule,
+                        empty
+                        )
+                    )
+                {
+                    what    = "has an invalid rule";
+                    badLine = number;
+
+                    return nullptr;
+                }
+
+                if (!empty && !isV4Rule(rule))
+                {
+                    what    = "has an IPv6 rule, which no client can match (only IPv4 is served)";
+                    badLine = number;
+
+                    return nullptr;
+                }
+
+                if (!empty)
+                {
+                    add(rule);
+                }
+            }
+        }
+
+        for (const AccessRule& rule : m_rules)
+        {
+            add(rule);
+        }
+
+        list->trie.index();
+        list->unmatched = anyAllow ? CidrVerdict::Deny : CidrVerdict::Allow;
+
+        return list;
+    }
+
+    void
+    run(
+        std::stop_token st
+        )
+    {
+        std::error_code ec;
+        auto stamp = std::filesystem::last_write_time(m_file, ec);
+        std::mutex waitMtx;
+        std::condition_variable_any cv;
+
+        while (!st.stop_requested())
+        {
+            {
+                std::unique_lock ul(waitMtx);
+                cv.wait_for(
+                    ul,
+                    st,
+                    std::chrono::seconds(1),
+                    [] ()
+                    {
+                        return false;
+                    }
+                    );
+            }
+
+            auto now = std::filesystem::last_write_time(m_file, ec);
+
+            if (ec || (now == stamp))
+            {
+                continue;
+            }
+
+            stamp = now;
+
+            const char* what    = "";
+            std::size_t badLine = 0;
+            auto list           = build(
+                what,
+                badLine
+                );
+
+            if (!list)
+            {
+                logRecord(
+                    {
+                        .format     = formatReloadFailed,
+                        .stream     = LogStream::Err,
+                        .text       = {what, ""},
+                        .num        = {static_cast<std::int64_t>(badLine)}
+                    },
+                    m_file
+                    );
+                continue;
+            }
+
+            std::size_t prefixes = list->trie.prefixes();
+            m_list.replace(std::move(list));
+
+            logRecord(
+                {
+                    .format = formatReloaded,
+                    .stream = LogStream::Out,
+                    .num    = {static_cast<std::int64_t>(prefixes)}
+                },
+                m_file
+                );
+        }
+    }
+
+    const std::vector<AccessRule> m_rules;
+    const std::string m_file;
+    RcuCell<List> m_list;
+
+    // Last member: started in the constructor once everything above exists.
+    std::jthread m_thread;
+};
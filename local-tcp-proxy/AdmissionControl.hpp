@@ -0,0 +1,454 @@
+﻿#pragma once
+
+#include "Metrics.hpp"
+#include "TimingWheel.hpp"
+
+#include <winsock2.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// What AdmissionControl enforces; zero means no limit.
+struct AdmissionLimits
+{
+    unsigned maxConnections {0};  // open connections, all clients together
+    unsigned maxPerClient {0};    // open connections per client address
+    unsigned connectRate {0};     // new connections per second per client address
+    unsigned connectBurst {0};    // ... allowed back to back (0 = connectRate)
+    unsigned clientBandwidth {0}; // bytes per second per client address, both directions
+
+    bool
+    perClient() const noexcept
+    {
+        return (maxPerClient > 0) || (connectRate > 0) || (clientBandwidth > 0);
+    }
+
+    bool
+    any() const noexcept
+    {
+        return (maxConnections > 0) || perClient();
+    }
+};
+
+class AdmissionControl;
+
+// Proof that a client was admitted, carried by its Connection and handed back
+// to AdmissionControl::release() when the connection closes.
+struct AdmissionTicket
+{
+    static constexpr std::uint32_t kNoSlot = std::numeric_limits<std::uint32_t>::max();
+
+    AdmissionControl* control {nullptr};
+    std::uint32_t slot {kNoSlot}; // client table entry, if per-client limits apply
+};
+
+// A relay read held back until its client's bandwidth debt is paid off. Like
+// IoOperation, onResume is called with the owner left for the caller to use.
+struct PausedRead
+{
+    TimerNode node;
+    void (*onResume)(PausedRead& paused) {nullptr};
+    void* owner {nullptr};
+};
+
+// Decides at accept() time whether a client may open another connection, and
+// meters the bandwidth of the clients it let in.
+//
+// Per-client state lives in a fixed table of 32-byte entries, allocated once,
+// keyed by IPv4 address and split into stripes with a lock each. A client maps
+// to a short run of entries inside one stripe, so an admission decision is a
+// hash, an uncontended lock and a scan of a few cache lines, and a flood of
+// connections from many addresses can neither grow the table nor slow it down.
+// An address takes over the least recently seen entry of its run that has no
+// open connection; if every entry there is in use, the client is turned away
+// rather than evicting anyone (RejectReason::TableFull).
+//
+// Rates are token buckets refilled lazily from the time since the entry was
+// last touched, in thousandths of a connection or byte so slow rates do not
+// round away. Bandwidth is charged after each receive and may go into debt;
+// the relay then pauses for as long as paying it off takes before it reads
+// again, on a timing wheel driven by this object's own thread.
+class AdmissionControl
+{
+public:
+    static constexpr std::chrono::milliseconds kPaceTick {10};
+
+    explicit AdmissionControl(
+        const AdmissionLimits& limits,
+        std::size_t tableEntries = 65536
+        )
+        : m_maxConnections(limits.maxConnections)
+        , m_maxPerClient(limits.maxPerClient)
+        , m_connectRate(limits.connectRate)
+        , m_connectCapacity(std::int64_t {limits.connectBurst ? limits.connectBurst : limits.connectRate} * 1000)
+        , m_bandwidth(limits.clientBandwidth)
+        , m_byteCapacity(std::int64_t {limits.clientBandwidth} * 1000)
+    {
+        if (limits.perClient())
+        {
+            m_stripeEntries = std::max<std::size_t>(
+                std::bit_ceil(tableEntries) / kStripes,
+                kProbe
+                );
+            m_entries = std::make_unique<Entry[]>(m_stripeEntries * kStripes);
+        }
+
+        if (m_bandwidth)
+        {
+            m_thread = std::jthread(
+                [this] (std::stop_token st)
+                {
+                    run(st);
+                }
+                );
+        }
+    }
+
+    ~AdmissionControl()
+    {
+        if (m_thread.joinable())
+        {
+            m_thread.request_stop();
+            m_thread.join();
+        }
+
+        // Paused relays are only left behind at process exit.
+        m_wheel.clear(
+            [] (TimerNode&)
+            {
+            }
+            );
+    }
+
+    AdmissionControl(const AdmissionControl&)            = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+    // Admit or turn away a client that was just accepted from peer (may be
+    // null, in which case only the global limit applies). Returns
+    // RejectReason::Count when admitted, with ticket to be released once the
+    // client's connection closes.
+    RejectReason
+    admit(
+        const sockaddr_in* peer,
+        AdmissionTicket& ticket
+        )
+    {
+        if (m_maxConnections && (m_open.fetch_add(1) >= m_maxConnections))
+        {
+            m_open.fetch_sub(1);
+
+            return RejectReason::ConnectionLimit;
+        }
+
+        ticket = {this, AdmissionTicket::kNoSlot};
+
+        if (m_entries && peer)
+        {
+            RejectReason verdict = admitClient(
+                peer->sin_addr.s_addr,
+                ticket.slot
+                );
+
+            if (verdict != RejectReason::Count)
+            {
+                if (m_maxConnections)
+                {
+                    m_open.fetch_sub(1);
+                }
+
+                ticket = {};
+
+                return verdict;
+            }
+        }
+
+        return RejectReason::Count;
+    }
+
+    void
+    release(
+        const AdmissionTicket& ticket
+        )
+    {
+        if (m_maxConnections)
+        {
+            m_open.fetch_sub(1);
+        }
+
+        if (ticket.slot != AdmissionTicket::kNoSlot)
+        {
+            std::lock_guard lock(stripeOf(ticket.slot).mtx);
+            --m_entries[ticket.slot].active;
+        }
+    }
+
+    // Count bytes a connection of ticket's client just received. Returns how
+    // long it should wait before reading again, zero while within budget.
+    std::chrono::milliseconds
+    charge(
+        const AdmissionTicket& ticket,
+        std::uint32_t bytes
+        )
+    {
+        if (!m_bandwidth || (ticket.slot == AdmissionTicket::kNoSlot))
+        {
+            return std::chrono::milliseconds(0);
+        }
+
+        std::int64_t credit = 0;
+
+        {
+            std::lock_guard lock(stripeOf(ticket.slot).mtx);
+            Entry& e = m_entries[ticket.slot];
+            refill(
+                e,
+                nowMs()
+                );
+            e.byteCredit -= std::int64_t {bytes} * 1000;
+            credit        = e.byteCredit;
+        }
+
+        if (credit >= 0)
+        {
+            return std::chrono::milliseconds(0);
+        }
+
+        // Credit is in thousandths of a byte, and the client earns m_bandwidth
+        // of those per millisecond.
+        return std::chrono::milliseconds((-credit + m_bandwidth - 1) / m_bandwidth);
+    }
+
+    // Call paused.onResume(paused) on this object's thread once delay (as
+    // returned by charge()) has passed.
+    void
+    pause(
+        PausedRead& paused,
+        std::chrono::milliseconds delay
+        )
+    {
+        paused.node.context = &paused;
+
+        std::lock_guard lock(m_paceMtx);
+        m_wheel.schedule(
+            paused.node,
+            m_wheel.now() + static_cast<std::uint64_t>((delay + kPaceTick - std::chrono::milliseconds(1)) / kPaceTick)
+            );
+    }
+
+private:
+    static constexpr std::size_t kStripes = 64;
+    static constexpr std::size_t kProbe   = 8; // entries an address may use, two cache lines
+
+    struct Entry
+    {
+        std::uint32_t addr {0}; // network order; 0 = free (no client has 0.0.0.0)
+        std::uint32_t active {0};
+        std::uint32_t stamp {0}; // ms of the last refill, also "last seen"
+        std::uint32_t unused {0};
+        std::int64_t connectCredit {0}; // thousandths of a connection
+        std::int64_t byteCredit {0};    // thousandths of a byte; negative = debt
+    };
+
+    static_assert(sizeof(Entry) == 32);
+
+    struct alignas(64) Stripe
+    {
+        std::mutex mtx;
+    };
+
+    std::uint32_t
+    nowMs() const noexcept
+    {
+        return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_started).count());
+    }
+
+    Stripe&
+    stripeOf(
+        std::uint32_t slot
+        ) noexcept
+    {
+        return m_stripes[slot / m_stripeEntries];
+    }
+
+    void
+    refill(
+        Entry& e,
+        std::uint32_t now
+        ) const noexcept
+    {
+        // Capped so the products below cannot overflow; a full bucket is
+        // reached long before that anyway.
+        std::int64_t elapsed = std::min<std::uint32_t>(
+            now - e.stamp,
+            1u << 22
+            );
+        e.stamp = now;
+
+        e.connectCredit = std::min(
+            e.connectCredit + elapsed * m_connectRate,
+            m_connectCapacity
+            );
+        e.byteCredit    = std::min(
+            e.byteCredit + elapsed * m_bandwidth,
+            m_byteCapacity
+            );
+    }
+
+    RejectReason
+    admitClient(
+        std::uint32_t addr,
+        std::uint32_t& slot
+        )
+    {
+        // Fibonacci hashing spreads neighbouring addresses across stripes.
+        std::uint32_t hash = addr * 0x9E3779B1u;
+        std::size_t stripe = hash >> (32 - std::countr_zero(kStripes));
+        std::size_t base   = stripe * m_stripeEntries;
+        std::size_t start  = (hash & 0xFFFFu) % m_stripeEntries;
+        std::uint32_t now  = nowMs();
+        Entry* found       = nullptr;
+        Entry* reusable    = nullptr;
+
+        std::lock_guard lock(m_stripes[stripe].mtx);
+
+        for (std::size_t i = 0; i < kProbe; ++i)
+        {
+            Entry& e = m_entries[base + (start + i) % m_stripeEntries];
+
+            if (e.addr == addr)
+            {
+                found = &e;
+                break;
+            }
+
+            // Prefer a free entry, then the one idle the longest.
+            if (
+                (e.active == 0) && (!reusable || (e.addr == 0)
+                    || ((reusable->addr != 0) && (now - e.stamp > now - reusable->stamp)))
+                )
+            {
+                reusable = &e;
+            }
+        }
+
+        if (!found)
+        {
+            if (!reusable)
+            {
+                return RejectReason::TableFull;
+            }
+
+            found                = reusable;
+            found->addr          = addr;
+            found->stamp         = now;
+            found->connectCredit = m_connectCapacity;
+            found->byteCredit    = m_byteCapacity;
+        }
+
+        refill(
+            *found,
+            now
+            );
+
+        if (m_maxPerClient && (found->active >= m_maxPerClient))
+        {
+            return RejectReason::ClientLimit;
+        }
+
+        if (m_connectRate)
+        {
+            if (found->connectCredit < 1000)
+            {
+                return RejectReason::ClientRate;
+            }
+
+            found->connectCredit -= 1000;
+        }
+
+        ++found->active;
+        slot = static_cast<std::uint32_t>(found - m_entries.get());
+
+        return RejectReason::Count;
+    }
+
+    void
+    run(
+        std::stop_token st
+        )
+    {
+        auto started = std::chrono::steady_clock::now();
+        std::mutex waitMtx;
+        std::condition_variable_any cv;
+        std::vector<PausedRead*> due;
+
+        while (!st.stop_requested())
+        {
+            {
+                std::unique_lock ul(waitMtx);
+                cv.wait_for(
+                    ul,
+                    st,
+                    kPaceTick,
+                    [] ()
+                    {
+                        return false;
+                    }
+                    );
+            }
+
+            auto now = static_cast<std::uint64_t>((std::chrono::steady_clock::now() - started) / kPaceTick);
+
+            {
+                std::lock_guard lock(m_paceMtx);
+                m_wheel.advance(
+                    now,
+                    [&] (TimerNode& node)
+                    {
+                        due.push_back(static_cast<PausedRead*>(node.context));
+                    }
+                    );
+            }
+
+            // Outside the lock: resuming issues the next read, which may
+            // complete and pause again straight away.
+            for (PausedRead* paused : due)
+            {
+                paused->onResume(*paused);
+            }
+
+            due.clear();
+        }
+    }
+
+    const unsigned m_maxConnections;
+    const unsigned m_maxPerClient;
+    const std::int64_t m_connectRate;
+    const std::int64_t m_connectCapacity;
+    const std::int64_t m_bandwidth;
+    const std::int64_t m_byteCapacity;
+    const std::chrono::steady_clock::time_point m_started {std::chrono::steady_clock::now()};
+
+    std::atomic<unsigned> m_open {0};
+
+    std::size_t m_stripeEntries {0};
+    std::unique_ptr<Entry[]> m_entries;
+    std::array<Stripe, kStripes> m_stripes;
+
+    std::mutex m_paceMtx;
+    TimingWheel m_wheel;
+
+    // Last member: started in the constructor once everything above exists.
+    std::jthread m_thread;
+};
@@ -0,0 +1,552 @@
+﻿#pragma once
+
+#include "WinsockError.hpp"
+
+#include <winsock2.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+enum class LogStream : std::uint8_t
+{
+    Out,
+    Err
+};
+
+// One log line as it travels from the thread that logs it to the formatter.
+//
+// Nothing is formatted on the logging thread: it fills in the fields below and
+// format turns them into text later. text[] must point at string literals (or
+// anything else that outlives the process); the one piece of text that is
+// copied is str, truncated to fit.
+struct LogRecord
+{
+    using FormatFn = void (*)(
+        std::ostream& out,
+        const LogRecord& rec
+        );
+
+    FormatFn format {nullptr};
+    LogStream stream {LogStream::Err};
+    ErrorClass errorClass {ErrorClass::None};
+    const char* text[2] {"", ""};
+    std::int64_t num[3] {};
+    char str[64] {};
+};
+
+// Logging that never blocks the thread doing the logging.
+//
+// Each logging thread owns a single-producer ring of fixed-size records, so
+// logging is a copy and a release store, with no lock and no shared cache line
+// between threads. A background thread drains every ring, formats the records
+// and writes each batch to the console with one stream call. When a ring is
+// full (slow or paused console) the record is dropped and counted instead of
+// waiting.
+//
+// Errors are additionally rate-limited per ErrorClass: past kBurstPerClass
+// messages of one class within a second, further ones are only counted, and
+// the formatter prints a summary line once the second is over. A NAT dropping
+// thousands of clients then costs a few lines instead of thousands.
+class AsyncLog
+{
+public:
+    struct Stats
+    {
+        std::uint64_t dropped;    // rings full
+        std::uint64_t suppressed; // rate-limited
+    };
+
+    AsyncLog()
+    {
+        m_thread = std::jthread(
+            [this] (std::stop_token st)
+            {
+                run(st);
+            }
+            );
+    }
+
+    // Drains whatever is still queued, so messages logged right before exit
+    // are not lost.
+    ~AsyncLog()
+    {
+        m_thread.request_stop();
+        m_thread.join();
+    }
+
+    AsyncLog(const AsyncLog&)            = delete;
+    AsyncLog& operator=(const AsyncLog&) = delete;
+
+    void
+    submit(
+        const LogRecord& rec
+        )
+    {
+        if ((rec.errorClass != ErrorClass::None) && !admit(rec.errorClass))
+        {
+            return;
+        }
+
+        Ring& ring      = localRing();
+        std::uint32_t h = ring.head.load(std::memory_order_relaxed);
+        std::uint32_t t = ring.tail.load(std::memory_order_acquire);
+
+        if (h - t == kRingSize)
+        {
+            // Only this thread writes dropped.
+            ring.dropped.store(
+                ring.dropped.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed
+                );
+
+            return;
+        }
+
+        ring.slots[h % kRingSize] = rec;
+        ring.head.store(
+            h + 1,
+            std::memory_order_release
+            );
+    }
+
+    Stats
+    snapshot()
+    {
+        Stats s {};
+
+        for (Ring* ring : rings())
+        {
+            s.dropped += ring->dropped.load(std::memory_order_relaxed);
+        }
+
+        for (const ClassLimit& l : m_limits)
+        {
+            s.suppressed += l.suppressedTotal.load(std::memory_order_relaxed);
+        }
+
+        return s;
+    }
+
+private:
+    static constexpr std::uint32_t kRingSize      = 1024;
+    static constexpr std::uint32_t kBurstPerClass = 20;
+    static constexpr std::size_t kClasses         = 4;
+    static constexpr std::chrono::milliseconds kFlushInterval {20};
+
+    struct Ring
+    {
+        alignas(64) std::atomic<std::uint32_t> head {0}; // written by the owning thread
+        alignas(64) std::atomic<std::uint32_t> tail {0}; // written by the formatter
+        std::atomic<std::uint64_t> dropped {0};
+        std::array<LogRecord, kRingSize> slots;
+        bool leased {false}; // owned by a live thread; guarded by m_ringsMtx
+    };
+
+    // Gives the calling thread's ring back when the thread exits, so threads
+    // that come and go (accept loops replaced by a route reload) reuse rings
+    // rather than each leaving one behind. Records still queued in a returned
+    // ring are formatted all the same: the formatter drains every ring.
+    struct RingLease
+    {
+        AsyncLog* log {nullptr};
+        Ring* ring {nullptr};
+
+        ~RingLease()
+        {
+            if (ring)
+            {
+                log->returnRing(*ring);
+            }
+        }
+    };
+
+    struct alignas(64) ClassLimit
+    {
+        std::atomic<std::int64_t> windowStartMs {0};
+        std::atomic<std::uint32_t> inWindow {0};
+        std::atomic<std::uint64_t> suppressed {0};      // since the last summary
+        std::atomic<std::uint64_t> suppressedTotal {0}; // for stats
+    };
+
+    static std::int64_t
+    nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool
+    admit(
+        ErrorClass cls
+        )
+    {
+        ClassLimit& l      = m_limits[static_cast<std::size_t>(cls) % kClasses];
+        std::int64_t now   = nowMs();
+        std::int64_t start = l.windowStartMs.load(std::memory_order_relaxed);
+
+        if (
+            (now - start >= 1000) && l.windowStartMs.compare_exchange_strong(
+                start,
+                now,
+                std::memory_order_relaxed
+                )
+            )
+        {
+            l.inWindow.store(
+                0,
+                std::memory_order_relaxed
+                );
+        }
+
+        if (
+            l.inWindow.fetch_add(
+                1,
+                std::memory_order_relaxed
+                ) < kBurstPerClass
+            )
+        {
+            return true;
+        }
+
+        l.suppressed.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+        l.suppressedTotal.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+
+        return false;
+    }
+
+    // The calling thread's ring, leased on first use. There are never more
+    // rings than threads that were logging at the same time.
+    Ring&
+    localRing()
+    {
+        thread_local RingLease lease;
+
+        if (!lease.ring)
+        {
+            lease.log  = this;
+            lease.ring = &leaseRing();
+        }
+
+        return *lease.ring;
+    }
+
+    // A returned ring if there is one, else a new one. The mutex hands the
+    // ring's producer side from its old thread to the new one.
+    Ring&
+    leaseRing()
+    {
+        std::lock_guard lock(m_ringsMtx);
+
+        for (const auto& ring : m_rings)
+        {
+            if (!ring->leased)
+            {
+                ring->leased = true;
+
+                return *ring;
+            }
+        }
+
+        m_rings.push_back(std::make_unique<Ring>());
+        m_rings.back()->leased = true;
+
+        return *m_rings.back();
+    }
+
+    void
+    returnRing(
+        Ring& ring
+        )
+    {
+        std::lock_guard lock(m_ringsMtx);
+        ring.leased = false;
+    }
+
+    std::vector<Ring*>
+    rings()
+    {
+        std::vector<Ring*> out;
+        std::lock_guard lock(m_ringsMtx);
+
+        for (const auto& ring : m_rings)
+        {
+            out.push_back(ring.get());
+        }
+
+        return out;
+    }
+
+    // Format everything queued so far. Returns whether anything was written.
+    bool
+    drain()
+    {
+        std::string out;
+        std::string err;
+        std::ostringstream line;
+
+        for (Ring* ring : rings())
+        {
+            std::uint32_t t = ring->tail.load(std::memory_order_relaxed);
+            std::uint32_t h = ring->head.load(std::memory_order_acquire);
+
+            for (; t != h; ++t)
+            {
+                const LogRecord& rec = ring->slots[t % kRingSize];
+
+                line.str({});
+                rec.format(
+                    line,
+                    rec
+                    );
+                (rec.stream == LogStream::Out ? out : err) += line.str();
+            }
+
+            ring->tail.store(
+                t,
+                std::memory_order_release
+                );
+        }
+
+        if (!out.empty())
+        {
+            std::cout << out;
+            std::cout.flush();
+        }
+
+        if (!err.empty())
+        {
+            std::cerr << err;
+        }
+
+        return !out.empty() || !err.empty();
+    }
+
+    void
+    reportSuppressed()
+    {
+        for (std::size_t i = 0; i < kClasses; ++i)
+        {
+            std::uint64_t n = m_limits[i].suppressed.exchange(
+                0,
+                std::memory_order_relaxed
+                );
+
+            if (n)
+            {
+                std::cerr << "(" << n << " more " << to_string(static_cast<ErrorClass>(i))
+                          << " messages suppressed)\n";
+            }
+        }
+    }
+
+    void
+    run(
+        std::stop_token st
+        )
+    {
+        std::mutex waitMtx;
+        std::condition_variable_any cv;
+        std::int64_t lastSummary = nowMs();
+
+        while (!st.stop_requested())
+        {
+            if (!drain())
+            {
+                std::unique_lock ul(waitMtx);
+                cv.wait_for(
+                    ul,
+                    st,
+                    kFlushInterval,
+                    [] ()
+                    {
+                        return false;
+                    }
+                    );
+            }
+
+            if (nowMs() - lastSummary >= 1000)
+            {
+                reportSuppressed();
+                lastSummary = nowMs();
+            }
+        }
+
+        drain();
+        reportSuppressed();
+    }
+
+    std::mutex m_ringsMtx;
+    std::vector<std::unique_ptr<Ring>> m_rings;
+    std::array<ClassLimit, kClasses> m_limits {};
+
+    // Last member: started in the constructor once everything above exists.
+    std::jthread m_thread;
+};
+
+inline AsyncLog&
+asyncLog()
+{
+    static AsyncLog log;
+
+    return log;
+}
+
+// Queue rec, copying str into it.
+inline void
+logRecord(
+    LogRecord rec,
+    std::string_view str = {}
+    )
+{
+    std::size_t n = std::min(
+        str.size(),
+        sizeof(rec.str) - 1
+        );
+    str.copy(
+        rec.str,
+        n
+        );
+    rec.str[n] = '\0';
+
+    asyncLog().submit(rec);
+}
+
+// "<text[0]>"
+inline void
+formatMessage(
+    std::ostream& out,
+    const LogRecord& rec
+    )
+{
+    out << rec.text[0] << "\n";
+}
+
+// Log a fixed message. msg must be a string literal.
+inline void
+logMessage(
+    LogStream stream,
+    const char* msg
+    )
+{
+    logRecord(
+        {
+            .format = formatMessage,
+            .stream = stream,
+            .text   = {msg, ""}
+        }
+        );
+}
+
+// "<text[0]> (<text[1]> = <num[0]>)"
+inline void
+formatErrorCode(
+    std::ostream& out,
+    const LogRecord& rec
+    )
+{
+    out << rec.text[0] << " (" << rec.text[1] << " = " << rec.num[0] << ")\n";
+}
+
+// Log a failed call with its error code, e.g. GetLastError(). msg must be a
+// string literal.
+inline void
+logErrorCode(
+    const char* msg,
+    const char* codeName,
+    std::int64_t code,
+    ErrorClass cls = ErrorClass::LocalProgrammingBug
+    )
+{
+    logRecord(
+        {
+            .format     = formatErrorCode,
+            .stream     = LogStream::Err,
+            .errorClass = cls,
+            .text       = {msg, codeName},
+            .num        = {code}
+        }
+        );
+}
+
+// Log a failed Winsock call with WSAGetLastError(). msg must be a string
+// literal.
+inline void
+logRawWSAError(
+    const char* msg
+    )
+{
+    int err = WSAGetLastError();
+
+    logErrorCode(
+        msg,
+        "WSAGetLastError",
+        err,
+        classifyWinsockError(err)
+        );
+}
+
+inline void
+formatSocketError(
+    std::ostream& out,
+    const LogRecord& rec
+    )
+{
+    switch (rec.errorClass)
+    {
+        case ErrorClass::NetworkOrRemoteIssue:
+            out << rec.text[0]
+                << ": network/remote closed or failed during " << rec.text[1] << " "
+                << "(WSA = " << rec.num[0] << ")\n";
+            break;
+        case ErrorClass::LocalProgrammingBug:
+            out << rec.text[0]
+                << ": local programming / socket misuse during " << rec.text[1] << " "
+                << "(WSA = " << rec.num[0] << ")\n";
+            break;
+        default:
+            out << rec.text[0]
+                << ": unexpected " << rec.text[1] << " error "
+                << "(WSA = " << rec.num[0] << ")\n";
+            break;
+    }
+}
+
+// Print a classified message for a failed socket call, e.g.
+// "client->target: network/remote closed or failed during recv() (WSA = 10054)".
+// directionLabel and operation must be string literals.
+inline void
+logSocketError(
+    const char* directionLabel,
+    const char* operation,
+    int err
+    )
+{
+    logRecord(
+        {
+            .format     = formatSocketError,
+            .stream     = LogStream::Err,
+            .errorClass = classifyWinsockError(err),
+            .text       = {directionLabel, operation},
+            .num        = {err}
+        }
+        );
+}
@@ -0,0 +1,475 @@
+﻿#pragma once
+
+#include "UpstreamPool.hpp"
+
+#include <winsock2.h>
+#include <afunix.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+enum class BalancePolicy
+{
+    RoundRobin,
+    LeastActive,
+    PowerOfTwoLatency,
+    ConsistentHash
+};
+
+inline const char*
+to_string(
+    BalancePolicy policy
+    )
+{
+    switch (policy)
+    {
+        case BalancePolicy::LeastActive: return "least-active";
+        case BalancePolicy::PowerOfTwoLatency: return "p2c-latency";
+        case BalancePolicy::ConsistentHash: return "consistent-hash";
+        default: return "round-robin";
+    }
+}
+
+// Inverse of to_string(); false for an unknown name.
+inline bool
+parseBalancePolicy(
+    std::string_view name,
+    BalancePolicy& policy
+    )
+{
+    for (BalancePolicy p : {BalancePolicy::RoundRobin, BalancePolicy::LeastActive, BalancePolicy::PowerOfTwoLatency, BalancePolicy::ConsistentHash})
+    {
+        if (name == to_string(p))
+        {
+            policy = p;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+class BackendSet;
+
+// One target the proxy can forward to, plus the live numbers the balancing
+// policies look at. Counters sit on their own cache line: every accept and
+// every close on any worker touches them.
+struct Backend
+{
+    sockaddr_in address {};
+    SOCKADDR_UN unixAddress {}; // AF_UNIX backends only
+    bool unixSocket {false};    // connect to unixAddress instead of address
+    std::string label;
+    BackendSet* set {nullptr};
+    std::size_t index {0};
+
+    // connectUs before the first sample.
+    static constexpr std::uint64_t kUnsampled = UINT64_MAX;
+
+    alignas(64) std::atomic<std::uint32_t> active {0};
+    std::atomic<std::uint64_t> connectUs {kUnsampled}; // EWMA of connect latency
+
+    // Optional warm connections to this backend. Declared after the counters,
+    // so it is destroyed, and its refill thread, which reports failed
+    // connects into them, stopped, before they are.
+    std::unique_ptr<UpstreamPool> warm;
+
+    void
+    recordConnectLatency(
+        std::chrono::microseconds latency
+        )
+    {
+        auto us = static_cast<std::uint64_t>(latency.count());
+
+        // EWMA with weight 1/8, seeded by the first sample. A lost update
+        // under a race only delays convergence slightly.
+        std::uint64_t avg = connectUs.load(std::memory_order_relaxed);
+        connectUs.store(
+            (avg != kUnsampled) ? avg - avg / 8 + us / 8 : us,
+            std::memory_order_relaxed
+            );
+    }
+
+    // A refused, failed or timed-out connect is sampled as if it had taken
+    // the whole connect timeout (a second at least), so a dead backend's
+    // average climbs instead of staying at its last good value, or unset.
+    void
+    recordConnectFailure(
+        std::chrono::milliseconds timeout
+        )
+    {
+        recordConnectLatency(std::max<std::chrono::microseconds>(
+            timeout,
+            std::chrono::seconds(1)
+            ));
+    }
+
+    // Called when a connection to this backend is created / destroyed.
+    inline void opened();
+    inline void closed();
+};
+
+// A fixed list of backends and the policy used to pick one per accept.
+//
+// Selection never takes a lock and costs O(1) (round-robin, least-active,
+// power-of-two) or O(log n) (consistent hashing):
+//  - least-active reads the root of a tournament tree over the active counts;
+//    each open/close replays only the leaf-to-root path of its backend.
+//    Concurrent replays can leave the root briefly pointing at a backend that
+//    is one or two connections away from the true minimum, which is fine for
+//    balancing purposes.
+//  - p2c-latency samples two distinct backends and keeps the one with the
+//    lower smoothed connect latency (ties go to fewer active connections).
+//    A backend with no sample yet loses to one with a sample, except while
+//    it has no connection of its own, so it is probed one connect at a time
+//    rather than either flooded or never measured.
+//  - consistent-hash maps the client IPv4 address onto a ring of virtual nodes
+//    so the same client keeps landing on the same backend while the set is up.
+class BackendSet
+{
+public:
+    // One backend to build: address for TCP, or unixAddress if unixSocket.
+    struct Target
+    {
+        sockaddr_in address {};
+        SOCKADDR_UN unixAddress {};
+        bool unixSocket {false};
+        std::string label;
+    };
+
+    BackendSet(
+        std::vector<Target> targets,
+        BalancePolicy policy
+        )
+        : m_policy(policy)
+    {
+        for (Target& t : targets)
+        {
+            auto b         = std::make_unique<Backend>();
+            b->address     = t.address;
+            b->unixAddress = t.unixAddress;
+            b->unixSocket  = t.unixSocket;
+            b->label       = std::move(t.label);
+            b->set         = this;
+            b->index       = m_backends.size();
+            m_backends.push_back(std::move(b));
+        }
+
+        buildTournament();
+        buildRing();
+    }
+
+    BackendSet(const BackendSet&)            = delete;
+    BackendSet& operator=(const BackendSet&) = delete;
+
+    BalancePolicy
+    policy() const noexcept
+    {
+        return m_policy;
+    }
+
+    std::size_t
+    size() const noexcept
+    {
+        return m_backends.size();
+    }
+
+    Backend&
+    operator[](
+        std::size_t i
+        )
+    {
+        return *m_backends[i];
+    }
+
+    // Give every TCP backend its own warm pool of minIdle connections. AF_UNIX
+    // connects are local and immediate, so there is nothing to pre-open. A
+    // pool's failed connects count against its backend like a client's, so
+    // p2c-latency steers away from a backend only the pool has found dead.
+    void
+    enableWarmPools(
+        unsigned minIdle,
+        std::chrono::milliseconds maxAge,
+        std::chrono::milliseconds connectTimeout,
+        DWORD socketFlags
+        )
+    {
+        for (auto& b : m_backends)
+        {
+            if (b->unixSocket)
+            {
+                continue;
+            }
+
+            b->warm = std::make_unique<UpstreamPool>(
+                b->address,
+                minIdle,
+                maxAge,
+                connectTimeout,
+                [backend = b.get(), connectTimeout] ()
+                {
+                    backend->recordConnectFailure(connectTimeout);
+                },
+                socketFlags
+                );
+        }
+    }
+
+    // Pick the backend for a new client. client may be null if the peer
+    // address is unknown; consistent hashing then falls back to round-robin.
+    Backend&
+    select(
+        const sockaddr_in* client
+        )
+    {
+        if (m_backends.size() == 1)
+        {
+            return *m_backends[0];
+        }
+
+        switch (m_policy)
+        {
+            case BalancePolicy::LeastActive:
+                return *m_backends[static_cast<std::size_t>(m_tree[1].load(std::memory_order_relaxed))];
+
+            case BalancePolicy::PowerOfTwoLatency:
+                return selectTwoChoices();
+
+            case BalancePolicy::ConsistentHash:
+                if (client)
+                {
+                    return selectByHash(client->sin_addr.s_addr);
+                }
+
+                break;
+
+            default:
+                break;
+        }
+
+        std::size_t n = m_next.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+
+        return *m_backends[n % m_backends.size()];
+    }
+
+private:
+    friend struct Backend;
+
+    static constexpr unsigned kVirtualNodes = 160;
+
+    // murmur3 fmix32: cheap and well distributed for 32-bit keys.
+    static std::uint32_t
+    mix32(
+        std::uint32_t h
+        )
+    {
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+
+        return h;
+    }
+
+    static std::uint64_t
+    nextRandom()
+    {
+        // xorshift64*, one stream per thread.
+        thread_local std::uint64_t state = 0x9E3779B97F4A7C15ull ^ reinterpret_cast<std::uintptr_t>(&state);
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    Backend&
+    selectTwoChoices()
+    {
+        std::size_t n = m_backends.size();
+        std::size_t a = static_cast<std::size_t>(nextRandom() % n);
+        std::size_t b = static_cast<std::size_t>(nextRandom() % (n - 1));
+
+        if (b >= a)
+        {
+            ++b;
+        }
+
+        Backend& x = *m_backends[a];
+        Backend& y = *m_backends[b];
+
+        std::uint64_t lx = x.connectUs.load(std::memory_order_relaxed);
+        std::uint64_t ly = y.connectUs.load(std::memory_order_relaxed);
+
+        if ((lx == Backend::kUnsampled) != (ly == Backend::kUnsampled))
+        {
+            Backend& unsampled = (lx == Backend::kUnsampled) ? x : y;
+            Backend& sampled   = (lx == Backend::kUnsampled) ? y : x;
+
+            return (unsampled.active.load(std::memory_order_relaxed) == 0) ? unsampled : sampled;
+        }
+
+        if (lx != ly)
+        {
+            return (lx < ly) ? x : y;
+        }
+
+        return (x.active.load(std::memory_order_relaxed) <= y.active.load(std::memory_order_relaxed)) ? x : y;
+    }
+
+    Backend&
+    selectByHash(
+        std::uint32_t clientAddr
+        )
+    {
+        std::uint32_t h = mix32(clientAddr);
+        auto it         = std::lower_bound(
+            m_ring.begin(),
+            m_ring.end(),
+            std::pair<std::uint32_t, std::uint32_t> {h, 0}
+            );
+
+        if (it == m_ring.end())
+        {
+            it = m_ring.begin();
+        }
+
+        return *m_backends[it->second];
+    }
+
+    void
+    buildRing()
+    {
+        m_ring.reserve(m_backends.size() * kVirtualNodes);
+
+        for (std::uint32_t i = 0; i < m_backends.size(); ++i)
+        {
+            // Seed from the address so the ring does not depend on the order
+            // backends were listed in.
+            const Backend& b   = *m_backends[i];
+            std::uint32_t seed = b.unixSocket
+                                     ? static_cast<std::uint32_t>(std::hash<std::string_view> {}(b.unixAddress.sun_path))
+                                     : mix32(b.address.sin_addr.s_addr ^ (std::uint32_t {b.address.sin_port} << 16));
+
+            for (std::uint32_t v = 0; v < kVirtualNodes; ++v)
+            {
+                m_ring.emplace_back(
+                    mix32(seed + v * 0x9E3779B9u),
+                    i
+                    );
+            }
+        }
+
+        std::sort(
+            m_ring.begin(),
+            m_ring.end()
+            );
+    }
+
+    // Heap-ordered tournament tree: node k's children are 2k and 2k+1, leaves
+    // start at m_leaves. Each node holds the index of the backend with the
+    // fewest active connections below it (-1 for padding leaves).
+    void
+    buildTournament()
+    {
+        m_leaves = 1;
+
+        while (m_leaves < m_backends.size())
+        {
+            m_leaves *= 2;
+        }
+
+        m_tree = std::make_unique<std::atomic<std::int32_t>[]>(2 * m_leaves);
+
+        for (std::size_t i = 0; i < m_leaves; ++i)
+        {
+            m_tree[m_leaves + i].store((i < m_backends.size()) ? static_cast<std::int32_t>(i) : -1);
+        }
+
+        for (std::size_t k = m_leaves - 1; k >= 1; --k)
+        {
+            m_tree[k].store(winner(k));
+        }
+    }
+
+    std::int32_t
+    winner(
+        std::size_t k
+        ) const
+    {
+        std::int32_t l = m_tree[2 * k].load(std::memory_order_relaxed);
+        std::int32_t r = m_tree[2 * k + 1].load(std::memory_order_relaxed);
+
+        if ((l < 0) || (r < 0))
+        {
+            return (l < 0) ? r : l;
+        }
+
+        return (m_backends[static_cast<std::size_t>(r)]->active.load(std::memory_order_relaxed) <
+                m_backends[static_cast<std::size_t>(l)]->active.load(std::memory_order_relaxed))
+                   ? r
+                   : l;
+    }
+
+    void
+    replay(
+        std::size_t index
+        )
+    {
+        if (m_policy != BalancePolicy::LeastActive)
+        {
+            return;
+        }
+
+        for (std::size_t k = (m_leaves + index) / 2; k >= 1; k /= 2)
+        {
+            m_tree[k].store(
+                winner(k),
+                std::memory_order_relaxed
+                );
+        }
+    }
+
+    BalancePolicy m_policy;
+    std::vector<std::unique_ptr<Backend>> m_backends;
+
+    alignas(64) std::atomic<std::size_t> m_next {0};
+
+    std::size_t m_leaves {1};
+    std::unique_ptr<std::atomic<std::int32_t>[]> m_tree;
+
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> m_ring; // (hash, backend index)
+};
+
+inline void
+Backend::opened()
+{
+    active.fetch_add(
+        1,
+        std::memory_order_relaxed
+        );
+    set->replay(index);
+}
+
+inline void
+Backend::closed()
+{
+    active.fetch_sub(
+        1,
+        std::memory_order_relaxed
+        );
+    set->replay(index);
+}
@@ -0,0 +1,286 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// A buffer on loan from a BufferPool. Empty (data == nullptr) when not held.
+struct PooledBuffer
+{
+    char* data {nullptr};
+    std::uint32_t size {0};
+    std::uint8_t sizeClass {0};
+
+    explicit
+    operator bool() const noexcept
+    {
+        return data != nullptr;
+    }
+};
+
+// Shared slab of I/O buffers in a few power-of-four size classes.
+//
+// Connections borrow a buffer only while data is in flight and give it back as
+// soon as the socket goes quiet, so idle connections cost no buffer memory.
+// Released buffers are cached per class (up to a limit) for reuse; the
+// counters let the cache limit be sized from real traffic.
+class BufferPool
+{
+public:
+    static constexpr std::size_t kClassCount = 4;
+
+    static constexpr std::array<std::uint32_t, kClassCount> kClassSizes = {
+        4 * 1024,
+        16 * 1024,
+        64 * 1024,
+        256 * 1024
+    };
+
+    struct ClassStats
+    {
+        std::uint32_t bufferSize;
+        std::uint64_t inUse;     // currently lent out
+        std::uint64_t highWater; // most ever lent out at once
+        std::uint64_t cached;    // idle in the free list
+        std::uint64_t allocated; // total heap allocations for this class
+    };
+
+    explicit BufferPool(
+        std::size_t maxCachedPerClass = 1024
+        )
+        : m_maxCached(maxCachedPerClass)
+    {
+    }
+
+    ~BufferPool()
+    {
+        for (std::size_t c = 0; c < kClassCount; ++c)
+        {
+            for (char* p : m_classes[c].freeList)
+            {
+                freeBuffer(p);
+            }
+        }
+    }
+
+    BufferPool(const BufferPool&)            = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Largest class whose buffers hold at most bytes; the smallest class if
+    // none is that small.
+    static std::uint8_t
+    largestClassWithin(
+        std::uint32_t bytes
+        ) noexcept
+    {
+        std::uint8_t c = 0;
+
+        while ((c + 1u < kClassCount) && (kClassSizes[c + 1] <= bytes))
+        {
+            ++c;
+        }
+
+        return c;
+    }
+
+    PooledBuffer
+    acquire(
+        std::uint8_t sizeClass
+        )
+    {
+        SizeClass& sc = m_classes[sizeClass];
+        char* data    = nullptr;
+
+        {
+            std::lock_guard lock(sc.mtx);
+
+            if (!sc.freeList.empty())
+            {
+                data = sc.freeList.back();
+                sc.freeList.pop_back();
+            }
+        }
+
+        if (!data)
+        {
+            data = static_cast<char*>(
+                ::operator new(
+                    kClassSizes[sizeClass],
+                    kAlignment
+                    )
+                );
+            sc.allocated.fetch_add(
+                1,
+                std::memory_order_relaxed
+                );
+        }
+
+        std::uint64_t inUse = sc.inUse.fetch_add(
+            1,
+            std::memory_order_relaxed
+            ) + 1;
+        std::uint64_t high = sc.highWater.load(std::memory_order_relaxed);
+
+        while (
+            (inUse > high) && !sc.highWater.compare_exchange_weak(
+                high,
+                inUse,
+                std::memory_order_relaxed
+                )
+            )
+        {
+        }
+
+        return {data, kClassSizes[sizeClass], sizeClass};
+    }
+
+    void
+    release(
+        PooledBuffer& buffer
+        )
+    {
+        if (!buffer)
+        {
+            return;
+        }
+
+        SizeClass& sc = m_classes[buffer.sizeClass];
+        sc.inUse.fetch_sub(
+            1,
+            std::memory_order_relaxed
+            );
+
+        bool cached = false;
+
+        {
+            std::lock_guard lock(sc.mtx);
+
+            if (sc.freeList.size() < m_maxCached)
+            {
+                sc.freeList.push_back(buffer.data);
+                cached = true;
+            }
+        }
+
+        if (!cached)
+        {
+            freeBuffer(buffer.data);
+        }
+
+        buffer = {};
+    }
+
+    std::array<ClassStats, kClassCount>
+    snapshot()
+    {
+        std::array<ClassStats, kClassCount> out {};
+
+        for (std::size_t c = 0; c < kClassCount; ++c)
+        {
+            SizeClass& sc = m_classes[c];
+            out[c].bufferSize = kClassSizes[c];
+            out[c].inUse      = sc.inUse.load(std::memory_order_relaxed);
+            out[c].highWater  = sc.highWater.load(std::memory_order_relaxed);
+            out[c].allocated  = sc.allocated.load(std::memory_order_relaxed);
+
+            std::lock_guard lock(sc.mtx);
+            out[c].cached = sc.freeList.size();
+        }
+
+        return out;
+    }
+
+private:
+    static constexpr std::align_val_t kAlignment {4096};
+
+    // Each class padded to whole cache lines (it spans more than one), so
+    // workers hammering different classes never share a line.
+    struct alignas(64) SizeClass
+    {
+        std::mutex mtx;
+        std::vector<char*> freeList;
+        std::atomic<std::uint64_t> inUse {0};
+        std::atomic<std::uint64_t> highWater {0};
+        std::atomic<std::uint64_t> allocated {0};
+    };
+
+    static void
+    freeBuffer(
+        char* p
+        )
+    {
+        ::operator delete(
+            p,
+            kAlignment
+            );
+    }
+
+    std::size_t m_maxCached;
+    std::array<SizeClass, kClassCount> m_classes;
+};
+
+// Per-direction size-class choice. A direction that keeps filling its buffer
+// moves up a class; one that keeps using only a small part of it moves back
+// down so long-lived connections do not hold on to bulk-sized buffers.
+struct BufferSizing
+{
+    static constexpr unsigned kGrowAfterFullReads    = 4;
+    static constexpr unsigned kShrinkAfterSmallReads = 32;
+
+    // Bytes, not ints: a relay carries one. Both counters stop at their
+    // threshold, so they cannot wrap while the class is pinned at 0 or at
+    // maxClass and has nowhere to move.
+    std::uint8_t sizeClass {0};
+    std::uint8_t fullReads {0};
+    std::uint8_t smallReads {0};
+    std::uint8_t maxClass {BufferPool::kClassCount - 1}; // never grows past this
+
+    void
+    record(
+        std::uint32_t bytes,
+        std::uint32_t capacity
+        )
+    {
+        if (bytes == capacity)
+        {
+            smallReads = 0;
+
+            if (fullReads < kGrowAfterFullReads)
+            {
+                ++fullReads;
+            }
+
+            if ((fullReads == kGrowAfterFullReads) && (sizeClass < maxClass))
+            {
+                ++sizeClass;
+                fullReads = 0;
+            }
+
+            return;
+        }
+
+        fullReads = 0;
+
+        if (bytes < capacity / 4)
+        {
+            if (smallReads < kShrinkAfterSmallReads)
+            {
+                ++smallReads;
+            }
+
+            if ((smallReads == kShrinkAfterSmallReads) && (sizeClass > 0))
+            {
+                --sizeClass;
+                smallReads = 0;
+            }
+        }
+        else
+        {
+            smallReads = 0;
+        }
+    }
+};
@@ -0,0 +1,422 @@
+﻿#pragma once
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A 128-bit address as two big-endian halves, so prefixes compare with plain
+// integer operations. IPv4 addresses are stored IPv4-mapped (::ffff:a.b.c.d),
+// which lets one trie hold both families.
+struct IpKey
+{
+    std::uint64_t hi {0};
+    std::uint64_t lo {0};
+
+    static IpKey
+    fromV4(
+        const in_addr& addr
+        ) noexcept
+    {
+        return {0, 0x0000FFFF00000000ull | ntohl(addr.s_addr)};
+    }
+
+    static IpKey
+    fromV6(
+        const in6_addr& addr
+        ) noexcept
+    {
+        unsigned char bytes[16];
+        std::memcpy(
+            bytes,
+            &addr,
+            sizeof(bytes)
+            );
+
+        IpKey key;
+
+        for (int i = 0; i < 8; ++i)
+        {
+            key.hi = (key.hi << 8) | bytes[i];
+            key.lo = (key.lo << 8) | bytes[8 + i];
+        }
+
+        return key;
+    }
+
+    // Bit i counted from the most significant end.
+    unsigned
+    bit(
+        unsigned i
+        ) const noexcept
+    {
+        return (i < 64) ? static_cast<unsigned>(hi >> (63 - i)) & 1 : static_cast<unsigned>(lo >> (127 - i)) & 1;
+    }
+
+    // Only the first len bits kept.
+    IpKey
+    masked(
+        unsigned len
+        ) const noexcept
+    {
+        IpKey key;
+        key.hi = (len == 0) ? 0 : (len >= 64) ? hi : hi & ~(~0ull >> len);
+        key.lo = (len <= 64) ? 0 : (len >= 128) ? lo : lo & ~(~0ull >> (len - 64));
+
+        return key;
+    }
+
+    // Number of leading bits a and b share (128 if equal).
+    friend unsigned
+    commonPrefix(
+        const IpKey& a,
+        const IpKey& b
+        ) noexcept
+    {
+        if (std::uint64_t diff = a.hi ^ b.hi)
+        {
+            return static_cast<unsigned>(std::countl_zero(diff));
+        }
+
+        return 64 + static_cast<unsigned>(std::countl_zero(a.lo ^ b.lo));
+    }
+};
+
+// Parse "a.b.c.d[/n]" or an IPv6 address with an optional "/n" into a key and
+// a prefix length on the key's 128-bit scale. A bare address is a host route.
+// Bits past the prefix are ignored.
+inline bool
+parseCidr(
+    std::string_view text,
+    IpKey& key,
+    unsigned& len
+    )
+{
+    std::size_t slash = text.find('/');
+    std::string addr(text.substr(
+        0,
+        slash
+        ));
+    bool v6         = (addr.find(':') != std::string::npos);
+    unsigned maxLen = v6 ? 128 : 32;
+    unsigned bits   = maxLen;
+
+    if (slash != std::string_view::npos)
+    {
+        std::string_view digits = text.substr(slash + 1);
+
+        if (digits.empty() || (digits.size() > 3))
+        {
+            return false;
+        }
+
+        bits = 0;
+
+        for (char c : digits)
+        {
+            if ((c < '0') || (c > '9'))
+            {
+                return false;
+            }
+
+            bits = bits * 10 + static_cast<unsigned>(c - '0');
+        }
+
+        if (bits > maxLen)
+        {
+            return false;
+        }
+    }
+
+    if (v6)
+    {
+        in6_addr a6 {};
+
+        if (
+            inet_pton(
+                AF_INET6,
+                addr.c_str(),
+                &a6
+                ) != 1
+            )
+        {
+            return false;
+        }
+
+        key = IpKey::fromV6(a6);
+        len = bits;
+    }
+    else
+    {
+        in_addr a4 {};
+
+        if (
+            inet_pton(
+                AF_INET,
+                addr.c_str(),
+                &a4
+                ) != 1
+            )
+        {
+            return false;
+        }
+
+        key = IpKey::fromV4(a4);
+        len = 96 + bits;
+    }
+
+    key = key.masked(len);
+
+    return true;
+}
+
+enum class CidrVerdict : std::uint8_t
+{
+    None,
+    Allow,
+    Deny
+};
+
+// Longest-prefix-match table of CIDR prefixes, as a path-compressed binary
+// (Patricia) trie.
+//
+// Each node stores a whole prefix and branches on the first bit after it, so
+// chains of single-child nodes never exist: a lookup visits at most one node
+// per distinct prefix length on its path and does one 128-bit compare per
+// node, O(prefix length) in the worst case and a handful of nodes in practice.
+// Nodes are 32 bytes in one vector and refer to each other by index, so the
+// whole trie is a single allocation that can be copied or dropped at once.
+//
+// Like poptrie's direct pointing, index() then records for every IPv4 /16
+// where its walk leaves the top of the trie, so an IPv4 lookup starts right
+// there instead of chasing a dozen or more nodes (and cache misses) first.
+// Built once and then only read; concurrent lookups need no synchronization.
+class CidrTrie
+{
+public:
+    CidrTrie()
+    {
+        m_nodes.push_back({}); // ::/0, no verdict
+    }
+
+    // Add or overwrite the verdict for prefix/len (len on the 128-bit scale).
+    void
+    insert(
+        const IpKey& prefix,
+        unsigned len,
+        CidrVerdict verdict
+        )
+    {
+        IpKey key       = prefix.masked(len);
+        std::uint32_t i = 0;
+
+        m_v4Index.clear();
+
+        while (true)
+        {
+            Node& node = m_nodes[i];
+
+            if (node.len == len)
+            {
+                m_prefixes += (node.verdict == CidrVerdict::None) ? 1 : 0;
+                node.verdict = verdict;
+
+                return;
+            }
+
+            unsigned side   = key.bit(node.len);
+            std::uint32_t c = node.child[side];
+
+            if (!c)
+            {
+                std::uint32_t leaf = add(
+                    key,
+                    len,
+                    verdict
+                    );
+                m_nodes[i].child[side] = leaf;
+
+                return;
+            }
+
+            unsigned common = std::min({commonPrefix(key, m_nodes[c].key), unsigned {m_nodes[c].len}, len});
+
+            if (common == m_nodes[c].len)
+            {
+                i = c;
+                continue;
+            }
+
+            // key leaves the child's prefix early: put a node for the shared
+            // part in between.
+            std::uint32_t mid = add(
+                key.masked(common),
+                common,
+                CidrVerdict::None
+                );
+            m_nodes[mid].child[m_nodes[c].key.bit(common)] = c;
+            m_nodes[i].child[side]                         = mid;
+
+            if (common == len)
+            {
+                m_nodes[mid].verdict = verdict;
+                ++m_prefixes;
+            }
+            else
+            {
+                std::uint32_t leaf = add(
+                    key,
+                    len,
+                    verdict
+                    );
+                m_nodes[mid].child[key.bit(common)] = leaf;
+            }
+
+            return;
+        }
+    }
+
+    // Build the IPv4 index; call after the last insert() (another insert()
+    // drops it). Lookups work without it, only slower.
+    void
+    index()
+    {
+        m_v4Index.resize(kV4Blocks);
+
+        for (std::uint32_t block = 0; block < kV4Blocks; ++block)
+        {
+            in_addr a {};
+            a.s_addr = htonl(block << 16);
+            IpKey key     = IpKey::fromV4(a);
+            Start& start  = m_v4Index[block];
+            const Node* n = m_nodes.data();
+            start.verdict = n->verdict;
+
+            // Every address of the block shares these nodes' prefixes.
+            while (true)
+            {
+                std::uint32_t c = n->child[key.bit(n->len)];
+
+                if (!c || (m_nodes[c].len > kV4BlockBits) || (commonPrefix(key, m_nodes[c].key) < m_nodes[c].len))
+                {
+                    break;
+                }
+
+                start.node = c;
+                n          = &m_nodes[c];
+
+                if (n->verdict != CidrVerdict::None)
+                {
+                    start.verdict = n->verdict;
+                }
+            }
+        }
+    }
+
+    // Verdict of the longest prefix containing addr, None if there is none.
+    CidrVerdict
+    lookup(
+        const IpKey& addr
+        ) const noexcept
+    {
+        const Node* node    = m_nodes.data();
+        CidrVerdict verdict = node->verdict;
+
+        if (!m_v4Index.empty() && (addr.hi == 0) && ((addr.lo >> 32) == 0xFFFF))
+        {
+            const Start& start = m_v4Index[(addr.lo >> 16) & 0xFFFF];
+            node               = &m_nodes[start.node];
+            verdict            = start.verdict;
+        }
+
+        while (node->len < 128)
+        {
+            std::uint32_t c = node->child[addr.bit(node->len)];
+
+            if (!c)
+            {
+                break;
+            }
+
+            node = &m_nodes[c];
+
+            if (commonPrefix(addr, node->key) < node->len)
+            {
+                break;
+            }
+
+            if (node->verdict != CidrVerdict::None)
+            {
+                verdict = node->verdict;
+            }
+        }
+
+        return verdict;
+    }
+
+    std::size_t
+    prefixes() const noexcept
+    {
+        return m_prefixes;
+    }
+
+    std::size_t
+    bytes() const noexcept
+    {
+        return m_nodes.size() * sizeof(Node) + m_v4Index.size() * sizeof(Start);
+    }
+
+private:
+    // ::ffff:a.b.0.0/112, i.e. an IPv4 /16.
+    static constexpr unsigned kV4BlockBits   = 112;
+    static constexpr std::uint32_t kV4Blocks = 1u << 16;
+
+    struct Node
+    {
+        IpKey key;                  // prefix, bits past len zero
+        std::uint32_t child[2] {}; // 0 = none (the root is never a child)
+        std::uint8_t len {0};       // 0..128
+        CidrVerdict verdict {CidrVerdict::None};
+    };
+
+    static_assert(sizeof(Node) == 32);
+
+    // Where the lookup of an address in one IPv4 /16 continues from.
+    struct Start
+    {
+        std::uint32_t node {0};
+        CidrVerdict verdict {CidrVerdict::None};
+    };
+
+    std::uint32_t
+    add(
+        const IpKey& key,
+        unsigned len,
+        CidrVerdict verdict
+        )
+    {
+        Node node;
+        node.key     = key;
+        node.len     = static_cast<std::uint8_t>(len);
+        node.verdict = verdict;
+        m_nodes.push_back(node);
+
+        if (verdict != CidrVerdict::None)
+        {
+            ++m_prefixes;
+        }
+
+        return static_cast<std::uint32_t>(m_nodes.size() - 1);
+    }
+
+    std::vector<Node> m_nodes;
+    std::vector<Start> m_v4Index; // by IPv4 /16, empty until index()
+    std::size_t m_prefixes {0};
+};
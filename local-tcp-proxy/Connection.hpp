@@ -0,0 +1,1225 @@
+﻿#pragma once
+
+#include "AdmissionControl.hpp"
+#include "AsyncLog.hpp"
+#include "BackendSet.hpp"
+#include "BufferPool.hpp"
+#include "IoReactor.hpp"
+#include "Metrics.hpp"
+#include "RioEngine.hpp"
+#include "Slab.hpp"
+#include "WinsockError.hpp"
+
+#include <winsock2.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+struct Connection;
+
+// How a connection moves payload between its two sockets.
+//
+// Copy:     wait for readability, recv() into our buffer, WSASend() it out.
+//           Winsock copies the data out of its receive buffer and into its send
+//           buffer, so each chunk is copied twice on top of the network stack.
+//           The buffer is borrowed from the pool only while data is flowing.
+// Overlapped: keep an overlapped WSARecv() posted so incoming data lands
+//           directly in our buffer instead of being staged in the socket
+//           receive buffer and copied out. That saves the receive-side copy
+//           only; it is not zero-copy. Sends still copy into the socket send
+//           buffer (with SO_SNDBUF = 0 a send completes only once the peer has
+//           ACKed it, and with one send in flight per direction a bulk
+//           transfer would move one buffer per round trip), and Windows has
+//           no splice() to hand data from one socket to another. The cost is a
+//           buffer pinned per direction even while the connection is idle.
+// Registered: like Overlapped, but through Registered I/O: receives and sends go
+//           through per-socket RIO request queues out of a pre-registered
+//           slice, and completions are reaped in batches (see RioEngine).
+enum class ForwardMode
+{
+    Copy,
+    Overlapped,
+    Registered
+};
+
+inline const char*
+to_string(
+    ForwardMode mode
+    )
+{
+    switch (mode)
+    {
+        case ForwardMode::Overlapped: return "overlapped-recv";
+        case ForwardMode::Registered: return "rio";
+        default: return "copy";
+    }
+}
+
+// One forwarding direction (src -> dst) of a connection.
+//
+// At most one overlapped operation is outstanding per relay, so its fields are
+// only ever touched by the worker handling the current completion. In copy mode
+// the relay cycles through: wait until src is readable (zero-byte WSARecv),
+// drain it with non-blocking recv(), push each chunk to dst with an overlapped
+// WSASend(). In overlapped mode the first step receives straight into buffer;
+// in registered mode it does the same with RIOReceive() into slice.
+struct Relay
+{
+    enum class Phase : std::uint8_t
+    {
+        WaitReadable,
+        Receiving,
+        Sending
+    };
+
+    Connection* conn {nullptr};
+    SOCKET src {INVALID_SOCKET};
+    SOCKET dst {INVALID_SOCKET};
+    const char* directionLabel {""};
+
+    // Flag associated with "send side" of dst.
+    std::atomic<bool>* shutdownFlag {nullptr};
+
+    IoOperation op;
+    Phase phase {Phase::WaitReadable};
+    BufferSizing sizing;
+    int pending {0};
+    PooledBuffer buffer;
+    int sent {0};
+
+    // Bytes delivered to dst so far, plus the process-wide total it feeds.
+    // Only the worker handling this relay's completion touches forwarded.
+    std::uint64_t forwarded {0};
+    StripedCounter* totalBytes {nullptr};
+
+    // Registered mode only: the request queues of src and dst, and the slice
+    // this relay receives into and sends from for its whole life.
+    RIO_RQ srcQueue {RIO_INVALID_RQ};
+    RIO_RQ dstQueue {RIO_INVALID_RQ};
+    RioOperation rioOp;
+    RioSlice slice;
+
+    // Timeout bookkeeping, in ticks of Connection::ticks (unused while that is
+    // null): when src last delivered data (kFinished once the relay is done),
+    // and since when a send to dst has been waiting without progress (0 = none
+    // pending). Written by the relay's worker, read by the ConnectionReaper.
+    static constexpr std::uint64_t kFinished = std::numeric_limits<std::uint64_t>::max();
+    std::atomic<std::uint64_t> lastReadTick {0};
+    std::atomic<std::uint64_t> sendSinceTick {0};
+
+    // Bandwidth limiting: how long to hold off the next read once the current
+    // chunk is out, and the wait itself (see AdmissionControl).
+    std::chrono::milliseconds pauseFor {0};
+    PausedRead paused;
+
+    // Holds the connection alive while this relay has an operation in flight.
+    SlabRef<Connection> keepAlive;
+};
+
+// Shared connection object, living in its shard's ConnectionTable.
+struct Connection
+{
+    // Whatever owns backend and admission.control (the route the client came
+    // in on). Declared first so it is released last, after the destructor
+    // below has finished with both.
+    std::shared_ptr<const void> owner;
+
+    SOCKET client {INVALID_SOCKET};
+    SOCKET target {INVALID_SOCKET};
+
+    BufferPool* pool {nullptr};
+
+    // Backend this connection counts against for load balancing.
+    Backend* backend {nullptr};
+
+    // Path chosen by startForwarding(); fixed for the life of the connection.
+    ForwardMode mode {ForwardMode::Copy};
+
+    // Largest buffer size class either relay may grow to.
+    std::uint8_t maxSizeClass {BufferPool::kClassCount - 1};
+
+    // Client bytes read before forwarding started (a handshake that had to be
+    // read to pick the backend), sent to the target ahead of everything else.
+    std::vector<char> preface;
+
+    // Ensure each direction only half-closes once.
+    std::atomic<bool> clientSendShutdownDone {false};
+    std::atomic<bool> targetSendShutdownDone {false};
+
+    // Set once startForwarding() has armed both relays.
+    bool forwarding {false};
+
+    // Set by abortConnection(). Relays stop issuing new operations once they
+    // see it, so the connection winds down through the normal finish() path.
+    std::atomic<bool> aborted {false};
+
+    Relay toTarget;
+    Relay toClient;
+
+    // Registered mode only. Both relays post to both request queues, which RIO
+    // does not synchronize, so posts go through rioMtx.
+    RioEngine* rio {nullptr};
+    RIO_RQ clientQueue {RIO_INVALID_RQ};
+    RIO_RQ targetQueue {RIO_INVALID_RQ};
+    std::mutex rioMtx;
+
+    // Clock of the ConnectionReaper watching this connection, if any; relays
+    // stamp their activity with it. Set before forwarding starts.
+    const std::atomic<std::uint64_t>* ticks {nullptr};
+
+    // Handed back to AdmissionControl when the connection closes.
+    AdmissionTicket admission;
+    std::chrono::steady_clock::time_point created {std::chrono::steady_clock::now()};
+
+    Connection()
+    {
+        proxyMetrics().active.add(1);
+    }
+
+    ~Connection()
+    {
+        // Final cleanup once the last reference is gone.
+        if (client != INVALID_SOCKET)
+        {
+            closesocket(client);
+        }
+
+        if (target != INVALID_SOCKET)
+        {
+            closesocket(target);
+        }
+
+        // Closing the sockets freed their request queues.
+        if (rio)
+        {
+            rio->releaseSocket();
+            rio->releaseSocket();
+        }
+
+        ProxyMetrics& m = proxyMetrics();
+        m.active.sub(1);
+        m.closed.add(1);
+
+        if (forwarding)
+        {
+            auto lifetime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - created);
+            m.connectionDuration.record(lifetime);
+
+            logRecord(
+                {
+                    .format = formatClosed,
+                    .stream = LogStream::Out,
+                    .num    = {
+                        static_cast<std::int64_t>(toTarget.forwarded),
+                        static_cast<std::int64_t>(toClient.forwarded),
+                        static_cast<std::int64_t>(lifetime.count() / 1000)
+                    }
+                },
+                backend ? std::string_view(backend->label) : std::string_view("?")
+                );
+        }
+
+        if (backend)
+        {
+            backend->closed();
+        }
+
+        if (admission.control)
+        {
+            admission.control->release(admission);
+        }
+    }
+
+    static void
+    formatClosed(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Connection closed: client -> " << rec.str
+            << ", " << rec.num[0] << " bytes up, "
+            << rec.num[1] << " bytes down, "
+            << rec.num[2] << " ms\n";
+    }
+};
+
+// Every connection of a shard, in place: a connection is a slot, not a heap
+// allocation, and the reaper and stats refer to it by handle.
+using ConnectionTable = Slab<Connection>;
+
+namespace relay_detail
+{
+
+inline void armReadable(Relay& r);
+inline void armReceive(Relay& r);
+inline void finish(Relay& r);
+inline void receiveRegistered(Relay& r);
+inline void sendRegistered(Relay& r);
+inline void pump(Relay& r);
+
+inline void
+formatShutdownMisuse(
+    std::ostream& out,
+    const LogRecord& rec
+    )
+{
+    out << rec.text[0] << ": shutdown(SD_SEND) local misuse? (WSA = " << rec.num[0] << ")\n";
+}
+
+inline std::uint64_t
+currentTick(
+    const Relay& r
+    )
+{
+    return r.conn->ticks->load(std::memory_order_relaxed);
+}
+
+// src delivered data.
+inline void
+noteRead(
+    Relay& r
+    )
+{
+    if (r.conn->ticks)
+    {
+        r.lastReadTick.store(
+            currentTick(r),
+            std::memory_order_relaxed
+            );
+    }
+}
+
+// A send to dst started or made progress; stalled reports whether any of the
+// chunk is still waiting to go out.
+inline void
+noteSend(
+    Relay& r,
+    bool stalled
+    )
+{
+    if (r.conn->ticks)
+    {
+        r.sendSinceTick.store(
+            stalled ? currentTick(r) : 0,
+            std::memory_order_relaxed
+            );
+    }
+}
+
+// Checked before queuing anything new. An operation queued just as the
+// connection is aborted can miss the cancel; the reaper keeps cancelling until
+// the connection is gone, so it is not left waiting forever.
+inline bool
+stopIfAborted(
+    Relay& r
+    )
+{
+    if (!r.conn->aborted.load())
+    {
+        return false;
+    }
+
+    finish(r);
+
+    return true;
+}
+
+// src delivered bytes; they count against the client's bandwidth.
+inline void
+chargeBandwidth(
+    Relay& r,
+    std::uint32_t bytes
+    )
+{
+    if (r.conn->admission.control)
+    {
+        r.pauseFor = r.conn->admission.control->charge(
+            r.conn->admission,
+            bytes
+            );
+    }
+}
+
+// Report a failed receive/send and wind the relay down. Failures caused by
+// abortConnection() were already reported there.
+inline void
+fail(
+    Relay& r,
+    const char* operation,
+    int err
+    )
+{
+    if (!r.conn->aborted.load())
+    {
+        logSocketError(
+            r.directionLabel,
+            operation,
+            err
+            );
+    }
+
+    finish(r);
+}
+
+// Make sure the relay holds a buffer of its current size class, trading in a
+// held buffer whose class no longer matches.
+inline void
+ensureBuffer(
+    Relay& r
+    )
+{
+    if (r.buffer && (r.buffer.sizeClass != r.sizing.sizeClass))
+    {
+        r.conn->pool->release(r.buffer);
+    }
+
+    if (!r.buffer)
+    {
+        r.buffer = r.conn->pool->acquire(r.sizing.sizeClass);
+    }
+}
+
+// Start the next read in whichever way this connection's mode uses.
+inline void
+readNext(
+    Relay& r
+    )
+{
+    switch (r.conn->mode)
+    {
+        case ForwardMode::Overlapped:
+            armReceive(r);
+            break;
+
+        case ForwardMode::Registered:
+            receiveRegistered(r);
+            break;
+
+        default:
+            pump(r);
+            break;
+    }
+}
+
+// Half-close our send side to dst exactly once per direction, then drop this
+// relay's reference. Must be the last thing done with r: releasing keepAlive
+// may destroy the Connection that owns it.
+inline void
+finish(
+    Relay& r
+    )
+{
+    if (r.conn->ticks)
+    {
+        r.lastReadTick.store(
+            Relay::kFinished,
+            std::memory_order_relaxed
+            );
+        r.sendSinceTick.store(
+            0,
+            std::memory_order_relaxed
+            );
+    }
+
+    // abortConnection() closes an aborted registered connection's sockets
+    // early, under rioMtx; taking it here keeps shutdown() off a closed handle.
+    bool registered = (r.conn->mode == ForwardMode::Registered);
+    std::unique_lock<std::mutex> rioLock;
+
+    if (registered)
+    {
+        rioLock = std::unique_lock(r.conn->rioMtx);
+    }
+
+    bool expected = false;
+
+    if (
+        !(registered && r.conn->aborted.load()) && r.shutdownFlag->compare_exchange_strong(
+            expected,
+            true
+            ) && (shutdown(
+            r.dst,
+            SD_SEND
+            ) == SOCKET_ERROR)
+        )
+    {
+        int err        = WSAGetLastError();
+        ErrorClass cls = classifyWinsockError(err);
+
+        // If it's a local bug, complain. If it's network-ish, it was dead anyway.
+        if (cls == ErrorClass::LocalProgrammingBug)
+        {
+            logRecord(
+                {
+                    .format     = formatShutdownMisuse,
+                    .stream     = LogStream::Err,
+                    .errorClass = cls,
+                    .text       = {r.directionLabel, ""},
+                    .num        = {err}
+                }
+                );
+        }
+    }
+
+    if (rioLock.owns_lock())
+    {
+        rioLock.unlock();
+    }
+
+    // NOTE:
+    // We do NOT call closesocket() here.
+    // Sockets are closed only in Connection::~Connection(),
+    // which runs once both relays have finished
+    // and all other references to the connection are gone
+    // (abortConnection() closes a registered connection's sockets early).
+    r.conn->pool->release(r.buffer);
+
+    if (r.conn->rio)
+    {
+        r.conn->rio->releaseSlice(r.slice);
+    }
+
+    auto last = std::move(r.keepAlive);
+}
+
+inline void
+sendPending(
+    Relay& r
+    )
+{
+    if (r.conn->mode == ForwardMode::Registered)
+    {
+        sendRegistered(r);
+
+        return;
+    }
+
+    if (stopIfAborted(r))
+    {
+        return;
+    }
+
+    r.op.reset();
+    r.op.socket = r.dst;
+    r.phase     = Relay::Phase::Sending;
+
+    WSABUF buf {};
+    buf.buf = r.buffer.data + r.sent;
+    buf.len = static_cast<ULONG>(r.pending - r.sent);
+
+    if (
+        WSASend(
+            r.dst,
+            &buf,
+            1,
+            nullptr,
+            0,
+            &r.op.overlapped,
+            nullptr
+            ) == SOCKET_ERROR
+        )
+    {
+        if (int err = WSAGetLastError(); err != WSA_IO_PENDING)
+        {
+            fail(
+                r,
+                "send()",
+                err
+                );
+        }
+    }
+}
+
+// Read whatever src has buffered and hand it to dst. Goes back to waiting for
+// readability (returning the buffer to the pool) once recv() would block.
+inline void
+pump(
+    Relay& r
+    )
+{
+    ensureBuffer(r);
+
+    int bytes = recv(
+        r.src,
+        r.buffer.data,
+        static_cast<int>(r.buffer.size),
+        0
+        );
+
+    if (bytes == 0)
+    {
+        finish(r);
+
+        return;
+    }
+
+    if (bytes < 0)
+    {
+        int err = WSAGetLastError();
+
+        if (err == WSAEWOULDBLOCK)
+        {
+            r.conn->pool->release(r.buffer);
+            armReadable(r);
+
+            return;
+        }
+
+        fail(
+            r,
+            "recv()",
+            err
+            );
+
+        return;
+    }
+
+    r.sizing.record(
+        static_cast<std::uint32_t>(bytes),
+        r.buffer.size
+        );
+    r.pending = bytes;
+    r.sent    = 0;
+    noteRead(r);
+    chargeBandwidth(
+        r,
+        static_cast<std::uint32_t>(bytes)
+        );
+    noteSend(
+        r,
+        true
+        );
+    sendPending(r);
+}
+
+// A zero-byte overlapped receive completes as soon as src has data (or EOF /
+// reset) without pinning a buffer for the lifetime of an idle connection.
+inline void
+armReadable(
+    Relay& r
+    )
+{
+    if (stopIfAborted(r))
+    {
+        return;
+    }
+
+    r.op.reset();
+    r.op.socket = r.src;
+    r.phase     = Relay::Phase::WaitReadable;
+
+    WSABUF buf {};
+    DWORD flags = 0;
+
+    if (
+        WSARecv(
+            r.src,
+            &buf,
+            1,
+            nullptr,
+            &flags,
+            &r.op.overlapped,
+            nullptr
+            ) == SOCKET_ERROR
+        )
+    {
+        if (int err = WSAGetLastError(); err != WSA_IO_PENDING)
+        {
+            fail(
+                r,
+                "recv()",
+                err
+                );
+        }
+    }
+}
+
+// Post a receive into buffer so the stack can place incoming data there
+// directly instead of staging it in the socket receive buffer.
+inline void
+armReceive(
+    Relay& r
+    )
+{
+    if (stopIfAborted(r))
+    {
+        return;
+    }
+
+    ensureBuffer(r);
+
+    r.op.reset();
+    r.op.socket = r.src;
+    r.phase     = Relay::Phase::Receiving;
+
+    WSABUF buf {};
+    buf.buf     = r.buffer.data;
+    buf.len     = static_cast<ULONG>(r.buffer.size);
+    DWORD flags = 0;
+
+    if (
+        WSARecv(
+            r.src,
+            &buf,
+            1,
+            nullptr,
+            &flags,
+            &r.op.overlapped,
+            nullptr
+            ) == SOCKET_ERROR
+        )
+    {
+        if (int err = WSAGetLastError(); err != WSA_IO_PENDING)
+        {
+            fail(
+                r,
+                "recv()",
+                err
+                );
+        }
+    }
+}
+
+// Post a registered receive into the relay's slice.
+inline void
+receiveRegistered(
+    Relay& r
+    )
+{
+    r.phase = Relay::Phase::Receiving;
+
+    RIO_BUF buf {};
+    buf.BufferId = r.slice.id;
+    buf.Offset   = r.slice.offset;
+    buf.Length   = RioEngine::kSliceSize;
+    int err      = 0;
+
+    {
+        std::lock_guard lock(r.conn->rioMtx);
+
+        // RIO requests cannot be cancelled; abortConnection() closes the
+        // sockets instead, so nothing may be posted after it.
+        if (r.conn->aborted.load())
+        {
+            err = WSAECONNABORTED;
+        }
+        else if (
+            !r.conn->rio->functions().RIOReceive(
+                r.srcQueue,
+                &buf,
+                1,
+                0,
+                &r.rioOp
+                )
+            )
+        {
+            err = WSAGetLastError();
+        }
+    }
+
+    if (err != 0)
+    {
+        fail(
+            r,
+            "recv()",
+            err
+            );
+    }
+}
+
+// Post a registered send of the unsent part of the slice.
+inline void
+sendRegistered(
+    Relay& r
+    )
+{
+    r.phase = Relay::Phase::Sending;
+
+    RIO_BUF buf {};
+    buf.BufferId = r.slice.id;
+    buf.Offset   = r.slice.offset + static_cast<ULONG>(r.sent);
+    buf.Length   = static_cast<ULONG>(r.pending - r.sent);
+    int err      = 0;
+
+    {
+        std::lock_guard lock(r.conn->rioMtx);
+
+        // RIO requests cannot be cancelled; abortConnection() closes the
+        // sockets instead, so nothing may be posted after it.
+        if (r.conn->aborted.load())
+        {
+            err = WSAECONNABORTED;
+        }
+        else if (
+            !r.conn->rio->functions().RIOSend(
+                r.dstQueue,
+                &buf,
+                1,
+                0,
+                &r.rioOp
+                )
+            )
+        {
+            err = WSAGetLastError();
+        }
+    }
+
+    if (err != 0)
+    {
+        fail(
+            r,
+            "send()",
+            err
+            );
+    }
+}
+
+// Advance r after its outstanding operation completed, whichever API it went
+// through.
+inline void
+onRelayProgress(
+    Relay& r,
+    DWORD bytes,
+    int error
+    )
+{
+    if (r.phase == Relay::Phase::WaitReadable)
+    {
+        if (error != 0)
+        {
+            fail(
+                r,
+                "recv()",
+                error
+                );
+
+            return;
+        }
+
+        pump(r);
+
+        return;
+    }
+
+    if (r.phase == Relay::Phase::Receiving)
+    {
+        if (error != 0)
+        {
+            fail(
+                r,
+                "recv()",
+                error
+                );
+
+            return;
+        }
+
+        if (bytes == 0)
+        {
+            finish(r);
+
+            return;
+        }
+
+        if (r.buffer)
+        {
+            r.sizing.record(
+                bytes,
+                r.buffer.size
+                );
+        }
+
+        r.pending = static_cast<int>(bytes);
+        r.sent    = 0;
+        noteRead(r);
+        chargeBandwidth(
+            r,
+            bytes
+            );
+        noteSend(
+            r,
+            true
+            );
+        sendPending(r);
+
+        return;
+    }
+
+    if (error != 0)
+    {
+        fail(
+            r,
+            "send()",
+            error
+            );
+
+        return;
+    }
+
+    r.sent      += static_cast<int>(bytes);
+    r.forwarded += bytes;
+    r.totalBytes->add(bytes);
+    noteSend(
+        r,
+        r.sent < r.pending
+        );
+
+    if (r.sent < r.pending)
+    {
+        sendPending(r);
+
+        return;
+    }
+
+    // Over its client's bandwidth: sit out the debt before reading again.
+    if (r.pauseFor.count() > 0)
+    {
+        proxyMetrics().pausedReads.add(1);
+        r.conn->admission.control->pause(
+            r.paused,
+            std::exchange(
+                r.pauseFor,
+                std::chrono::milliseconds(0)
+                )
+            );
+
+        return;
+    }
+
+    readNext(r);
+}
+
+// A bandwidth pause is over; runs on the AdmissionControl thread.
+inline void
+onPauseOver(
+    PausedRead& paused
+    )
+{
+    Relay& r = *static_cast<Relay*>(paused.owner);
+
+    // The wait was ours, not a silent peer's.
+    noteRead(r);
+    readNext(r);
+}
+
+inline void
+onRelayComplete(
+    IoOperation& op,
+    DWORD bytes,
+    int error
+    )
+{
+    onRelayProgress(
+        *static_cast<Relay*>(op.owner),
+        bytes,
+        error
+        );
+}
+
+inline void
+onRioComplete(
+    RioOperation& op,
+    ULONG bytes,
+    int error
+    )
+{
+    onRelayProgress(
+        *static_cast<Relay*>(op.owner),
+        bytes,
+        error
+        );
+}
+
+inline void
+initRelay(
+    Relay& r,
+    const SlabRef<Connection>& conn,
+    bool clientToTarget
+    )
+{
+    r.conn             = conn.get();
+    r.src              = clientToTarget ? conn->client : conn->target;
+    r.dst              = clientToTarget ? conn->target : conn->client;
+    r.directionLabel   = clientToTarget ? "client->target" : "target->client";
+    r.shutdownFlag     = clientToTarget ? &conn->targetSendShutdownDone : &conn->clientSendShutdownDone;
+    r.totalBytes       = clientToTarget ? &proxyMetrics().bytesToTarget : &proxyMetrics().bytesToClient;
+    r.op.owner         = &r;
+    r.op.onComplete    = onRelayComplete;
+    r.srcQueue         = clientToTarget ? conn->clientQueue : conn->targetQueue;
+    r.dstQueue         = clientToTarget ? conn->targetQueue : conn->clientQueue;
+    r.rioOp.owner      = &r;
+    r.rioOp.onComplete = onRioComplete;
+    r.paused.owner     = &r;
+    r.paused.onResume  = onPauseOver;
+    r.sizing.maxClass  = conn->maxSizeClass;
+    r.keepAlive        = conn.share();
+}
+
+// Hand conn.preface to the target. The target was only just connected and its
+// send buffer is empty, so a handshake-sized preface goes out in one
+// non-blocking send(); false (logged) if it does not.
+inline bool
+sendPreface(
+    Connection& conn
+    )
+{
+    int size = static_cast<int>(conn.preface.size());
+    int sent = send(
+        conn.target,
+        conn.preface.data(),
+        size,
+        0
+        );
+
+    if (sent != size)
+    {
+        if (sent == SOCKET_ERROR)
+        {
+            logRawWSAError("send() of the client's first bytes failed");
+        }
+        else
+        {
+            logMessage(
+                LogStream::Err,
+                "Target did not take the client's first bytes in one send()"
+                );
+        }
+
+        return false;
+    }
+
+    conn.toTarget.forwarded += static_cast<std::uint64_t>(size);
+    proxyMetrics().bytesToTarget.add(static_cast<std::uint64_t>(size));
+    std::vector<char>().swap(conn.preface);
+
+    return true;
+}
+
+// Give both sockets a request queue on rio and both relays a registered slice.
+// Returns false, with nothing held, if the engine is full or RIO refused, in
+// which case the connection falls back to the copy path.
+inline bool
+enableRegisteredIo(
+    Connection& conn,
+    RioEngine& rio
+    )
+{
+    if (!rio.reserveSocket())
+    {
+        return false;
+    }
+
+    if (!rio.reserveSocket())
+    {
+        rio.releaseSocket();
+
+        return false;
+    }
+
+    conn.toTarget.slice = rio.acquireSlice();
+    conn.toClient.slice = rio.acquireSlice();
+
+    if (conn.toTarget.slice && conn.toClient.slice)
+    {
+        conn.clientQueue = rio.createRequestQueue(
+            conn.client,
+            &conn
+            );
+        conn.targetQueue = (conn.clientQueue != RIO_INVALID_RQ)
+                               ? rio.createRequestQueue(
+                                     conn.target,
+                                     &conn
+                                     )
+                               : RIO_INVALID_RQ;
+
+        if (conn.targetQueue != RIO_INVALID_RQ)
+        {
+            conn.rio = &rio;
+
+            return true;
+        }
+
+        // A queue created on the client socket is simply left unused; it goes
+        // away with the socket.
+        logRawWSAError("RIOCreateRequestQueue() failed, using copy path");
+    }
+
+    rio.releaseSlice(conn.toTarget.slice);
+    rio.releaseSlice(conn.toClient.slice);
+    rio.releaseSocket();
+    rio.releaseSocket();
+
+    return false;
+}
+
+} // namespace relay_detail
+
+// Start forwarding on a connected client/target pair. Both sockets must already
+// be associated with the reactor's completion port; they are switched to
+// non-blocking mode here. From then on the connection lives for as long as
+// either direction is still forwarding. conn->mode reports the path actually
+// used, which is Copy if Registered was requested but could not be set up.
+// rio is only used for Registered and may be null otherwise.
+inline bool
+startForwarding(
+    BufferPool& pool,
+    RioEngine* rio,
+    const SlabRef<Connection>& conn,
+    ForwardMode requested
+    )
+{
+    conn->pool = &pool;
+
+    for (SOCKET s : {conn->client, conn->target})
+    {
+        u_long nonBlocking = 1;
+
+        if (
+            ioctlsocket(
+                s,
+                FIONBIO,
+                &nonBlocking
+                ) == SOCKET_ERROR
+            )
+        {
+            logRawWSAError("ioctlsocket(FIONBIO) failed");
+
+            return false;
+        }
+    }
+
+    // Ahead of anything the relays forward.
+    if (!conn->preface.empty() && !relay_detail::sendPreface(*conn))
+    {
+        return false;
+    }
+
+    if ((requested == ForwardMode::Registered) && rio && relay_detail::enableRegisteredIo(*conn, *rio))
+    {
+        conn->mode = ForwardMode::Registered;
+    }
+    else if (requested == ForwardMode::Overlapped)
+    {
+        conn->mode = ForwardMode::Overlapped;
+    }
+    else
+    {
+        conn->mode = ForwardMode::Copy;
+    }
+
+    relay_detail::initRelay(
+        conn->toTarget,
+        conn,
+        true
+        );
+    relay_detail::initRelay(
+        conn->toClient,
+        conn,
+        false
+        );
+
+    // Timeouts count from here.
+    relay_detail::noteRead(conn->toTarget);
+    relay_detail::noteRead(conn->toClient);
+
+    conn->forwarding = true;
+
+    switch (conn->mode)
+    {
+        case ForwardMode::Overlapped:
+            relay_detail::armReceive(conn->toTarget);
+            relay_detail::armReceive(conn->toClient);
+            break;
+
+        case ForwardMode::Registered:
+            relay_detail::receiveRegistered(conn->toTarget);
+            relay_detail::receiveRegistered(conn->toClient);
+            break;
+
+        default:
+            relay_detail::armReadable(conn->toTarget);
+            relay_detail::armReadable(conn->toClient);
+            break;
+    }
+
+    return true;
+}
+
+// Cancel whatever overlapped I/O is pending on conn's sockets. Registered
+// connections have nothing to cancel once aborted.
+inline void
+cancelPending(
+    Connection& conn
+    )
+{
+    if (conn.mode == ForwardMode::Registered)
+    {
+        return;
+    }
+
+    for (SOCKET s : {conn.client, conn.target})
+    {
+        CancelIoEx(
+            reinterpret_cast<HANDLE>(s),
+            nullptr
+            );
+    }
+}
+
+// Tear conn down from outside its relays, e.g. when it timed out. Whatever is
+// pending completes with an error and each relay finishes as it would after a
+// reset; until both have, the caller should repeat cancelPending() now and
+// then to catch operations queued while this ran. Returns false if conn was
+// already being aborted.
+inline bool
+abortConnection(
+    Connection& conn
+    )
+{
+    if (conn.aborted.exchange(true))
+    {
+        return false;
+    }
+
+    // Reset on close instead of lingering on a peer that has gone away.
+    LINGER abortive {};
+    abortive.l_onoff  = 1;
+    abortive.l_linger = 0;
+
+    for (SOCKET s : {conn.client, conn.target})
+    {
+        setsockopt(
+            s,
+            SOL_SOCKET,
+            SO_LINGER,
+            reinterpret_cast<const char*>(&abortive),
+            sizeof(abortive)
+            );
+    }
+
+    if (conn.mode == ForwardMode::Registered)
+    {
+        // RIO requests cannot be cancelled, but closing the sockets completes
+        // them. Relays only post or shut down under rioMtx after checking
+        // aborted, so they never touch the closed handles.
+        std::lock_guard lock(conn.rioMtx);
+        closesocket(conn.client);
+        closesocket(conn.target);
+        conn.client = INVALID_SOCKET;
+        conn.target = INVALID_SOCKET;
+
+        return true;
+    }
+
+    cancelPending(conn);
+
+    return true;
+}
@@ -0,0 +1,408 @@
+﻿#pragma once
+
+#include "AsyncLog.hpp"
+#include "Connection.hpp"
+#include "Metrics.hpp"
+#include "TimingWheel.hpp"
+#include "WinsockError.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <stop_token>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// How long a connection may go without progress; zero disables a timeout.
+// Read timeouts are per peer (how long it may stay silent), write timeouts
+// how long data for that peer may wait without any of it being taken.
+struct ConnectionTimeouts
+{
+    std::chrono::milliseconds idle {0}; // nothing in either direction
+    std::chrono::milliseconds clientRead {0};
+    std::chrono::milliseconds targetRead {0};
+    std::chrono::milliseconds clientWrite {0};
+    std::chrono::milliseconds targetWrite {0};
+
+    bool
+    any() const noexcept
+    {
+        return (idle.count() > 0) || (clientRead.count() > 0) || (targetRead.count() > 0) || (clientWrite.count() > 0)
+            || (targetWrite.count() > 0);
+    }
+};
+
+// Closes connections that stopped making progress, e.g. a client whose NAT
+// silently dropped the flow, which would otherwise hold both sockets forever.
+//
+// Relays never touch the timer itself: on each receive or send they store the
+// current tick of this reaper's clock into their own cache line, which is one
+// relaxed store and no lock or syscall. Each watched connection has a single
+// timer in a hierarchical TimingWheel, armed for the earliest moment any of its
+// timeouts could run out. When it fires, the reaper compares the stamps with
+// the timeouts and either aborts the connection or re-arms the timer for the
+// new earliest moment, so a busy connection costs one timer visit per timeout
+// period instead of a timer update per I/O. Timeouts are accurate to one tick.
+class ConnectionReaper
+{
+public:
+    static constexpr std::chrono::milliseconds kTick {100};
+
+    explicit ConnectionReaper(
+        const ConnectionTimeouts& timeouts
+        )
+        : m_idle(toTicks(timeouts.idle))
+        , m_clientRead(toTicks(timeouts.clientRead))
+        , m_targetRead(toTicks(timeouts.targetRead))
+        , m_clientWrite(toTicks(timeouts.clientWrite))
+        , m_targetWrite(toTicks(timeouts.targetWrite))
+    {
+        for (std::uint64_t t : {m_idle, m_clientRead, m_targetRead, m_clientWrite, m_targetWrite})
+        {
+            if (t && (!m_firstCheck || (t < m_firstCheck)))
+            {
+                m_firstCheck = t;
+            }
+        }
+
+        m_thread = std::jthread(
+            [this] (std::stop_token st)
+            {
+                run(st);
+            }
+            );
+    }
+
+    ~ConnectionReaper()
+    {
+        m_thread.request_stop();
+        m_thread.join();
+
+        m_wheel.clear(
+            [] (TimerNode& node)
+            {
+                delete static_cast<Entry*>(node.context);
+            }
+            );
+    }
+
+    ConnectionReaper(const ConnectionReaper&)            = delete;
+    ConnectionReaper& operator=(const ConnectionReaper&) = delete;
+
+    // What relays stamp their activity with (Connection::ticks).
+    const std::atomic<std::uint64_t>&
+    clock() const noexcept
+    {
+        return m_clock;
+    }
+
+    // Start enforcing the timeouts on conn, which must be forwarding with
+    // conn->ticks pointing at clock().
+    void
+    watch(
+        const SlabRef<Connection>& conn
+        )
+    {
+        auto* entry         = new Entry {};
+        entry->node.context = entry;
+        entry->table        = conn.slab();
+        entry->conn         = conn.handle();
+
+        std::lock_guard lock(m_mtx);
+        m_wheel.schedule(
+            entry->node,
+            m_wheel.now() + m_firstCheck
+            );
+    }
+
+private:
+    static constexpr std::uint64_t kNever = std::numeric_limits<std::uint64_t>::max();
+
+    // The wheel only holds a handle: a connection that closes on its own goes
+    // away at once, and its entry is dropped when the timer next fires.
+    struct Entry
+    {
+        TimerNode node;
+        ConnectionTable* table {nullptr};
+        SlabHandle conn;
+    };
+
+    static std::uint64_t
+    toTicks(
+        std::chrono::milliseconds timeout
+        )
+    {
+        if (timeout.count() <= 0)
+        {
+            return 0;
+        }
+
+        return std::max<std::uint64_t>(
+            (timeout + kTick - std::chrono::milliseconds(1)) / kTick,
+            1
+            );
+    }
+
+    static void
+    formatReaped(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Connection reaped: client -> " << rec.str << " (" << rec.text[0] << ")\n";
+    }
+
+    // The first timeout conn has run out of, or ReapReason::Count with next
+    // set to the tick at which one could run out next (kNever if none can).
+    ReapReason
+    check(
+        const Connection& conn,
+        std::uint64_t now,
+        std::uint64_t& next
+        ) const
+    {
+        ReapReason verdict = ReapReason::Count;
+        next               = kNever;
+
+        auto consider = [&] (std::uint64_t timeout, std::uint64_t since, ReapReason reason)
+            {
+                if (!timeout)
+                {
+                    return;
+                }
+
+                if (since + timeout <= now)
+                {
+                    if (verdict == ReapReason::Count)
+                    {
+                        verdict = reason;
+                    }
+                }
+                else
+                {
+                    next = std::min(
+                        next,
+                        since + timeout
+                        );
+                }
+            };
+
+        std::uint64_t fromClient = conn.toTarget.lastReadTick.load(std::memory_order_relaxed);
+        std::uint64_t fromTarget = conn.toClient.lastReadTick.load(std::memory_order_relaxed);
+        bool clientOpen          = (fromClient != Relay::kFinished);
+        bool targetOpen          = (fromTarget != Relay::kFinished);
+
+        // A peer that half-closed is done sending; only the other one counts.
+        if (clientOpen || targetOpen)
+        {
+            consider(
+                m_idle,
+                std::max(
+                    clientOpen ? fromClient : 0,
+                    targetOpen ? fromTarget : 0
+                    ),
+                ReapReason::Idle
+                );
+        }
+
+        if (clientOpen)
+        {
+            consider(
+                m_clientRead,
+                fromClient,
+                ReapReason::ClientReadStall
+                );
+        }
+
+        if (targetOpen)
+        {
+            consider(
+                m_targetRead,
+                fromTarget,
+                ReapReason::TargetReadStall
+                );
+        }
+
+        // With no send waiting, a stall could at the earliest start now.
+        std::uint64_t toClientSince = conn.toClient.sendSinceTick.load(std::memory_order_relaxed);
+        std::uint64_t toTargetSince = conn.toTarget.sendSinceTick.load(std::memory_order_relaxed);
+
+        consider(
+            m_clientWrite,
+            toClientSince ? toClientSince : now,
+            ReapReason::ClientWriteStall
+            );
+        consider(
+            m_targetWrite,
+            toTargetSince ? toTargetSince : now,
+            ReapReason::TargetWriteStall
+            );
+
+        return verdict;
+    }
+
+    static void
+    reap(
+        Connection& conn,
+        ReapReason reason
+        )
+    {
+        if (!abortConnection(conn))
+        {
+            return;
+        }
+
+        proxyMetrics().reaped[static_cast<std::size_t>(reason)].add(1);
+        logRecord(
+            {
+                .format     = formatReaped,
+                .stream     = LogStream::Err,
+                .errorClass = ErrorClass::NetworkOrRemoteIssue,
+                .text       = {to_string(reason), ""}
+            },
+            conn.backend ? std::string_view(conn.backend->label) : std::string_view("?")
+            );
+    }
+
+    // A connection's timer fired: reap it or look again later.
+    void
+    review(
+        Entry& entry,
+        std::uint64_t now
+        )
+    {
+        SlabRef<Connection> conn = entry.table->acquire(entry.conn);
+
+        if (!conn)
+        {
+            delete &entry;
+
+            return;
+        }
+
+        std::uint64_t next = now + 1;
+
+        if (conn->aborted.load())
+        {
+            if ((conn->toClient.lastReadTick.load() == Relay::kFinished)
+                && (conn->toTarget.lastReadTick.load() == Relay::kFinished))
+            {
+                delete &entry;
+
+                return;
+            }
+
+            // Reaped earlier and still winding down: keep cancelling in case
+            // a relay queued something just as it was aborted.
+            cancelPending(*conn);
+        }
+        else
+        {
+            ReapReason reason = check(
+                *conn,
+                now,
+                next
+                );
+
+            if (reason != ReapReason::Count)
+            {
+                reap(
+                    *conn,
+                    reason
+                    );
+                next = now + 1;
+            }
+            else if (next == kNever)
+            {
+                delete &entry;
+
+                return;
+            }
+        }
+
+        std::lock_guard lock(m_mtx);
+        m_wheel.schedule(
+            entry.node,
+            next
+            );
+    }
+
+    void
+    run(
+        std::stop_token st
+        )
+    {
+        auto started = std::chrono::steady_clock::now();
+        std::mutex waitMtx;
+        std::condition_variable_any cv;
+        std::vector<Entry*> due;
+
+        while (!st.stop_requested())
+        {
+            {
+                std::unique_lock ul(waitMtx);
+                cv.wait_for(
+                    ul,
+                    st,
+                    kTick,
+                    [] ()
+                    {
+                        return false;
+                    }
+                    );
+            }
+
+            // Count ticks from the clock rather than from wakeups, so a late
+            // wakeup does not slow time down.
+            auto now = static_cast<std::uint64_t>((std::chrono::steady_clock::now() - started) / kTick);
+            m_clock.store(
+                now,
+                std::memory_order_relaxed
+                );
+
+            {
+                std::lock_guard lock(m_mtx);
+                m_wheel.advance(
+                    now,
+                    [&] (TimerNode& node)
+                    {
+                        due.push_back(static_cast<Entry*>(node.context));
+                    }
+                    );
+            }
+
+            // Outside the lock: reaping logs and may run the last owner's
+            // ~Connection().
+            for (Entry* entry : due)
+            {
+                review(
+                    *entry,
+                    now
+                    );
+            }
+
+            due.clear();
+        }
+    }
+
+    const std::uint64_t m_idle;
+    const std::uint64_t m_clientRead;
+    const std::uint64_t m_targetRead;
+    const std::uint64_t m_clientWrite;
+    const std::uint64_t m_targetWrite;
+    std::uint64_t m_firstCheck {0};
+
+    std::atomic<std::uint64_t> m_clock {0};
+
+    std::mutex m_mtx;
+    TimingWheel m_wheel;
+
+    // Last member: started in the constructor once everything above exists.
+    std::jthread m_thread;
+};
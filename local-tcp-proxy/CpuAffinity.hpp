@@ -0,0 +1,46 @@
+﻿#pragma once
+
+#include <Windows.h>
+
+// Logical processors across all processor groups.
+inline unsigned
+logicalCoreCount()
+{
+    DWORD count = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+
+    return count ? static_cast<unsigned>(count) : 1;
+}
+
+// Restrict the calling thread to one logical processor, numbered across all
+// processor groups in order (so machines with more than 64 work too). Returns
+// false if core does not exist or Windows refused.
+inline bool
+pinCurrentThread(
+    unsigned core
+    )
+{
+    WORD groups = GetActiveProcessorGroupCount();
+
+    for (WORD group = 0; group < groups; ++group)
+    {
+        DWORD inGroup = GetActiveProcessorCount(group);
+
+        if (core >= inGroup)
+        {
+            core -= inGroup;
+            continue;
+        }
+
+        GROUP_AFFINITY affinity {};
+        affinity.Group = group;
+        affinity.Mask  = KAFFINITY {1} << core;
+
+        return SetThreadGroupAffinity(
+            GetCurrentThread(),
+            &affinity,
+            nullptr
+            ) != FALSE;
+    }
+
+    return false;
+}
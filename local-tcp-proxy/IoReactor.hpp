@@ -0,0 +1,223 @@
+﻿#pragma once
+
+#include "CpuAffinity.hpp"
+
+#include <winsock2.h>
+#include <Windows.h>
+
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct IoOperation;
+
+// Called on a reactor worker when an operation completes. error is a Winsock
+// error code (0 on success) so callers can feed it to classifyWinsockError().
+using IoCompletionFn = void (*)(
+    IoOperation& op,
+    DWORD bytes,
+    int error
+    );
+
+// One overlapped request in flight. The OVERLAPPED must stay first so the
+// pointer handed back by the completion port maps straight back to the op.
+struct IoOperation
+{
+    OVERLAPPED overlapped {};
+    SOCKET socket {INVALID_SOCKET};
+    IoCompletionFn onComplete {nullptr};
+    void* owner {nullptr};
+
+    void
+    reset()
+    {
+        overlapped = {};
+    }
+};
+
+// Fixed pool of worker threads draining one I/O completion port.
+//
+// Sockets are associated once; every overlapped WSARecv()/WSASend() issued on
+// them then completes on whichever worker is free, so the number of threads no
+// longer depends on the number of connections.
+//
+// Given a core, every worker is pinned to that logical processor; with one
+// worker that makes the reactor a single-threaded event loop owning its core.
+class IoReactor
+{
+public:
+    static constexpr unsigned kAnyCore = ~0u;
+
+    explicit IoReactor(
+        unsigned workerCount,
+        unsigned core = kAnyCore
+        )
+    {
+        m_port = CreateIoCompletionPort(
+            INVALID_HANDLE_VALUE,
+            nullptr,
+            0,
+            0
+            );
+
+        if (!m_port)
+        {
+            throw std::runtime_error("CreateIoCompletionPort() failed (GetLastError = " + std::to_string(GetLastError()) + ")");
+        }
+
+        if (workerCount == 0)
+        {
+            workerCount = 1;
+        }
+
+        m_workers.reserve(workerCount);
+
+        for (unsigned i = 0; i < workerCount; ++i)
+        {
+            m_workers.emplace_back(
+                [this, core] ()
+                {
+                    if (core != kAnyCore)
+                    {
+                        pinCurrentThread(core);
+                    }
+
+                    run();
+                }
+                );
+        }
+    }
+
+    ~IoReactor()
+    {
+        // A null OVERLAPPED is the stop signal; one per worker.
+        for (size_t i = 0; i < m_workers.size(); ++i)
+        {
+            PostQueuedCompletionStatus(
+                m_port,
+                0,
+                0,
+                nullptr
+                );
+        }
+
+        m_workers.clear();
+        CloseHandle(m_port);
+    }
+
+    IoReactor(const IoReactor&)            = delete;
+    IoReactor& operator=(const IoReactor&) = delete;
+
+    bool
+    associate(
+        SOCKET s
+        )
+    {
+        return CreateIoCompletionPort(
+            reinterpret_cast<HANDLE>(s),
+            m_port,
+            0,
+            0
+            ) == m_port;
+    }
+
+    // Queue op for completion on a worker without any socket I/O.
+    bool
+    post(
+        IoOperation& op,
+        DWORD bytes = 0
+        )
+    {
+        return PostQueuedCompletionStatus(
+            m_port,
+            bytes,
+            0,
+            &op.overlapped
+            ) != FALSE;
+    }
+
+    // For APIs that signal this port themselves (e.g. RIO notifications).
+    HANDLE
+    port() const noexcept
+    {
+        return m_port;
+    }
+
+    size_t
+    workerCount() const noexcept
+    {
+        return m_workers.size();
+    }
+
+private:
+    static constexpr ULONG kBatchSize = 64;
+
+    void
+    run()
+    {
+        OVERLAPPED_ENTRY entries[kBatchSize];
+
+        while (true)
+        {
+            ULONG count = 0;
+
+            if (
+                !GetQueuedCompletionStatusEx(
+                    m_port,
+                    entries,
+                    kBatchSize,
+                    &count,
+                    INFINITE,
+                    FALSE
+                    )
+                )
+            {
+                // Only fails if the port itself is gone.
+                return;
+            }
+
+            for (ULONG i = 0; i < count; ++i)
+            {
+                OVERLAPPED_ENTRY& entry = entries[i];
+
+                if (!entry.lpOverlapped)
+                {
+                    return;
+                }
+
+                auto* op    = CONTAINING_RECORD(entry.lpOverlapped, IoOperation, overlapped);
+                DWORD bytes = entry.dwNumberOfBytesTransferred;
+                int error   = 0;
+
+                // Internal holds the NTSTATUS; let Winsock translate failures.
+                if ((entry.Internal != 0) && (op->socket != INVALID_SOCKET))
+                {
+                    DWORD flags = 0;
+
+                    if (
+                        !WSAGetOverlappedResult(
+                            op->socket,
+                            &op->overlapped,
+                            &bytes,
+                            FALSE,
+                            &flags
+                            )
+                        )
+                    {
+                        error = WSAGetLastError();
+                    }
+                }
+
+                op->onComplete(
+                    *op,
+                    bytes,
+                    error
+                    );
+            }
+        }
+    }
+
+    HANDLE m_port {nullptr};
+    std::vector<std::jthread> m_workers;
+};
@@ -0,0 +1,418 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Counter split across cache-line-sized cells. Each thread adds to its own
+// cell, so hot-path increments from many workers never contend; reads sum all
+// cells and may be a moment stale, which is all a stats snapshot needs.
+class StripedCounter
+{
+public:
+    void
+    add(
+        std::uint64_t n
+        ) noexcept
+    {
+        Cell& c = m_cells[stripe()];
+        c.value.fetch_add(
+            n,
+            std::memory_order_relaxed
+            );
+    }
+
+    void
+    sub(
+        std::uint64_t n
+        ) noexcept
+    {
+        Cell& c = m_cells[stripe()];
+        c.value.fetch_sub(
+            n,
+            std::memory_order_relaxed
+            );
+    }
+
+    std::uint64_t
+    load() const noexcept
+    {
+        std::uint64_t sum = 0;
+
+        for (const Cell& c : m_cells)
+        {
+            sum += c.value.load(std::memory_order_relaxed);
+        }
+
+        return sum;
+    }
+
+private:
+    static constexpr std::size_t kStripes = 32;
+
+    struct alignas(64) Cell
+    {
+        std::atomic<std::uint64_t> value {0};
+    };
+
+    static std::size_t
+    stripe() noexcept
+    {
+        static std::atomic<std::size_t> nextStripe {0};
+        thread_local std::size_t mine = nextStripe.fetch_add(
+            1,
+            std::memory_order_relaxed
+            ) % kStripes;
+
+        return mine;
+    }
+
+    std::array<Cell, kStripes> m_cells {};
+};
+
+// Log-linear histogram in the style of HdrHistogram: 16 sub-buckets per power
+// of two, i.e. every recorded value is kept to within ~6% of its true value,
+// from 1 us up to about 12 days. Recording is one relaxed fetch_add.
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned kSubBits    = 4;
+    static constexpr unsigned kSubBuckets = 1u << kSubBits;
+    static constexpr unsigned kMaxExp     = 40;
+    static constexpr std::size_t kBuckets = kSubBuckets + (kMaxExp - kSubBits + 1) * kSubBuckets;
+
+    void
+    record(
+        std::chrono::microseconds value
+        ) noexcept
+    {
+        std::uint64_t v = (value.count() > 0) ? static_cast<std::uint64_t>(value.count()) : 0;
+        m_counts[bucketOf(v)].fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+    }
+
+    struct Snapshot
+    {
+        std::array<std::uint64_t, kBuckets> counts {};
+        std::uint64_t total {0};
+
+        // Smallest value v such that at least q of the samples are <= v
+        // (reported as the upper edge of its bucket).
+        std::uint64_t
+        percentile(
+            double q
+            ) const noexcept
+        {
+            if (total == 0)
+            {
+                return 0;
+            }
+
+            auto rank        = static_cast<std::uint64_t>(q * static_cast<double>(total) + 0.5);
+            std::uint64_t seen = 0;
+
+            for (std::size_t i = 0; i < kBuckets; ++i)
+            {
+                seen += counts[i];
+
+                if ((seen >= rank) && (seen > 0))
+                {
+                    return upperEdge(i);
+                }
+            }
+
+            return upperEdge(kBuckets - 1);
+        }
+    };
+
+    Snapshot
+    snapshot() const noexcept
+    {
+        Snapshot s;
+
+        for (std::size_t i = 0; i < kBuckets; ++i)
+        {
+            s.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+            s.total    += s.counts[i];
+        }
+
+        return s;
+    }
+
+private:
+    static std::size_t
+    bucketOf(
+        std::uint64_t v
+        ) noexcept
+    {
+        if (v < kSubBuckets)
+        {
+            return static_cast<std::size_t>(v);
+        }
+
+        unsigned exp = static_cast<unsigned>(std::bit_width(v)) - 1; // >= kSubBits
+
+        if (exp > kMaxExp)
+        {
+            return kBuckets - 1;
+        }
+
+        unsigned sub = static_cast<unsigned>(v >> (exp - kSubBits)) & (kSubBuckets - 1);
+
+        return kSubBuckets + (exp - kSubBits) * kSubBuckets + sub;
+    }
+
+    static std::uint64_t
+    upperEdge(
+        std::size_t bucket
+        ) noexcept
+    {
+        if (bucket < kSubBuckets)
+        {
+            return bucket;
+        }
+
+        std::size_t rel   = bucket - kSubBuckets;
+        unsigned exp      = static_cast<unsigned>(rel / kSubBuckets) + kSubBits;
+        std::uint64_t sub = rel % kSubBuckets;
+
+        return ((std::uint64_t {kSubBuckets} + sub + 1) << (exp - kSubBits)) - 1;
+    }
+
+    std::array<std::atomic<std::uint64_t>, kBuckets> m_counts {};
+};
+
+// Why the ConnectionReaper closed a connection.
+enum class ReapReason : std::uint8_t
+{
+    Idle,             // nothing in either direction
+    ClientReadStall,  // client sent nothing
+    TargetReadStall,  // target sent nothing
+    ClientWriteStall, // client stopped taking data
+    TargetWriteStall, // target stopped taking data
+    Count
+};
+
+inline const char*
+to_string(
+    ReapReason reason
+    )
+{
+    switch (reason)
+    {
+        case ReapReason::Idle: return "idle";
+        case ReapReason::ClientReadStall: return "client read stall";
+        case ReapReason::TargetReadStall: return "target read stall";
+        case ReapReason::ClientWriteStall: return "client write stall";
+        case ReapReason::TargetWriteStall: return "target write stall";
+        default: return "?";
+    }
+}
+
+// Why a client was turned away at accept().
+enum class RejectReason : std::uint8_t
+{
+    AccessDenied,    // the access list does not allow this address
+    ConnectionLimit, // too many connections overall
+    ClientLimit,     // too many connections from this address
+    ClientRate,      // this address is opening connections too fast
+    TableFull,       // no room to track this address
+    Count
+};
+
+inline const char*
+to_string(
+    RejectReason reason
+    )
+{
+    switch (reason)
+    {
+        case RejectReason::AccessDenied: return "access denied";
+        case RejectReason::ConnectionLimit: return "connection limit";
+        case RejectReason::ClientLimit: return "client limit";
+        case RejectReason::ClientRate: return "client rate";
+        case RejectReason::TableFull: return "table full";
+        default: return "?";
+    }
+}
+
+// Process-wide traffic and latency counters.
+//
+// Everything here is updated with relaxed atomics from the accept threads and
+// I/O workers and read by the stats dump without taking any lock, so leaving
+// it on costs a handful of uncontended increments per connection and one per
+// forwarded chunk.
+struct ProxyMetrics
+{
+    std::chrono::steady_clock::time_point started {std::chrono::steady_clock::now()};
+
+    StripedCounter accepts;
+    StripedCounter connectFailures;
+    StripedCounter active;
+    StripedCounter closed;
+    StripedCounter bytesToTarget;
+    StripedCounter bytesToClient;
+
+    // Registered I/O: results reaped and the RIODequeueCompletion() calls it
+    // took, i.e. how well completions are being batched.
+    StripedCounter rioCompletions;
+    StripedCounter rioDequeues;
+
+    // UDP: sessions open and expired, datagrams each way (bytes go into the
+    // totals above), datagrams lost to truncation or failed sends, and
+    // receives that came back as a coalesced train of datagrams.
+    StripedCounter udpSessions;
+    StripedCounter udpExpired;
+    StripedCounter udpDatagramsToTarget;
+    StripedCounter udpDatagramsToClient;
+    StripedCounter udpDropped;
+    StripedCounter udpCoalesced;
+
+    // Connections closed by timeouts, by ReapReason.
+    std::array<StripedCounter, static_cast<std::size_t>(ReapReason::Count)> reaped;
+
+    // Clients turned away at accept() (and UDP datagrams from denied
+    // addresses), by RejectReason, and reads held back because a client was
+    // over its bandwidth.
+    std::array<StripedCounter, static_cast<std::size_t>(RejectReason::Count)> rejected;
+    StripedCounter pausedReads;
+
+    // Handshake routing: clients sent to a host's backends or to the route's
+    // own (unknown host, not a handshake), clients dropped for not sending one
+    // within the budget, and clients routed on their first peek, so nothing
+    // had to be read off the socket.
+    StripedCounter handshakeByHost;
+    StripedCounter handshakeDefault;
+    StripedCounter handshakeDropped;
+    StripedCounter handshakePeeked;
+
+    LatencyHistogram connectLatency;
+    LatencyHistogram connectionDuration;
+};
+
+inline ProxyMetrics&
+proxyMetrics()
+{
+    static ProxyMetrics metrics;
+
+    return metrics;
+}
+
+// Write a human-readable snapshot of m. lastAccepts / lastDump carry the
+// previous dump's values so accepts/sec covers the interval in between.
+inline void
+writeMetrics(
+    std::ostream& out,
+    const ProxyMetrics& m,
+    std::uint64_t& lastAccepts,
+    std::chrono::steady_clock::time_point& lastDump
+    )
+{
+    auto now              = std::chrono::steady_clock::now();
+    std::uint64_t accepts = m.accepts.load();
+    double seconds        = std::chrono::duration<double>(now - lastDump).count();
+
+    auto printHistogram = [&] (const char* name, const LatencyHistogram& h)
+        {
+            LatencyHistogram::Snapshot s = h.snapshot();
+            out << name << " (us): n=" << s.total
+                << " p50=" << s.percentile(0.50)
+                << " p90=" << s.percentile(0.90)
+                << " p99=" << s.percentile(0.99)
+                << " p999=" << s.percentile(0.999)
+                << " max=" << s.percentile(1.0) << "\n";
+        };
+
+    out << "uptime " << std::chrono::duration_cast<std::chrono::seconds>(now - m.started).count() << " s, "
+        << m.active.load() << " active, "
+        << accepts << " accepted ("
+        << ((seconds > 0) ? static_cast<std::uint64_t>(static_cast<double>(accepts - lastAccepts) / seconds) : 0)
+        << "/s), "
+        << m.closed.load() << " closed, "
+        << m.connectFailures.load() << " connect failures\n"
+        << "bytes client->target " << m.bytesToTarget.load()
+        << ", target->client " << m.bytesToClient.load() << "\n";
+
+    if (std::uint64_t dequeues = m.rioDequeues.load())
+    {
+        std::uint64_t completions = m.rioCompletions.load();
+        out << "rio: " << completions << " completions in " << dequeues << " dequeues ("
+            << (completions / dequeues) << " per dequeue)\n";
+    }
+
+    if (std::uint64_t upstream = m.udpDatagramsToTarget.load())
+    {
+        out << "udp: " << m.udpSessions.load() << " sessions, "
+            << m.udpExpired.load() << " expired, datagrams client->target " << upstream
+            << ", target->client " << m.udpDatagramsToClient.load() << ", "
+            << m.udpDropped.load() << " dropped, "
+            << m.udpCoalesced.load() << " coalesced receives\n";
+    }
+
+    std::uint64_t reapedTotal = 0;
+
+    for (const StripedCounter& c : m.reaped)
+    {
+        reapedTotal += c.load();
+    }
+
+    if (reapedTotal)
+    {
+        out << "reaped: " << reapedTotal << " (";
+
+        for (std::size_t i = 0; i < m.reaped.size(); ++i)
+        {
+            out << (i ? ", " : "") << to_string(static_cast<ReapReason>(i)) << " " << m.reaped[i].load();
+        }
+
+        out << ")\n";
+    }
+
+    std::uint64_t rejectedTotal = 0;
+
+    for (const StripedCounter& c : m.rejected)
+    {
+        rejectedTotal += c.load();
+    }
+
+    if (std::uint64_t paused = m.pausedReads.load(); rejectedTotal || paused)
+    {
+        out << "admission: " << rejectedTotal << " rejected (";
+
+        for (std::size_t i = 0; i < m.rejected.size(); ++i)
+        {
+            out << (i ? ", " : "") << to_string(static_cast<RejectReason>(i)) << " " << m.rejected[i].load();
+        }
+
+        out << "), " << paused << " reads paused for bandwidth\n";
+    }
+
+    std::uint64_t byHost    = m.handshakeByHost.load();
+    std::uint64_t byDefault = m.handshakeDefault.load();
+
+    if (std::uint64_t dropped = m.handshakeDropped.load(); byHost || byDefault || dropped)
+    {
+        out << "handshake: " << byHost << " routed by host, "
+            << byDefault << " to default backends, "
+            << dropped << " dropped, "
+            << m.handshakePeeked.load() << " seen in one peek\n";
+    }
+
+    printHistogram(
+        "connect latency",
+        m.connectLatency
+        );
+    printHistogram(
+        "connection duration",
+        m.connectionDuration
+        );
+
+    lastAccepts = accepts;
+    lastDump    = now;
+}
@@ -0,0 +1,176 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// What the bytes a client has sent so far say about its first packet.
+enum class HandshakeParse : std::uint8_t
+{
+    Incomplete,  // could still become a handshake; wait for more
+    Complete,    // a handshake, host filled in
+    NotHandshake // something else (legacy ping, another protocol, too big)
+};
+
+// Lower-case ASCII and drop what is not part of the name: anything from the
+// first NUL on (Forge appends "\0FML\0" and friends) and a trailing dot.
+inline std::string
+normalizeHostName(
+    std::string_view host
+    )
+{
+    host = host.substr(
+        0,
+        host.find('\0')
+        );
+
+    if (host.ends_with('.'))
+    {
+        host.remove_suffix(1);
+    }
+
+    std::string name(host);
+
+    for (char& c : name)
+    {
+        if ((c >= 'A') && (c <= 'Z'))
+        {
+            c = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+
+    return name;
+}
+
+namespace handshake_detail
+{
+
+// Protocol VarInt: 7 bits per byte, least significant group first, high bit
+// set on every byte but the last, at most 5 bytes. Returns the bytes used, 0
+// if data ends first, -1 if it runs past 5 bytes.
+inline int
+readVarInt(
+    std::string_view data,
+    std::uint32_t& value
+    )
+{
+    value = 0;
+
+    for (int i = 0; i < 5; ++i)
+    {
+        if (static_cast<std::size_t>(i) >= data.size())
+        {
+            return 0;
+        }
+
+        auto b = static_cast<unsigned char>(data[i]);
+        value |= std::uint32_t {b & 0x7Fu} << (7 * i);
+
+        if (!(b & 0x80))
+        {
+            return i + 1;
+        }
+    }
+
+    return -1;
+}
+
+} // namespace handshake_detail
+
+// Parse the first packet of a Minecraft Java Edition connection:
+//
+//   VarInt length, then length bytes of:
+//     VarInt packet id (0x00), VarInt protocol version,
+//     VarInt-prefixed UTF-8 server address (at most 255 characters),
+//     unsigned short port, VarInt next state (1 status, 2 login, 3 transfer)
+//
+// data is everything received so far; only the whole packet counts, so a
+// client cannot be routed on a prefix it might still contradict. The address
+// is what the player typed, which is what virtual hosts key on; host gets it
+// normalized. A first byte of 0xFE is the pre-1.7 server list ping, which has
+// no address worth routing on.
+inline HandshakeParse
+parseMinecraftHandshake(
+    std::string_view data,
+    std::string& host
+    )
+{
+    using handshake_detail::readVarInt;
+
+    // Largest possible handshake body: id, version, a 255-character address
+    // of up to 3 bytes each plus its length, port and next state.
+    constexpr std::uint32_t kMaxBody = 1 + 5 + 2 + 255 * 3 + 2 + 1;
+
+    if (data.empty())
+    {
+        return HandshakeParse::Incomplete;
+    }
+
+    if (static_cast<unsigned char>(data[0]) == 0xFE)
+    {
+        return HandshakeParse::NotHandshake;
+    }
+
+    std::uint32_t length = 0;
+    int used             = readVarInt(
+        data,
+        length
+        );
+
+    if (used <= 0)
+    {
+        return used ? HandshakeParse::NotHandshake : HandshakeParse::Incomplete;
+    }
+
+    if ((length == 0) || (length > kMaxBody))
+    {
+        return HandshakeParse::NotHandshake;
+    }
+
+    if (data.size() - static_cast<std::size_t>(used) < length)
+    {
+        return HandshakeParse::Incomplete;
+    }
+
+    std::string_view body = data.substr(
+        used,
+        length
+        );
+    std::uint32_t packetId = 0;
+    std::uint32_t version  = 0;
+    std::uint32_t hostLen  = 0;
+    std::uint32_t state    = 0;
+
+    // Read the next VarInt of body into value; false if it is not there.
+    auto next = [&body] (std::uint32_t& value)
+        {
+            int n = readVarInt(
+                body,
+                value
+                );
+            body.remove_prefix((n > 0) ? static_cast<std::size_t>(n) : 0);
+
+            return n > 0;
+        };
+
+    if (!next(packetId) || (packetId != 0) || !next(version) || !next(hostLen) || (hostLen > 255 * 3) || (body.size() < hostLen + 2))
+    {
+        return HandshakeParse::NotHandshake;
+    }
+
+    std::string_view address = body.substr(
+        0,
+        hostLen
+        );
+    body.remove_prefix(hostLen + 2); // address, port
+
+    if (!next(state) || (state < 1) || (state > 3))
+    {
+        return HandshakeParse::NotHandshake;
+    }
+
+    host = normalizeHostName(address);
+
+    return HandshakeParse::Complete;
+}
@@ -0,0 +1,194 @@
+﻿#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Read-copy-update for data that hot paths read all the time and something
+// else replaces once in a while, such as configuration reloaded from a file.
+//
+// A reader marks its thread's slot with the current epoch for the duration of
+// an RcuReadGuard and clears it afterwards: two stores to a cache line no other
+// thread writes, no lock and never a wait. A writer publishes the new version
+// with one atomic exchange, moves the epoch on and then waits for every slot
+// still showing an older epoch to clear before freeing the old version, so the
+// only one who ever waits is the writer. Read sections must be short and must
+// not nest or block.
+namespace rcu_detail
+{
+
+constexpr std::size_t kMaxReaders = 256;
+
+struct alignas(64) ReaderSlot
+{
+    std::atomic<std::uint64_t> epoch {0}; // 0 = not reading
+    std::atomic<bool> taken {false};
+};
+
+struct Domain
+{
+    std::atomic<std::uint64_t> epoch {1};
+    std::array<ReaderSlot, kMaxReaders> slots;
+};
+
+inline Domain&
+domain()
+{
+    static Domain d;
+
+    return d;
+}
+
+// The calling thread's slot, claimed on first use and freed when the thread
+// exits. Past kMaxReaders concurrent reader threads, the next one waits for a
+// slot to come free.
+class ThreadSlot
+{
+public:
+    ThreadSlot()
+    {
+        Domain& d = domain();
+
+        while (true)
+        {
+            for (ReaderSlot& s : d.slots)
+            {
+                if (!s.taken.load(std::memory_order_relaxed) && !s.taken.exchange(true))
+                {
+                    m_slot = &s;
+
+                    return;
+                }
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+    ~ThreadSlot()
+    {
+        m_slot->epoch.store(0);
+        m_slot->taken.store(false);
+    }
+
+    ThreadSlot(const ThreadSlot&)            = delete;
+    ThreadSlot& operator=(const ThreadSlot&) = delete;
+
+    ReaderSlot&
+    get() noexcept
+    {
+        return *m_slot;
+    }
+
+private:
+    ReaderSlot* m_slot {nullptr};
+};
+
+inline ReaderSlot&
+threadSlot()
+{
+    thread_local ThreadSlot slot;
+
+    return slot.get();
+}
+
+} // namespace rcu_detail
+
+// Marks a read section; anything loaded from an RcuCell stays valid until the
+// guard goes away.
+class RcuReadGuard
+{
+public:
+    RcuReadGuard()
+        : m_slot(rcu_detail::threadSlot())
+    {
+        m_slot.epoch.store(rcu_detail::domain().epoch.load());
+    }
+
+    ~RcuReadGuard()
+    {
+        m_slot.epoch.store(
+            0,
+            std::memory_order_release
+            );
+    }
+
+    RcuReadGuard(const RcuReadGuard&)            = delete;
+    RcuReadGuard& operator=(const RcuReadGuard&) = delete;
+
+private:
+    rcu_detail::ReaderSlot& m_slot;
+};
+
+// Wait until every read section that was running when this was called has
+// ended. Read sections started since then are not waited for.
+inline void
+rcuSynchronize()
+{
+    rcu_detail::Domain& d = rcu_detail::domain();
+    std::uint64_t target  = d.epoch.fetch_add(1) + 1;
+
+    for (rcu_detail::ReaderSlot& s : d.slots)
+    {
+        while (true)
+        {
+            std::uint64_t seen = s.epoch.load();
+
+            if ((seen == 0) || (seen >= target))
+            {
+                break;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+}
+
+// One RCU-protected value. load() inside an RcuReadGuard; replace() from any
+// thread (writers are serialized) whenever a new version is ready.
+template <typename T>
+class RcuCell
+{
+public:
+    explicit RcuCell(
+        std::unique_ptr<const T> initial
+        )
+        : m_current(initial.release())
+    {
+    }
+
+    ~RcuCell()
+    {
+        delete m_current.load();
+    }
+
+    RcuCell(const RcuCell&)            = delete;
+    RcuCell& operator=(const RcuCell&) = delete;
+
+    const T*
+    load() const noexcept
+    {
+        return m_current.load();
+    }
+
+    // Publish next. Returns once no reader can still be looking at the version
+    // it replaced, which has been freed by then.
+    void
+    replace(
+        std::unique_ptr<const T> next
+        )
+    {
+        std::lock_guard lock(m_writeMtx);
+        const T* old = m_current.exchange(next.release());
+        rcuSynchronize();
+        delete old;
+    }
+
+private:
+    std::atomic<const T*> m_current;
+    std::mutex m_writeMtx;
+};
@@ -0,0 +1,370 @@
+﻿#pragma once
+
+#include "AsyncLog.hpp"
+#include "IoReactor.hpp"
+#include "Metrics.hpp"
+
+#include <winsock2.h>
+#include <mswsock.h>
+#include <Windows.h>
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct RioOperation;
+
+// Called on a reactor worker for each dequeued RIO result. error is a Winsock
+// error code (0 on success), as for IoCompletionFn.
+using RioCompletionFn = void (*)(
+    RioOperation& op,
+    ULONG bytes,
+    int error
+    );
+
+// One RIOReceive()/RIOSend() in flight; its address is the request context.
+struct RioOperation
+{
+    RioCompletionFn onComplete {nullptr};
+    void* owner {nullptr};
+};
+
+// A fixed-size piece of registered memory.
+struct RioSlice
+{
+    RIO_BUFFERID id {RIO_INVALID_BUFFERID};
+    ULONG offset {0};
+    char* data {nullptr};
+
+    explicit
+    operator bool() const noexcept
+    {
+        return data != nullptr;
+    }
+};
+
+// Registered I/O (RIO) for one reactor.
+//
+// Sockets using this engine get a request queue whose completions land in a
+// single completion queue. Buffers are carved from chunks registered with the
+// kernel once, so posting a receive or send skips the per-call buffer probe and
+// lock that overlapped WSARecv()/WSASend() pay. Completions are reaped in
+// batches: the completion queue raises one IOCP notification on the reactor's
+// port, and the worker that picks it up drains up to kDequeueBatch results with
+// a single RIODequeueCompletion() before re-arming.
+//
+// Sockets must be created with WSA_FLAG_REGISTERED_IO (accept()ed sockets
+// inherit it from the listener). RIO request queues are not thread-safe:
+// callers serialize posts to the same queue.
+class RioEngine
+{
+public:
+    static constexpr ULONG kSliceSize = 16 * 1024;
+
+    explicit RioEngine(
+        IoReactor& reactor
+        )
+    {
+        loadFunctionTable();
+
+        m_notifyOp.onComplete = onNotify;
+        m_notifyOp.owner      = this;
+
+        RIO_NOTIFICATION_COMPLETION notify {};
+        notify.Type               = RIO_IOCP_COMPLETION;
+        notify.Iocp.IocpHandle    = reactor.port();
+        notify.Iocp.CompletionKey = nullptr;
+        notify.Iocp.Overlapped    = &m_notifyOp.overlapped;
+
+        m_cq = m_rio.RIOCreateCompletionQueue(
+            kCompletionQueueSize,
+            &notify
+            );
+
+        if (m_cq == RIO_INVALID_CQ)
+        {
+            throw std::runtime_error("RIOCreateCompletionQueue() failed (WSA = " + std::to_string(WSAGetLastError()) + ")");
+        }
+
+        if (int err = m_rio.RIONotify(m_cq); err != 0)
+        {
+            m_rio.RIOCloseCompletionQueue(m_cq);
+
+            throw std::runtime_error("RIONotify() failed (WSA = " + std::to_string(err) + ")");
+        }
+    }
+
+    ~RioEngine()
+    {
+        m_rio.RIOCloseCompletionQueue(m_cq);
+
+        for (const Chunk& chunk : m_chunks)
+        {
+            m_rio.RIODeregisterBuffer(chunk.id);
+            VirtualFree(
+                chunk.base,
+                0,
+                MEM_RELEASE
+                );
+        }
+    }
+
+    RioEngine(const RioEngine&)            = delete;
+    RioEngine& operator=(const RioEngine&) = delete;
+
+    const RIO_EXTENSION_FUNCTION_TABLE&
+    functions() const noexcept
+    {
+        return m_rio;
+    }
+
+    // Reserve completion queue room for one socket's receive + send, so that
+    // request queues are only ever created when the queue cannot overflow.
+    // Returns false when the engine is full; the caller uses another path.
+    bool
+    reserveSocket()
+    {
+        unsigned used = m_reservedSockets.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+
+        if (used >= kMaxSockets)
+        {
+            releaseSocket();
+
+            return false;
+        }
+
+        return true;
+    }
+
+    void
+    releaseSocket()
+    {
+        m_reservedSockets.fetch_sub(
+            1,
+            std::memory_order_relaxed
+            );
+    }
+
+    // One receive and one send outstanding at a time; context is reported back
+    // as RIORESULT::SocketContext.
+    RIO_RQ
+    createRequestQueue(
+        SOCKET s,
+        void* context
+        )
+    {
+        return m_rio.RIOCreateRequestQueue(
+            s,
+            1,
+            1,
+            1,
+            1,
+            m_cq,
+            m_cq,
+            context
+            );
+    }
+
+    RioSlice
+    acquireSlice()
+    {
+        std::lock_guard lock(m_sliceMtx);
+
+        if (m_freeSlices.empty() && !addChunk())
+        {
+            return {};
+        }
+
+        RioSlice slice = m_freeSlices.back();
+        m_freeSlices.pop_back();
+
+        return slice;
+    }
+
+    void
+    releaseSlice(
+        RioSlice& slice
+        )
+    {
+        if (!slice)
+        {
+            return;
+        }
+
+        std::lock_guard lock(m_sliceMtx);
+        m_freeSlices.push_back(slice);
+        slice = {};
+    }
+
+private:
+    static constexpr DWORD kCompletionQueueSize = 64 * 1024;
+    static constexpr unsigned kMaxSockets       = kCompletionQueueSize / 2;
+    static constexpr ULONG kSlicesPerChunk      = 256;
+    static constexpr ULONG kDequeueBatch        = 256;
+
+    struct Chunk
+    {
+        char* base;
+        RIO_BUFFERID id;
+    };
+
+    void
+    loadFunctionTable()
+    {
+        SOCKET probe = WSASocketW(
+            AF_INET,
+            SOCK_STREAM,
+            IPPROTO_TCP,
+            nullptr,
+            0,
+            WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO
+            );
+
+        if (probe == INVALID_SOCKET)
+        {
+            throw std::runtime_error("socket() failed while loading RIO (WSA = " + std::to_string(WSAGetLastError()) + ")");
+        }
+
+        GUID guid    = WSAID_MULTIPLE_RIO;
+        DWORD bytes  = 0;
+        m_rio        = {};
+        m_rio.cbSize = sizeof(m_rio);
+        int rc       = WSAIoctl(
+            probe,
+            SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER,
+            &guid,
+            sizeof(guid),
+            &m_rio,
+            sizeof(m_rio),
+            &bytes,
+            nullptr,
+            nullptr
+            );
+        int err = WSAGetLastError();
+        closesocket(probe);
+
+        if (rc == SOCKET_ERROR)
+        {
+            throw std::runtime_error("WSAIoctl(RIO) failed (WSA = " + std::to_string(err) + ")");
+        }
+    }
+
+    // Register another chunk of slices. Called with m_sliceMtx held.
+    bool
+    addChunk()
+    {
+        DWORD chunkSize = kSliceSize * kSlicesPerChunk;
+        auto* base      = static_cast<char*>(
+            VirtualAlloc(
+                nullptr,
+                chunkSize,
+                MEM_COMMIT | MEM_RESERVE,
+                PAGE_READWRITE
+                )
+            );
+
+        if (!base)
+        {
+            logErrorCode(
+                "VirtualAlloc() failed for RIO buffers",
+                "GetLastError",
+                GetLastError()
+                );
+
+            return false;
+        }
+
+        RIO_BUFFERID id = m_rio.RIORegisterBuffer(
+            base,
+            chunkSize
+            );
+
+        if (id == RIO_INVALID_BUFFERID)
+        {
+            logRawWSAError("RIORegisterBuffer() failed");
+            VirtualFree(
+                base,
+                0,
+                MEM_RELEASE
+                );
+
+            return false;
+        }
+
+        m_chunks.push_back({base, id});
+
+        for (ULONG i = 0; i < kSlicesPerChunk; ++i)
+        {
+            m_freeSlices.push_back({id, i * kSliceSize, base + i * kSliceSize});
+        }
+
+        return true;
+    }
+
+    // The completion queue signalled the port. Take what is there, re-arm so
+    // another worker can reap the next batch, then run the callbacks.
+    static void
+    onNotify(
+        IoOperation& op,
+        DWORD /*bytes*/,
+        int /*error*/
+        )
+    {
+        auto& self = *static_cast<RioEngine*>(op.owner);
+        RIORESULT results[kDequeueBatch];
+
+        ULONG count = self.m_rio.RIODequeueCompletion(
+            self.m_cq,
+            results,
+            kDequeueBatch
+            );
+
+        if (count == RIO_CORRUPT_CQ)
+        {
+            logMessage(
+                LogStream::Err,
+                "RIODequeueCompletion() reported a corrupt completion queue; RIO connections on this reactor are stalled"
+                );
+
+            return;
+        }
+
+        if (int err = self.m_rio.RIONotify(self.m_cq); err != 0)
+        {
+            logErrorCode(
+                "RIONotify() failed",
+                "WSA",
+                err
+                );
+        }
+
+        ProxyMetrics& m = proxyMetrics();
+        m.rioDequeues.add(1);
+        m.rioCompletions.add(count);
+
+        for (ULONG i = 0; i < count; ++i)
+        {
+            auto* rioOp = reinterpret_cast<RioOperation*>(static_cast<ULONG_PTR>(results[i].RequestContext));
+            rioOp->onComplete(
+                *rioOp,
+                results[i].BytesTransferred,
+                static_cast<int>(results[i].Status)
+                );
+        }
+    }
+
+    RIO_EXTENSION_FUNCTION_TABLE m_rio {};
+    RIO_CQ m_cq {RIO_INVALID_CQ};
+    IoOperation m_notifyOp;
+
+    std::atomic<unsigned> m_reservedSockets {0};
+
+    std::mutex m_sliceMtx;
+    std::vector<Chunk> m_chunks;
+    std::vector<RioSlice> m_freeSlices;
+};
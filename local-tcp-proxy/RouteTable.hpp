@@ -0,0 +1,888 @@
+﻿#pragma once
+
+#include "AdmissionControl.hpp"
+#include "AsyncLog.hpp"
+#include "BackendSet.hpp"
+#include "TargetConnector.hpp"
+#include "UnixSocket.hpp"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// One listen address and everything about where its clients go.
+struct RouteSpec
+{
+    std::string listen; // TCP port, or unix:<path>
+    std::vector<BackendSet::Target> targets;
+    BalancePolicy balance {BalancePolicy::RoundRobin};
+    unsigned maxBuffer {0}; // largest relay buffer in bytes, 0 = any
+    AdmissionLimits limits; // none
+
+    // Handshake routing (off while hosts is empty).
+    std::vector<HostRoute> hosts;
+    HandshakeBudget handshake;
+
+    // The route's line with comments and extra blanks dropped, so a reload
+    // can tell which routes changed. Empty for routes not from a file.
+    std::string text;
+};
+
+// Parse a decimal number no larger than max.
+inline bool
+parseRouteNumber(
+    std::string_view text,
+    std::uint32_t max,
+    unsigned& value
+    )
+{
+    unsigned n  = 0;
+    auto result = std::from_chars(
+        text.data(),
+        text.data() + text.size(),
+        n
+        );
+
+    if ((result.ec != std::errc {}) || (result.ptr != text.data() + text.size()) || (n > max))
+    {
+        return false;
+    }
+
+    value = n;
+
+    return true;
+}
+
+// Parse "<ipv4>:<port>" or "unix:<path>" into a backend.
+inline bool
+parseRouteTarget(
+    std::string_view spec,
+    BackendSet::Target& target
+    )
+{
+    target       = {};
+    target.label = spec;
+
+    if (isUnixEndpoint(spec))
+    {
+        target.unixSocket = true;
+
+        return makeUnixAddress(
+            std::string(spec.substr(kUnixPrefix.size())),
+            target.unixAddress
+            );
+    }
+
+    std::size_t colon = spec.rfind(':');
+    unsigned port     = 0;
+
+    if (
+        (colon == std::string_view::npos) ||
+        !parseRouteNumber(
+            spec.substr(colon + 1),
+            65535,
+            port
+            ) ||
+        (port == 0)
+        )
+    {
+        return false;
+    }
+
+    std::string ip(spec.substr(
+        0,
+        colon
+        ));
+    target.address.sin_family = AF_INET;
+    target.address.sin_port   = htons(static_cast<u_short>(port));
+
+    return inet_pton(
+        AF_INET,
+        ip.c_str(),
+        &target.address.sin_addr
+        ) == 1;
+}
+
+// Parse "<target>[,<target>...]" onto targets.
+inline bool
+parseRouteTargets(
+    std::string_view list,
+    std::vector<BackendSet::Target>& targets
+    )
+{
+    while (!list.empty())
+    {
+        std::size_t comma = list.find(',');
+        BackendSet::Target target;
+
+        if (
+            !parseRouteTarget(
+                list.substr(
+                    0,
+                    comma
+                    ),
+                target
+                )
+            )
+        {
+            return false;
+        }
+
+        targets.push_back(std::move(target));
+        list = (comma == std::string_view::npos) ? std::string_view() : list.substr(comma + 1);
+    }
+
+    return true;
+}
+
+// Parse one route line:
+//
+//   <listen> <target>[,<target>...] [<option>=<value>...]
+//
+// <listen> is a TCP port or unix:<path>, a <target> is <ip>:<port> or
+// unix:<path>, and the options are balance, max-buffer, max-connections,
+// max-client-connections, client-connect-rate, client-connect-burst,
+// client-bandwidth, handshake-timeout and handshake-bytes, meaning what the
+// command-line options of the same name mean for this route alone, plus
+// host:<name>=<target>[,<target>...] as --host. Anything after a '#' is a
+// comment. Returns false for a malformed line; blank lines parse to no route
+// (empty stays true).
+inline bool
+parseRoute(
+    std::string_view line,
+    RouteSpec& route,
+    bool& empty
+    )
+{
+    line = line.substr(
+        0,
+        line.find('#')
+        );
+
+    std::vector<std::string_view> words;
+    std::size_t pos = line.find_first_not_of(" \t\r");
+
+    while (pos != std::string_view::npos)
+    {
+        std::size_t end = line.find_first_of(" \t\r", pos);
+        words.push_back(line.substr(
+            pos,
+            end - pos
+            ));
+        pos = line.find_first_not_of(" \t\r", end);
+    }
+
+    empty = words.empty();
+
+    if (empty)
+    {
+        return true;
+    }
+
+    if (words.size() < 2)
+    {
+        return false;
+    }
+
+    route = {};
+
+    for (std::string_view word : words)
+    {
+        route.text += route.text.empty() ? "" : " ";
+        route.text += word;
+    }
+
+    std::string_view listen = words[0];
+
+    if (isUnixEndpoint(listen))
+    {
+        SOCKADDR_UN addr {};
+
+        if (
+            !makeUnixAddress(
+                std::string(listen.substr(kUnixPrefix.size())),
+                addr
+                )
+            )
+        {
+            return false;
+        }
+
+        route.listen = listen;
+    }
+    else
+    {
+        unsigned port = 0;
+
+        if (
+            !parseRouteNumber(
+                listen,
+                65535,
+                port
+                ) ||
+            (port == 0)
+            )
+        {
+            return false;
+        }
+
+        route.listen = std::to_string(port);
+    }
+
+    if (
+        !parseRouteTargets(
+            words[1],
+            route.targets
+            ) ||
+        route.targets.empty()
+        )
+    {
+        return false;
+    }
+
+    for (std::size_t i = 2; i < words.size(); ++i)
+    {
+        std::size_t eq = words[i].find('=');
+
+        if (eq == std::string_view::npos)
+        {
+            return false;
+        }
+
+        std::string_view key    = words[i].substr(
+            0,
+            eq
+            );
+        std::string_view value  = words[i].substr(eq + 1);
+        AdmissionLimits& limits = route.limits;
+        unsigned* number        = nullptr;
+        std::uint32_t max       = 1000000;
+        bool ok                 = false;
+
+        if (key.starts_with("host:"))
+        {
+            HostRoute host;
+            host.host = normalizeHostName(key.substr(sizeof("host:") - 1));
+            ok        = parseRouteTargets(
+                value,
+                host.targets
+                ) && !host.host.empty() && !host.targets.empty();
+            route.hosts.push_back(std::move(host));
+        }
+        else if (key == "handshake-timeout")
+        {
+            unsigned ms = 0;
+            ok          = parseRouteNumber(
+                value,
+                600000,
+                ms
+                ) && (ms > 0);
+            route.handshake.timeout = std::chrono::milliseconds(ms);
+        }
+        else if (key == "handshake-bytes")
+        {
+            number = &route.handshake.bytes;
+            max    = 65536;
+        }
+        else if (key == "balance")
+        {
+            ok = parseBalancePolicy(
+                value,
+                route.balance
+                );
+        }
+        else if (key == "max-buffer")
+        {
+            number = &route.maxBuffer;
+            max    = 1u << 30;
+        }
+        else if (key == "max-connections")
+        {
+            number = &limits.maxConnections;
+        }
+        else if (key == "max-client-connections")
+        {
+            number = &limits.maxPerClient;
+        }
+        else if (key == "client-connect-rate")
+        {
+            number = &limits.connectRate;
+        }
+        else if (key == "client-connect-burst")
+        {
+            number = &limits.connectBurst;
+        }
+        else if (key == "client-bandwidth")
+        {
+            number = &limits.clientBandwidth;
+            max    = 4000000000;
+        }
+
+        if (number)
+        {
+            ok = parseRouteNumber(
+                value,
+                max,
+                *number
+                );
+        }
+
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    // Room for at least a short handshake.
+    return route.handshake.bytes >= 16;
+}
+
+// A route being served: its listener and the accept threads blocked on it.
+// Destroying it stops the accepting; clients already accepted hold on to
+// target and close on their own.
+struct Route
+{
+    RouteSpec spec;
+    std::shared_ptr<ForwardTarget> target;
+    SOCKET listener {INVALID_SOCKET};
+    std::vector<std::jthread> acceptThreads; // given listener, target and a stop_token
+
+    Route() = default;
+
+    Route(const Route&)            = delete;
+    Route& operator=(const Route&) = delete;
+
+    ~Route()
+    {
+        for (std::jthread& t : acceptThreads)
+        {
+            t.request_stop();
+        }
+
+        // Wakes the threads out of accept(); they see the stop request and
+        // return, and are joined as acceptThreads goes away.
+        if (listener != INVALID_SOCKET)
+        {
+            closesocket(listener);
+        }
+    }
+};
+
+// The routes one proxy process serves: each listen address with its own
+// backends, policy, buffer cap and limits, all running on the same shards,
+// buffer pools and connection tables.
+//
+// Routes come from the command line and, optionally, a file with one route per
+// line (see parseRoute()). The file is polled for changes once a second. A
+// reload compares the new list with the running routes by listen address:
+// new routes are opened, removed ones closed, and a route whose line changed
+// is closed and opened again with its new settings. Every other route keeps
+// its listener and is not touched at all. Closing a route only stops its
+// accepting; its open connections keep their backends and limits alive and
+// finish normally. The closed route's target is parked here until they have,
+// and freed by the reload thread, so it is never torn down on a thread it
+// owns (the pacing thread of its AdmissionControl, say). A file that fails to
+// parse is reported and the running routes stay as they are; a route that
+// fails to open (say its port is taken) is reported and tried again at the
+// next change.
+class RouteTable
+{
+public:
+    // Sets up everything a route needs to run (listener, target, accept
+    // threads) except spec; null on failure, which it has already logged.
+    using Opener = std::function<std::unique_ptr<Route>(const RouteSpec& spec)>;
+
+    RouteTable(
+        std::vector<RouteSpec> fixed,
+        std::string file,
+        Opener open
+        )
+        : m_fixed(std::move(fixed))
+        , m_file(std::move(file))
+        , m_open(std::move(open))
+    {
+        std::vector<RouteSpec> specs;
+        const char* what = "";
+        std::size_t line = 0;
+
+        if (
+            !build(
+                specs,
+                what,
+                line
+                )
+            )
+        {
+            throw std::runtime_error("route table '" + m_file + "' " + what + (line ? " on line " + std::to_string(line) : std::string()));
+        }
+
+        if (
+            std::size_t failed = apply(
+                std::move(specs),
+                false
+                ); failed
+            )
+        {
+            throw std::runtime_error(std::to_string(failed) + " route(s) could not be opened");
+        }
+
+        if (!m_file.empty())
+        {
+            m_thread = std::jthread(
+                [this] (std::stop_token st)
+                {
+                    run(st);
+                }
+                );
+        }
+    }
+
+    RouteTable(const RouteTable&)            = delete;
+    RouteTable& operator=(const RouteTable&) = delete;
+
+    std::size_t
+    size() const
+    {
+        std::lock_guard lock(m_mtx);
+
+        return m_routes.size();
+    }
+
+    // Target of the route listening on listen, null if there is none.
+    std::shared_ptr<ForwardTarget>
+    find(
+        const std::string& listen
+        ) const
+    {
+        std::lock_guard lock(m_mtx);
+        auto it = m_routes.find(listen);
+
+        return (it == m_routes.end()) ? nullptr : it->second->target;
+    }
+
+    // Call fn(spec, target) for each route in listen order. Routes do not
+    // change while it runs.
+    template <typename Fn>
+    void
+    forEach(
+        Fn&& fn
+        ) const
+    {
+        std::lock_guard lock(m_mtx);
+
+        for (const auto& [listen, route] : m_routes)
+        {
+            fn(
+                route->spec,
+                *route->target
+                );
+        }
+    }
+
+private:
+    static void
+    formatOpened(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Route " << rec.str << " opened, " << rec.num[0] << " backend(s)\n";
+    }
+
+    static void
+    formatClosed(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Route " << rec.str << " closed; its open connections finish on their own\n";
+    }
+
+    static void
+    formatOpenFailed(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Route " << rec.str << " could not be opened; it is tried again when the route table changes\n";
+    }
+
+    static void
+    formatReloaded(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Route table " << rec.str << " reloaded, " << rec.num[0] << " routes\n";
+    }
+
+    static void
+    formatReloadFailed(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Route table " << rec.str << " not reloaded, it " << rec.text[0];
+
+        if (rec.num[0])
+        {
+            out << " on line " << rec.num[0];
+        }
+
+        out << "; keeping the running routes\n";
+    }
+
+    // The file's routes and then the command line's. On failure returns false
+    // with what went wrong, and where if it is a line of the file.
+    bool
+    build(
+        std::vector<RouteSpec>& specs,
+        const char*& what,
+        std::size_t& badLine
+        ) const
+    {
+        auto taken = [&] (const std::string& listen)
+            {
+                for (const RouteSpec& spec : specs)
+                {
+                    if (spec.listen == listen)
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            };
+
+        if (!m_file.empty())
+        {
+            std::ifstream in(m_file);
+
+            if (!in)
+            {
+                what = "cannot be read";
+
+                return false;
+            }
+
+            std::string line;
+            std::size_t number = 0;
+
+            while (std::getline(in, line))
+            {
+                ++number;
+                RouteSpec spec;
+                bool empty = false;
+
+                if (
+                    !parseRoute(
+                        line,
+                        spec,
+                        empty
+                        )
+                    )
+                {
+                    what    = "has an invalid route";
+                    badLine = number;
+
+                    return false;
+                }
+
+                if (empty)
+                {
+                    continue;
+                }
+
+                if (taken(spec.listen))
+                {
+                    what    = "listens on the same address twice";
+                    badLine = number;
+
+                    return false;
+                }
+
+                specs.push_back(std::move(spec));
+            }
+        }
+
+        for (const RouteSpec& spec : m_fixed)
+        {
+            if (taken(spec.listen))
+            {
+                what = "listens where the command line already does";
+
+                return false;
+            }
+
+            specs.push_back(spec);
+        }
+
+        return true;
+    }
+
+    // Bring the running routes in line with specs. Returns how many routes
+    // could not be opened. Changed and removed routes are closed before any
+    // route is opened, so a route can move to a port another just gave up.
+    //
+    // Only taking routes out and putting them in holds the lock: closing a
+    // route joins its accept threads and opening one binds a listener and
+    // builds its target, which must not stall find() and forEach(). Only the
+    // constructor and then the reload thread call this, so nothing else
+    // changes the routes in between.
+    std::size_t
+    apply(
+        std::vector<RouteSpec> specs,
+        bool announce
+        )
+    {
+        std::map<std::string, const RouteSpec*> wanted;
+
+        for (const RouteSpec& spec : specs)
+        {
+            wanted.emplace(
+                spec.listen,
+                &spec
+                );
+        }
+
+        std::vector<std::unique_ptr<Route>> closing;
+        std::vector<RouteSpec*> opening;
+
+        {
+            std::lock_guard lock(m_mtx);
+
+            for (auto it = m_routes.begin(); it != m_routes.end();)
+            {
+                auto w = wanted.find(it->first);
+
+                if ((w != wanted.end()) && (w->second->text == it->second->spec.text))
+                {
+                    ++it;
+                    continue;
+                }
+
+                m_retired.push_back(it->second->target);
+                closing.push_back(std::move(it->second));
+                it = m_routes.erase(it);
+            }
+
+            for (RouteSpec& spec : specs)
+            {
+                if (!m_routes.contains(spec.listen))
+                {
+                    opening.push_back(&spec);
+                }
+            }
+        }
+
+        for (std::unique_ptr<Route>& route : closing)
+        {
+            if (announce)
+            {
+                logRecord(
+                    {
+                        .format = formatClosed,
+                        .stream = LogStream::Out
+                    },
+                    route->spec.listen
+                    );
+            }
+
+            route.reset();
+        }
+
+        std::size_t failed = 0;
+        std::vector<std::unique_ptr<Route>> opened;
+
+        for (RouteSpec* next : opening)
+        {
+            RouteSpec& spec = *next;
+            std::unique_ptr<Route> route;
+
+            try
+            {
+                route = m_open(spec);
+            }
+            catch (const std::exception&)
+            {
+                route = nullptr;
+            }
+
+            if (!route)
+            {
+                ++failed;
+                logRecord(
+                    {
+                        .format = formatOpenFailed,
+                        .stream = LogStream::Err
+                    },
+                    spec.listen
+                    );
+                continue;
+            }
+
+            if (announce)
+            {
+                logRecord(
+                    {
+                        .format = formatOpened,
+                        .stream = LogStream::Out,
+                        .num    = {static_cast<std::int64_t>(spec.targets.size())}
+                    },
+                    spec.listen
+                    );
+            }
+
+            route->spec = std::move(spec);
+            opened.push_back(std::move(route));
+        }
+
+        std::lock_guard lock(m_mtx);
+
+        for (std::unique_ptr<Route>& route : opened)
+        {
+            std::string listen = route->spec.listen;
+            m_routes.emplace(
+                std::move(listen),
+                std::move(route)
+                );
+        }
+
+        return failed;
+    }
+
+    void
+    run(
+        std::stop_token st
+        )
+    {
+        std::error_code ec;
+        auto stamp = std::filesystem::last_write_time(m_file, ec);
+        std::mutex waitMtx;
+        std::condition_variable_any cv;
+
+        while (!st.stop_requested())
+        {
+            {
+                std::unique_lock ul(waitMtx);
+                cv.wait_for(
+                    ul,
+                    st,
+                    std::chrono::seconds(1),
+                    [] ()
+                    {
+                        return false;
+                    }
+                    );
+            }
+
+            {
+                // Nothing can take a new reference to a retired target, so
+                // one that is only ours is no longer used by any connection.
+                // It is destroyed once the lock is released: that joins the
+                // threads of its warm pools and admission control.
+                std::vector<std::shared_ptr<ForwardTarget>> unused;
+
+                {
+                    std::lock_guard lock(m_mtx);
+                    auto firstUnused = std::partition(
+                        m_retired.begin(),
+                        m_retired.end(),
+                        [] (const std::shared_ptr<ForwardTarget>& target)
+                        {
+                            return target.use_count() > 1;
+                        }
+                        );
+
+                    unused.assign(
+                        std::make_move_iterator(firstUnused),
+                        std::make_move_iterator(m_retired.end())
+                        );
+                    m_retired.erase(
+                        firstUnused,
+                        m_retired.end()
+                        );
+                }
+            }
+
+            auto now = std::filesystem::last_write_time(m_file, ec);
+
+            if (ec || (now == stamp))
+            {
+                continue;
+            }
+
+            stamp = now;
+
+            std::vector<RouteSpec> specs;
+            const char* what    = "";
+            std::size_t badLine = 0;
+
+            if (
+                !build(
+                    specs,
+                    what,
+                    badLine
+                    )
+                )
+            {
+                logRecord(
+                    {
+                        .format     = formatReloadFailed,
+                        .stream     = LogStream::Err,
+                        .text       = {what, ""},
+                        .num        = {static_cast<std::int64_t>(badLine)}
+                    },
+                    m_file
+                    );
+                continue;
+            }
+
+            apply(
+                std::move(specs),
+                true
+                );
+
+            logRecord(
+                {
+                    .format = formatReloaded,
+                    .stream = LogStream::Out,
+                    .num    = {static_cast<std::int64_t>(size())}
+                },
+                m_file
+                );
+        }
+    }
+
+    const std::vector<RouteSpec> m_fixed;
+    const std::string m_file;
+    const Opener m_open;
+
+    mutable std::mutex m_mtx;
+    std::map<std::string, std::unique_ptr<Route>> m_routes; // by listen
+    std::vector<std::shared_ptr<ForwardTarget>> m_retired;  // closed, still in use
+
+    // Last member: started in the constructor once everything above exists.
+    std::jthread m_thread;
+};
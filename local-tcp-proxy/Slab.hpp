@@ -0,0 +1,463 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+
+// Names one object of a Slab: the slot it lives in and which of the slot's
+// occupants it was. Safe to keep after the object is gone; Slab::acquire()
+// then comes back empty, so a stale handle never reaches the slot's next
+// occupant.
+struct SlabHandle
+{
+    std::uint32_t index {0};
+    std::uint32_t generation {0}; // 0 never names an object
+};
+
+template <typename T>
+class Slab;
+
+// One counted reference to a live slab object. The last one to go destroys the
+// object and frees its slot right there, on whichever thread dropped it.
+// Move-only; share() takes another reference.
+template <typename T>
+class SlabRef
+{
+public:
+    SlabRef() = default;
+
+    SlabRef(
+        SlabRef&& other
+        ) noexcept
+        : m_slab(std::exchange(other.m_slab, nullptr))
+        , m_obj(std::exchange(other.m_obj, nullptr))
+    {
+    }
+
+    SlabRef&
+    operator=(
+        SlabRef&& other
+        ) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            m_slab = std::exchange(other.m_slab, nullptr);
+            m_obj  = std::exchange(other.m_obj, nullptr);
+        }
+
+        return *this;
+    }
+
+    ~SlabRef()
+    {
+        reset();
+    }
+
+    SlabRef(const SlabRef&)            = delete;
+    SlabRef& operator=(const SlabRef&) = delete;
+
+    SlabRef
+    share() const
+    {
+        m_slab->retain(*m_obj);
+
+        return SlabRef(
+            m_slab,
+            m_obj
+            );
+    }
+
+    void
+    reset()
+    {
+        if (T* obj = std::exchange(m_obj, nullptr))
+        {
+            std::exchange(m_slab, nullptr)->release(*obj);
+        }
+    }
+
+    SlabHandle
+    handle() const noexcept
+    {
+        return m_slab->handleOf(*m_obj);
+    }
+
+    Slab<T>*
+    slab() const noexcept
+    {
+        return m_slab;
+    }
+
+    T*
+    get() const noexcept
+    {
+        return m_obj;
+    }
+
+    T*
+    operator->() const noexcept
+    {
+        return m_obj;
+    }
+
+    T&
+    operator*() const noexcept
+    {
+        return *m_obj;
+    }
+
+    explicit
+    operator bool() const noexcept
+    {
+        return m_obj != nullptr;
+    }
+
+private:
+    friend class Slab<T>;
+
+    SlabRef(
+        Slab<T>* slab,
+        T* obj
+        )
+        : m_slab(slab)
+        , m_obj(obj)
+    {
+    }
+
+    Slab<T>* m_slab {nullptr};
+    T* m_obj {nullptr};
+};
+
+// Generational slab: objects of one type constructed in place in fixed slots,
+// named by (index, generation) handles and kept alive by intrusive reference
+// counts.
+//
+// Slots come in chunks that are allocated as the table grows and never move or
+// go away, so after warm-up creating an object is popping a free list and
+// destroying one is pushing it back, with no heap traffic and no separate
+// control block. Each slot packs its generation and reference count into one
+// atomic word: acquire() only succeeds while the count is non-zero and the
+// generation still matches, and freeing a slot moves its generation on, so
+// handles can be held by anyone (timers, stats) without keeping the object
+// alive. Every live object can be visited with forEach().
+template <typename T>
+class Slab
+{
+public:
+    static constexpr std::uint32_t kChunkSlots = 256;
+
+    // Room for maxObjects, rounded up to whole chunks.
+    explicit Slab(
+        std::size_t maxObjects = std::size_t {1} << 20
+        )
+        : m_maxChunks((maxObjects + kChunkSlots - 1) / kChunkSlots)
+        , m_chunks(std::make_unique<std::unique_ptr<Slot[]>[]>(m_maxChunks))
+    {
+    }
+
+    // Objects still alive at this point are abandoned, not destroyed; only
+    // happens at process exit.
+    ~Slab() = default;
+
+    Slab(const Slab&)            = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    // Construct a new object from args. Returns an empty reference if the slab
+    // is full (or out of memory for another chunk).
+    template <typename... Args>
+    SlabRef<T>
+    create(
+        Args&&... args
+        )
+    {
+        Slot* slot = takeFree();
+
+        if (!slot)
+        {
+            return {};
+        }
+
+        try
+        {
+            ::new (static_cast<void*>(slot->storage)) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            giveBack(*slot);
+            throw;
+        }
+
+        slot->state.store(
+            slot->state.load(std::memory_order_relaxed) + 1,
+            std::memory_order_release
+            );
+        m_live.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+
+        return SlabRef<T>(
+            this,
+            objectIn(*slot)
+            );
+    }
+
+    // A reference to the object handle names, or an empty one if it is gone.
+    SlabRef<T>
+    acquire(
+        SlabHandle handle
+        )
+    {
+        if (handle.index >= m_slots.load(std::memory_order_acquire))
+        {
+            return {};
+        }
+
+        Slot& slot          = slotAt(handle.index);
+        std::uint64_t state = slot.state.load(std::memory_order_acquire);
+
+        while ((generationOf(state) == handle.generation) && referencesOf(state))
+        {
+            if (
+                slot.state.compare_exchange_weak(
+                    state,
+                    state + 1,
+                    std::memory_order_acquire
+                    )
+                )
+            {
+                return SlabRef<T>(
+                    this,
+                    objectIn(slot)
+                    );
+            }
+        }
+
+        return {};
+    }
+
+    // Call fn(T&) for every object alive when its slot is reached, holding a
+    // reference for the duration of the call.
+    template <typename Fn>
+    void
+    forEach(
+        Fn&& fn
+        )
+    {
+        std::uint32_t slots = m_slots.load(std::memory_order_acquire);
+
+        for (std::uint32_t i = 0; i < slots; ++i)
+        {
+            std::uint64_t state = slotAt(i).state.load(std::memory_order_relaxed);
+
+            if (SlabRef<T> ref = acquire({i, generationOf(state)}))
+            {
+                fn(*ref);
+            }
+        }
+    }
+
+    std::size_t
+    live() const noexcept
+    {
+        return m_live.load(std::memory_order_relaxed);
+    }
+
+    std::size_t
+    slots() const noexcept
+    {
+        return m_slots.load(std::memory_order_relaxed);
+    }
+
+    // Everything the slab has allocated, whether in use or free.
+    std::size_t
+    bytes() const noexcept
+    {
+        std::size_t chunks = (slots() + kChunkSlots - 1) / kChunkSlots;
+
+        return chunks * kChunkSlots * sizeof(Slot) + m_maxChunks * sizeof(m_chunks[0]);
+    }
+
+    static constexpr std::size_t
+    slotBytes() noexcept
+    {
+        return sizeof(Slot);
+    }
+
+private:
+    friend class SlabRef<T>;
+
+    static constexpr std::uint32_t kNoSlot = ~0u;
+
+    struct Slot
+    {
+        // First, so an object's address is its slot's.
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        // Generation in the high half, references in the low half.
+        std::atomic<std::uint64_t> state {std::uint64_t {1} << 32};
+        std::uint32_t index {0};
+        std::uint32_t nextFree {kNoSlot};
+    };
+
+    static std::uint32_t
+    generationOf(
+        std::uint64_t state
+        ) noexcept
+    {
+        return static_cast<std::uint32_t>(state >> 32);
+    }
+
+    static std::uint32_t
+    referencesOf(
+        std::uint64_t state
+        ) noexcept
+    {
+        return static_cast<std::uint32_t>(state);
+    }
+
+    static T*
+    objectIn(
+        Slot& slot
+        ) noexcept
+    {
+        return std::launder(reinterpret_cast<T*>(slot.storage));
+    }
+
+    static Slot&
+    slotOf(
+        T& obj
+        ) noexcept
+    {
+        return *reinterpret_cast<Slot*>(&obj);
+    }
+
+    Slot&
+    slotAt(
+        std::uint32_t index
+        ) const noexcept
+    {
+        return m_chunks[index / kChunkSlots][index % kChunkSlots];
+    }
+
+    SlabHandle
+    handleOf(
+        T& obj
+        ) const noexcept
+    {
+        Slot& slot = slotOf(obj);
+
+        return {slot.index, generationOf(slot.state.load(std::memory_order_relaxed))};
+    }
+
+    void
+    retain(
+        T& obj
+        ) noexcept
+    {
+        slotOf(obj).state.fetch_add(
+            1,
+            std::memory_order_relaxed
+            );
+    }
+
+    void
+    release(
+        T& obj
+        )
+    {
+        Slot& slot         = slotOf(obj);
+        std::uint64_t prev = slot.state.fetch_sub(
+            1,
+            std::memory_order_acq_rel
+            );
+
+        if (referencesOf(prev) != 1)
+        {
+            return;
+        }
+
+        obj.~T();
+        m_live.fetch_sub(
+            1,
+            std::memory_order_relaxed
+            );
+
+        // Nobody can acquire a slot with no references, so moving the
+        // generation on after the destructor is race-free.
+        std::uint32_t generation = generationOf(prev) + 1;
+        slot.state.store(
+            std::uint64_t {generation ? generation : 1u} << 32,
+            std::memory_order_release
+            );
+
+        giveBack(slot);
+    }
+
+    Slot*
+    takeFree()
+    {
+        std::lock_guard lock(m_freeMtx);
+
+        if (m_freeHead != kNoSlot)
+        {
+            Slot& slot = slotAt(m_freeHead);
+            m_freeHead = slot.nextFree;
+
+            return &slot;
+        }
+
+        std::uint32_t index = m_slots.load(std::memory_order_relaxed);
+
+        if (index % kChunkSlots == 0)
+        {
+            if (index / kChunkSlots >= m_maxChunks)
+            {
+                return nullptr;
+            }
+
+            auto chunk = std::unique_ptr<Slot[]>(new (std::nothrow) Slot[kChunkSlots]);
+
+            if (!chunk)
+            {
+                return nullptr;
+            }
+
+            m_chunks[index / kChunkSlots] = std::move(chunk);
+        }
+
+        Slot& slot = slotAt(index);
+        slot.index = index;
+
+        // Publishes the chunk and the slot to acquire() and forEach().
+        m_slots.store(
+            index + 1,
+            std::memory_order_release
+            );
+
+        return &slot;
+    }
+
+    void
+    giveBack(
+        Slot& slot
+        )
+    {
+        std::lock_guard lock(m_freeMtx);
+        slot.nextFree = m_freeHead;
+        m_freeHead    = slot.index;
+    }
+
+    const std::size_t m_maxChunks;
+    std::unique_ptr<std::unique_ptr<Slot[]>[]> m_chunks;
+    std::atomic<std::uint32_t> m_slots {0};
+    std::atomic<std::size_t> m_live {0};
+
+    std::mutex m_freeMtx;
+    std::uint32_t m_freeHead {kNoSlot};
+};
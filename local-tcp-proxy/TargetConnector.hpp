@@ -0,0 +1,947 @@
+﻿#pragma once
+
+#include "AsyncLog.hpp"
+#include "BackendSet.hpp"
+#include "BufferPool.hpp"
+#include "Connection.hpp"
+#include "ConnectionReaper.hpp"
+#include "IoReactor.hpp"
+#include "Metrics.hpp"
+#include "MinecraftHandshake.hpp"
+#include "RioEngine.hpp"
+#include "UnixSocket.hpp"
+#include "WinsockError.hpp"
+
+#include <winsock2.h>
+#include <mswsock.h>
+#include <Windows.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Backends for one host name of a handshake-routed route.
+struct HostRoute
+{
+    std::string host; // as normalizeHostName() leaves it
+    std::vector<BackendSet::Target> targets;
+};
+
+// How long, and for how many bytes, a handshake-routed client may take to
+// send its handshake before it is dropped.
+struct HandshakeBudget
+{
+    std::chrono::milliseconds timeout {3000};
+    std::uint32_t bytes {512};
+};
+
+// Where one route's clients are forwarded: its backends, their policy and the
+// route's limits and buffer cap. Every connection holds a reference, so a
+// route removed at runtime stays alive until the last client it accepted has
+// gone.
+struct ForwardTarget
+{
+    ForwardTarget(
+        std::vector<BackendSet::Target> targets,
+        BalancePolicy policy,
+        ForwardMode mode,
+        std::uint32_t maxBuffer,
+        const AdmissionLimits& limits,
+        std::vector<HostRoute> hostRoutes = {},
+        HandshakeBudget budget            = {}
+        )
+        : backends(
+              std::move(targets),
+              policy
+              )
+        , admission(limits.any() ? std::make_unique<AdmissionControl>(limits) : nullptr)
+        , mode(mode)
+        , maxSizeClass(maxBuffer ? BufferPool::largestClassWithin(maxBuffer) : BufferPool::kClassCount - 1)
+        , handshake(budget)
+    {
+        for (HostRoute& h : hostRoutes)
+        {
+            hosts.emplace(
+                std::move(h.host),
+                std::make_unique<BackendSet>(
+                    std::move(h.targets),
+                    policy
+                    )
+                );
+        }
+    }
+
+    ForwardTarget(const ForwardTarget&)            = delete;
+    ForwardTarget& operator=(const ForwardTarget&) = delete;
+
+    BackendSet backends;
+    std::unique_ptr<AdmissionControl> admission; // null = no limits
+    ForwardMode mode;
+    std::uint8_t maxSizeClass;
+
+    // Handshake routing, on when hosts is not empty: clients are routed by
+    // the server address in their Minecraft handshake, to backends when the
+    // address is not listed or they do not send a handshake.
+    std::unordered_map<std::string, std::unique_ptr<BackendSet>> hosts;
+    HandshakeBudget handshake;
+};
+
+// Opens the target leg of each accepted client with an overlapped ConnectEx(),
+// so the accept loop never waits on target latency. A threadpool timer cancels
+// connects that have not completed within the configured timeout. The backend
+// is picked per client by the policy of the route it came in on; if that
+// backend has a warm UpstreamPool, the client is paired with an
+// already-connected socket whenever one is available and skips the connect
+// entirely. In registered mode target
+// sockets are created RIO-capable and forwarding runs on the shard's RioEngine.
+// With a reaper, established connections are handed to it for timeouts.
+// Connections are created in the shard's ConnectionTable. AF_UNIX backends are
+// connected on the spot, since a local connect never waits on anything.
+//
+// On a handshake-routed route the backend depends on the client's first
+// packet, so that is read first, under the route's time and byte budget. An
+// overlapped MSG_PEEK receive looks at it without taking it off the socket,
+// and when the whole handshake is there (nearly always: clients send it in one
+// segment) forwarding then starts as if nothing had happened, overlapped and
+// RIO paths included. A peek cannot wait for more bytes than it has already
+// seen, though, so a handshake that arrives in pieces is read for real and
+// handed to the target ahead of everything else once it is connected.
+class TargetConnector
+{
+public:
+    TargetConnector(
+        ConnectionTable& table,
+        IoReactor& reactor,
+        RioEngine* rio,
+        ConnectionReaper* reaper,
+        BufferPool& pool,
+        std::chrono::milliseconds timeout
+        )
+        : m_table(table)
+        , m_reactor(reactor)
+        , m_rio(rio)
+        , m_reaper(reaper)
+        , m_pool(pool)
+        , m_timeout(timeout)
+    {
+        m_connectEx = loadConnectEx();
+    }
+
+    TargetConnector(const TargetConnector&)            = delete;
+    TargetConnector& operator=(const TargetConnector&) = delete;
+
+    // Start connecting a target socket for client. Takes ownership of client:
+    // on any failure both sockets are closed and the client simply sees EOF.
+    // clientAddr (may be null) feeds address-based selection among the route's
+    // backends; the connection hands admission back when it closes, however
+    // that happens.
+    void
+    connect(
+        SOCKET client,
+        const sockaddr_in* clientAddr,
+        const AdmissionTicket& admission,
+        const std::shared_ptr<ForwardTarget>& route
+        )
+    {
+        SlabRef<Connection> conn = m_table.create();
+
+        if (!conn)
+        {
+            logMessage(
+                LogStream::Err,
+                "Connection table full, dropping client"
+                );
+            proxyMetrics().connectFailures.add(1);
+            closesocket(client);
+
+            if (admission.control)
+            {
+                admission.control->release(admission);
+            }
+
+            return;
+        }
+
+        conn->owner        = route;
+        conn->client       = client;
+        conn->admission    = admission;
+        conn->maxSizeClass = route->maxSizeClass;
+        conn->ticks        = m_reaper ? &m_reaper->clock() : nullptr;
+
+        if (!associate(client))
+        {
+            return;
+        }
+
+        if (!route->hosts.empty())
+        {
+            readHandshake(
+                std::move(conn),
+                clientAddr,
+                route
+                );
+
+            return;
+        }
+
+        openTarget(
+            std::move(conn),
+            *route,
+            route->backends,
+            clientAddr
+            );
+    }
+
+private:
+    struct Request
+    {
+        IoOperation op;
+        TargetConnector* owner {nullptr};
+        ForwardMode mode {ForwardMode::Copy};
+        SlabRef<Connection> conn;
+        PTP_TIMER timer {nullptr};
+        std::atomic<bool> timedOut {false};
+        std::chrono::steady_clock::time_point started;
+    };
+
+    // A client's handshake being read, before it has a backend.
+    struct HandshakeRead
+    {
+        IoOperation op;
+        TargetConnector* owner {nullptr};
+        SlabRef<Connection> conn;
+        std::shared_ptr<ForwardTarget> route;
+        sockaddr_in peer {};
+        bool hasPeer {false};
+        bool consuming {false}; // reading for real, after a peek came up short
+        std::uint32_t have {0};
+        std::vector<char> buffer; // the route's byte budget
+        PTP_TIMER timer {nullptr};
+        std::atomic<bool> timedOut {false};
+    };
+
+    // Pick a backend from backends (the route's own or a host's) and connect
+    // conn's target leg to it.
+    void
+    openTarget(
+        SlabRef<Connection> conn,
+        const ForwardTarget& route,
+        BackendSet& backends,
+        const sockaddr_in* clientAddr
+        )
+    {
+        Backend& backend = backends.select(clientAddr);
+
+        conn->backend = &backend;
+        backend.opened();
+
+        if (backend.warm)
+        {
+            if (SOCKET warm = backend.warm->take(); warm != INVALID_SOCKET)
+            {
+                conn->target = warm;
+
+                if (!associate(conn->target))
+                {
+                    return;
+                }
+
+                if (
+                    startForwarding(
+                        m_pool,
+                        m_rio,
+                        conn,
+                        route.mode
+                        )
+                    )
+                {
+                    watch(conn);
+                    logEstablished(
+                        backend,
+                        conn->mode,
+                        ", warm"
+                        );
+                }
+
+                return;
+            }
+        }
+
+        if (backend.unixSocket)
+        {
+            connectUnixBackend(
+                conn,
+                backend
+                );
+
+            return;
+        }
+
+        conn->target = WSASocketW(
+            AF_INET,
+            SOCK_STREAM,
+            IPPROTO_TCP,
+            nullptr,
+            0,
+            (route.mode == ForwardMode::Registered) ? WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO : WSA_FLAG_OVERLAPPED
+            );
+
+        if (conn->target == INVALID_SOCKET)
+        {
+            logRawWSAError("socket() failed for target");
+            proxyMetrics().connectFailures.add(1);
+
+            return;
+        }
+
+        // ConnectEx() requires an explicitly bound socket.
+        sockaddr_in local {};
+        local.sin_family      = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port        = 0;
+
+        if (
+            bind(
+                conn->target,
+                (sockaddr*) &local,
+                sizeof(local)
+                ) == SOCKET_ERROR
+            )
+        {
+            logRawWSAError("bind() failed for target");
+            proxyMetrics().connectFailures.add(1);
+
+            return;
+        }
+
+        if (!associate(conn->target))
+        {
+            return;
+        }
+
+        auto* req = new Request {};
+        req->owner         = this;
+        req->mode          = route.mode;
+        req->conn          = std::move(conn);
+        req->op.socket     = req->conn->target;
+        req->op.owner      = req;
+        req->op.onComplete = onConnectComplete;
+
+        req->timer = CreateThreadpoolTimer(
+            onConnectTimeout,
+            req,
+            nullptr
+            );
+
+        if (!req->timer)
+        {
+            logErrorCode(
+                "CreateThreadpoolTimer() failed",
+                "GetLastError",
+                GetLastError()
+                );
+            delete req;
+
+            return;
+        }
+
+        startTimer(
+            req->timer,
+            m_timeout
+            );
+
+        sockaddr_in targetAddr = backend.address; // copy template
+        req->started           = std::chrono::steady_clock::now();
+
+        if (
+            !m_connectEx(
+                req->conn->target,
+                (sockaddr*) &targetAddr,
+                sizeof(targetAddr),
+                nullptr,
+                0,
+                nullptr,
+                &req->op.overlapped
+                )
+            )
+        {
+            if (int err = WSAGetLastError(); err != WSA_IO_PENDING)
+            {
+                // Nothing was queued, so no completion will arrive; clean up here.
+                logConnectFailed(
+                    backend,
+                    err
+                    );
+                backend.recordConnectFailure(m_timeout);
+                proxyMetrics().connectFailures.add(1);
+                stopTimer(req->timer);
+                delete req;
+            }
+        }
+    }
+
+
+    static void
+    formatEstablished(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "Connection established: client -> " << rec.str
+            << " (" << rec.text[0] << " path" << rec.text[1] << ")\n";
+    }
+
+    static void
+    formatConnectFailed(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "connect() to target " << rec.str << " failed (WSAGetLastError = " << rec.num[0] << ")\n";
+    }
+
+    static void
+    formatConnectTimedOut(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "connect() to target " << rec.str << " timed out after " << rec.num[0] << " ms\n";
+    }
+
+    // suffix must be a string literal.
+    static void
+    logEstablished(
+        const Backend& backend,
+        ForwardMode mode,
+        const char* suffix
+        )
+    {
+        logRecord(
+            {
+                .format = formatEstablished,
+                .stream = LogStream::Out,
+                .text   = {to_string(mode), suffix}
+            },
+            backend.label
+            );
+    }
+
+    static void
+    logConnectFailed(
+        const Backend& backend,
+        int err
+        )
+    {
+        logRecord(
+            {
+                .format     = formatConnectFailed,
+                .stream     = LogStream::Err,
+                .errorClass = classifyWinsockError(err),
+                .num        = {err}
+            },
+            backend.label
+            );
+    }
+
+    // ConnectEx() is TCP-only, but an AF_UNIX connect is answered by the local
+    // listener's backlog straight away, so it is made synchronously. Registered
+    // I/O does not cover AF_UNIX sockets; these connections use the copy path.
+    void
+    connectUnixBackend(
+        const SlabRef<Connection>& conn,
+        Backend& backend
+        )
+    {
+        auto started = std::chrono::steady_clock::now();
+        int err      = 0;
+        conn->target = connectUnix(
+            backend.unixAddress,
+            err
+            );
+
+        if (conn->target == INVALID_SOCKET)
+        {
+            logConnectFailed(
+                backend,
+                err
+                );
+            backend.recordConnectFailure(m_timeout);
+            proxyMetrics().connectFailures.add(1);
+
+            return;
+        }
+
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+        backend.recordConnectLatency(latency);
+        proxyMetrics().connectLatency.record(latency);
+
+        if (!associate(conn->target))
+        {
+            return;
+        }
+
+        if (
+            startForwarding(
+                m_pool,
+                m_rio,
+                conn,
+                ForwardMode::Copy
+                )
+            )
+        {
+            watch(conn);
+            logEstablished(
+                backend,
+                conn->mode,
+                ", unix"
+                );
+        }
+    }
+
+    void
+    watch(
+        const SlabRef<Connection>& conn
+        )
+    {
+        if (m_reaper)
+        {
+            m_reaper->watch(conn);
+        }
+    }
+
+    bool
+    associate(
+        SOCKET s
+        )
+    {
+        if (!m_reactor.associate(s))
+        {
+            logErrorCode(
+                "CreateIoCompletionPort() failed to associate socket",
+                "GetLastError",
+                GetLastError()
+                );
+
+            return false;
+        }
+
+        return true;
+    }
+
+    static void
+    formatHandshakeTimedOut(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        out << "No handshake from client within " << rec.num[0] << " ms, dropping it\n";
+    }
+
+    // Start reading conn's handshake, with the route's deadline running.
+    void
+    readHandshake(
+        SlabRef<Connection> conn,
+        const sockaddr_in* clientAddr,
+        const std::shared_ptr<ForwardTarget>& route
+        )
+    {
+        auto req = std::make_unique<HandshakeRead>();
+        req->owner         = this;
+        req->conn          = std::move(conn);
+        req->route         = route;
+        req->hasPeer       = (clientAddr != nullptr);
+        req->peer          = clientAddr ? *clientAddr : sockaddr_in {};
+        req->op.socket     = req->conn->client;
+        req->op.owner      = req.get();
+        req->op.onComplete = onHandshakeComplete;
+        req->buffer.resize(route->handshake.bytes);
+
+        req->timer = CreateThreadpoolTimer(
+            onHandshakeTimeout,
+            req.get(),
+            nullptr
+            );
+
+        if (!req->timer)
+        {
+            logErrorCode(
+                "CreateThreadpoolTimer() failed",
+                "GetLastError",
+                GetLastError()
+                );
+
+            return;
+        }
+
+        startTimer(
+            req->timer,
+            route->handshake.timeout
+            );
+        postHandshakeRead(req.release());
+    }
+
+    // Peek at (or, once consuming, receive more of) the handshake into the
+    // request's buffer. Frees the request if nothing could be posted.
+    static void
+    postHandshakeRead(
+        HandshakeRead* req
+        )
+    {
+        req->op.reset();
+
+        WSABUF buf {};
+        buf.buf     = req->buffer.data() + (req->consuming ? req->have : 0);
+        buf.len     = static_cast<ULONG>(req->buffer.size() - (req->consuming ? req->have : 0));
+        DWORD flags = req->consuming ? 0 : MSG_PEEK;
+
+        if (
+            WSARecv(
+                req->conn->client,
+                &buf,
+                1,
+                nullptr,
+                &flags,
+                &req->op.overlapped,
+                nullptr
+                ) == SOCKET_ERROR
+            )
+        {
+            if (int err = WSAGetLastError(); err != WSA_IO_PENDING)
+            {
+                // Nothing was queued; the client is gone.
+                proxyMetrics().handshakeDropped.add(1);
+                stopTimer(req->timer);
+                delete req;
+
+                return;
+            }
+        }
+
+        // A deadline that passed while no read was posted cancelled nothing.
+        if (req->timedOut.load())
+        {
+            CancelIoEx(
+                reinterpret_cast<HANDLE>(req->conn->client),
+                &req->op.overlapped
+                );
+        }
+    }
+
+    static void CALLBACK
+    onHandshakeTimeout(
+        PTP_CALLBACK_INSTANCE /*instance*/,
+        PVOID context,
+        PTP_TIMER /*timer*/
+        )
+    {
+        auto* req = static_cast<HandshakeRead*>(context);
+        req->timedOut.store(true);
+
+        // Completes the pending read with WSA_OPERATION_ABORTED; if none is
+        // pending, postHandshakeRead() sees timedOut and cancels its own.
+        CancelIoEx(
+            reinterpret_cast<HANDLE>(req->conn->client),
+            &req->op.overlapped
+            );
+    }
+
+    static void
+    onHandshakeComplete(
+        IoOperation& op,
+        DWORD bytes,
+        int error
+        )
+    {
+        auto* req = static_cast<HandshakeRead*>(op.owner);
+
+        if ((error != 0) || (bytes == 0))
+        {
+            std::unique_ptr<HandshakeRead> done(req);
+            stopTimer(done->timer);
+            proxyMetrics().handshakeDropped.add(1);
+
+            if (done->timedOut.load())
+            {
+                logRecord(
+                    {
+                        .format     = formatHandshakeTimedOut,
+                        .stream     = LogStream::Err,
+                        .errorClass = ErrorClass::NetworkOrRemoteIssue,
+                        .num        = {static_cast<std::int64_t>(done->route->handshake.timeout.count())}
+                    }
+                    );
+            }
+
+            return;
+        }
+
+        // A peek sees the whole of what is waiting each time, a receive only
+        // what is new.
+        req->have = req->consuming ? req->have + bytes : bytes;
+
+        std::string host;
+        HandshakeParse parsed = parseMinecraftHandshake(
+            std::string_view(
+                req->buffer.data(),
+                req->have
+                ),
+            host
+            );
+
+        if ((parsed == HandshakeParse::Incomplete) && (req->have < req->buffer.size()))
+        {
+            // Another peek would come straight back with the same bytes, so
+            // from here on they are taken off the socket as they arrive.
+            if (!req->consuming)
+            {
+                req->consuming = true;
+                req->have      = 0;
+            }
+
+            postHandshakeRead(req);
+
+            return;
+        }
+
+        std::unique_ptr<HandshakeRead> done(req);
+        stopTimer(done->timer);
+
+        // A handshake bigger than the budget is treated like any other
+        // first packet that is not one.
+        ForwardTarget& route = *done->route;
+        BackendSet* backends = &route.backends;
+
+        if (parsed == HandshakeParse::Complete)
+        {
+            if (auto it = route.hosts.find(host); it != route.hosts.end())
+            {
+                backends = it->second.get();
+            }
+        }
+
+        if (backends != &route.backends)
+        {
+            proxyMetrics().handshakeByHost.add(1);
+        }
+        else
+        {
+            proxyMetrics().handshakeDefault.add(1);
+        }
+
+        if (done->consuming)
+        {
+            done->conn->preface.assign(
+                done->buffer.begin(),
+                done->buffer.begin() + done->have
+                );
+        }
+        else
+        {
+            proxyMetrics().handshakePeeked.add(1);
+        }
+
+        done->owner->openTarget(
+            std::move(done->conn),
+            route,
+            *backends,
+            done->hasPeer ? &done->peer : nullptr
+            );
+    }
+
+    static LPFN_CONNECTEX
+    loadConnectEx()
+    {
+        SOCKET probe = socket(
+            AF_INET,
+            SOCK_STREAM,
+            IPPROTO_TCP
+            );
+
+        if (probe == INVALID_SOCKET)
+        {
+            throw std::runtime_error("socket() failed while loading ConnectEx (WSA = " + std::to_string(WSAGetLastError()) + ")");
+        }
+
+        GUID guid         = WSAID_CONNECTEX;
+        LPFN_CONNECTEX fn = nullptr;
+        DWORD bytes       = 0;
+        int rc            = WSAIoctl(
+            probe,
+            SIO_GET_EXTENSION_FUNCTION_POINTER,
+            &guid,
+            sizeof(guid),
+            &fn,
+            sizeof(fn),
+            &bytes,
+            nullptr,
+            nullptr
+            );
+        int err = WSAGetLastError();
+        closesocket(probe);
+
+        if ((rc == SOCKET_ERROR) || !fn)
+        {
+            throw std::runtime_error("WSAIoctl(ConnectEx) failed (WSA = " + std::to_string(err) + ")");
+        }
+
+        return fn;
+    }
+
+    // Fire timer once, after delay.
+    static void
+    startTimer(
+        PTP_TIMER timer,
+        std::chrono::milliseconds delay
+        )
+    {
+        // Negative due time = relative, in 100 ns units.
+        LONGLONG relative = -static_cast<LONGLONG>(delay.count()) * 10'000;
+        FILETIME dueTime {};
+        dueTime.dwLowDateTime  = static_cast<DWORD>(relative & 0xFFFFFFFF);
+        dueTime.dwHighDateTime = static_cast<DWORD>(relative >> 32);
+
+        SetThreadpoolTimer(
+            timer,
+            &dueTime,
+            0,
+            0
+            );
+    }
+
+    // Disarm the timer and wait out a callback that may already be running, so
+    // the request can be freed safely afterwards.
+    static void
+    stopTimer(
+        PTP_TIMER& timer
+        )
+    {
+        SetThreadpoolTimer(
+            timer,
+            nullptr,
+            0,
+            0
+            );
+        WaitForThreadpoolTimerCallbacks(
+            timer,
+            TRUE
+            );
+        CloseThreadpoolTimer(timer);
+        timer = nullptr;
+    }
+
+    static void CALLBACK
+    onConnectTimeout(
+        PTP_CALLBACK_INSTANCE /*instance*/,
+        PVOID context,
+        PTP_TIMER /*timer*/
+        )
+    {
+        auto* req = static_cast<Request*>(context);
+        req->timedOut.store(true);
+
+        // Completes the pending ConnectEx() with WSA_OPERATION_ABORTED. Harmless
+        // if it already completed.
+        CancelIoEx(
+            reinterpret_cast<HANDLE>(req->conn->target),
+            &req->op.overlapped
+            );
+    }
+
+    static void
+    onConnectComplete(
+        IoOperation& op,
+        DWORD /*bytes*/,
+        int error
+        )
+    {
+        std::unique_ptr<Request> req(static_cast<Request*>(op.owner));
+        stopTimer(req->timer);
+
+        TargetConnector& self = *req->owner;
+        Backend& backend      = *req->conn->backend;
+
+        if (error != 0)
+        {
+            if (req->timedOut.load())
+            {
+                logRecord(
+                    {
+                        .format     = formatConnectTimedOut,
+                        .stream     = LogStream::Err,
+                        .errorClass = ErrorClass::NetworkOrRemoteIssue,
+                        .num        = {static_cast<std::int64_t>(self.m_timeout.count())}
+                    },
+                    backend.label
+                    );
+            }
+            else
+            {
+                logConnectFailed(
+                    backend,
+                    error
+                    );
+            }
+
+            backend.recordConnectFailure(self.m_timeout);
+            proxyMetrics().connectFailures.add(1);
+
+            return;
+        }
+
+        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - req->started);
+        backend.recordConnectLatency(latency);
+        proxyMetrics().connectLatency.record(latency);
+
+        // Make shutdown()/getpeername() etc. work on the ConnectEx() socket.
+        if (
+            setsockopt(
+                req->conn->target,
+                SOL_SOCKET,
+                SO_UPDATE_CONNECT_CONTEXT,
+                nullptr,
+                0
+                ) == SOCKET_ERROR
+            )
+        {
+            logRawWSAError("setsockopt(SO_UPDATE_CONNECT_CONTEXT) failed");
+
+            return;
+        }
+
+        if (
+            !startForwarding(
+                self.m_pool,
+                self.m_rio,
+                req->conn,
+                req->mode
+                )
+            )
+        {
+            return;
+        }
+
+        self.watch(req->conn);
+        logEstablished(
+            backend,
+            req->conn->mode,
+            ""
+            );
+    }
+
+    ConnectionTable& m_table;
+    IoReactor& m_reactor;
+    RioEngine* m_rio;
+    ConnectionReaper* m_reaper;
+    BufferPool& m_pool;
+    std::chrono::milliseconds m_timeout;
+    LPFN_CONNECTEX m_connectEx {nullptr};
+};
@@ -0,0 +1,190 @@
+﻿#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+
+// Intrusive timer for TimingWheel. context is free for the owner's use.
+struct TimerNode
+{
+    TimerNode* prev {nullptr};
+    TimerNode* next {nullptr};
+    std::uint64_t deadline {0};
+    void* context {nullptr};
+
+    bool
+    linked() const noexcept
+    {
+        return prev != nullptr;
+    }
+};
+
+// Hierarchical timing wheel (Varghese & Lauck) over an abstract tick count.
+//
+// Level 0 has one slot per tick for the next 64 ticks, level 1 one slot per 64
+// ticks for the next 4096, and so on; timers further out than the top level
+// covers are parked at its far end and simply come round again. Scheduling and
+// cancelling are O(1) list operations; each tick fires one level-0 slot and,
+// every 64^n ticks, redistributes one slot of level n into the levels below.
+//
+// Not thread-safe: the owner serializes all calls.
+class TimingWheel
+{
+public:
+    static constexpr unsigned kLevelBits = 6;
+    static constexpr unsigned kSlots     = 1u << kLevelBits;
+    static constexpr unsigned kLevels    = 4;
+    static constexpr std::uint64_t kSpan = std::uint64_t {1} << (kLevelBits * kLevels);
+
+    explicit TimingWheel(
+        std::uint64_t now = 0
+        )
+        : m_now(now)
+    {
+        for (auto& level : m_slots)
+        {
+            for (TimerNode& head : level)
+            {
+                head.prev = &head;
+                head.next = &head;
+            }
+        }
+    }
+
+    TimingWheel(const TimingWheel&)            = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    std::uint64_t
+    now() const noexcept
+    {
+        return m_now;
+    }
+
+    // (Re)arm node for deadline. Deadlines not after now fire on the next tick.
+    void
+    schedule(
+        TimerNode& node,
+        std::uint64_t deadline
+        ) noexcept
+    {
+        cancel(node);
+
+        if (deadline <= m_now)
+        {
+            deadline = m_now + 1;
+        }
+        else if (deadline - m_now >= kSpan)
+        {
+            deadline = m_now + kSpan - 1;
+        }
+
+        node.deadline = deadline;
+        link(node);
+    }
+
+    void
+    cancel(
+        TimerNode& node
+        ) noexcept
+    {
+        if (!node.linked())
+        {
+            return;
+        }
+
+        node.prev->next = node.next;
+        node.next->prev = node.prev;
+        node.prev       = nullptr;
+        node.next       = nullptr;
+    }
+
+    // Move time forward to now, calling onExpired(TimerNode&) for every timer
+    // that comes due, already unlinked. onExpired may schedule the node again.
+    template <typename Fn>
+    void
+    advance(
+        std::uint64_t now,
+        Fn&& onExpired
+        )
+    {
+        while (m_now < now)
+        {
+            ++m_now;
+
+            // Higher levels first, so that what they hand down for this tick
+            // is in place before the lower slots are processed.
+            for (unsigned level = kLevels - 1; level > 0; --level)
+            {
+                if ((m_now & ((std::uint64_t {1} << (kLevelBits * level)) - 1)) == 0)
+                {
+                    cascade(level);
+                }
+            }
+
+            TimerNode& head = m_slots[0][m_now & (kSlots - 1)];
+
+            while (head.next != &head)
+            {
+                TimerNode& node = *head.next;
+                cancel(node);
+                onExpired(node);
+            }
+        }
+    }
+
+    // Unlink every timer without firing it, calling fn(TimerNode&) for each,
+    // e.g. to free them.
+    template <typename Fn>
+    void
+    clear(
+        Fn&& fn
+        )
+    {
+        for (auto& level : m_slots)
+        {
+            for (TimerNode& head : level)
+            {
+                while (head.next != &head)
+                {
+                    TimerNode& node = *head.next;
+                    cancel(node);
+                    fn(node);
+                }
+            }
+        }
+    }
+
+private:
+    void
+    link(
+        TimerNode& node
+        ) noexcept
+    {
+        std::uint64_t delta = node.deadline - m_now;
+        unsigned level      = (delta < kSlots) ? 0 : (static_cast<unsigned>(std::bit_width(delta)) - 1) / kLevelBits;
+        TimerNode& head     = m_slots[level][(node.deadline >> (kLevelBits * level)) & (kSlots - 1)];
+
+        node.prev       = head.prev;
+        node.next       = &head;
+        head.prev->next = &node;
+        head.prev       = &node;
+    }
+
+    void
+    cascade(
+        unsigned level
+        ) noexcept
+    {
+        TimerNode& head = m_slots[level][(m_now >> (kLevelBits * level)) & (kSlots - 1)];
+
+        while (head.next != &head)
+        {
+            TimerNode& node = *head.next;
+            cancel(node);
+            link(node);
+        }
+    }
+
+    std::uint64_t m_now;
+    std::array<std::array<TimerNode, kSlots>, kLevels> m_slots;
+};
@@ -0,0 +1,1173 @@
+﻿#pragma once
+
+#include "AccessControl.hpp"
+#include "AsyncLog.hpp"
+#include "BackendSet.hpp"
+#include "IoReactor.hpp"
+#include "Metrics.hpp"
+#include "WinsockError.hpp"
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <Windows.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Forwards UDP datagrams arriving on the listen port to the backends.
+//
+// Each client address gets a session: an upstream UDP socket connected to the
+// backend picked for that client, so replies can be told apart and sent back
+// to the right client from the listen port. Sessions nobody has sent through
+// for the idle timeout are closed by a sweeper thread. With an access list,
+// datagrams from addresses it denies never get a session and are dropped.
+// Every session holds a socket and kSessionDepth buffers until it goes idle,
+// so at most maxSessions are open at once; a datagram from a new address past
+// that is dropped rather than letting a flood of spoofed sources use up memory
+// and handles before the sweeper gets to them.
+//
+// Winsock has no recvmmsg()/sendmmsg(); batching comes from the reactor
+// instead. The listener keeps kListenerDepth overlapped WSARecvMsg() calls
+// posted and every session kSessionDepth, so the stack always has somewhere to
+// put the next datagram and each GetQueuedCompletionStatusEx() on the workers
+// reaps many of them at once. Each slot receives into its buffer, sends the
+// same bytes out of it and re-posts itself, so a datagram is never copied.
+// Where the stack supports UDP segmentation offload, receive coalescing (URO,
+// the GRO equivalent) is also switched on: one completion may carry a train of
+// equal-sized datagrams from the same sender, which is sent on with a single
+// USO (GSO equivalent) send that the stack splits back into the same datagrams.
+class UdpForwarder
+{
+public:
+    UdpForwarder(
+        IoReactor& reactor,
+        BackendSet& backends,
+        const AccessControl* access,
+        int listenPort,
+        std::chrono::milliseconds idleTimeout,
+        unsigned maxSessions
+        )
+        : m_reactor(reactor)
+        , m_backends(backends)
+        , m_access(access)
+        , m_idleTimeout(idleTimeout)
+        , m_maxSessions(maxSessions)
+    {
+        m_listener = WSASocketW(
+            AF_INET,
+            SOCK_DGRAM,
+            IPPROTO_UDP,
+            nullptr,
+            0,
+            WSA_FLAG_OVERLAPPED
+            );
+
+        if (m_listener == INVALID_SOCKET)
+        {
+            throw std::runtime_error("socket() failed for UDP listener (WSA = " + std::to_string(WSAGetLastError()) + ")");
+        }
+
+        sockaddr_in listenAddr {};
+        listenAddr.sin_family      = AF_INET;
+        listenAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+        listenAddr.sin_port        = htons(static_cast<u_short>(listenPort));
+
+        if (
+            bind(
+                m_listener,
+                (sockaddr*) &listenAddr,
+                sizeof(listenAddr)
+                ) == SOCKET_ERROR
+            )
+        {
+            fail("bind() failed for UDP listener");
+        }
+
+        m_recvMsg  = loadWSARecvMsg(m_listener);
+        m_coalesce = supportsSendOffload();
+        configureSocket(m_listener);
+
+        // Room for a burst to queue up while the workers catch up.
+        int rcvbuf = kListenerReceiveBuffer;
+
+        if (
+            setsockopt(
+                m_listener,
+                SOL_SOCKET,
+                SO_RCVBUF,
+                reinterpret_cast<const char*>(&rcvbuf),
+                sizeof(rcvbuf)
+                ) == SOCKET_ERROR
+            )
+        {
+            logRawWSAError("setsockopt(SO_RCVBUF) failed for UDP listener");
+            // Not fatal; continue anyway.
+        }
+
+        if (!m_reactor.associate(m_listener))
+        {
+            fail("CreateIoCompletionPort() failed to associate UDP listener");
+        }
+
+        unsigned posted = 0;
+
+        for (unsigned i = 0; i < kListenerDepth; ++i)
+        {
+            Slot& slot = newSlot(
+                Leg::FromClient,
+                nullptr
+                );
+
+            if (postReceive(slot))
+            {
+                ++posted;
+            }
+            else
+            {
+                retire(slot);
+            }
+        }
+
+        if (posted == 0)
+        {
+            fail("WSARecvMsg() failed on UDP listener");
+        }
+
+        m_sweeper = std::jthread(
+            [this] (std::stop_token st)
+            {
+                runSweeper(st);
+            }
+            );
+    }
+
+    // Closes every session and waits until all outstanding operations have
+    // come back, so nothing completes into a destroyed forwarder.
+    ~UdpForwarder()
+    {
+        m_sweeper.request_stop();
+        m_sweeper.join();
+
+        m_stopping.store(true);
+
+        for (Shard& shard : m_shards)
+        {
+            std::unique_lock lock(shard.mtx);
+
+            for (auto& [key, session] : shard.sessions)
+            {
+                closeSession(*session);
+            }
+
+            shard.sessions.clear();
+        }
+
+        CancelIoEx(
+            reinterpret_cast<HANDLE>(m_listener),
+            nullptr
+            );
+
+        {
+            std::unique_lock lock(m_slotsMtx);
+            m_slotsIdle.wait(
+                lock,
+                [this] ()
+                {
+                    return m_liveSlots == 0;
+                }
+                );
+        }
+
+        closesocket(m_listener);
+    }
+
+    UdpForwarder(const UdpForwarder&)            = delete;
+    UdpForwarder& operator=(const UdpForwarder&) = delete;
+
+    // Whether datagram trains are coalesced on receive and segmented on send.
+    bool
+    coalescing() const noexcept
+    {
+        return m_coalesce;
+    }
+
+private:
+    static constexpr DWORD kDatagramBuffer      = 64 * 1024;
+    static constexpr DWORD kMaxCoalesced        = 65507; // largest IPv4 UDP payload
+    static constexpr DWORD kProbeSegment        = 1200;
+    static constexpr int kListenerReceiveBuffer = 4 * 1024 * 1024;
+    static constexpr unsigned kListenerDepth    = 32;
+    static constexpr unsigned kSessionDepth     = 2;
+    static constexpr std::size_t kShards        = 16;
+    static constexpr std::int64_t kTouchGrainMs = 100;
+
+    // Which socket a slot receives on: the listener (datagrams from clients)
+    // or a session's upstream socket (datagrams from its backend).
+    enum class Leg : std::uint8_t
+    {
+        FromClient,
+        FromTarget
+    };
+
+    struct Session
+    {
+        SOCKET socket {INVALID_SOCKET};
+        sockaddr_in client {};
+        std::uint64_t key {0};
+        Backend* backend {nullptr};
+        std::atomic<unsigned>* live {nullptr}; // released when destroyed
+        std::atomic<std::int64_t> lastActiveMs {0};
+        std::atomic<bool> closed {false};
+
+        Session() = default;
+
+        Session(const Session&)            = delete;
+        Session& operator=(const Session&) = delete;
+
+        // Runs once the last slot using the session is gone, so no operation
+        // can still be pending on the socket.
+        ~Session()
+        {
+            if (socket != INVALID_SOCKET)
+            {
+                closesocket(socket);
+            }
+
+            if (backend)
+            {
+                backend->closed();
+                proxyMetrics().udpSessions.sub(1);
+            }
+
+            if (live)
+            {
+                live->fetch_sub(1);
+            }
+        }
+    };
+
+    // One buffer and the operation cycling through it: receive, send the same
+    // bytes on, receive again. Only the worker handling its completion touches
+    // a slot.
+    struct Slot
+    {
+        IoOperation op;
+        UdpForwarder* owner {nullptr};
+        Leg leg {Leg::FromClient};
+        bool sending {false};
+
+        // FromTarget: the session received on. FromClient: the session the
+        // current datagram is being sent to, held only while sending.
+        std::shared_ptr<Session> session;
+
+        sockaddr_in peer {};
+        WSAMSG msg {};
+        WSABUF data {};
+        alignas(8) char control[64] {};
+        std::unique_ptr<char[]> buffer;
+    };
+
+    // Sessions are spread over shards by client address so that lookups on the
+    // hot path from different workers rarely share a lock.
+    struct alignas(64) Shard
+    {
+        std::shared_mutex mtx;
+        std::unordered_map<std::uint64_t, std::shared_ptr<Session>> sessions;
+    };
+
+    static std::int64_t
+    nowMs()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static std::uint64_t
+    keyOf(
+        const sockaddr_in& addr
+        )
+    {
+        return (static_cast<std::uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+    }
+
+    Shard&
+    shardOf(
+        std::uint64_t key
+        )
+    {
+        return m_shards[(key ^ (key >> 16)) % kShards];
+    }
+
+    [[noreturn]] void
+    fail(
+        const char* what
+        )
+    {
+        int err = WSAGetLastError();
+        closesocket(m_listener);
+
+        throw std::runtime_error(std::string(what) + " (WSA = " + std::to_string(err) + ")");
+    }
+
+    static void
+    formatSession(
+        std::ostream& out,
+        const LogRecord& rec
+        )
+    {
+        in_addr addr {};
+        addr.s_addr = static_cast<ULONG>(rec.num[0]);
+        char ip[INET_ADDRSTRLEN] {};
+        inet_ntop(
+            AF_INET,
+            &addr,
+            ip,
+            sizeof(ip)
+            );
+
+        out << "UDP session " << rec.text[0] << ": " << ip << ":" << rec.num[1]
+            << " -> " << rec.str << rec.text[1] << "\n";
+    }
+
+    // event and suffix must be string literals.
+    static void
+    logSession(
+        const Session& session,
+        const char* event,
+        const char* suffix
+        )
+    {
+        logRecord(
+            {
+                .format = formatSession,
+                .stream = LogStream::Out,
+                .text   = {event, suffix},
+                .num    = {
+                    static_cast<std::int64_t>(session.client.sin_addr.s_addr),
+                    ntohs(session.client.sin_port)
+                }
+            },
+            session.backend->label
+            );
+    }
+
+    LPFN_WSARECVMSG
+    loadWSARecvMsg(
+        SOCKET s
+        )
+    {
+        GUID guid          = WSAID_WSARECVMSG;
+        LPFN_WSARECVMSG fn = nullptr;
+        DWORD bytes        = 0;
+
+        if (
+            (WSAIoctl(
+                s,
+                SIO_GET_EXTENSION_FUNCTION_POINTER,
+                &guid,
+                sizeof(guid),
+                &fn,
+                sizeof(fn),
+                &bytes,
+                nullptr,
+                nullptr
+                ) == SOCKET_ERROR) || !fn
+            )
+        {
+            fail("WSAIoctl(WSARecvMsg) failed");
+        }
+
+        return fn;
+    }
+
+    // USO needs a recent stack; only coalesce receives if trains can be sent on
+    // as one send again.
+    static bool
+    supportsSendOffload()
+    {
+        SOCKET probe = socket(
+            AF_INET,
+            SOCK_DGRAM,
+            IPPROTO_UDP
+            );
+
+        if (probe == INVALID_SOCKET)
+        {
+            return false;
+        }
+
+        DWORD segment = kProbeSegment;
+        bool ok       = setsockopt(
+            probe,
+            IPPROTO_UDP,
+            UDP_SEND_MSG_SIZE,
+            reinterpret_cast<const char*>(&segment),
+            sizeof(segment)
+            ) != SOCKET_ERROR;
+        closesocket(probe);
+
+        return ok;
+    }
+
+    void
+    configureSocket(
+        SOCKET s
+        )
+    {
+        // Without this an ICMP port unreachable for an earlier send fails the
+        // next receive with WSAECONNRESET.
+        BOOL reportReset = FALSE;
+        DWORD bytes      = 0;
+
+        if (
+            WSAIoctl(
+                s,
+                SIO_UDP_CONNRESET,
+                &reportReset,
+                sizeof(reportReset),
+                nullptr,
+                0,
+                &bytes,
+                nullptr,
+                nullptr
+                ) == SOCKET_ERROR
+            )
+        {
+            logRawWSAError("WSAIoctl(SIO_UDP_CONNRESET) failed");
+        }
+
+        if (m_coalesce)
+        {
+            DWORD maxCoalesced = kMaxCoalesced;
+
+            // Best effort: without it this socket just sees single datagrams.
+            setsockopt(
+                s,
+                IPPROTO_UDP,
+                UDP_RECV_MAX_COALESCED_SIZE,
+                reinterpret_cast<const char*>(&maxCoalesced),
+                sizeof(maxCoalesced)
+                );
+        }
+    }
+
+    Slot&
+    newSlot(
+        Leg leg,
+        std::shared_ptr<Session> session
+        )
+    {
+        auto* slot          = new Slot {};
+        slot->owner         = this;
+        slot->leg           = leg;
+        slot->session       = std::move(session);
+        slot->op.owner      = slot;
+        slot->op.onComplete = onComplete;
+        slot->buffer        = std::make_unique<char[]>(kDatagramBuffer);
+
+        std::lock_guard lock(m_slotsMtx);
+        ++m_liveSlots;
+
+        return *slot;
+    }
+
+    void
+    retire(
+        Slot& slot
+        )
+    {
+        delete &slot;
+
+        std::lock_guard lock(m_slotsMtx);
+
+        if (--m_liveSlots == 0)
+        {
+            m_slotsIdle.notify_all();
+        }
+    }
+
+    bool
+    stopped(
+        const Slot& slot
+        ) const
+    {
+        return m_stopping.load() || ((slot.leg == Leg::FromTarget) && slot.session->closed.load());
+    }
+
+    // Post slot's next receive. Returns false if nothing is pending.
+    bool
+    postReceive(
+        Slot& slot
+        )
+    {
+        SOCKET s = (slot.leg == Leg::FromClient) ? m_listener : slot.session->socket;
+
+        slot.sending             = false;
+        slot.op.reset();
+        slot.op.socket           = s;
+        slot.data.buf            = slot.buffer.get();
+        slot.data.len            = kDatagramBuffer;
+        slot.msg.name            = (sockaddr*) &slot.peer;
+        slot.msg.namelen         = sizeof(slot.peer);
+        slot.msg.lpBuffers       = &slot.data;
+        slot.msg.dwBufferCount   = 1;
+        slot.msg.Control.buf     = slot.control;
+        slot.msg.Control.len     = sizeof(slot.control);
+        slot.msg.dwFlags         = 0;
+
+        if (
+            m_recvMsg(
+                s,
+                &slot.msg,
+                nullptr,
+                &slot.op.overlapped,
+                nullptr
+                ) == SOCKET_ERROR
+            )
+        {
+            if (int err = WSAGetLastError(); err != WSA_IO_PENDING)
+            {
+                logSocketError(
+                    (slot.leg == Leg::FromClient) ? "udp client->target" : "udp target->client",
+                    "WSARecvMsg()",
+                    err
+                    );
+
+                return false;
+            }
+        }
+
+        // Raced with closeSession() or shutdown, which may have cancelled
+        // before this receive was queued: cancel it here instead.
+        if (stopped(slot))
+        {
+            CancelIoEx(
+                reinterpret_cast<HANDLE>(s),
+                &slot.op.overlapped
+                );
+        }
+
+        return true;
+    }
+
+    // Send bytes from slot's buffer on s (to *to, unless s is connected).
+    // segment > 0 marks a coalesced train of datagrams of that size. Returns 0
+    // or the Winsock error if nothing was queued.
+    static int
+    postSend(
+        Slot& slot,
+        SOCKET s,
+        bool addressed,
+        DWORD bytes,
+        DWORD segment
+        )
+    {
+        slot.sending     = true;
+        slot.op.reset();
+        slot.op.socket   = s;
+        slot.data.len    = bytes;
+        slot.msg.name    = addressed ? (sockaddr*) &slot.peer : nullptr;
+        slot.msg.namelen = addressed ? sizeof(slot.peer) : 0;
+        slot.msg.dwFlags = 0;
+
+        if ((segment > 0) && (segment < bytes))
+        {
+            auto* cmsg       = reinterpret_cast<WSACMSGHDR*>(slot.control);
+            cmsg->cmsg_len   = WSA_CMSG_LEN(sizeof(DWORD));
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type  = UDP_SEND_MSG_SIZE;
+            std::memcpy(
+                WSA_CMSG_DATA(cmsg),
+                &segment,
+                sizeof(segment)
+                );
+
+            slot.msg.Control.buf = slot.control;
+            slot.msg.Control.len = static_cast<ULONG>(WSA_CMSG_SPACE(sizeof(DWORD)));
+        }
+        else
+        {
+            slot.msg.Control.buf = nullptr;
+            slot.msg.Control.len = 0;
+        }
+
+        if (
+            WSASendMsg(
+                s,
+                &slot.msg,
+                0,
+                nullptr,
+                &slot.op.overlapped,
+                nullptr
+                ) == SOCKET_ERROR
+            )
+        {
+            if (int err = WSAGetLastError(); err != WSA_IO_PENDING)
+            {
+                return err;
+            }
+        }
+
+        return 0;
+    }
+
+    // Segment size of a coalesced receive, or 0 for a single datagram.
+    static DWORD
+    coalescedSegment(
+        WSAMSG& msg
+        )
+    {
+        for (WSACMSGHDR* cmsg = WSA_CMSG_FIRSTHDR(&msg); cmsg; cmsg = WSA_CMSG_NXTHDR(&msg, cmsg))
+        {
+            if ((cmsg->cmsg_level == IPPROTO_UDP) && (cmsg->cmsg_type == UDP_COALESCED_INFO))
+            {
+                DWORD segment = 0;
+                std::memcpy(
+                    &segment,
+                    WSA_CMSG_DATA(cmsg),
+                    sizeof(segment)
+                    );
+
+                return segment;
+            }
+        }
+
+        return 0;
+    }
+
+    // Only store the timestamp when it moved on noticeably, so a busy session
+    // does not bounce its cache line between workers on every datagram.
+    static void
+    touch(
+        Session& session
+        )
+    {
+        std::int64_t now = nowMs();
+
+        if (now - session.lastActiveMs.load(std::memory_order_relaxed) >= kTouchGrainMs)
+        {
+            session.lastActiveMs.store(
+                now,
+                std::memory_order_relaxed
+                );
+        }
+    }
+
+    std::shared_ptr<Session>
+    findOrOpen(
+        const sockaddr_in& client
+        )
+    {
+        std::uint64_t key = keyOf(client);
+        Shard& shard      = shardOf(key);
+
+        {
+            std::shared_lock lock(shard.mtx);
+
+            if (auto it = shard.sessions.find(key); it != shard.sessions.end())
+            {
+                return it->second;
+            }
+        }
+
+        if (m_stopping.load())
+        {
+            return {};
+        }
+
+        if (m_access && !m_access->allowed(client.sin_addr))
+        {
+            proxyMetrics().rejected[static_cast<std::size_t>(RejectReason::AccessDenied)].add(1);
+
+            return {};
+        }
+
+        // Counted until the session is destroyed, not just while it is in a
+        // shard, since its buffers and socket live that long.
+        if (m_liveSessions.fetch_add(1) >= m_maxSessions)
+        {
+            m_liveSessions.fetch_sub(1);
+            proxyMetrics().rejected[static_cast<std::size_t>(RejectReason::ConnectionLimit)].add(1);
+
+            return {};
+        }
+
+        auto session     = std::make_shared<Session>();
+        session->live    = &m_liveSessions;
+        Backend& backend = m_backends.select(&client);
+        session->client  = client;
+        session->key     = key;
+        session->lastActiveMs.store(nowMs());
+        session->socket  = WSASocketW(
+            AF_INET,
+            SOCK_DGRAM,
+            IPPROTO_UDP,
+            nullptr,
+            0,
+            WSA_FLAG_OVERLAPPED
+            );
+
+        if (session->socket == INVALID_SOCKET)
+        {
+            logRawWSAError("socket() failed for UDP session");
+
+            return {};
+        }
+
+        session->backend = &backend;
+        backend.opened();
+        proxyMetrics().udpSessions.add(1);
+
+        // Connected, so only the backend's replies arrive here and sends need
+        // no address.
+        sockaddr_in targetAddr = backend.address;
+
+        if (
+            ::connect(
+                session->socket,
+                (sockaddr*) &targetAddr,
+                sizeof(targetAddr)
+                ) == SOCKET_ERROR
+            )
+        {
+            logRawWSAError("connect() failed for UDP session");
+
+            return {};
+        }
+
+        configureSocket(session->socket);
+
+        if (!m_reactor.associate(session->socket))
+        {
+            logErrorCode(
+                "CreateIoCompletionPort() failed to associate socket",
+                "GetLastError",
+                GetLastError()
+                );
+
+            return {};
+        }
+
+        {
+            std::unique_lock lock(shard.mtx);
+
+            auto [it, inserted] = shard.sessions.try_emplace(
+                key,
+                session
+                );
+
+            // Another worker opened one for the same client first; use that.
+            if (!inserted)
+            {
+                return it->second;
+            }
+        }
+
+        logSession(
+            *session,
+            "opened",
+            ""
+            );
+
+        for (unsigned i = 0; i < kSessionDepth; ++i)
+        {
+            Slot& slot = newSlot(
+                Leg::FromTarget,
+                session
+                );
+
+            if (!postReceive(slot))
+            {
+                retire(slot);
+            }
+        }
+
+        return session;
+    }
+
+    // Stop the session's receives. The caller has already taken it out of its
+    // shard; the socket closes once the last slot lets go of it.
+    static void
+    closeSession(
+        Session& session
+        )
+    {
+        if (session.closed.exchange(true))
+        {
+            return;
+        }
+
+        CancelIoEx(
+            reinterpret_cast<HANDLE>(session.socket),
+            nullptr
+            );
+    }
+
+    void
+    dropSession(
+        const std::shared_ptr<Session>& session
+        )
+    {
+        Shard& shard = shardOf(session->key);
+
+        {
+            std::unique_lock lock(shard.mtx);
+
+            if (auto it = shard.sessions.find(session->key); (it != shard.sessions.end()) && (it->second == session))
+            {
+                shard.sessions.erase(it);
+            }
+        }
+
+        closeSession(*session);
+    }
+
+    void
+    runSweeper(
+        std::stop_token st
+        )
+    {
+        auto interval = std::clamp(
+            m_idleTimeout / 4,
+            std::chrono::milliseconds(100),
+            std::chrono::milliseconds(1000)
+            );
+
+        std::mutex waitMtx;
+        std::condition_variable_any cv;
+        std::vector<std::shared_ptr<Session>> expired;
+
+        while (!st.stop_requested())
+        {
+            {
+                std::unique_lock ul(waitMtx);
+
+                if (
+                    cv.wait_for(
+                        ul,
+                        st,
+                        interval,
+                        [] ()
+                        {
+                            return false;
+                        }
+                        )
+                    )
+                {
+                    continue;
+                }
+            }
+
+            std::int64_t cutoff = nowMs() - m_idleTimeout.count();
+
+            for (Shard& shard : m_shards)
+            {
+                std::unique_lock lock(shard.mtx);
+
+                for (auto it = shard.sessions.begin(); it != shard.sessions.end();)
+                {
+                    if (it->second->lastActiveMs.load(std::memory_order_relaxed) < cutoff)
+                    {
+                        expired.push_back(std::move(it->second));
+                        it = shard.sessions.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+            }
+
+            for (const auto& session : expired)
+            {
+                closeSession(*session);
+                proxyMetrics().udpExpired.add(1);
+                logSession(
+                    *session,
+                    "expired",
+                    " (idle)"
+                    );
+            }
+
+            expired.clear();
+        }
+    }
+
+    static void
+    onComplete(
+        IoOperation& op,
+        DWORD bytes,
+        int error
+        )
+    {
+        auto& slot = *static_cast<Slot*>(op.owner);
+        auto& self = *slot.owner;
+
+        if (slot.sending)
+        {
+            self.onSendComplete(
+                slot,
+                error
+                );
+        }
+        else if (slot.leg == Leg::FromClient)
+        {
+            self.onClientDatagram(
+                slot,
+                bytes,
+                error
+                );
+        }
+        else
+        {
+            self.onTargetDatagram(
+                slot,
+                bytes,
+                error
+                );
+        }
+    }
+
+    // Receive again, or retire the slot if that is no longer possible.
+    void
+    rearm(
+        Slot& slot
+        )
+    {
+        if (stopped(slot) || !postReceive(slot))
+        {
+            retire(slot);
+        }
+    }
+
+    void
+    forward(
+        Slot& slot,
+        SOCKET s,
+        bool addressed,
+        DWORD bytes,
+        const char* directionLabel
+        )
+    {
+        DWORD segment = coalescedSegment(slot.msg);
+
+        if (
+            int err = postSend(
+                slot,
+                s,
+                addressed,
+                bytes,
+                segment
+                ); err != 0
+            )
+        {
+            logSocketError(
+                directionLabel,
+                "WSASendMsg()",
+                err
+                );
+            proxyMetrics().udpDropped.add(1);
+
+            if (slot.leg == Leg::FromClient)
+            {
+                slot.session.reset();
+            }
+
+            rearm(slot);
+        }
+    }
+
+    void
+    onClientDatagram(
+        Slot& slot,
+        DWORD bytes,
+        int error
+        )
+    {
+        if (error != 0)
+        {
+            if (error == WSAEMSGSIZE)
+            {
+                proxyMetrics().udpDropped.add(1);
+            }
+            else if (!stopped(slot))
+            {
+                logSocketError(
+                    "udp client->target",
+                    "WSARecvMsg()",
+                    error
+                    );
+            }
+
+            rearm(slot);
+
+            return;
+        }
+
+        std::shared_ptr<Session> session = findOrOpen(slot.peer);
+
+        if (!session)
+        {
+            proxyMetrics().udpDropped.add(1);
+            rearm(slot);
+
+            return;
+        }
+
+        touch(*session);
+        countDatagrams(
+            proxyMetrics().udpDatagramsToTarget,
+            proxyMetrics().bytesToTarget,
+            slot.msg,
+            bytes
+            );
+
+        SOCKET upstream = session->socket;
+        slot.session    = std::move(session);
+        forward(
+            slot,
+            upstream,
+            false,
+            bytes,
+            "udp client->target"
+            );
+    }
+
+    void
+    onTargetDatagram(
+        Slot& slot,
+        DWORD bytes,
+        int error
+        )
+    {
+        if (error != 0)
+        {
+            if (stopped(slot))
+            {
+                retire(slot);
+
+                return;
+            }
+
+            if (error == WSAEMSGSIZE)
+            {
+                proxyMetrics().udpDropped.add(1);
+                rearm(slot);
+
+                return;
+            }
+
+            // The upstream socket itself is broken; let the client start over
+            // with a fresh session.
+            logSocketError(
+                "udp target->client",
+                "WSARecvMsg()",
+                error
+                );
+            dropSession(slot.session);
+            retire(slot);
+
+            return;
+        }
+
+        touch(*slot.session);
+        countDatagrams(
+            proxyMetrics().udpDatagramsToClient,
+            proxyMetrics().bytesToClient,
+            slot.msg,
+            bytes
+            );
+
+        slot.peer = slot.session->client;
+        forward(
+            slot,
+            m_listener,
+            true,
+            bytes,
+            "udp target->client"
+            );
+    }
+
+    void
+    onSendComplete(
+        Slot& slot,
+        int error
+        )
+    {
+        if ((error != 0) && !stopped(slot))
+        {
+            logSocketError(
+                (slot.leg == Leg::FromClient) ? "udp client->target" : "udp target->client",
+                "WSASendMsg()",
+                error
+                );
+            proxyMetrics().udpDropped.add(1);
+        }
+
+        if (slot.leg == Leg::FromClient)
+        {
+            slot.session.reset();
+        }
+
+        rearm(slot);
+    }
+
+    static void
+    countDatagrams(
+        StripedCounter& datagrams,
+        StripedCounter& totalBytes,
+        WSAMSG& msg,
+        DWORD bytes
+        )
+    {
+        DWORD segment = coalescedSegment(msg);
+        DWORD count   = 1;
+
+        if ((segment > 0) && (segment < bytes))
+        {
+            count = (bytes + segment - 1) / segment;
+            proxyMetrics().udpCoalesced.add(1);
+        }
+
+        datagrams.add(count);
+        totalBytes.add(bytes);
+    }
+
+    IoReactor& m_reactor;
+    BackendSet& m_backends;
+    const AccessControl* m_access; // may be null
+    std::chrono::milliseconds m_idleTimeout;
+    unsigned m_maxSessions;
+
+    // Before m_shards, so it outlives the sessions they hold.
+    std::atomic<unsigned> m_liveSessions {0};
+
+    SOCKET m_listener {INVALID_SOCKET};
+    LPFN_WSARECVMSG m_recvMsg {nullptr};
+    bool m_coalesce {false};
+    std::atomic<bool> m_stopping {false};
+
+    std::array<Shard, kShards> m_shards;
+
+    std::mutex m_slotsMtx;
+    std::condition_variable m_slotsIdle;
+    unsigned m_liveSlots {0};
+
+    // Last member: started in the constructor once everything above exists.
+    std::jthread m_sweeper;
+};
@@ -0,0 +1,245 @@
+﻿#pragma once
+
+#include "AsyncLog.hpp"
+
+#include <winsock2.h>
+#include <afunix.h>
+#include <Windows.h>
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// AF_UNIX stream sockets (Windows 10 1803 and later) for peers on this host.
+// Same-host traffic over them skips the TCP stack entirely: no segmentation,
+// checksums, ACKs or congestion control on either leg.
+//
+// Endpoints are written "unix:<path>" wherever a port or <ip>:<port> is
+// accepted.
+constexpr std::string_view kUnixPrefix = "unix:";
+
+inline bool
+isUnixEndpoint(
+    std::string_view spec
+    ) noexcept
+{
+    return spec.starts_with(kUnixPrefix);
+}
+
+// Fill addr for path; false if the path is empty or too long for sun_path.
+inline bool
+makeUnixAddress(
+    const std::string& path,
+    SOCKADDR_UN& addr
+    ) noexcept
+{
+    if (path.empty() || (path.size() >= sizeof(addr.sun_path)))
+    {
+        return false;
+    }
+
+    addr            = {};
+    addr.sun_family = AF_UNIX;
+    std::memcpy(
+        addr.sun_path,
+        path.c_str(),
+        path.size()
+        );
+
+    return true;
+}
+
+// Connect an overlapped-capable AF_UNIX socket to addr. A local connect either
+// succeeds or is refused straight away, so this is done synchronously.
+// Returns INVALID_SOCKET with the Winsock error in err on failure.
+inline SOCKET
+connectUnix(
+    const SOCKADDR_UN& addr,
+    int& err
+    )
+{
+    SOCKET s = WSASocketW(
+        AF_UNIX,
+        SOCK_STREAM,
+        0,
+        nullptr,
+        0,
+        WSA_FLAG_OVERLAPPED
+        );
+
+    if (s == INVALID_SOCKET)
+    {
+        err = WSAGetLastError();
+
+        return INVALID_SOCKET;
+    }
+
+    if (
+        connect(
+            s,
+            (const sockaddr*) &addr,
+            sizeof(addr)
+            ) == SOCKET_ERROR
+        )
+    {
+        err = WSAGetLastError();
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    return s;
+}
+
+namespace unix_socket_detail
+{
+
+inline void
+formatNotSocketFile(
+    std::ostream& out,
+    const LogRecord& rec
+    )
+{
+    out << "AF_UNIX listener path " << rec.str << " exists and is not a socket file; not replacing it\n";
+}
+
+// Make room for a listener at path: nothing to do if nothing is there, and a
+// socket file left behind by an earlier run is deleted. Anything else (a typo
+// naming a real file, a directory) is left alone and reported; only files
+// with the AF_UNIX reparse tag are ever deleted.
+inline bool
+removeStaleSocketFile(
+    const std::string& path
+    )
+{
+    WIN32_FIND_DATAA data {};
+    HANDLE found = FindFirstFileA(
+        path.c_str(),
+        &data
+        );
+
+    if (found == INVALID_HANDLE_VALUE)
+    {
+        DWORD err = GetLastError();
+
+        if ((err == ERROR_FILE_NOT_FOUND) || (err == ERROR_PATH_NOT_FOUND))
+        {
+            return true;
+        }
+
+        logErrorCode(
+            "FindFirstFile() failed for the AF_UNIX listener path",
+            "GetLastError",
+            err
+            );
+
+        return false;
+    }
+
+    FindClose(found);
+
+    // For a reparse point, dwReserved0 holds its tag.
+    if (!(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) || (data.dwReserved0 != IO_REPARSE_TAG_AF_UNIX))
+    {
+        logRecord(
+            {
+                .format = formatNotSocketFile,
+                .stream = LogStream::Err
+            },
+            path
+            );
+
+        return false;
+    }
+
+    if (!DeleteFileA(path.c_str()))
+    {
+        logErrorCode(
+            "DeleteFile() failed for the old AF_UNIX socket file",
+            "GetLastError",
+            GetLastError()
+            );
+
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace unix_socket_detail
+
+// Listen on path, replacing a socket file left behind by an earlier run (bind()
+// fails on an existing file) but refusing to touch any other kind of file.
+// Logs and returns INVALID_SOCKET on failure.
+inline SOCKET
+listenUnix(
+    const std::string& path
+    )
+{
+    SOCKADDR_UN addr {};
+
+    if (
+        !makeUnixAddress(
+            path,
+            addr
+            )
+        )
+    {
+        logMessage(
+            LogStream::Err,
+            "AF_UNIX listener path is empty or too long"
+            );
+
+        return INVALID_SOCKET;
+    }
+
+    if (!unix_socket_detail::removeStaleSocketFile(path))
+    {
+        return INVALID_SOCKET;
+    }
+
+    SOCKET listener = WSASocketW(
+        AF_UNIX,
+        SOCK_STREAM,
+        0,
+        nullptr,
+        0,
+        WSA_FLAG_OVERLAPPED
+        );
+
+    if (listener == INVALID_SOCKET)
+    {
+        logRawWSAError("socket(AF_UNIX) failed for listener");
+
+        return INVALID_SOCKET;
+    }
+
+    if (
+        bind(
+            listener,
+            (const sockaddr*) &addr,
+            sizeof(addr)
+            ) == SOCKET_ERROR
+        )
+    {
+        logRawWSAError("bind() failed for AF_UNIX listener");
+        closesocket(listener);
+
+        return INVALID_SOCKET;
+    }
+
+    if (
+        listen(
+            listener,
+            SOMAXCONN
+            ) == SOCKET_ERROR
+        )
+    {
+        logRawWSAError("listen() failed on AF_UNIX listener");
+        closesocket(listener);
+
+        return INVALID_SOCKET;
+    }
+
+    return listener;
+}
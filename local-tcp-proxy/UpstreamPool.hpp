@@ -0,0 +1,469 @@
+﻿#pragma once
+
+#include "AsyncLog.hpp"
+
+#include <winsock2.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <vector>
+
+// Pre-established connections to the target, handed to new clients so they
+// skip the TCP handshake to the target entirely.
+//
+// A background thread keeps at least minIdle sockets connected, replacing any
+// that exceed maxAge or that the target has closed while they sat idle (many
+// servers drop idle sockets). take() never blocks on the network: it either
+// returns a live socket or INVALID_SOCKET, in which case the caller connects
+// as usual. socketFlags are the WSASocket() flags for pooled sockets, so they
+// can be made usable with Registered I/O.
+//
+// The refill thread's connects are non-blocking and given up after
+// connectTimeout, so a blackholed target costs it that long per attempt, not
+// the OS connect timeout, and stopping the pool does not wait for one to
+// finish. Each failed or timed-out connect calls onConnectFailed, if set.
+class UpstreamPool
+{
+public:
+    struct Stats
+    {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t discarded;      // found dead or too old
+        std::uint64_t idle;           // ready right now
+        std::uint64_t avgConnectUs;   // what a miss costs
+        std::uint64_t savedConnectUs; // hits x connect time at the time of the hit
+    };
+
+    UpstreamPool(
+        const sockaddr_in& target,
+        unsigned minIdle,
+        std::chrono::milliseconds maxAge,
+        std::chrono::milliseconds connectTimeout,
+        std::function<void()> onConnectFailed = {},
+        DWORD socketFlags                     = WSA_FLAG_OVERLAPPED
+        )
+        : m_target(target)
+        , m_minIdle(minIdle)
+        , m_maxAge(maxAge)
+        , m_connectTimeout(connectTimeout)
+        , m_onConnectFailed(std::move(onConnectFailed))
+        , m_socketFlags(socketFlags)
+    {
+        m_refillThread = std::jthread(
+            [this] (std::stop_token st)
+            {
+                runRefill(st);
+            }
+            );
+    }
+
+    ~UpstreamPool()
+    {
+        m_refillThread.request_stop();
+        m_refillThread.join();
+
+        for (const Idle& idle : m_idle)
+        {
+            closesocket(idle.socket);
+        }
+    }
+
+    UpstreamPool(const UpstreamPool&)            = delete;
+    UpstreamPool& operator=(const UpstreamPool&) = delete;
+
+    // Returns a connected, non-blocking target socket, or INVALID_SOCKET if the
+    // pool has nothing usable. The caller owns the returned socket.
+    SOCKET
+    take()
+    {
+        SOCKET found = INVALID_SOCKET;
+        std::vector<SOCKET> dead;
+
+        {
+            std::lock_guard lock(m_mtx);
+            auto now = std::chrono::steady_clock::now();
+
+            // Newest first: the oldest sockets are the likeliest to have been
+            // dropped by the target and are left for the refill thread to age out.
+            while (!m_idle.empty())
+            {
+                Idle idle = m_idle.back();
+                m_idle.pop_back();
+
+                if ((now - idle.connectedAt <= m_maxAge) && isAlive(idle.socket))
+                {
+                    found = idle.socket;
+                    break;
+                }
+
+                dead.push_back(idle.socket);
+            }
+        }
+
+        for (SOCKET s : dead)
+        {
+            closesocket(s);
+        }
+
+        m_discarded.fetch_add(
+            dead.size(),
+            std::memory_order_relaxed
+            );
+
+        if (found == INVALID_SOCKET)
+        {
+            m_misses.fetch_add(
+                1,
+                std::memory_order_relaxed
+                );
+        }
+        else
+        {
+            m_hits.fetch_add(
+                1,
+                std::memory_order_relaxed
+                );
+            m_savedConnectUs.fetch_add(
+                m_avgConnectUs.load(std::memory_order_relaxed),
+                std::memory_order_relaxed
+                );
+        }
+
+        m_wake.notify_one();
+
+        return found;
+    }
+
+    Stats
+    snapshot()
+    {
+        Stats s {};
+        s.hits           = m_hits.load(std::memory_order_relaxed);
+        s.misses         = m_misses.load(std::memory_order_relaxed);
+        s.discarded      = m_discarded.load(std::memory_order_relaxed);
+        s.avgConnectUs   = m_avgConnectUs.load(std::memory_order_relaxed);
+        s.savedConnectUs = m_savedConnectUs.load(std::memory_order_relaxed);
+
+        std::lock_guard lock(m_mtx);
+        s.idle = m_idle.size();
+
+        return s;
+    }
+
+private:
+    struct Idle
+    {
+        SOCKET socket;
+        std::chrono::steady_clock::time_point connectedAt;
+    };
+
+    static constexpr std::chrono::milliseconds kSweepInterval {250};
+    static constexpr std::chrono::milliseconds kRetryBackoff {1000};
+
+    // How often a connect in progress checks whether the pool is stopping.
+    static constexpr std::chrono::milliseconds kStopPoll {100};
+
+    // An idle socket should have nothing to read. recv() == 0 means the target
+    // sent FIN; an error other than "would block" means it is reset or broken.
+    // Data waiting (server-speaks-first protocols) is fine: it will be
+    // forwarded to the client.
+    static bool
+    isAlive(
+        SOCKET s
+        )
+    {
+        char probe;
+        int rc = recv(
+            s,
+            &probe,
+            1,
+            MSG_PEEK
+            );
+
+        if (rc > 0)
+        {
+            return true;
+        }
+
+        return (rc == SOCKET_ERROR) && (WSAGetLastError() == WSAEWOULDBLOCK);
+    }
+
+    // Wait for the connect in progress on s until the connect timeout,
+    // counted from started, in slices of kStopPoll so a stop is seen
+    // promptly. False if it failed, timed out or the pool is stopping.
+    bool
+    waitConnected(
+        SOCKET s,
+        std::chrono::steady_clock::time_point started,
+        std::stop_token st
+        )
+    {
+        auto deadline = started + m_connectTimeout;
+
+        while (!st.stop_requested())
+        {
+            auto left = std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now());
+
+            if (left.count() <= 0)
+            {
+                WSASetLastError(WSAETIMEDOUT);
+                logRawWSAError("connect() for warm target connection timed out");
+                connectFailed();
+
+                return false;
+            }
+
+            auto slice = std::min<std::chrono::microseconds>(
+                left,
+                kStopPoll
+                );
+            timeval tv {};
+            tv.tv_usec = static_cast<long>(slice.count());
+
+            fd_set writable;
+            fd_set failed;
+            FD_ZERO(&writable);
+            FD_ZERO(&failed);
+            FD_SET(s, &writable);
+            FD_SET(s, &failed);
+
+            // A failed connect is reported in the except set on Windows.
+            if (
+                select(
+                    0,
+                    nullptr,
+                    &writable,
+                    &failed,
+                    &tv
+                    ) == SOCKET_ERROR
+                )
+            {
+                logRawWSAError("select() failed for warm target connection");
+
+                return false;
+            }
+
+            if (FD_ISSET(s, &failed))
+            {
+                int err    = 0;
+                int errLen = sizeof(err);
+                getsockopt(
+                    s,
+                    SOL_SOCKET,
+                    SO_ERROR,
+                    reinterpret_cast<char*>(&err),
+                    &errLen
+                    );
+                WSASetLastError(err);
+                logRawWSAError("connect() for warm target connection failed");
+                connectFailed();
+
+                return false;
+            }
+
+            if (FD_ISSET(s, &writable))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void
+    connectFailed()
+    {
+        if (m_onConnectFailed)
+        {
+            m_onConnectFailed();
+        }
+    }
+
+    // Non-blocking connect, waited for by waitConnected(); only ever called
+    // from the refill thread.
+    SOCKET
+    connectOne(
+        std::stop_token st
+        )
+    {
+        SOCKET s = WSASocketW(
+            AF_INET,
+            SOCK_STREAM,
+            IPPROTO_TCP,
+            nullptr,
+            0,
+            m_socketFlags
+            );
+
+        if (s == INVALID_SOCKET)
+        {
+            logRawWSAError("socket() failed for warm target connection");
+
+            return INVALID_SOCKET;
+        }
+
+        u_long nonBlocking = 1;
+
+        if (
+            ioctlsocket(
+                s,
+                FIONBIO,
+                &nonBlocking
+                ) == SOCKET_ERROR
+            )
+        {
+            logRawWSAError("ioctlsocket(FIONBIO) failed for warm target connection");
+            closesocket(s);
+
+            return INVALID_SOCKET;
+        }
+
+        sockaddr_in targetAddr = m_target; // copy template
+        auto started           = std::chrono::steady_clock::now();
+
+        if (
+            connect(
+                s,
+                (sockaddr*) &targetAddr,
+                sizeof(targetAddr)
+                ) == SOCKET_ERROR
+            )
+        {
+            if (WSAGetLastError() != WSAEWOULDBLOCK)
+            {
+                logRawWSAError("connect() for warm target connection failed");
+                connectFailed();
+                closesocket(s);
+
+                return INVALID_SOCKET;
+            }
+
+            if (
+                !waitConnected(
+                    s,
+                    started,
+                    st
+                    )
+                )
+            {
+                closesocket(s);
+
+                return INVALID_SOCKET;
+            }
+        }
+
+        auto us = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count()
+            );
+
+        // EWMA with weight 1/8, seeded by the first sample.
+        std::uint64_t avg = m_avgConnectUs.load(std::memory_order_relaxed);
+        m_avgConnectUs.store(
+            avg ? avg - avg / 8 + us / 8 : us,
+            std::memory_order_relaxed
+            );
+
+        return s;
+    }
+
+    void
+    runRefill(
+        std::stop_token st
+        )
+    {
+        while (!st.stop_requested())
+        {
+            // Age out and health-check what is sitting idle.
+            std::vector<SOCKET> dead;
+            std::size_t idleCount = 0;
+
+            {
+                std::lock_guard lock(m_mtx);
+                auto now = std::chrono::steady_clock::now();
+
+                std::erase_if(
+                    m_idle,
+                    [&] (const Idle& idle)
+                    {
+                        if ((now - idle.connectedAt > m_maxAge) || !isAlive(idle.socket))
+                        {
+                            dead.push_back(idle.socket);
+
+                            return true;
+                        }
+
+                        return false;
+                    }
+                    );
+                idleCount = m_idle.size();
+            }
+
+            for (SOCKET s : dead)
+            {
+                closesocket(s);
+            }
+
+            m_discarded.fetch_add(
+                dead.size(),
+                std::memory_order_relaxed
+                );
+
+            bool failed = false;
+
+            while ((idleCount < m_minIdle) && !st.stop_requested())
+            {
+                SOCKET s = connectOne(st);
+
+                if (s == INVALID_SOCKET)
+                {
+                    failed = true;
+                    break;
+                }
+
+                std::lock_guard lock(m_mtx);
+                m_idle.push_back({s, std::chrono::steady_clock::now()});
+                idleCount = m_idle.size();
+            }
+
+            std::unique_lock lock(m_mtx);
+            m_wake.wait_for(
+                lock,
+                st,
+                failed ? kRetryBackoff : kSweepInterval,
+                [&] ()
+                {
+                    // After a failed connect, sit out the backoff regardless.
+                    return !failed && (m_idle.size() < m_minIdle);
+                }
+                );
+        }
+    }
+
+    sockaddr_in m_target;
+    unsigned m_minIdle;
+    std::chrono::milliseconds m_maxAge;
+    std::chrono::milliseconds m_connectTimeout;
+    std::function<void()> m_onConnectFailed;
+    DWORD m_socketFlags;
+
+    std::mutex m_mtx;
+    std::condition_variable_any m_wake;
+    std::deque<Idle> m_idle;
+
+    std::atomic<std::uint64_t> m_hits {0};
+    std::atomic<std::uint64_t> m_misses {0};
+    std::atomic<std::uint64_t> m_discarded {0};
+    std::atomic<std::uint64_t> m_avgConnectUs {0};
+    std::atomic<std::uint64_t> m_savedConnectUs {0};
+
+    // Last member: started in the constructor once everything above exists.
+    std::jthread m_refillThread;
+};
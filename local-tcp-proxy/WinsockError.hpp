@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include <winsock2.h>
+
+enum class ErrorClass
+{
+    None,
+    NormalRemoteClose,    // recv() returned 0 (not actually an error)
+    NetworkOrRemoteIssue, // NAT drop, remote crash, WIFI, firewall, etc.
+    LocalProgrammingBug   // misuse of Winsock API or race in our code
+};
+
+inline const char*
+to_string(
+    ErrorClass cls
+    )
+{
+    switch (cls)
+    {
+        case ErrorClass::NormalRemoteClose: return "normal close";
+        case ErrorClass::NetworkOrRemoteIssue: return "network/remote";
+        case ErrorClass::LocalProgrammingBug: return "local misuse";
+        default: return "unclassified";
+    }
+}
+
+inline ErrorClass
+classifyWinsockError(
+    int wsaError
+    )
+{
+    switch (wsaError)
+    {
+        // Common “normal network failure” errors:
+        case WSAECONNRESET:   // peer reset or middlebox RST
+        case WSAETIMEDOUT:    // retransmits gave up
+        case WSAECONNABORTED: // aborted by network or local stack
+        case WSAENETRESET:
+        case WSAENETDOWN:
+        case WSAENETUNREACH:
+        case WSAEHOSTUNREACH:
+            return ErrorClass::NetworkOrRemoteIssue;
+
+        // Errors that usually mean our own misuse / bug:
+        case WSAEINVAL:
+        case WSAENOTSOCK:
+        case WSAEFAULT:
+            return ErrorClass::LocalProgrammingBug;
+
+        default:
+            // Unknown / less common codes: treat as network-ish by default.
+            return ErrorClass::NetworkOrRemoteIssue;
+    }
+}
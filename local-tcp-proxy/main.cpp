@@ -2,72 +2,162 @@
 // Simple hardened TCP port forwarder / proxy for Windows (IPv4)
 //
 // Usage:
-//   local-tcp-proxy <listenPort> <targetIP> <targetPort>
+//   local-tcp-proxy [options] <listen> <targetIP> <targetPort>
+//   local-tcp-proxy [options] <listen> unix:<path>
+//   local-tcp-proxy [options] --backend=<target> [--backend=...] <listen>
+//   local-tcp-proxy [options] --routes=<file>
+//
+// <listen> is a TCP port or unix:<path> for an AF_UNIX stream socket, and a
+// <target> is <ip>:<port> or unix:<path>. Same-host peers connected over
+// AF_UNIX skip the TCP stack on that leg; those legs use the copy path, and
+// access rules and --udp need a TCP listener.
+//
+// With --routes, one process serves many listeners, each with its own
+// backends, policy, buffer cap and limits, on shared workers and buffer pools.
+// The file has one route per line:
+//
+//   <listen> <target>[,<target>...] [<option>=<value>...]
+//
+// where the options are balance, max-buffer, max-connections,
+// max-client-connections, client-connect-rate, client-connect-burst,
+// client-bandwidth, handshake-timeout and handshake-bytes, as below but for
+// that route alone, and host:<name>=<target>[,<target>...] like --host. The
+// file is reloaded
+// when it changes; only routes whose lines changed are touched, and clients
+// of a removed route stay connected until they leave. A route given on the
+// command line as well is served alongside the file's, with the command-line
+// limits.
+//
+// Options:
+//   --workers=<n>                    I/O worker threads (default: one per logical CPU)
+//   --forward-mode=<copy|overlapped|rio>
+//                                    payload path (default: copy); overlapped
+//                                    receives straight into the relay buffer,
+//                                    saving the receive-side copy only (sends
+//                                    are still copied, and Windows has no
+//                                    splice() equivalent), rio (Registered
+//                                    I/O) falls back to copy per connection
+//                                    if it cannot be set up
+//   --stats-interval=<seconds>       print traffic, latency, buffer and warm pool
+//                                    stats periodically
+//   --stats-port=<port>              serve the same stats to anything that
+//                                    connects to 127.0.0.1:<port>
+//   --connect-timeout=<ms>           give up on a target connect, a client's
+//                                    or the warm pool's, after this long
+//                                    (default: 5000)
+//   --accept-shards=<n>              accept threads, each with its own I/O
+//                                    workers and connections (default: 1)
+//   --per-core[=<n>]                 thread per core: n shards (default: one
+//                                    per logical CPU), each an accept thread
+//                                    and a single I/O worker pinned to its own
+//                                    core with its own buffer pool; overrides
+//                                    --accept-shards and --workers
+//   --warm-pool=<n>                  keep at least n idle target connections
+//                                    ready for new clients (default: 0 = off)
+//   --warm-pool-max-age=<ms>         replace warm connections older than this
+//                                    (default: 30000)
+//   --backend=<ip>:<port>            add a backend (repeatable); the positional
+//                                    target, if given, is the first backend
+//   --balance=<policy>               round-robin (default), least-active,
+//                                    p2c-latency or consistent-hash
+//   --max-buffer=<bytes>             cap the adaptive relay buffers at the
+//                                    largest size class that fits (default:
+//                                    no cap)
+//   --routes=<file>                  serve the routes in this file too,
+//                                    reloaded when it changes
+//   --host=<name>=<target>[,<target>...]
+//                                    send Minecraft clients whose handshake
+//                                    names this server to these targets
+//                                    instead (repeatable); the others go to
+//                                    the backends above
+//   --handshake-timeout=<ms>         drop a --host client that has not sent
+//                                    its handshake within this long
+//                                    (default: 3000)
+//   --handshake-bytes=<n>            look at most this far into the stream
+//                                    for the handshake; past it the client
+//                                    goes to the backends above (default: 512)
+//   --udp                            also forward UDP datagrams arriving on
+//                                    the listen port, one upstream socket per
+//                                    client address
+//   --udp-idle-timeout=<ms>          close UDP sessions idle this long
+//                                    (default: 60000)
+//   --udp-max-sessions=<n>           UDP sessions open at once; datagrams
+//                                    from further addresses are dropped
+//                                    (default: 4096)
+//   --idle-timeout=<ms>              close TCP connections with no data in
+//                                    either direction for this long
+//   --client-read-timeout=<ms>       ... when the client sent nothing
+//   --target-read-timeout=<ms>       ... when the target sent nothing
+//   --client-write-timeout=<ms>      ... when data for the client was not
+//                                    taken by it for this long
+//   --target-write-timeout=<ms>      ... likewise for the target
+//                                    (all default to 0 = off)
+//   --max-connections=<n>            refuse clients beyond n open connections
+//   --max-client-connections=<n>     ... beyond n open from one address
+//   --client-connect-rate=<n>        ... opening more than n per second from
+//                                    one address
+//   --client-connect-burst=<n>       ... of which n may come back to back
+//                                    (default: the rate)
+//   --client-bandwidth=<bytes/s>     slow down each client address to this,
+//                                    both directions together
+//                                    (all default to 0 = no limit)
+//   --allow=<cidr>                   allow clients in this IPv4 prefix
+//   --deny=<cidr>                    refuse clients in this prefix (both
+//                                    repeatable; the longest matching prefix
+//                                    decides, and with any allow rule every
+//                                    unmatched client is refused)
+//   --access-list=<file>             more rules, one "allow <cidr>" or
+//                                    "deny <cidr>" per line, reloaded when the
+//                                    file changes
+//
+// Press Ctrl+Break to print a stats snapshot at any time.
 //
 // Example (Minecraft on same machine):
 //   local-tcp-proxy 25566 127.0.0.1 25565
 
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
+#include "AccessControl.hpp"
+#include "AdmissionControl.hpp"
+#include "AsyncLog.hpp"
+#include "BackendSet.hpp"
+#include "BufferPool.hpp"
+#include "Connection.hpp"
+#include "ConnectionReaper.hpp"
+#include "CpuAffinity.hpp"
+#include "IoReactor.hpp"
+#include "Metrics.hpp"
+#include "RioEngine.hpp"
+#include "RouteTable.hpp"
+#include "TargetConnector.hpp"
+#include "UdpForwarder.hpp"
+#include "UnixSocket.hpp"
+#include "WinsockError.hpp"
+
 #include <iostream>
 #include <cstdlib>
 #include <string>
 #include <thread>
 #include <memory>
 #include <atomic>
+#include <vector>
+#include <exception>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <stop_token>
+#include <algorithm>
+#include <array>
+#include <sstream>
+#include <ostream>
 #include <Windows.h>
 #include <ws2def.h>
-#include <stop_token>
 
 #pragma comment(lib, "ws2_32.lib")
 
-enum class ErrorClass
-{
-    None,
-    NormalRemoteClose,    // recv() returned 0 (not actually an error)
-    NetworkOrRemoteIssue, // NAT drop, remote crash, WIFI, firewall, etc.
-    LocalProgrammingBug   // misuse of Winsock API or race in our code
-};
-
-void
-logRawWSAError(
-    const char* msg
-    )
-{
-    std::cerr << msg << " (WSAGetLastError = " << WSAGetLastError() << ")\n";
-}
-
-ErrorClass
-classifyWinsockError(
-    int wsaError
-    )
-{
-    switch (wsaError)
-    {
-        // Common “normal network failure” errors:
-        case WSAECONNRESET:   // peer reset or middlebox RST
-        case WSAETIMEDOUT:    // retransmits gave up
-        case WSAECONNABORTED: // aborted by network or local stack
-        case WSAENETRESET:
-        case WSAENETDOWN:
-        case WSAENETUNREACH:
-        case WSAEHOSTUNREACH:
-            return ErrorClass::NetworkOrRemoteIssue;
-
-        // Errors that usually mean our own misuse / bug:
-        case WSAEINVAL:
-        case WSAENOTSOCK:
-        case WSAEFAULT:
-            return ErrorClass::LocalProgrammingBug;
-
-        default:
-            // Unknown / less common codes: treat as network-ish by default.
-            return ErrorClass::NetworkOrRemoteIssue;
-    }
-}
-
 static int
 parsePort(
     const char* s,
@@ -98,177 +188,1270 @@ parsePort(
     return static_cast<int>(value);
 }
 
-// Shared connection object
-struct Connection
+static bool
+parseCount(
+    const char* s,
+    const char* what,
+    unsigned long minValue,
+    unsigned long maxValue,
+    unsigned& out
+    )
 {
-    SOCKET client {INVALID_SOCKET};
-    SOCKET target {INVALID_SOCKET};
+    char* end           = nullptr;
+    unsigned long value = std::strtoul(
+        s,
+        &end,
+        10
+        );
+
+    if ((end == s) || (*end != '\0'))
+    {
+        std::cerr << "Invalid " << what << " '" << s << "' (not a number)\n";
 
-    // Ensure each direction only half-closes once.
-    std::atomic<bool> clientSendShutdownDone {false};
-    std::atomic<bool> targetSendShutdownDone {false};
+        return false;
+    }
 
-    ~Connection()
+    if ((value < minValue) || (value > maxValue))
     {
-        // Final cleanup once all shared_ptr owners are gone.
-        if (client != INVALID_SOCKET)
-        {
-            closesocket(client);
-        }
+        std::cerr << "Invalid " << what << " '" << s << "' (must be " << minValue << ".." << maxValue << ")\n";
 
-        if (target != INVALID_SOCKET)
-        {
-            closesocket(target);
-        }
+        return false;
     }
-};
 
-namespace
+    out = static_cast<unsigned>(value);
+
+    return true;
+}
+
+// Milliseconds, 0 meaning off.
+static bool
+parseTimeout(
+    const char* s,
+    const char* what,
+    std::chrono::milliseconds& out
+    )
+{
+    unsigned ms = 0;
+
+    if (
+        !parseCount(
+            s,
+            what,
+            0,
+            86400000,
+            ms
+            )
+        )
+    {
+        return false;
+    }
+
+    out = std::chrono::milliseconds(ms);
+
+    return true;
+}
+
+static void
+printUsage()
+{
+    std::cout << "Usage: local-tcp-proxy [options] <listen> <targetIP> <targetPort>\n"
+              << "       local-tcp-proxy [options] <listen> unix:<path>\n"
+              << "       local-tcp-proxy [options] --backend=<target> [--backend=...] <listen>\n"
+              << "       local-tcp-proxy [options] --routes=<file>\n"
+              << "\n"
+              << "<listen> is a TCP port or unix:<path>; <target> is <ip>:<port> or unix:<path>.\n"
+              << "\n"
+              << "Options:\n"
+              << "  --workers=<n>                   I/O worker threads (default: one per logical CPU)\n"
+              << "  --forward-mode=<mode>           payload path: copy (default), overlapped or rio\n"
+              << "  --stats-interval=<seconds>      print stats periodically\n"
+              << "  --stats-port=<port>             serve stats on 127.0.0.1:<port>\n"
+              << "  --connect-timeout=<ms>          target connect timeout (default: 5000)\n"
+              << "  --accept-shards=<n>             accept threads with their own workers (default: 1)\n"
+              << "  --per-core[=<n>]                one pinned accept thread + worker per core (default: all cores)\n"
+              << "  --warm-pool=<n>                 idle target connections kept ready (default: 0)\n"
+              << "  --warm-pool-max-age=<ms>        replace warm connections older than this (default: 30000)\n"
+              << "  --backend=<ip>:<port>           add a backend (repeatable)\n"
+              << "  --balance=<policy>              round-robin, least-active, p2c-latency, consistent-hash\n"
+              << "  --max-buffer=<bytes>            largest relay buffer per direction (default: no cap)\n"
+              << "  --routes=<file>                 '<listen> <target>[,...] [<option>=<value>...]' per line, reloaded on change\n"
+              << "  --host=<name>=<target>[,...]    route Minecraft clients by the server name they connect to (repeatable)\n"
+              << "  --handshake-timeout=<ms>        time a --host client has to send its handshake (default: 3000)\n"
+              << "  --handshake-bytes=<n>           bytes read looking for the handshake (default: 512)\n"
+              << "  --udp                           also forward UDP on the listen port\n"
+              << "  --udp-idle-timeout=<ms>         close idle UDP sessions after this long (default: 60000)\n"
+              << "  --udp-max-sessions=<n>          UDP sessions open at once (default: 4096)\n"
+              << "  --idle-timeout=<ms>             close connections idle both ways this long (default: 0 = off)\n"
+              << "  --client-read-timeout=<ms>      close when the client sends nothing this long (default: off)\n"
+              << "  --target-read-timeout=<ms>      close when the target sends nothing this long (default: off)\n"
+              << "  --client-write-timeout=<ms>     close when the client takes no data this long (default: off)\n"
+              << "  --target-write-timeout=<ms>     close when the target takes no data this long (default: off)\n"
+              << "  --max-connections=<n>           open connections allowed in total (default: 0 = no limit)\n"
+              << "  --max-client-connections=<n>    open connections allowed per client address (default: no limit)\n"
+              << "  --client-connect-rate=<n>       new connections per second per client address (default: no limit)\n"
+              << "  --client-connect-burst=<n>      new connections back to back per client address (default: the rate)\n"
+              << "  --client-bandwidth=<bytes/s>    bandwidth per client address, both ways (default: no limit)\n"
+              << "  --allow=<cidr>                  allow clients in this prefix (repeatable)\n"
+              << "  --deny=<cidr>                   refuse clients in this prefix (repeatable)\n"
+              << "  --access-list=<file>            allow/deny rules, one per line, reloaded on change\n"
+              << "\n"
+              << "Press Ctrl+Break to print stats.\n";
+}
+
+struct ProxyConfig
 {
+    const char* listenPort    = nullptr;
+    std::vector<std::string> backends; // "<ip>:<port>"
+    BalancePolicy balance     = BalancePolicy::RoundRobin;
+    unsigned workers          = 0; // 0 = one per logical CPU
+    ForwardMode forwardMode   = ForwardMode::Copy;
+    unsigned statsSeconds     = 0; // 0 = never print
+    const char* statsPort     = nullptr;
+    unsigned connectTimeoutMs = 5000;
+    unsigned acceptShards     = 1;
+    unsigned perCore          = 0; // 0 = off, else cores used
+    unsigned warmPool         = 0; // 0 = no warm target connections
+    unsigned warmPoolMaxAgeMs = 30000;
+    bool udp                  = false;
+    unsigned udpIdleTimeoutMs = 60000;
+    unsigned udpMaxSessions   = 4096;
+    ConnectionTimeouts timeouts; // all off
+    AdmissionLimits limits;      // none
+    unsigned maxBuffer        = 0; // 0 = no cap
+    std::vector<AccessRule> accessRules;
+    std::string accessList; // file, empty = none
+    std::string routesFile; // empty = command-line route only
+    std::vector<std::string> hosts; // "<name>=<target>[,<target>...]"
+    unsigned handshakeTimeoutMs = 3000;
+    unsigned handshakeBytes     = 512;
+};
 
-// Helper to handle send() errors and print messages, then return false to break the loop.
-bool
-handleSendError(
-    int sent,
-    const char* directionLabel
+static bool
+parseCommandLine(
+    int argc,
+    char* argv[],
+    ProxyConfig& cfg
     )
 {
-    if (sent == SOCKET_ERROR)
+    std::vector<const char*> positional;
+
+    for (int i = 1; i < argc; ++i)
     {
-        switch (int err = WSAGetLastError(); classifyWinsockError(err))
+        std::string arg = argv[i];
+
+        if (arg.starts_with("--workers="))
         {
-            case ErrorClass::NetworkOrRemoteIssue:
-                std::cerr << directionLabel
-                          << ": network/remote closed or failed during send() "
-                          << "(WSA = " << err << ")\n";
-                break;
-            case ErrorClass::LocalProgrammingBug:
-                std::cerr << directionLabel
-                          << ": local programming / socket misuse during send() "
-                          << "(WSA = " << err << ")\n";
-                break;
-            default:
-                std::cerr << directionLabel
-                          << ": unexpected send() error "
-                          << "(WSA = " << err << ")\n";
-                break;
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--workers=") - 1,
+                    "worker count",
+                    1,
+                    1024,
+                    cfg.workers
+                    )
+                )
+            {
+                return false;
+            }
         }
+        else if (arg.starts_with("--forward-mode="))
+        {
+            std::string value = arg.substr(sizeof("--forward-mode=") - 1);
 
-        return false;
-    }
+            if (value == "copy")
+            {
+                cfg.forwardMode = ForwardMode::Copy;
+            }
+            else if (value == "overlapped")
+            {
+                cfg.forwardMode = ForwardMode::Overlapped;
+            }
+            else if (value == "rio")
+            {
+                cfg.forwardMode = ForwardMode::Registered;
+            }
+            else
+            {
+                std::cerr << "Invalid forward mode '" << value << "' (must be copy, overlapped or rio)\n";
+
+                return false;
+            }
+        }
+        else if (arg.starts_with("--stats-interval="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--stats-interval=") - 1,
+                    "stats interval",
+                    1,
+                    86400,
+                    cfg.statsSeconds
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--stats-port="))
+        {
+            cfg.statsPort = argv[i] + sizeof("--stats-port=") - 1;
+        }
+        else if (arg.starts_with("--connect-timeout="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--connect-timeout=") - 1,
+                    "connect timeout",
+                    1,
+                    600000,
+                    cfg.connectTimeoutMs
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--accept-shards="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--accept-shards=") - 1,
+                    "accept shard count",
+                    1,
+                    64,
+                    cfg.acceptShards
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg == "--per-core")
+        {
+            cfg.perCore = logicalCoreCount();
+        }
+        else if (arg.starts_with("--per-core="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--per-core=") - 1,
+                    "core count",
+                    1,
+                    logicalCoreCount(),
+                    cfg.perCore
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--warm-pool="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--warm-pool=") - 1,
+                    "warm pool size",
+                    0,
+                    4096,
+                    cfg.warmPool
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--warm-pool-max-age="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--warm-pool-max-age=") - 1,
+                    "warm pool max age",
+                    100,
+                    86400000,
+                    cfg.warmPoolMaxAgeMs
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--backend="))
+        {
+            cfg.backends.push_back(arg.substr(sizeof("--backend=") - 1));
+        }
+        else if (arg.starts_with("--balance="))
+        {
+            std::string value = arg.substr(sizeof("--balance=") - 1);
+
+            if (
+                !parseBalancePolicy(
+                    value,
+                    cfg.balance
+                    )
+                )
+            {
+                std::cerr << "Invalid balance policy '" << value
+                          << "' (must be round-robin, least-active, p2c-latency or consistent-hash)\n";
+
+                return false;
+            }
+        }
+        else if (arg == "--udp")
+        {
+            cfg.udp = true;
+        }
+        else if (arg.starts_with("--udp-idle-timeout="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--udp-idle-timeout=") - 1,
+                    "UDP idle timeout",
+                    100,
+                    86400000,
+                    cfg.udpIdleTimeoutMs
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--udp-max-sessions="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--udp-max-sessions=") - 1,
+                    "UDP session limit",
+                    1,
+                    1000000,
+                    cfg.udpMaxSessions
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--idle-timeout="))
+        {
+            if (
+                !parseTimeout(
+                    argv[i] + sizeof("--idle-timeout=") - 1,
+                    "idle timeout",
+                    cfg.timeouts.idle
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--client-read-timeout="))
+        {
+            if (
+                !parseTimeout(
+                    argv[i] + sizeof("--client-read-timeout=") - 1,
+                    "client read timeout",
+                    cfg.timeouts.clientRead
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--target-read-timeout="))
+        {
+            if (
+                !parseTimeout(
+                    argv[i] + sizeof("--target-read-timeout=") - 1,
+                    "target read timeout",
+                    cfg.timeouts.targetRead
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--client-write-timeout="))
+        {
+            if (
+                !parseTimeout(
+                    argv[i] + sizeof("--client-write-timeout=") - 1,
+                    "client write timeout",
+                    cfg.timeouts.clientWrite
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--target-write-timeout="))
+        {
+            if (
+                !parseTimeout(
+                    argv[i] + sizeof("--target-write-timeout=") - 1,
+                    "target write timeout",
+                    cfg.timeouts.targetWrite
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--max-connections="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--max-connections=") - 1,
+                    "connection limit",
+                    0,
+                    1000000,
+                    cfg.limits.maxConnections
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--max-client-connections="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--max-client-connections=") - 1,
+                    "client connection limit",
+                    0,
+                    1000000,
+                    cfg.limits.maxPerClient
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--client-connect-rate="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--client-connect-rate=") - 1,
+                    "client connect rate",
+                    0,
+                    1000000,
+                    cfg.limits.connectRate
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--client-connect-burst="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--client-connect-burst=") - 1,
+                    "client connect burst",
+                    0,
+                    1000000,
+                    cfg.limits.connectBurst
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--client-bandwidth="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--client-bandwidth=") - 1,
+                    "client bandwidth",
+                    0,
+                    4000000000,
+                    cfg.limits.clientBandwidth
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--allow=") || arg.starts_with("--deny="))
+        {
+            AccessRule rule;
+            rule.verdict     = arg.starts_with("--allow=") ? CidrVerdict::Allow : CidrVerdict::Deny;
+            std::string cidr = arg.substr(arg.find('=') + 1);
+
+            if (
+                !parseCidr(
+                    cidr,
+                    rule.prefix,
+                    rule.len
+                    )
+                )
+            {
+                std::cerr << "Invalid prefix '" << cidr << "' (expected <ip>[/<bits>])\n";
+
+                return false;
+            }
+
+            if (!isV4Rule(rule))
+            {
+                std::cerr << "IPv6 prefix '" << cidr << "' is not supported: clients are only accepted over IPv4\n";
+
+                return false;
+            }
+
+            cfg.accessRules.push_back(rule);
+        }
+        else if (arg.starts_with("--access-list="))
+        {
+            cfg.accessList = arg.substr(sizeof("--access-list=") - 1);
+        }
+        else if (arg.starts_with("--max-buffer="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--max-buffer=") - 1,
+                    "max buffer",
+                    0,
+                    1u << 30,
+                    cfg.maxBuffer
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--routes="))
+        {
+            cfg.routesFile = arg.substr(sizeof("--routes=") - 1);
+        }
+        else if (arg.starts_with("--host="))
+        {
+            cfg.hosts.push_back(arg.substr(sizeof("--host=") - 1));
+        }
+        else if (arg.starts_with("--handshake-timeout="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--handshake-timeout=") - 1,
+                    "handshake timeout",
+                    1,
+                    600000,
+                    cfg.handshakeTimeoutMs
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--handshake-bytes="))
+        {
+            if (
+                !parseCount(
+                    argv[i] + sizeof("--handshake-bytes=") - 1,
+                    "handshake bytes",
+                    16,
+                    65536,
+                    cfg.handshakeBytes
+                    )
+                )
+            {
+                return false;
+            }
+        }
+        else if (arg.starts_with("--"))
+        {
+            std::cerr << "Unknown option '" << arg << "'\n";
+
+            return false;
+        }
+        else
+        {
+            positional.push_back(argv[i]);
+        }
+    }
+
+    if (positional.size() == 3)
+    {
+        cfg.backends.insert(
+            cfg.backends.begin(),
+            std::string(positional[1]) + ":" + positional[2]
+            );
+    }
+    else if ((positional.size() == 2) && isUnixEndpoint(positional[1]))
+    {
+        cfg.backends.insert(
+            cfg.backends.begin(),
+            positional[1]
+            );
+    }
+    else if (positional.empty() && cfg.backends.empty() && !cfg.routesFile.empty())
+    {
+        // Routes from the file only.
+        return true;
+    }
+    else if ((positional.size() != 1) || cfg.backends.empty())
+    {
+        return false;
+    }
+
+    cfg.listenPort = positional[0];
+
+    return true;
+}
+
+// Parse "<ipv4>:<port>" or "unix:<path>" into a backend, validating the IP
+// once.
+static bool
+parseBackend(
+    const std::string& spec,
+    BackendSet::Target& target
+    )
+{
+    target.label = spec;
+
+    if (isUnixEndpoint(spec))
+    {
+        target.unixSocket = true;
+
+        if (
+            !makeUnixAddress(
+                spec.substr(kUnixPrefix.size()),
+                target.unixAddress
+                )
+            )
+        {
+            std::cerr << "Invalid backend '" << spec << "' (path empty or too long)\n";
+
+            return false;
+        }
+
+        return true;
+    }
+
+    sockaddr_in& addr = target.address;
+    std::size_t colon = spec.rfind(':');
+
+    if (colon == std::string::npos)
+    {
+        std::cerr << "Invalid backend '" << spec << "' (expected <ip>:<port> or unix:<path>)\n";
+
+        return false;
+    }
+
+    std::string ip   = spec.substr(
+        0,
+        colon
+        );
+    std::string port = spec.substr(colon + 1);
+
+    int targetPort = parsePort(
+        port.c_str(),
+        "target port"
+        );
+
+    if (targetPort < 0)
+    {
+        return false;
+    }
+
+    addr            = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(static_cast<u_short>(targetPort));
+
+    if (
+        int ptonResult = inet_pton(
+            AF_INET,
+            ip.c_str(),
+            &addr.sin_addr
+            ); (ptonResult != 1)
+        )
+    {
+        if (ptonResult == 0)
+        {
+            std::cerr << "inet_pton(): invalid target IP address string '"
+                      << ip << "'\n";
+        }
+        else
+        {
+            logRawWSAError("inet_pton() failed");
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+// TCP listener on every IPv4 interface. socketFlags are inherited by accepted
+// clients. Logs and returns INVALID_SOCKET on failure.
+static SOCKET
+openTcpListener(
+    int port,
+    DWORD socketFlags
+    )
+{
+    SOCKET listener = WSASocketW(
+        AF_INET,
+        SOCK_STREAM,
+        IPPROTO_TCP,
+        nullptr,
+        0,
+        socketFlags
+        );
+
+    if (listener == INVALID_SOCKET)
+    {
+        logRawWSAError("socket() failed for listener");
+
+        return INVALID_SOCKET;
+    }
+
+    // Allow quick restart of the program without "address already in use"
+    {
+        BOOL opt = TRUE;
+
+        if (
+            setsockopt(
+                listener,
+                SOL_SOCKET,
+                SO_REUSEADDR,
+                reinterpret_cast<const char*>(&opt),
+                sizeof(opt)
+                ) == SOCKET_ERROR
+            )
+        {
+            logRawWSAError("setsockopt(SO_REUSEADDR) failed");
+            // Not fatal; continue anyway.
+        }
+    }
+
+    sockaddr_in listenAddr {};
+    listenAddr.sin_family      = AF_INET;
+    listenAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    listenAddr.sin_port        = htons(static_cast<u_short>(port));
+
+    if (
+        bind(
+            listener,
+            (sockaddr*) &listenAddr,
+            sizeof(listenAddr)
+            ) == SOCKET_ERROR
+        )
+    {
+        logRawWSAError("bind() failed for listener");
+        closesocket(listener);
+
+        return INVALID_SOCKET;
+    }
+
+    if (
+        listen(
+            listener,
+            SOMAXCONN
+            ) == SOCKET_ERROR
+        )
+    {
+        logRawWSAError("listen() failed on listener");
+        closesocket(listener);
+
+        return INVALID_SOCKET;
+    }
+
+    return listener;
+}
+
+static void
+writePoolStats(
+    std::ostream& out,
+    const std::vector<std::unique_ptr<BufferPool>>& pools,
+    const RouteTable& routes
+    )
+{
+    // Thread-per-core runs one pool per core; report them as one.
+    std::array<BufferPool::ClassStats, BufferPool::kClassCount> total {};
+
+    for (const auto& pool : pools)
+    {
+        auto snapshot = pool->snapshot();
+
+        for (std::size_t i = 0; i < snapshot.size(); ++i)
+        {
+            total[i].bufferSize  = snapshot[i].bufferSize;
+            total[i].inUse      += snapshot[i].inUse;
+            total[i].highWater  += snapshot[i].highWater;
+            total[i].cached     += snapshot[i].cached;
+            total[i].allocated  += snapshot[i].allocated;
+        }
+    }
+
+    for (const auto& c : total)
+    {
+        out << "buffer pool " << (c.bufferSize / 1024) << " KiB: "
+            << c.inUse << " in use, "
+            << c.highWater << " high-water, "
+            << c.cached << " cached, "
+            << c.allocated << " allocated\n";
+    }
+
+    auto writeBackends = [&] (BackendSet& backends)
+        {
+            for (std::size_t i = 0; i < backends.size(); ++i)
+            {
+                Backend& b       = backends[i];
+                std::uint64_t us = b.connectUs.load(std::memory_order_relaxed);
+
+                out << "backend " << b.label << ": "
+                    << b.active.load(std::memory_order_relaxed) << " active, avg connect ";
+
+                if (us == Backend::kUnsampled)
+                {
+                    out << "not measured yet\n";
+                }
+                else
+                {
+                    out << us << " us\n";
+                }
+
+                if (!b.warm)
+                {
+                    continue;
+                }
+
+                UpstreamPool::Stats s = b.warm->snapshot();
+                std::uint64_t takes   = s.hits + s.misses;
+
+                out << "  warm pool: " << s.idle << " idle, "
+                    << s.hits << " hits, " << s.misses << " misses ("
+                    << (takes ? (100 * s.hits / takes) : 0) << "% hit rate), "
+                    << s.discarded << " discarded, avg connect "
+                    << s.avgConnectUs << " us, saved "
+                    << (s.savedConnectUs / 1000) << " ms to first byte\n";
+            }
+        };
+
+    // Backends are listed under their route once there is more than one, and
+    // a route's host backends under their host name.
+    bool labelRoutes = (routes.size() > 1);
+
+    routes.forEach(
+        [&] (const RouteSpec& spec, ForwardTarget& target)
+        {
+            if (labelRoutes)
+            {
+                out << "route " << spec.listen << ": " << target.backends.size() << " backend(s), "
+                    << to_string(target.backends.policy()) << "\n";
+            }
+
+            writeBackends(target.backends);
+
+            for (auto& [host, backends] : target.hosts)
+            {
+                out << "host " << host << ": " << backends->size() << " backend(s)\n";
+                writeBackends(*backends);
+            }
+        }
+        );
+}
+
+// Walks every shard's connection table, so the numbers are of connections
+// that actually exist right now rather than counters.
+static void
+writeConnectionStats(
+    std::ostream& out,
+    const std::vector<std::unique_ptr<ConnectionTable>>& tables
+    )
+{
+    auto now          = std::chrono::steady_clock::now();
+    std::size_t open  = 0;
+    std::size_t slots = 0;
+    std::size_t bytes = 0;
+    auto oldest       = now;
+
+    for (const auto& table : tables)
+    {
+        table->forEach(
+            [&] (Connection& conn)
+            {
+                ++open;
+                oldest = std::min(
+                    oldest,
+                    conn.created
+                    );
+            }
+            );
+        slots += table->slots();
+        bytes += table->bytes();
+    }
+
+    out << "connection table: " << open << " open, oldest "
+        << std::chrono::duration_cast<std::chrono::seconds>(now - oldest).count() << " s, "
+        << slots << " slots of " << ConnectionTable::slotBytes() << " bytes, "
+        << (bytes / 1024) << " KiB\n";
+}
+
+// Builds stats snapshots for the periodic printer, the Ctrl+Break handler and
+// the stats socket, any of which may ask at the same time. Only the snapshot
+// itself is serialized; the counters it reads are never locked.
+class StatsReporter
+{
+public:
+    StatsReporter(
+        const std::vector<std::unique_ptr<BufferPool>>& pools,
+        const std::vector<std::unique_ptr<ConnectionTable>>& tables,
+        const RouteTable& routes
+        )
+        : m_pools(pools)
+        , m_tables(tables)
+        , m_routes(routes)
+    {
+    }
+
+    std::string
+    report()
+    {
+        std::lock_guard lock(m_mtx);
+        std::ostringstream out;
+
+        writeMetrics(
+            out,
+            proxyMetrics(),
+            m_lastAccepts,
+            m_lastReport
+            );
+        writeConnectionStats(
+            out,
+            m_tables
+            );
+        writePoolStats(
+            out,
+            m_pools,
+            m_routes
+            );
+
+        AsyncLog::Stats log = asyncLog().snapshot();
+        out << "log: " << log.dropped << " records dropped, "
+            << log.suppressed << " rate-limited\n";
+
+        return out.str();
+    }
+
+private:
+    const std::vector<std::unique_ptr<BufferPool>>& m_pools;
+    const std::vector<std::unique_ptr<ConnectionTable>>& m_tables;
+    const RouteTable& m_routes;
+
+    std::mutex m_mtx;
+    std::uint64_t m_lastAccepts {0};
+    std::chrono::steady_clock::time_point m_lastReport {std::chrono::steady_clock::now()};
+};
+
+// Console control handlers run on a thread of their own, so the dump never
+// waits for (or stalls) the accept threads and I/O workers.
+static StatsReporter* g_statsReporter = nullptr;
+
+static BOOL WINAPI
+onConsoleCtrl(
+    DWORD ctrlType
+    )
+{
+    if ((ctrlType != CTRL_BREAK_EVENT) || !g_statsReporter)
+    {
+        return FALSE;
+    }
+
+    std::cout << g_statsReporter->report();
+    std::cout.flush();
+
+    return TRUE;
+}
+
+static void
+runStatsPrinter(
+    std::stop_token st,
+    StatsReporter* reporter,
+    std::chrono::seconds interval
+    )
+{
+    std::mutex waitMtx;
+    std::condition_variable_any cv;
+
+    while (!st.stop_requested())
+    {
+        std::unique_lock ul(waitMtx);
+
+        if (
+            cv.wait_for(
+                ul,
+                st,
+                interval,
+                [] ()
+                {
+                    return false;
+                }
+                )
+            )
+        {
+            continue;
+        }
+
+        std::cout << reporter->report();
+        std::cout.flush();
+    }
+}
+
+// Loopback-only listener for the stats socket: connect, read, done.
+static SOCKET
+openStatsListener(
+    int port
+    )
+{
+    SOCKET s = socket(
+        AF_INET,
+        SOCK_STREAM,
+        IPPROTO_TCP
+        );
+
+    if (s == INVALID_SOCKET)
+    {
+        logRawWSAError("socket() failed for stats listener");
+
+        return INVALID_SOCKET;
+    }
+
+    sockaddr_in addr {};
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = htons(static_cast<u_short>(port));
+
+    if (
+        bind(
+            s,
+            (sockaddr*) &addr,
+            sizeof(addr)
+            ) == SOCKET_ERROR
+        )
+    {
+        logRawWSAError("bind() failed for stats listener");
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    if (
+        listen(
+            s,
+            8
+            ) == SOCKET_ERROR
+        )
+    {
+        logRawWSAError("listen() failed on stats listener");
+        closesocket(s);
+
+        return INVALID_SOCKET;
+    }
+
+    return s;
+}
+
+// Each stats client gets one snapshot and is then disconnected, so e.g.
+// "curl telnet://127.0.0.1:<port>" or "ncat 127.0.0.1 <port>" prints it.
+static void
+runStatsServer(
+    SOCKET listener,
+    StatsReporter* reporter
+    )
+{
+    while (true)
+    {
+        SOCKET client = accept(
+            listener,
+            nullptr,
+            nullptr
+            );
+
+        if (client == INVALID_SOCKET)
+        {
+            int err = WSAGetLastError();
+
+            // The listener was closed: shutting down.
+            if ((err == WSAENOTSOCK) || (err == WSAEINTR))
+            {
+                return;
+            }
+
+            logRawWSAError("accept() failed on stats listener");
+            continue;
+        }
+
+        std::string text = reporter->report();
+        std::size_t sent = 0;
+
+        while (sent < text.size())
+        {
+            int n = send(
+                client,
+                text.data() + sent,
+                static_cast<int>(text.size() - sent),
+                0
+                );
+
+            if (n == SOCKET_ERROR)
+            {
+                break;
+            }
+
+            sent += static_cast<std::size_t>(n);
+        }
+
+        shutdown(
+            client,
+            SD_SEND
+            );
+        closesocket(client);
+    }
+}
+
+// A reactor plus, on every route's listener, one accept thread handing it
+// each connection it accepts (the threads belong to the routes).
+//
+// Winsock has no SO_REUSEPORT-style load balancing between listeners, but any
+// number of threads may block in accept() on the same listener and the stack
+// hands each new connection to exactly one of them. Giving each shard's
+// threads its own completion port and workers keeps a shard's connections on
+// that shard, so accept bursts and forwarding spread across cores.
+struct AcceptShard
+{
+    std::unique_ptr<ConnectionReaper> reaper; // timeouts only; outlives the connections
+    std::unique_ptr<IoReactor> reactor;
+    std::unique_ptr<RioEngine> rio; // registered mode only
+    std::unique_ptr<TargetConnector> connector;
+    unsigned core {IoReactor::kAnyCore}; // pinned here when running per core
+};
+
+static void
+formatRejected(
+    std::ostream& out,
+    const LogRecord& rec
+    )
+{
+    auto addr = static_cast<std::uint32_t>(rec.num[0]);
+    out << "Connection rejected: " << (addr >> 24) << "." << ((addr >> 16) & 0xFF) << "."
+        << ((addr >> 8) & 0xFF) << "." << (addr & 0xFF) << " (" << rec.text[0] << ")\n";
+}
+
+// Turn a client away as cheaply as possible: a reset frees the socket at once
+// instead of lingering in a graceful close.
+static void
+reject(
+    SOCKET client,
+    const sockaddr_in* peer,
+    RejectReason reason
+    )
+{
+    LINGER abortive {};
+    abortive.l_onoff  = 1;
+    abortive.l_linger = 0;
+    setsockopt(
+        client,
+        SOL_SOCKET,
+        SO_LINGER,
+        reinterpret_cast<const char*>(&abortive),
+        sizeof(abortive)
+        );
+    closesocket(client);
 
-    return true;
+    proxyMetrics().rejected[static_cast<std::size_t>(reason)].add(1);
+    logRecord(
+        {
+            .format     = formatRejected,
+            .stream     = LogStream::Err,
+            .errorClass = ErrorClass::NetworkOrRemoteIssue,
+            .text       = {to_string(reason), ""},
+            .num        = {peer ? static_cast<std::int64_t>(ntohl(peer->sin_addr.s_addr)) : 0}
+        }
+        );
 }
 
-} // namespace
-
+// Accepts clients for one route until its listener is closed with a stop
+// requested.
 static void
-forward(
-    std::stop_token /*stoken*/,
-    std::shared_ptr<Connection> conn,
-    bool clientToTarget,
-    const char* directionLabel
+runAcceptLoop(
+    std::stop_token st,
+    SOCKET listener,
+    TargetConnector* connector,
+    const AccessControl* access,
+    std::shared_ptr<ForwardTarget> target,
+    unsigned core
     )
 {
-    std::string buffer(4096, '\0');
+    AdmissionControl* admission = target->admission.get();
 
-    SOCKET src = clientToTarget ? conn->client : conn->target;
-    SOCKET dst = clientToTarget ? conn->target : conn->client;
-
-    // Flag associated with "send side" of dst.
-    std::atomic<bool>& shutdownFlag = clientToTarget ? conn->targetSendShutdownDone : conn->clientSendShutdownDone;
+    if (core != IoReactor::kAnyCore)
+    {
+        pinCurrentThread(core);
+    }
 
     while (true)
     {
-        int bytes = recv(
-            src,
-            &buffer[0],
-            static_cast<int>(buffer.size()),
-            0
+        // Big enough for AF_UNIX peers too, which have no IPv4 address.
+        sockaddr_storage peer {};
+        int peerLen   = sizeof(peer);
+        SOCKET client = accept(
+            listener,
+            (sockaddr*) &peer,
+            &peerLen
             );
 
-        if (bytes == 0)
-        {
-            break;
-        }
-        else if (bytes < 0)
+        if (client == INVALID_SOCKET)
         {
-            switch (int err = WSAGetLastError(); classifyWinsockError(err))
+            if (st.stop_requested())
             {
-                case ErrorClass::NetworkOrRemoteIssue:
-                    std::cerr << directionLabel
-                              << ": network/remote closed or failed during recv() "
-                              << "(WSA = " << err << ")\n";
-                    break;
-                case ErrorClass::LocalProgrammingBug:
-                    std::cerr << directionLabel
-                              << ": local programming / socket misuse during recv() "
-                              << "(WSA = " << err << ")\n";
-                    break;
-                default:
-                    std::cerr << directionLabel
-                              << ": unexpected recv() error "
-                              << "(WSA = " << err << ")\n";
-                    break;
+                return;
             }
 
-            break;
+            logRawWSAError("accept() failed");
+            continue;
         }
 
-        int sentTotal = 0;
+        proxyMetrics().accepts.add(1);
 
-        while (sentTotal < bytes)
+        const sockaddr_in* peerAddr = (peer.ss_family == AF_INET) ? reinterpret_cast<const sockaddr_in*>(&peer) : nullptr;
+        AdmissionTicket ticket;
+
+        if (access && (!peerAddr || !access->allowed(peerAddr->sin_addr)))
         {
-            int sent = send(
-                dst,
-                &buffer[0] + sentTotal,
-                bytes - sentTotal,
-                0
+            reject(
+                client,
+                peerAddr,
+                RejectReason::AccessDenied
                 );
+            continue;
+        }
 
+        if (admission)
+        {
             if (
-                !handleSendError(
-                    sent,
-                    directionLabel
-                    )
+                RejectReason reason = admission->admit(
+                    peerAddr,
+                    ticket
+                    ); reason != RejectReason::Count
                 )
             {
-                goto done;
+                reject(
+                    client,
+                    peerAddr,
+                    reason
+                    );
+                continue;
             }
-
-            sentTotal += sent;
         }
-    }
 
-done:
-    // Half-close our send side to dst exactly once per direction.
-    bool expected = false;
-
-    if (
-        shutdownFlag.compare_exchange_strong(
-            expected,
-            true
-            ) && (shutdown(
-            dst,
-            SD_SEND
-            ) == SOCKET_ERROR)
-        )
-    {
-        int err        = WSAGetLastError();
-        ErrorClass cls = classifyWinsockError(err);
-
-        // If it's a local bug, complain. If it's network-ish, it was dead anyway.
-        if (cls == ErrorClass::LocalProgrammingBug)
-        {
-            std::cerr << directionLabel << ": shutdown(SD_SEND) local misuse? (WSA = " << err << ")\n";
-        }
+        // The target connect completes on a reactor worker, which then starts
+        // forwarding; a slow target never holds up the next accept().
+        connector->connect(
+            client,
+            peerAddr,
+            ticket,
+            target
+            );
     }
-
-    // NOTE:
-    // We do NOT call closesocket() here.
-    // Sockets are closed only in Connection::~Connection(),
-    // which runs once both directions' threads have exited
-    // and all std::shared_ptr<Connection> owners are gone.
 }
 
 int
@@ -277,29 +1460,68 @@ main(
     char* argv[]
     )
 {
-    if (argc != 4)
+    ProxyConfig cfg {};
+
+    if (
+        !parseCommandLine(
+            argc,
+            argv,
+            cfg
+            )
+        )
     {
-        std::cout << "Usage: local-tcp-proxy <listenPort> <targetIP> <targetPort>\n";
+        printUsage();
 
         return 1;
     }
 
-    const char* listenPortStr = argv[1];
-    const char* targetIP      = argv[2];
-    const char* targetPortStr = argv[3];
+    bool unixListener = cfg.listenPort && isUnixEndpoint(cfg.listenPort);
+    int listenPort    = 0;
 
-    int listenPort = parsePort(
-        listenPortStr,
-        "listen port"
-        );
-    int targetPort = parsePort(
-        targetPortStr,
-        "target port"
-        );
+    if (!cfg.listenPort)
+    {
+        if (cfg.udp)
+        {
+            std::cerr << "--udp needs a listener on the command line\n";
 
-    if ((listenPort < 0) || (targetPort < 0))
+            return 1;
+        }
+    }
+    else if (unixListener)
     {
-        return 1;
+        if (cfg.udp || !cfg.accessRules.empty() || !cfg.accessList.empty())
+        {
+            std::cerr << "--udp and access rules need a TCP listener\n";
+
+            return 1;
+        }
+    }
+    else
+    {
+        listenPort = parsePort(
+            cfg.listenPort,
+            "listen port"
+            );
+
+        if (listenPort < 0)
+        {
+            return 1;
+        }
+    }
+
+    int statsPort = 0;
+
+    if (cfg.statsPort)
+    {
+        statsPort = parsePort(
+            cfg.statsPort,
+            "stats port"
+            );
+
+        if (statsPort < 0)
+        {
+            return 1;
+        }
     }
 
     WSADATA wsaData {};
@@ -319,189 +1541,425 @@ main(
         return 1;
     }
 
-    SOCKET listener = socket(
-        AF_INET,
-        SOCK_STREAM,
-        IPPROTO_TCP
-        );
+    // Registered I/O needs RIO-capable sockets; accept()ed clients inherit the
+    // listener's flags.
+    DWORD socketFlags = (cfg.forwardMode == ForwardMode::Registered)
+                            ? WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO
+                            : WSA_FLAG_OVERLAPPED;
 
-    if (listener == INVALID_SOCKET)
+    // The command-line route, if there is one. Pre-build backend addresses and
+    // validate each IP once.
+    std::vector<RouteSpec> fixedRoutes;
+    std::string mainListen;
+
+    if (cfg.listenPort)
     {
-        logRawWSAError("socket() failed for listener");
-        WSACleanup();
+        RouteSpec spec;
+        spec.listen    = unixListener ? std::string(cfg.listenPort) : std::to_string(listenPort);
+        spec.balance   = cfg.balance;
+        spec.maxBuffer = cfg.maxBuffer;
+        spec.limits    = cfg.limits;
 
-        return 1;
+        for (const std::string& backend : cfg.backends)
+        {
+            BackendSet::Target target;
+
+            if (
+                !parseBackend(
+                    backend,
+                    target
+                    )
+                )
+            {
+                WSACleanup();
+
+                return 1;
+            }
+
+            if (cfg.udp && target.unixSocket)
+            {
+                std::cerr << "--udp needs <ip>:<port> backends, not '" << backend << "'\n";
+                WSACleanup();
+
+                return 1;
+            }
+
+            spec.targets.push_back(std::move(target));
+        }
+
+        // "<name>=<target>[,<target>...]"
+        for (const std::string& host : cfg.hosts)
+        {
+            std::size_t eq = host.find('=');
+            HostRoute route;
+            route.host = normalizeHostName(std::string_view(host).substr(
+                0,
+                eq
+                ));
+
+            if ((eq == std::string::npos) || route.host.empty())
+            {
+                std::cerr << "Invalid host route '" << host << "' (expected <name>=<target>[,<target>...])\n";
+                WSACleanup();
+
+                return 1;
+            }
+
+            for (std::size_t pos = eq + 1; pos <= host.size();)
+            {
+                std::size_t comma = std::min(
+                    host.find(
+                        ',',
+                        pos
+                        ),
+                    host.size()
+                    );
+                BackendSet::Target target;
+
+                if (
+                    !parseBackend(
+                        host.substr(
+                            pos,
+                            comma - pos
+                            ),
+                        target
+                        )
+                    )
+                {
+                    WSACleanup();
+
+                    return 1;
+                }
+
+                route.targets.push_back(std::move(target));
+                pos = comma + 1;
+            }
+
+            spec.hosts.push_back(std::move(route));
+        }
+
+        spec.handshake.timeout = std::chrono::milliseconds(cfg.handshakeTimeoutMs);
+        spec.handshake.bytes   = cfg.handshakeBytes;
+
+        mainListen = spec.listen;
+        fixedRoutes.push_back(std::move(spec));
     }
 
-    // Allow quick restart of the program without "address already in use"
+    // Thread per core: one shard per core, each a pinned accept thread and a
+    // single pinned I/O worker, so a connection is accepted, forwarded and
+    // closed on the core that accepted it and its shard shares nothing hot
+    // with the others.
+    unsigned shardCount      = cfg.perCore ? cfg.perCore : cfg.acceptShards;
+    unsigned totalWorkers    = cfg.perCore ? cfg.perCore : (cfg.workers ? cfg.workers : std::thread::hardware_concurrency());
+    unsigned workersPerShard = std::max(
+        totalWorkers / shardCount,
+        1u
+        );
+
+    // Buffers are borrowed only while data is in flight, from a pool shared by
+    // all connections, or from the shard's own pool when running per core.
+    std::vector<std::unique_ptr<BufferPool>> bufferPools;
+
+    for (unsigned i = 0; i < (cfg.perCore ? shardCount : 1); ++i)
     {
-        BOOL opt = TRUE;
+        bufferPools.push_back(std::make_unique<BufferPool>());
+    }
 
-        if (
-            setsockopt(
-                listener,
-                SOL_SOCKET,
-                SO_REUSEADDR,
-                reinterpret_cast<const char*>(&opt),
-                sizeof(opt)
-                ) == SOCKET_ERROR
-            )
+    // Each shard's connections live in its own table, which outlives them.
+    std::vector<std::unique_ptr<ConnectionTable>> connectionTables;
+
+    for (unsigned i = 0; i < shardCount; ++i)
+    {
+        connectionTables.push_back(std::make_unique<ConnectionTable>());
+    }
+
+    // Shared by all shards and the UDP forwarder.
+    std::unique_ptr<AccessControl> access;
+
+    if (!cfg.accessRules.empty() || !cfg.accessList.empty())
+    {
+        try
         {
-            logRawWSAError("setsockopt(SO_REUSEADDR) failed");
-            // Not fatal; continue anyway.
+            access = std::make_unique<AccessControl>(
+                cfg.accessRules,
+                cfg.accessList
+                );
+        }
+        catch (const std::exception& ex)
+        {
+            std::cerr << "Failed to load access rules: " << ex.what() << "\n";
+            WSACleanup();
+
+            return 1;
         }
     }
 
-    sockaddr_in listenAddr {};
-    listenAddr.sin_family      = AF_INET;
-    listenAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    listenAddr.sin_port        = htons(static_cast<u_short>(listenPort));
+    // Otherwise the I/O workers are split evenly across shards, at least one
+    // each, and float.
+    std::vector<AcceptShard> shards(shardCount);
 
-    if (
-        bind(
-            listener,
-            (sockaddr*) &listenAddr,
-            sizeof(listenAddr)
-            ) == SOCKET_ERROR
-        )
+    try
     {
-        logRawWSAError("bind() failed for listener");
-        closesocket(listener);
+        for (unsigned i = 0; i < shardCount; ++i)
+        {
+            AcceptShard& shard = shards[i];
+            shard.core         = cfg.perCore ? i : IoReactor::kAnyCore;
+            shard.reactor      = std::make_unique<IoReactor>(
+                workersPerShard,
+                shard.core
+                );
+
+            if (cfg.forwardMode == ForwardMode::Registered)
+            {
+                shard.rio = std::make_unique<RioEngine>(*shard.reactor);
+            }
+
+            if (cfg.timeouts.any())
+            {
+                shard.reaper = std::make_unique<ConnectionReaper>(cfg.timeouts);
+            }
+
+            shard.connector = std::make_unique<TargetConnector>(
+                *connectionTables[i],
+                *shard.reactor,
+                shard.rio.get(),
+                shard.reaper.get(),
+                *bufferPools[cfg.perCore ? i : 0],
+                std::chrono::milliseconds(cfg.connectTimeoutMs)
+                );
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Failed to start I/O workers: " << ex.what() << "\n";
         WSACleanup();
 
         return 1;
     }
 
-    if (
-        listen(
-            listener,
-            SOMAXCONN
-            ) == SOCKET_ERROR
-        )
+    // Opens a route's listener and puts an accept thread on it for every shard,
+    // pinned like the shard's workers. Access rules cover the TCP routes.
+    auto openRoute = [&] (const RouteSpec& spec) -> std::unique_ptr<Route>
+        {
+            bool unixRoute = isUnixEndpoint(spec.listen);
+            auto route     = std::make_unique<Route>();
+
+            // Registered I/O does not cover AF_UNIX sockets.
+            route->target = std::make_shared<ForwardTarget>(
+                spec.targets,
+                spec.balance,
+                unixRoute ? ForwardMode::Copy : cfg.forwardMode,
+                spec.maxBuffer,
+                spec.limits,
+                spec.hosts,
+                spec.handshake
+                );
+
+            // Optional warm target connections, per backend and shared by all
+            // shards.
+            if (cfg.warmPool)
+            {
+                route->target->backends.enableWarmPools(
+                    cfg.warmPool,
+                    std::chrono::milliseconds(cfg.warmPoolMaxAgeMs),
+                    std::chrono::milliseconds(cfg.connectTimeoutMs),
+                    socketFlags
+                    );
+
+                for (auto& [host, backends] : route->target->hosts)
+                {
+                    backends->enableWarmPools(
+                        cfg.warmPool,
+                        std::chrono::milliseconds(cfg.warmPoolMaxAgeMs),
+                        std::chrono::milliseconds(cfg.connectTimeoutMs),
+                        socketFlags
+                        );
+                }
+            }
+
+            route->listener = unixRoute
+                                  ? listenUnix(spec.listen.substr(kUnixPrefix.size()))
+                                  : openTcpListener(
+                                        std::stoi(spec.listen),
+                                        socketFlags
+                                        );
+
+            if (route->listener == INVALID_SOCKET)
+            {
+                return nullptr;
+            }
+
+            for (AcceptShard& shard : shards)
+            {
+                route->acceptThreads.emplace_back(
+                    runAcceptLoop,
+                    route->listener,
+                    shard.connector.get(),
+                    unixRoute ? nullptr : access.get(),
+                    route->target,
+                    shard.core
+                    );
+            }
+
+            return route;
+        };
+
+    std::unique_ptr<RouteTable> routes;
+
+    try
     {
-        logRawWSAError("listen() failed on listener");
-        closesocket(listener);
+        routes = std::make_unique<RouteTable>(
+            std::move(fixedRoutes),
+            cfg.routesFile,
+            openRoute
+            );
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Failed to start routes: " << ex.what() << "\n";
         WSACleanup();
 
         return 1;
     }
 
-    // Pre-build target address template and validate the IP once
-    sockaddr_in targetTemplate {};
-    targetTemplate.sin_family = AF_INET;
-    targetTemplate.sin_port   = htons(static_cast<u_short>(targetPort));
+    // Fixed routes are never closed, so this stays valid.
+    std::shared_ptr<ForwardTarget> mainRoute = cfg.listenPort ? routes->find(mainListen) : nullptr;
 
-    if (
-        int ptonResult = inet_pton(
-            AF_INET,
-            targetIP,
-            &targetTemplate.sin_addr
-            ); (ptonResult != 1)
-        )
+    // UDP completions run on the first shard's workers.
+    std::unique_ptr<UdpForwarder> udp;
+
+    if (cfg.udp)
     {
-        if (ptonResult == 0)
+        try
         {
-            std::cerr << "inet_pton(): invalid target IP address string '"
-                      << targetIP << "'\n";
+            udp = std::make_unique<UdpForwarder>(
+                *shards.front().reactor,
+                mainRoute->backends,
+                access.get(),
+                listenPort,
+                std::chrono::milliseconds(cfg.udpIdleTimeoutMs),
+                cfg.udpMaxSessions
+                );
         }
-        else
+        catch (const std::exception& ex)
         {
-            logRawWSAError("inet_pton() failed");
+            std::cerr << "Failed to start UDP forwarding: " << ex.what() << "\n";
+            WSACleanup();
+
+            return 1;
         }
+    }
 
-        closesocket(listener);
-        WSACleanup();
+    // Stats are always collected; these only decide who gets to see them.
+    StatsReporter statsReporter(
+        bufferPools,
+        connectionTables,
+        *routes
+        );
+    g_statsReporter = &statsReporter;
 
-        return 1;
+    if (
+        !SetConsoleCtrlHandler(
+            onConsoleCtrl,
+            TRUE
+            )
+        )
+    {
+        std::cerr << "SetConsoleCtrlHandler() failed, Ctrl+Break stats disabled (GetLastError = " << GetLastError() << ")\n";
     }
 
-    std::cout << "local-tcp-proxy listening on port " << listenPort
-              << ", forwarding to " << targetIP << ":" << targetPort << "\n";
+    std::jthread statsThread;
 
-    while (true)
+    if (cfg.statsSeconds)
     {
-        SOCKET client = accept(
-            listener,
-            nullptr,
-            nullptr
+        statsThread = std::jthread(
+            runStatsPrinter,
+            &statsReporter,
+            std::chrono::seconds(cfg.statsSeconds)
             );
+    }
 
-        if (client == INVALID_SOCKET)
+    SOCKET statsListener = INVALID_SOCKET;
+    std::jthread statsServerThread;
+
+    if (statsPort)
+    {
+        statsListener = openStatsListener(statsPort);
+
+        if (statsListener == INVALID_SOCKET)
         {
-            logRawWSAError("accept() failed");
-            continue;
+            WSACleanup();
+
+            return 1;
         }
 
-        SOCKET target = socket(
-            AF_INET,
-            SOCK_STREAM,
-            IPPROTO_TCP
+        statsServerThread = std::jthread(
+            runStatsServer,
+            statsListener,
+            &statsReporter
             );
+    }
+
+    std::cout << "local-tcp-proxy ";
 
-        if (target == INVALID_SOCKET)
+    if (mainRoute)
+    {
+        if (unixListener)
         {
-            logRawWSAError("socket() failed for target");
-            closesocket(client);
-            continue;
+            std::cout << "listening on " << cfg.listenPort << ", forwarding to ";
+        }
+        else
+        {
+            std::cout << "listening on port " << listenPort << ", forwarding to ";
         }
 
-        sockaddr_in targetAddr = targetTemplate; // copy template
+        BackendSet& backends = mainRoute->backends;
 
-        if (
-            connect(
-                target,
-                (sockaddr*) &targetAddr,
-                sizeof(targetAddr)
-                ) == SOCKET_ERROR
-            )
+        if (backends.size() == 1)
         {
-            logRawWSAError("connect() to target failed");
-            closesocket(client);
-            closesocket(target);
-            continue;
+            std::cout << backends[0].label;
         }
+        else
+        {
+            std::cout << backends.size() << " backends (" << to_string(backends.policy()) << ")";
+        }
+    }
 
-        std::cout << "Connection established: client -> "
-                  << targetIP << ":" << targetPort << "\n";
-
-        // Create shared connection object
-        auto conn = std::make_shared<Connection>();
-        conn->client = client;
-        conn->target = target;
+    if (!cfg.routesFile.empty())
+    {
+        std::cout << (mainRoute ? ", plus " : "serving ")
+                  << (routes->size() - (mainRoute ? 1 : 0)) << " route(s) from " << cfg.routesFile;
+    }
 
-        // Launch a new thread to handle the forwarding for this connection
-        std::thread(
-            [conn] ()
-            {
-                try
-                {
-                    std::jthread t1(
-                        forward,
-                        conn,
-                        true,
-                        "client->target"
-                        );
-                    std::jthread t2(
-                        forward,
-                        conn,
-                        false,
-                        "target->client"
-                        );
-                    t1.join();
-                    t2.join();
-                }
-                catch (const std::exception& ex)
-                {
-                    std::cerr << "Forwarding thread exception: " << ex.what() << "\n";
-                }
-            }
-            ).detach();
+    if (cfg.perCore)
+    {
+        std::cout << " (thread per core on " << shards.size() << " cores)\n";
+    }
+    else
+    {
+        std::cout << " (" << shards.size() << " accept shard(s) x "
+                  << workersPerShard << " I/O workers)\n";
+    }
 
-        // Main thread continues to accept new connections
+    if (udp)
+    {
+        std::cout << "UDP forwarding enabled on port " << listenPort
+                  << (udp->coalescing() ? " (receive coalescing + send segmentation offload)\n" : "\n");
     }
 
+    // Routes accept on their own threads until the process exits.
+    Sleep(INFINITE);
+
     // Not reached in current design, but correct in case you ever add a way to exit.
-    closesocket(listener);
+    if (statsListener != INVALID_SOCKET)
+    {
+        closesocket(statsListener);
+        statsServerThread.join();
+    }
+
+    udp.reset();
+    routes.reset();
+
     WSACleanup();
 
     return 0;